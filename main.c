@@ -1,15 +1,117 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>          // Validação dos nomes de documentos
+#include <stdint.h>         // Tipos de largura fixa do journal binário
+#include <limits.h>         // Tamanho máximo de um arquivo importado
+#include <stddef.h>         // offsetof nos histogramas das métricas
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>     // Thread gravadora do journal
+#include <sched.h>       // sched_yield enquanto o escritor da réplica compartilhada trabalha
+#include <fcntl.h>
+#include <sys/mman.h>    // Mapeamento do snapshot e dos arquivos importados em memória
+#include <sys/stat.h>
 #include <sys/select.h>  // Para função select() - entrada não-bloqueante
 #include <sys/time.h>    // Para struct timeval
+#include <sys/ioctl.h>   // Tamanho do terminal
+#include <termios.h>     // Teclas sem eco na visualização em tempo real
+#include <stdarg.h>
+#ifdef NANO_SIMULACAO
+#include <errno.h>
+#include <signal.h>      // Os ranks simulados restantes morrem junto com um que aborta
+#include <sys/wait.h>
+#else
 #include <mpi.h>         // Biblioteca para comunicação entre processos distribuídos
+#endif
 #include <omp.h>         // Biblioteca para paralelização OpenMP
+#include <zlib.h>        // Compressão dos estados completos transferidos
 
-#define MAX_LINHAS 100
-#define MAX_TEXTO 256
+#ifdef NANO_SIMULACAO
+// Transporte simulado (-DNANO_SIMULACAO, sem biblioteca MPI): o subconjunto do MPI usado pelo
+// editor, com a mesma interface. --simular=N cria N ranks a partir de um só binário; as
+// chamadas MPI do restante do arquivo não mudam. Implementação no fim do arquivo
+typedef int MPI_Comm;
+typedef int MPI_Datatype;    // O próprio tamanho do elemento, em bytes
+typedef int MPI_Op;
+typedef int MPI_Info;
+typedef int MPI_Win;
+typedef int MPI_Errhandler;
+typedef long MPI_Aint;
+typedef struct RequisicaoSimulada* MPI_Request;
+typedef struct MensagemSimulada* MPI_Message;
+typedef struct {
+    int MPI_SOURCE;
+    int MPI_TAG;
+    int MPI_ERROR;
+    int bytes;
+} MPI_Status;
+
+#define MPI_SUCCESS            0
+#define MPI_COMM_WORLD         0
+#define MPI_COMM_NULL          (-1)
+#define MPI_COMM_TYPE_SHARED   1
+#define MPI_INFO_NULL          0
+#define MPI_WIN_NULL           (-1)
+#define MPI_MODE_NOCHECK       0
+#define MPI_UNDEFINED          (-32766)
+#define MPI_ANY_SOURCE         (-1)
+#define MPI_ANY_TAG            (-1)
+#define MPI_BYTE               1
+#define MPI_CHAR               1
+#define MPI_INT                ((MPI_Datatype)sizeof(int))
+#define MPI_LONG               ((MPI_Datatype)sizeof(long))
+#define MPI_SUM                0
+#define MPI_THREAD_MULTIPLE    3
+#define MPI_ERRORS_RETURN      1
+#define MPI_REQUEST_NULL       ((MPI_Request)NULL)
+#define MPI_STATUS_IGNORE      ((MPI_Status*)NULL)
+#define MPI_STATUSES_IGNORE    ((MPI_Status*)NULL)
+#define TRANSPORTE_RELATORIO   ", transporte simulado"
+
+int MPI_Init_thread(int* argc, char*** argv, int requerido, int* fornecido);
+int MPI_Finalize(void);
+int MPI_Abort(MPI_Comm comm, int codigo);
+int MPI_Comm_rank(MPI_Comm comm, int* rank);
+int MPI_Comm_size(MPI_Comm comm, int* tamanho);
+int MPI_Comm_set_errhandler(MPI_Comm comm, MPI_Errhandler tratador);
+int MPI_Comm_split(MPI_Comm comm, int cor, int chave, MPI_Comm* novo);
+int MPI_Comm_split_type(MPI_Comm comm, int tipo, int chave, MPI_Info info, MPI_Comm* novo);
+int MPI_Comm_free(MPI_Comm* comm);
+double MPI_Wtime(void);
+int MPI_Isend(const void* buffer, int quantidade, MPI_Datatype tipo, int destino, int tag, MPI_Comm comm, MPI_Request* requisicao);
+int MPI_Send(const void* buffer, int quantidade, MPI_Datatype tipo, int destino, int tag, MPI_Comm comm);
+int MPI_Irecv(void* buffer, int quantidade, MPI_Datatype tipo, int origem, int tag, MPI_Comm comm, MPI_Request* requisicao);
+int MPI_Recv(void* buffer, int quantidade, MPI_Datatype tipo, int origem, int tag, MPI_Comm comm, MPI_Status* status);
+int MPI_Iprobe(int origem, int tag, MPI_Comm comm, int* flag, MPI_Status* status);
+int MPI_Probe(int origem, int tag, MPI_Comm comm, MPI_Status* status);
+int MPI_Improbe(int origem, int tag, MPI_Comm comm, int* flag, MPI_Message* mensagem, MPI_Status* status);
+int MPI_Mrecv(void* buffer, int quantidade, MPI_Datatype tipo, MPI_Message* mensagem, MPI_Status* status);
+int MPI_Get_count(const MPI_Status* status, MPI_Datatype tipo, int* quantidade);
+int MPI_Test(MPI_Request* requisicao, int* flag, MPI_Status* status);
+int MPI_Testall(int num, MPI_Request* requisicoes, int* flag, MPI_Status* status);
+int MPI_Wait(MPI_Request* requisicao, MPI_Status* status);
+int MPI_Waitall(int num, MPI_Request* requisicoes, MPI_Status* status);
+int MPI_Cancel(MPI_Request* requisicao);
+int MPI_Request_free(MPI_Request* requisicao);
+int MPI_Ibarrier(MPI_Comm comm, MPI_Request* requisicao);
+int MPI_Barrier(MPI_Comm comm);
+int MPI_Bcast(void* buffer, int quantidade, MPI_Datatype tipo, int raiz, MPI_Comm comm);
+int MPI_Reduce(const void* envio, void* recepcao, int quantidade, MPI_Datatype tipo, MPI_Op op, int raiz, MPI_Comm comm);
+int MPI_Allgather(const void* envio, int quantidade_envio, MPI_Datatype tipo_envio, void* recepcao,
+                  int quantidade_recepcao, MPI_Datatype tipo_recepcao, MPI_Comm comm);
+int MPI_Win_allocate_shared(MPI_Aint tamanho, int unidade, MPI_Info info, MPI_Comm comm, void* base, MPI_Win* janela);
+int MPI_Win_shared_query(MPI_Win janela, int rank, MPI_Aint* tamanho, int* unidade, void* base);
+int MPI_Win_lock_all(int modo, MPI_Win janela);
+int MPI_Win_unlock_all(MPI_Win janela);
+int MPI_Win_sync(MPI_Win janela);
+int MPI_Win_free(MPI_Win* janela);
+#else
+#define TRANSPORTE_RELATORIO   ""
+#endif
+
+#define LINHAS_INICIAIS 100   // Linhas do documento gerado na inicialização
+#define MAX_TEXTO 256         // Tamanho máximo de mensagens de chat
 #define MASTER 0       // Processo mestre que gerencia o documento
 
 // Códigos de Cor ANSI para o terminal
@@ -20,50 +122,1235 @@
 #define ANSI_COLOR_GREEN   "\x1b[32m"
 #define ANSI_COLOR_CYAN    "\x1b[36m" // Ciano/Azul claro
 
-// Tags para a comunicação MPI - identificam o tipo de mensagem sendo enviada
-#define TAG_PEDIDO_BLOQUEIO     1    // Usuário solicita bloqueio de linha para edição
-#define TAG_RESPOSTA_BLOQUEIO   2    // Mestre responde se o bloqueio foi concedido
-#define TAG_ENVIAR_NOVO_TEXTO   3    // Usuário envia texto editado para o mestre
-#define TAG_MENSAGEM_PRIVADA    4    // Mensagem entre usuários
-#define TAG_SAIR                5    // Usuário notifica que está saindo
-#define TAG_ATUALIZACAO         6    // Mestre envia atualizações do documento
+// Tags para a comunicação MPI. Pedidos, respostas, deltas e o chat viajam em pacotes de quadros
+// do protocolo binário (abaixo); só a finalização usa uma mensagem simples
+#define TAG_QUADROS             1    // Pacote ponto a ponto: pedidos a um coordenador ou respostas dele
+#define TAG_ATUALIZACAO         2    // Pacote de deltas de um coordenador, repassado inteiro na árvore de difusão
+#define TAG_CHAT                4    // Pacote de mensagens de chat entregue pelo mestre a um usuário
 #define TAG_FINALIZAR           7    // Sinal para encerramento seguro
+#define TAG_METRICAS            8    // Pedido vazio a um coordenador; a resposta é o texto das métricas dele
+#define TAG_RESERVA             9    // Sinal {RESERVA_*, valor, rank} entre o mestre e as reservas (e a promoção a todos)
+#define NUM_TAGS               10
+
+// Protocolo binário: cada pacote é uma sequência de quadros, cada um com um cabeçalho fixo
+// seguido do corpo. Corpos são alinhados a 8 bytes para serem lidos no lugar. Toda mensagem
+// de um remetente para um destino segue na mesma tag, então a ordem entre tipos não depende
+// de o MPI preservar a ordem entre tags diferentes
+#define VERSAO_PROTOCOLO 1
+#define ALINHAMENTO_QUADRO 8
+#define LIMITE_PACOTE (64 * 1024)    // Bytes acumulados que forçam o envio do pacote
+#define MENSAGENS_POR_DESPACHO 32    // Coordenador: pacotes recebidos entre envios sob carga contínua
+
+typedef struct {
+    uint8_t versao;        // VERSAO_PROTOCOLO de quem montou o quadro
+    uint8_t tipo;          // Um dos tipos QUADRO_*
+    uint16_t reservado;
+    uint32_t comprimento;  // Bytes do corpo, sem o alinhamento
+    uint32_t sequencia;    // Quadros deste remetente para o destino (deltas: versão do coordenador)
+    int32_t origem;        // Rank que montou o quadro (nos deltas repassados, o coordenador)
+} Quadro;
+
+#define CORPO_QUADRO(q) ((char*)(q) + sizeof(Quadro))
+
+// Tipos de quadro. Corpos de tamanho fixo são vetores de int
+#define QUADRO_PEDIDO_BLOQUEIO   1   // {posição vista, id, id do pedido, aceita esperar na fila}
+#define QUADRO_TEXTO             2   // EnvioTexto: linha bloqueada pelo remetente
+#define QUADRO_EDICAO_DIRETA     3   // EnvioTexto: bloqueio, texto e liberação de uma vez
+#define QUADRO_TRECHO            4   // EnvioTrecho: edição por trecho, sem bloqueio
+#define QUADRO_PEDIDO_INTERVALO  5   // {id do pedido, quantidade, ids...}
+#define QUADRO_LOTE              6   // EnvioLote: texto de várias linhas
+#define QUADRO_OPERACAO_LINHA    7   // {id do pedido, tipo ATUALIZACAO_*, posição vista, id, deslocamento, id da seguinte}
+#define QUADRO_RENOVAR_BLOQUEIO  8   // Sem corpo: estende todos os bloqueios do remetente
+#define QUADRO_RESSINCRONIZACAO  9   // {versão local, documento, versão mínima do estado}: lacuna de versões, pede o estado completo
+#define QUADRO_SAIR             10   // Sem corpo: usuário saiu do editor
+#define QUADRO_RESPOSTA         11   // {id do pedido, estado, id estável da linha}
+#define QUADRO_ATUALIZACAO      12   // Atualizacao: delta ou estado completo
+#define QUADRO_BUSCA            13   // {id do pedido, comprimento, texto}: busca no documento (só o mestre)
+#define QUADRO_RESULTADO_BUSCA  14   // {id do pedido, total, quantidade, µs no mestre, pares (linha, deslocamento)...}
+#define QUADRO_CHAT             15   // EnvioChat: mensagem para um canal ou conversa privada (só o mestre)
+#define QUADRO_CANAL            16   // {id do pedido, CANAL_*, nome do canal}: entrar ou sair de um canal
+#define QUADRO_HISTORICO        17   // {id do pedido, antes da sequência, quantidade, nome do canal}
+#define QUADRO_PAGINA_HISTORICO 18   // {id do pedido, estado, total, primeira guardada, quantidade, 0} e MensagemChat...
+#define QUADRO_MENSAGEM_CHAT    19   // MensagemChat: entrega do mestre, em TAG_CHAT
+#define QUADRO_ABRIR_DOCUMENTO  20   // {id do pedido, nome do documento}: abre (ou cria) e assina (só o mestre)
+#define QUADRO_FECHAR_DOCUMENTO 21   // {id do documento}: cancela a assinatura e solta os bloqueios nele
+#define QUADRO_DOCUMENTO        22   // {id do documento}: os próximos quadros do remetente se referem a ele
+#define QUADRO_DESFAZER         23   // {id do pedido, refazer}: desfaz (ou refaz) a última mudança de texto do remetente
+#define QUADRO_VERSOES_LINHA    24   // {id do pedido, id da linha, revisão pedida (-1 = só a lista)}
+#define QUADRO_VERSOES          25   // {id do pedido, estado, revisão atual, revisão do texto, quantidade, comprimento}, RevisaoLinha... e texto
+
+// Pacote em montagem: quadros acumulados até o envio
+typedef struct {
+    char* dados;
+    int tamanho;
+    int capacidade;
+} Pacote;
+
+// Tipos de atualização transportados em QUADRO_ATUALIZACAO (também usados em QUADRO_OPERACAO_LINHA)
+#define ATUALIZACAO_TEXTO      1    // Delta: novo texto e estado de bloqueio de uma linha
+#define ATUALIZACAO_BLOQUEIO   2    // Delta: apenas o estado de bloqueio de uma linha mudou
+#define ATUALIZACAO_COMPLETA   3    // Estado completo (resposta a um pedido de ressincronização)
+#define ATUALIZACAO_INSERIR    4    // Delta: nova linha inserida na posição indicada
+#define ATUALIZACAO_REMOVER    5    // Delta: linha removida
+#define ATUALIZACAO_DIVIDIR    6    // Delta: linha dividida em duas no deslocamento indicado
+#define ATUALIZACAO_JUNTAR     7    // Delta: linha unida com a seguinte
+#define ATUALIZACAO_PARTICAO   8    // Estado completo apenas das linhas de um coordenador
+#define ATUALIZACAO_TRECHO     9    // Delta: trecho de uma linha substituído (edição sem bloqueio)
+#define ATUALIZACAO_BLOQUEIOS 10    // Delta: mesmo estado de bloqueio em várias linhas (ids no texto)
+#define ATUALIZACAO_LOTE      11    // Delta: novo texto de várias linhas (no formato de serializar_linhas)
+#define ATUALIZACAO_BLOCO_ESTADO 12 // Bloco comprimido de um estado completo ou de partição (BlocoEstado no texto)
+#define ATUALIZACAO_REPLICA   13    // Réplica do escritor aos leitores do nó quando a janela esgota (versões e documento)
+
+// Linha do documento: nó de uma treap implícita ordenada pela posição no texto.
+// O tamanho das subárvores permite localizar a i-ésima linha em O(log n).
+typedef struct Linha {
+    struct Linha *esq, *dir, *pai;
+    unsigned int prioridade;   // Prioridade aleatória que mantém a árvore balanceada
+    int tamanho_subarvore;     // Quantidade de linhas nesta subárvore
+    int id;                    // Identificador estável: não muda com inserções e remoções
+    int dono_bloqueio;         // Controle de bloqueio: -1=livre, rank=bloqueada
+    int comprimento;           // Bytes do texto, sem o '\0'
+    int revisao;               // Alterações de texto já aplicadas (base das edições por trecho)
+    int texto_externo;         // Texto aponta para um snapshot mapeado (sem '\0', não é liberado)
+    char* texto;
+} Linha;
+
+// Documento de tamanho variável: memória proporcional ao conteúdo real
+typedef struct {
+    Linha* raiz;
+    int total_linhas;
+    int proximo_id;            // Próximo identificador livre (só o mestre cria linhas)
+    Linha** por_id;            // Tabela direta id -> linha (NULL para linhas removidas)
+    int capacidade_ids;
+} Documento;
 
 // Estruturas globais compartilhadas
-char documento[MAX_LINHAS][MAX_TEXTO];  // Documento colaborativo com 100 linhas
-int linhas_em_uso[MAX_LINHAS];          // Controle de bloqueio: -1=livre, rank=bloqueada
+Documento documento;                    // Documento colaborativo (réplica local em cada processo)
 int rank_global, size_global;           // Identificador e total de processos MPI
+char nome_processo[32];                 // "MESTRE", "COORDENADOR_k" ou "Usuario_k" (prefixo das mensagens)
+
+// Particionamento do gerenciador de bloqueios: os ranks 0..num_coordenadores-1 são coordenadores,
+// cada um dono (bloqueios e texto oficial) das linhas com id % num_coordenadores == seu rank.
+// O rank 0 (MASTER) também é o único que altera a estrutura do documento.
+int num_coordenadores = 1;
+int particao_local = -1;                // Partição servida por este rank (0 = a do mestre; -1 = trabalhador)
+int* versao_coordenador;                // Última versão aplicada vinda de cada coordenador
+int* aguardando_ressincronizacao;       // Já foi pedido o estado completo a cada coordenador
+char arquivo_log[64];                   // Journal de edições (cada coordenador registra as das suas linhas)
+
+// Journal de edições
+#define CAPACIDADE_JOURNAL 4096      // Registros pendentes no anel em memória
+#define INTERVALO_FSYNC_MS 1000      // Intervalo da política FSYNC_PERIODICO
+#define MAGICO_JOURNAL "NCJ1"        // Assinatura no início do journal binário
+
+#define FORMATO_LOG_BINARIO 0
+#define FORMATO_LOG_TEXTO   1
+#define FSYNC_NUNCA      0           // Apenas fflush: o sistema operacional decide quando gravar
+#define FSYNC_PERIODICO  1           // fsync no máximo a cada INTERVALO_FSYNC_MS
+#define FSYNC_SEMPRE     2           // fsync a cada lote gravado
+
+int formato_log = FORMATO_LOG_BINARIO;
+int politica_fsync = FSYNC_PERIODICO;
+
+// Registro binário do journal: campos de largura fixa seguidos de 'comprimento' bytes de texto
+typedef struct {
+    int32_t tipo;          // Um dos tipos ATUALIZACAO_*
+    int32_t versao;        // Versão do coordenador após a operação
+    int32_t rank;          // Usuário que fez a operação
+    int32_t linha;         // Posição da linha no momento da operação
+    int32_t id;            // Identificador estável da linha
+    int32_t id_novo;       // Linha criada (inserir/dividir)
+    int32_t deslocamento;  // Posição do corte (dividir)
+    int32_t comprimento;   // Bytes de texto que seguem o registro
+    int64_t timestamp;     // Segundos desde 1970
+} RegistroJournal;
+
+typedef struct {
+    RegistroJournal reg;
+    char* texto;
+    FILE* arquivo;         // Journal do documento em que a operação foi feita
+} EntradaJournal;
+
+struct {
+    EntradaJournal anel[CAPACIDADE_JOURNAL];  // Fila circular de registros pendentes
+    int inicio, fim;                          // [inicio, fim) ainda não gravados
+    int encerrar, ativo;
+    FILE* arquivo;                            // Mantido aberto durante toda a sessão
+    FILE* destino;                            // Journal do documento carregado (o principal é o arquivo acima)
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t nao_vazio, nao_cheio;
+} journal;
+
+// Snapshots do documento
+#define ARQUIVO_SNAPSHOT "snapshot_editor.bin"
+#define MAGICO_SNAPSHOT "NCS2"
+#define SNAPSHOT_A_CADA_PADRAO 1000  // Atualizações entre snapshots periódicos
+
+typedef struct {
+    char* base;                // Início do mapeamento
+    long tamanho_arquivo;
+    int num_versoes;           // Quantidade de coordenadores da sessão que gravou o snapshot
+    int* versoes;              // Versão de cada coordenador incluída no snapshot
+    char* documento;           // Documento serializado, dentro do mapa
+    int tamanho_documento;
+} SnapshotMapeado;
+
+int retomar = 0;                              // --retomar: parte do último snapshot + journal
+int snapshot_a_cada = SNAPSHOT_A_CADA_PADRAO;
+SnapshotMapeado snapshot_sessao;              // Snapshot de onde os textos das linhas foram mapeados
+
+#define BLOCO_MINIMO_IMPORTACAO (1 << 20)        // Arquivos menores que dois blocos são lidos por uma thread
+#define BUFFER_EXPORTACAO       (4 << 20)        // Bytes acumulados por chamada a write na exportação
+#define LINHAS_POR_LEITURA_EXPORTACAO 4096       // Linhas lidas de uma vez da réplica compartilhada
+
+const char* arquivo_importar = NULL;          // --importar=ARQUIVO: documento inicial lido de um arquivo de texto
+const char* arquivo_exportar = NULL;          // --exportar=ARQUIVO: o mestre grava o documento ao encerrar
+struct {
+    char* base;                               // Arquivo importado, mapeado: os textos das linhas apontam para ele
+    size_t tamanho;
+} arquivo_importado;
+
+struct {
+    pthread_t thread;
+    int thread_ativa;
+    int em_andamento;                         // Gravação em segundo plano ainda não terminou
+    int atualizacoes_desde_ultimo;
+} snapshot_periodico;
+
+// Atualização incremental enviada pelo mestre: cabeçalho fixo seguido apenas dos bytes do texto
+typedef struct {
+    int tipo;              // Um dos tipos ATUALIZACAO_*
+    int coordenador;       // Partição de origem, dona da sequência de versões (0 = a do mestre, onde quer que ele esteja)
+    int documento;         // Documento hospedado a que se refere (DOCUMENTO_PRINCIPAL ou um aberto pelo usuário)
+    int versao;            // Versão do documento após aplicar esta atualização
+    int linha;             // Posição de inserção (ATUALIZACAO_INSERIR)
+    int id;                // Linha alterada (identificador estável)
+    int id_novo;           // Linha criada por ATUALIZACAO_INSERIR ou ATUALIZACAO_DIVIDIR
+    int dono_bloqueio;     // Novo estado de bloqueio da linha: -1=livre, rank=bloqueada
+    int deslocamento;      // Posição do corte em ATUALIZACAO_DIVIDIR
+    int apagar;            // Caracteres removidos a partir do deslocamento em ATUALIZACAO_TRECHO
+    int revisao;           // Revisão da linha após ATUALIZACAO_TEXTO/TRECHO; 0 se desconhecida
+    int autor;             // Rank do usuário que originou a alteração
+    int64_t instante_origem; // Relógio do usuário (CLOCK_REALTIME, ns) ao enviar o texto; 0 se desconhecido
+    int comprimento;       // Bytes de texto que seguem o cabeçalho
+    char texto[];          // Novo texto da linha (ou o trecho inserido), sem '\0' (ou o documento serializado)
+} Atualizacao;
+
+// Estados completos saem do coordenador em blocos de linhas inteiras, fechados ao passar de
+// TAMANHO_BLOCO_ESTADO bytes serializados e comprimidos um a um (zlib); o documento inicial
+// é difundido em blocos de exatamente TAMANHO_BLOCO_ESTADO bytes
+#define TAMANHO_BLOCO_ESTADO   (128 * 1024)
+#define MAX_DELTAS_PENDENTES   65536   // Deltas guardados enquanto um estado completo chega
+
+// Cabeçalho no texto de um ATUALIZACAO_BLOCO_ESTADO, seguido dos bytes comprimidos
+typedef struct {
+    int tipo_estado;       // ATUALIZACAO_COMPLETA ou ATUALIZACAO_PARTICAO
+    int total;             // Bytes do estado serializado inteiro
+    int deslocamento;      // Posição do bloco no estado serializado
+    int comprimento;       // Bytes do bloco descomprimido
+} BlocoEstado;
+
+// Estado completo em recepção vindo de um coordenador, e os deltas dele que chegaram depois
+// do pedido: são aplicados sobre o estado, a partir da versão em que ele foi tirado
+typedef struct {
+    int total;
+    int recebidos;
+    Atualizacao* estado;   // Montado bloco a bloco já no formato do delta COMPLETA/PARTICAO
+    Atualizacao** pendentes;
+    int num_pendentes;
+    int capacidade_pendentes;
+} RecepcaoEstado;
+
+RecepcaoEstado* recepcao_estado;       // Por coordenador de origem, do documento carregado
+
+// Texto enviado ao coordenador em um único quadro (QUADRO_TEXTO e QUADRO_EDICAO_DIRETA)
+typedef struct {
+    int id_pedido;         // Devolvido na resposta para o cliente casar com a operação
+    int id;                // Linha editada (identificador estável)
+    int64_t instante_origem; // Relógio do usuário (CLOCK_REALTIME, ns) ao enviar
+    int comprimento;       // Bytes de texto que seguem o cabeçalho
+    char texto[];
+} EnvioTexto;
+
+// Edição por trecho enviada ao coordenador (QUADRO_TRECHO): substitui 'apagar' caracteres
+// a partir de 'posicao' pelo texto, como visto na revisão 'revisao_base' da linha
+typedef struct {
+    int id_pedido;
+    int id;                // Linha editada (identificador estável)
+    int revisao_base;      // Revisão da réplica local quando a edição foi feita
+    int posicao;
+    int apagar;
+    int64_t instante_origem;
+    int comprimento;       // Bytes inseridos que seguem o cabeçalho
+    char texto[];
+} EnvioTrecho;
+
+// Edição em lote (QUADRO_LOTE): em dados, para cada linha, [id][comprimento][texto]
+typedef struct {
+    int id_pedido;
+    int num_linhas;
+    int direta;            // 1 = linhas livres são bloqueadas, gravadas e liberadas de uma vez
+    int64_t instante_origem;
+    int comprimento;       // Bytes em dados
+    char dados[];
+} EnvioLote;
+
+// Histórico de trechos aplicados pelo coordenador, usado para transformar edições feitas
+// sobre revisões antigas (transformação operacional centralizada)
+#define CAPACIDADE_HISTORICO 4096
+typedef struct {
+    int id;                // Linha
+    int revisao;           // Revisão da linha após este trecho
+    int posicao;
+    int apagar;
+    int inserir;           // Bytes inseridos
+} TrechoAplicado;
+
+typedef struct {
+    TrechoAplicado registros[CAPACIDADE_HISTORICO];  // Buffer circular
+    long total;
+} HistoricoTrechos;
+
+HistoricoTrechos historico_principal;
+HistoricoTrechos* historico = &historico_principal;  // Do documento carregado
+pthread_mutex_t historico_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Histórico de versões das linhas (coordenadores). Cada mudança de texto guarda num anel de
+// bytes com orçamento fixo o que refaz a revisão anterior a partir da seguinte: os bytes do
+// meio antigo e quantos do início e do fim as duas têm em comum. A cadeia de cada linha parte
+// do texto atual, no documento, e segue para trás; com o anel cheio os registros mais antigos
+// são descartados e as cadeias ficam mais curtas, sem reler o journal
+#define ORCAMENTO_HISTORICO_PADRAO_MB 64
+#define ALINHAMENTO_VERSAO      8
+#define MAX_REVISOES_LISTADAS   32    // Revisões mais recentes devolvidas numa consulta
+#define CAPACIDADE_DESFAZER     64    // Mudanças de cada usuário que ainda podem ser desfeitas, por documento
+#define DESFAZER_FEITO          1
+#define DESFAZER_VAZIO          0     // Nada a desfazer (ou refazer)
+#define DESFAZER_CONFLITO       -1    // A linha mudou depois, ou outro usuário a bloqueou
+#define DESFAZER_DESCARTADO     -2    // A revisão anterior já saiu do histórico
+
+typedef struct {
+    int tamanho;              // Bytes ocupados no anel, alinhados; id_linha -1 marca a sobra no fim do anel
+    int id_linha;
+    int revisao;              // Revisão que a mudança produziu; o registro refaz a anterior
+    int autor;
+    int prefixo;              // Bytes iniciais em comum com a revisão seguinte
+    int sufixo;               // Bytes finais em comum com a revisão seguinte
+    int comprimento;          // Bytes do meio antigo, logo após o cabeçalho
+    int reservado;
+    int64_t instante;         // Tempo de parede da mudança (s)
+    int64_t anterior;         // Posição lógica do registro da revisão anterior (-1 = nenhum)
+    char meio[];
+} RegistroVersao;
+
+// Revisão de uma linha, como listada ao usuário
+typedef struct {
+    int revisao;
+    int autor;
+    int64_t instante;
+} RevisaoLinha;
+
+typedef struct {
+    int id_linha;
+    int revisao;              // Revisão produzida pela mudança
+} MudancaUsuario;
+
+// Anel de mudanças de um usuário: empilhar além da capacidade descarta a mais antiga
+typedef struct {
+    MudancaUsuario itens[CAPACIDADE_DESFAZER];
+    int topo;
+    int base;
+} PilhaMudancas;
+
+typedef struct {
+    int64_t* cabeca;          // Registro da revisão atual de cada linha, pelo id (-1 = nenhum)
+    int capacidade_ids;
+    PilhaMudancas* desfazer;  // Indexadas pelo rank, criadas na primeira mudança
+    PilhaMudancas* refazer;
+} HistoricoLinhas;
+
+HistoricoLinhas historico_linhas_principal;
+HistoricoLinhas* historico_linhas = &historico_linhas_principal;  // Do documento carregado
+
+struct {
+    char* dados;
+    int64_t capacidade;       // --orcamento-historico=MB (0 = sem histórico)
+    int64_t inicio;           // Posição lógica do registro mais antigo ainda guardado
+    int64_t fim;              // Posição lógica do próximo registro
+    long descartados;
+    pthread_mutex_t mutex;    // Tratadores do coordenador registram juntos
+} anel_versoes = { .capacidade = ORCAMENTO_HISTORICO_PADRAO_MB * 1024LL * 1024LL, .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+int edicao_por_trecho = 0;         // --edicao-trecho: edita trechos sem bloquear a linha
+
+// Estado devolvido em QUADRO_RESPOSTA a um pedido de bloqueio
+#define BLOQUEIO_NEGADO     0
+#define BLOQUEIO_CONCEDIDO  1
+#define BLOQUEIO_NA_FILA    2        // A concessão chegará em outra resposta, quando a linha for liberada
+
+#define PRAZO_BLOQUEIO_PADRAO_S 10
+#define INTERVALO_EXPIRACAO_MS  50   // Frequência com que o coordenador confere os prazos
+
+// Tabela de bloqueios do coordenador: só as linhas bloqueadas, cada uma com o prazo da
+// concessão e a fila de espera (FIFO) de quem pediu a linha ocupada
+typedef struct PedidoEmEspera {
+    int rank;
+    int id_pedido;
+    struct PedidoEmEspera* proximo;
+} PedidoEmEspera;
+
+typedef struct {
+    int id_linha;
+    int dono;
+    int64_t prazo;                // CLOCK_MONOTONIC (ns) em que expira sem renovação; 0 = sem prazo
+    PedidoEmEspera* primeiro;
+    PedidoEmEspera* ultimo;
+} BloqueioAtivo;
+
+// A tabela é repartida em faixas pelo id da linha: com --tratadores, quadros de linhas em
+// faixas diferentes são tratados ao mesmo tempo, cada um segurando só a trava da sua faixa
+#define FAIXAS_BLOQUEIO 64
+#define FAIXA_DA_LINHA(id) ((unsigned)(id) % FAIXAS_BLOQUEIO)
+
+typedef struct {
+    BloqueioAtivo* entradas;
+    int total;
+    int capacidade;
+} FaixaBloqueios;
+
+typedef struct {
+    FaixaBloqueios faixas[FAIXAS_BLOQUEIO];
+    int64_t ultima_verificacao;
+} TabelaBloqueios;
+
+TabelaBloqueios tabela_bloqueios;  // Do documento carregado
+
+int prazo_bloqueio_s = PRAZO_BLOQUEIO_PADRAO_S;  // --prazo-bloqueio=S (0 = bloqueios não expiram)
+int fila_bloqueio = 1;             // --sem-fila: linha ocupada nega o pedido na hora, sem espera
+
+// Documentos hospedados: além do principal (carregado na inicialização, particionado entre os
+// coordenadores e difundido a todos em árvore), o mestre hospeda documentos abertos pelos
+// usuários pelo nome. Cada um tem réplica, bloqueios, histórico de trechos, versões e journal
+// próprios, e seus deltas vão direto só aos assinantes. O estado do documento carregado fica
+// nas variáveis globais (documento, tabela_bloqueios, ...), e trocar de documento troca o
+// conteúdo delas com o guardado no registro: o código de bloqueio e edição não muda
+#define DOCUMENTO_PRINCIPAL     0
+#define NOME_DOCUMENTO_PRINCIPAL "principal"
+#define TAMANHO_NOME_DOCUMENTO  32
+#define MAX_DOCUMENTOS          256
+#define BALDES_DOCUMENTOS       512       // Tabela de nomes com endereçamento aberto, no máximo meio cheia
+#define LINHAS_DOCUMENTO_NOVO   10
+
+typedef struct {
+    char nome[TAMANHO_NOME_DOCUMENTO];
+    Documento documento;               // Enquanto outro documento está carregado
+    TabelaBloqueios bloqueios;
+    HistoricoTrechos* historico;
+    HistoricoLinhas* historico_linhas;
+    int* versoes;                      // versao_coordenador deste documento
+    int* aguardando;                   // aguardando_ressincronizacao deste documento
+    RecepcaoEstado* recepcao;          // recepcao_estado deste documento
+    FILE* journal;
+    char* assinantes;                  // Mestre: indexado pelo rank
+    int num_assinantes;
+    int recebido;                      // Trabalhador: o estado completo já chegou
+} EstadoDocumento;
+
+struct {
+    EstadoDocumento* estados[MAX_DOCUMENTOS];  // Indexados pelo id; NULL = livre (ou não aberto aqui)
+    int num_documentos;
+    int baldes[BALDES_DOCUMENTOS];     // Mestre: id + 1 do documento com o nome, 0 = balde vazio
+    int* do_remetente;                 // Mestre: documento em que cada usuário está trabalhando
+    int carregado;                     // Documento cujo estado está nas variáveis globais
+    int indice_principal;              // indice_busca.ativo do principal enquanto outro está carregado
+} documentos;
+
+int documento_ativo = DOCUMENTO_PRINCIPAL;  // Mestre: contexto do quadro em tratamento; trabalhador: documento em uso
+
+// Índice de busca do mestre: cada trigrama (3 bytes) do texto cai num balde com as linhas
+// que o contêm. Linhas alteradas são reindexadas com uma nova geração; as entradas das
+// gerações anteriores ficam obsoletas, são puladas na busca e somem na próxima reconstrução
+#define BITS_BALDES_TRIGRAMAS   18
+#define BALDES_TRIGRAMAS        (1 << BITS_BALDES_TRIGRAMAS)
+#define MAX_RESULTADOS_BUSCA    256      // Ocorrências devolvidas por busca (o total é sempre contado)
+#define MINIMO_OBSOLETAS_INDICE 65536    // Entradas obsoletas toleradas além das válidas antes de reconstruir
+#define FRACAO_VARREDURA_BUSCA  8        // Balde com mais de 1/8 das linhas: varre o documento em paralelo
+
+typedef struct {
+    int id;
+    int geracao;                  // Geração da linha quando a entrada foi criada
+} EntradaIndice;
+
+typedef struct {
+    EntradaIndice* entradas;
+    int tamanho;
+    int capacidade;
+} BaldeIndice;
+
+struct {
+    int ativo;                    // Só no mestre, depois da carga do documento
+    int reconstruir;              // Documento substituído por inteiro: reindexa tudo
+    BaldeIndice* baldes;
+    uint32_t* marca;              // Última reindexação que tocou cada balde (uma entrada por linha)
+    uint32_t marca_atual;
+    int* geracao;                 // Indexados pelo id estável da linha
+    int* entradas_linha;          // Entradas válidas de cada linha
+    char* pendente;
+    int* posicao;                 // Posição de cada linha, refeita só depois de inserções e remoções
+    int posicoes_validas;
+    int capacidade_ids;
+    int* pendentes;               // Ids alterados desde a última atualização do índice
+    int num_pendentes;
+    int capacidade_pendentes;
+    long entradas_validas;
+    long entradas_obsoletas;
+    pthread_mutex_t mutex;        // Só para marcar: tratadores do coordenador alteram linhas juntos
+} indice_busca = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Operações do cliente assíncrono
+#define MAX_OPERACOES          256   // Operações em voo por trabalhador
+#define OPERACAO_BLOQUEIO      1
+#define OPERACAO_TEXTO         2     // Texto de uma linha já bloqueada (libera o bloqueio)
+#define OPERACAO_EDICAO_DIRETA 3     // Bloqueio, texto e liberação em uma só ida e volta
+#define OPERACAO_TRECHO        4     // Edição por trecho, sem bloqueio
+#define OPERACAO_INTERVALO     5     // Bloqueio de várias linhas consecutivas
+#define OPERACAO_LOTE          6     // Texto de várias linhas em uma só mensagem
+#define OPERACAO_ESTRUTURA     7     // Inserir, remover, dividir ou juntar linhas (só o mestre)
+#define OPERACAO_BUSCA         8     // Busca no documento, respondida pelo índice do mestre
+#define OPERACAO_CHAT          9     // Mensagem, entrada ou saída de canal, ou página do histórico
+#define OPERACAO_DOCUMENTO    10     // Abertura de um documento hospedado no mestre
+#define OPERACAO_DESFAZER     11     // Desfazer ou refazer a última mudança de texto do usuário (só o mestre)
+#define OPERACAO_VERSOES      12     // Revisões de uma linha, pedidas ao coordenador dela
+
+typedef struct {
+    int id_pedido;
+    int tipo;              // Um dos tipos OPERACAO_*
+    int id_linha;
+    int sucesso;           // 1 = aprovada pelo coordenador
+    int64_t inicio;        // CLOCK_MONOTONIC (ns) no envio do pedido
+} Conclusao;
+
+typedef void (*RetornoOperacao)(const Conclusao* conclusao, void* contexto);
+
+// Resposta de uma busca: as primeiras ocorrências em ordem de linha e deslocamento
+typedef struct {
+    int total;                    // Ocorrências no documento inteiro
+    int quantidade;               // Ocorrências devolvidas (até MAX_RESULTADOS_BUSCA)
+    int microssegundos;           // Duração da busca no mestre
+    int linhas[MAX_RESULTADOS_BUSCA];
+    int deslocamentos[MAX_RESULTADOS_BUSCA];
+} ResultadoBusca;
+
+// Resposta de uma consulta de versões: as revisões mais recentes e o texto da pedida
+typedef struct {
+    int revisao_atual;
+    int revisao_texto;            // Revisão do texto devolvido; -1 = já descartada ou inexistente
+    int quantidade;
+    RevisaoLinha revisoes[MAX_REVISOES_LISTADAS];  // Da mais recente para a mais antiga
+    char* texto;                  // Alocado na conclusão; liberado por quem pediu
+    int comprimento;
+} VersoesLinha;
+
+typedef struct {
+    int ativa;
+    int concluida;         // Concluída e ainda não recolhida por cliente_aguardar
+    int na_fila;           // Bloqueio aguardando na fila da linha
+    Conclusao conclusao;
+    RetornoOperacao retorno; // NULL = recolhida por cliente_aguardar
+    void* contexto;
+    void* resultado;       // Busca, página de chat ou versões preenchidas antes da conclusão (NULL = descarta)
+    int destino;           // Rank que responde; se ele morrer a operação falha
+} OperacaoPendente;
+
+struct {
+    OperacaoPendente operacoes[MAX_OPERACOES];  // Indexadas por id_pedido % MAX_OPERACOES
+    int proximo_id;
+    int em_voo;
+    int perdidos_vistos;       // Ranks mortos já tratados (reservas.num_perdidos)
+    // Bloqueios concedidos e ainda sem texto, renovados também pela thread de progresso
+    int mantidos[MAX_OPERACOES];
+    int num_mantidos;
+    int64_t ultima_renovacao;
+    pthread_mutex_t mantidos_mutex;
+} cliente = { .mantidos_mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Envios não bloqueantes em andamento: cada mensagem ocupa uma vaga até todos os seus
+// MPI_Isend completarem, e só então o buffer é liberado. Com todas ocupadas o conjunto
+// dobra: esperar uma vaga prenderia o rank ao destinatário mais lento com os mutexes travados
+#define VAGAS_ENVIO 64             // Vagas iniciais; a partir da metade as transferências esperam
+typedef struct {
+    void* buffer;          // NULL = vaga livre
+    int num_pedidos;
+    MPI_Request* pedidos;
+} EnvioPendente;
+
+EnvioPendente* envios = NULL;
+int num_vagas_envio = 0;
+pthread_mutex_t envios_mutex = PTHREAD_MUTEX_INITIALIZER;  // Cliente e thread de progresso enviam juntos
+int difusao_em_arvore = 1;         // 0 = a origem envia direto a todos (sem MPI_THREAD_MULTIPLE)
+
+// Estados completos a caminho de quem ressincroniza ou abre um documento: o coordenador
+// serializa e envia um bloco comprimido de cada por volta do loop, e só com metade das
+// vagas de envio livres, para que um estado grande não atrase os deltas e as respostas
+// dos demais. Nada é copiado antes: cada bloco sai das linhas a partir de proxima_linha
+typedef struct Transferencia {
+    int destino;
+    int documento;
+    int tipo_estado;       // ATUALIZACAO_COMPLETA ou ATUALIZACAO_PARTICAO
+    int coordenador;       // Dono das linhas serializadas (-1 = todas)
+    int versao;            // Versão do coordenador em que os blocos estão sendo serializados
+    int quantidade;        // Linhas do estado, contadas ao (re)começar
+    int proxima_linha;     // Id da próxima linha a serializar; -1 = já foram todas
+    int tamanho;           // Bytes do estado serializado inteiro
+    int enviado;           // Bytes do estado já enviados
+    long comprimido;       // Bytes já enviados depois da compressão
+    int de_uma_vez;        // Já recomeçou uma vez: o restante sai numa única passada
+    struct Transferencia* proxima;
+} Transferencia;
+
+struct {
+    Transferencia* primeira;
+    Transferencia* ultima;
+    pthread_mutex_t mutex;         // Tratadores enfileiram, o loop do coordenador envia
+} transferencias = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Quadros ainda não enviados: um pacote por destino (pedidos de um trabalhador ou respostas
+// de um coordenador) e, nos coordenadores, o pacote de deltas a difundir
+struct {
+    Pacote* saida;                 // Indexado pelo rank de destino
+    Pacote difusao;                // Deltas deste coordenador, na ordem das versões
+    uint32_t* enviados;            // Quadros já numerados para cada destino
+    uint32_t* recebidos;           // Último número de quadro recebido de cada remetente
+    pthread_mutex_t mutex;         // Interface e thread de progresso enfileiram juntas
+    pthread_mutex_t difusao_mutex; // Versões e pacote de deltas (tratadores do coordenador difundem juntos)
+} correio = { .mutex = PTHREAD_MUTEX_INITIALIZER, .difusao_mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Tratadores do coordenador (--tratadores=N, requer MPI_THREAD_MULTIPLE): o loop só recebe e
+// distribui os pacotes, os de um remetente sempre à mesma thread para que seus quadros sigam
+// em ordem. Bloqueio e texto de uma linha do principal correm em paralelo com a trava de
+// leitura do documento e a da faixa da linha; o resto (estrutura, lotes, trechos, busca,
+// chat, outros documentos e a manutenção do loop) pega a trava de escrita e roda sozinho.
+// Os pacotes de deltas saem por uma thread de difusão própria, e o journal já tem a sua
+#define MAX_TRATADORES          64
+#define INTERVALO_MANUTENCAO_US 1000  // Com tratadores, o loop só para os demais para manutenção a cada 1 ms
+
+typedef struct PacoteRecebido {
+    int remetente;
+    int tamanho;
+    char* dados;
+    struct PacoteRecebido* proximo;
+} PacoteRecebido;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t sinal;
+    PacoteRecebido* primeiro;
+    PacoteRecebido* ultimo;
+} FilaTratador;
+
+// Pacote de deltas entregue à thread de difusão, com os destinos já resolvidos
+typedef struct DifusaoPendente {
+    char* dados;
+    int tamanho;
+    int num_destinos;
+    int* destinos;
+    struct DifusaoPendente* proximo;
+} DifusaoPendente;
+
+struct {
+    int num;                                   // --tratadores=N (0 = o loop trata tudo sozinho)
+    FilaTratador* filas;
+    int encerrar;
+    int trabalhadores_ativos;                  // Atômico: cada tratador desconta quem sai
+    pthread_rwlock_t documento;
+    pthread_mutex_t travas_faixas[FAIXAS_BLOQUEIO];
+    pthread_t thread_difusao;
+    pthread_mutex_t difusao_mutex;
+    pthread_cond_t difusao_sinal;
+    DifusaoPendente* primeira;
+    DifusaoPendente* ultima;
+    int encerrar_difusao;
+} tratadores = { .difusao_mutex = PTHREAD_MUTEX_INITIALIZER,
+                 .difusao_sinal = PTHREAD_COND_INITIALIZER };
+
+// Modo headless (usuários automáticos para medir desempenho)
+#define DISTRIBUICAO_UNIFORME  0
+#define DISTRIBUICAO_QUENTE    1     // Maior parte dos acessos concentrada nas primeiras linhas
+#define FRACAO_ACESSOS_QUENTES 0.9
+#define BALDES_HISTOGRAMA      1024
+
+#if defined(NANO_BENCH) || defined(NANO_SIMULACAO)
+int modo_headless = 1;               // Alvo de benchmark e simulação: usuários automáticos por padrão
+#else
+int modo_headless = 0;
+#endif
+
+struct {
+    double taxa_edicao;              // Edições por segundo por usuário (0 = sem pausa)
+    double taxa_mensagens;           // Mensagens privadas por segundo por usuário (0 = nenhuma)
+    double duracao;                  // Segundos de execução
+    int distribuicao;
+    int linhas_quentes;
+    unsigned int semente;
+    int em_voo;                      // Operações simultâneas por usuário
+    int edicao_direta;               // 1 = bloqueio, texto e liberação em uma só mensagem
+    int lote;                        // Linhas consecutivas reescritas por edição (1 = sem lote)
+    double taxa_buscas;              // Buscas por segundo por usuário (0 = nenhuma)
+    int verificar_convergencia;      // --verificar-convergencia: o mestre compara o hash de todas as réplicas
+} carga = {10, 0, 10, DISTRIBUICAO_UNIFORME, 8, 1, 1, 0, 1, 0, 0};
+
+#define CONTADOR_PEDIDOS       0
+#define CONTADOR_NEGADOS       1
+#define CONTADOR_EDICOES       2
+#define CONTADOR_MENSAGENS     3
+#define CONTADOR_ATUALIZACOES  4
+#define CONTADOR_ENVIOS_MPI    5     // Mensagens MPI postadas (um pacote para cada destino conta uma)
+#define CONTADOR_BUSCAS        6
+#define CONTADOR_OCORRENCIAS   7     // Ocorrências encontradas pelas buscas
+#define CONTADOR_ENTREGUES     8     // Mensagens de chat recebidas pelos usuários
+#define NUM_CONTADORES         9
+
+// Somente campos long: o relatório soma tudo com um único MPI_Reduce
+typedef struct {
+    long contadores[NUM_CONTADORES];
+    long latencia_bloqueio[BALDES_HISTOGRAMA];    // Pedido de bloqueio até a resposta
+    long latencia_propagacao[BALDES_HISTOGRAMA];  // Envio do texto até a aplicação em outro rank
+    long latencia_busca[BALDES_HISTOGRAMA];       // Pedido de busca até o resultado
+    long duracao_busca[BALDES_HISTOGRAMA];        // Busca no mestre, sem a ida e volta
+} Estatisticas;
+
+Estatisticas estatisticas;
+
+// Verbosidade do console: os eventos da sessão aparecem por padrão; o log de cada pedido
+// recebido pelo coordenador custa caro sob carga e só sai com --verbosidade=2
+#define VERBOSIDADE_SILENCIOSO 0     // Só erros e avisos
+#define VERBOSIDADE_EVENTOS    1     // Início, saídas, prazos expirados, ressincronizações
+#define VERBOSIDADE_PEDIDOS    2     // Também cada pedido tratado
+int verbosidade = VERBOSIDADE_EVENTOS;
+
+// Métricas de operação (sempre ativas, em qualquer modo). Cada thread soma nos contadores do
+// seu próprio bloco, sem trava nem instrução atômica travada; quem grava o arquivo ou responde
+// a TAG_METRICAS soma os blocos de todas as threads. Histogramas em faixas fixas de tempo
+#define METRICA_ENVIADA  0
+#define METRICA_RECEBIDA 1
+#define NUM_TIPOS_QUADRO 26
+#define RESULTADO_CONCEDIDO       0  // Pedido de bloqueio (ou intervalo) concedido na hora
+#define RESULTADO_NEGADO          1
+#define RESULTADO_NA_FILA         2
+#define RESULTADO_CONCEDIDO_FILA  3  // Concessão a quem esperava na fila
+#define RESULTADO_EXPIRADO        4  // Prazo do bloqueio venceu
+#define NUM_RESULTADOS_BLOQUEIO   5
+#define NUM_LIMITES_METRICAS      13
+#define METRICAS_A_CADA_PADRAO_S  10
+
+typedef struct {
+    uint64_t baldes[NUM_LIMITES_METRICAS + 1];   // Não cumulativos; o último é acima do maior limite
+    uint64_t soma_ns;
+} HistogramaMetricas;
+
+typedef struct BlocoMetricas {
+    uint64_t mensagens[2][NUM_TAGS];             // [METRICA_*][tag]
+    uint64_t bytes[2][NUM_TAGS];
+    uint64_t quadros[NUM_TIPOS_QUADRO];          // Quadros tratados pelo coordenador, por tipo
+    uint64_t bloqueios[NUM_RESULTADOS_BLOQUEIO];
+    HistogramaMetricas tratador[NUM_TIPOS_QUADRO]; // Tempo dentro de tratar_quadro, por tipo
+    HistogramaMetricas difusao;                  // Postar um pacote de deltas a todos os filhos
+    HistogramaMetricas aplicacao;                // Aplicar um pacote de deltas recebido
+    struct BlocoMetricas* proximo;
+} BlocoMetricas;
+
+struct {
+    BlocoMetricas* blocos;           // Lista de todas as threads, com inserção sem trava
+    int a_cada_s;                    // Intervalo de gravação do arquivo (0 = não grava)
+    int64_t ultima_gravacao;
+    pthread_mutex_t gravacao_mutex;  // A interface e a thread de progresso podem gravar
+} metricas = { .a_cada_s = METRICAS_A_CADA_PADRAO_S, .gravacao_mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Sistema de mensagens/chat. Toda mensagem passa pelo mestre, que guarda o histórico de cada
+// canal e entrega as mensagens de cada destino juntas, um pacote por intervalo. Conversas
+// privadas são canais "@a-b" (menor rank primeiro) com os dois usuários como membros
+#define MAX_MENSAGENS 50                 // Últimas mensagens recebidas guardadas pelo usuário
+#define TAMANHO_NOME_CANAL 32
+#define CANAL_GERAL "geral"              // Todos os usuários são membros desde o início
+#define MAX_CANAIS 64
+#define MAX_HISTORICO_CANAL 65536        // Mensagens guardadas pelo mestre por canal (as mais antigas saem)
+#define INTERVALO_ENTREGA_CHAT_MS 20     // Mensagens para um mesmo usuário saem juntas neste intervalo
+#define MENSAGENS_POR_PAGINA 10          // Mensagens por página do histórico
+
+#define CANAL_ENTRAR 1
+#define CANAL_SAIR   2
+
+// Pedido de envio: o mestre identifica o remetente pelo rank de origem
+typedef struct {
+    int id_pedido;
+    int comprimento;
+    char canal[TAMANHO_NOME_CANAL];      // Nome do canal, ou "@rank" para uma conversa privada
+    char texto[];
+} EnvioChat;
+
+// Mensagem aceita pelo mestre: entrada do histórico, entrega e item de página
+typedef struct {
+    int sequencia;                       // Posição no histórico do canal (a primeira é 1)
+    int remetente;
+    int comprimento;
+    int reservado;
+    int64_t instante;                    // CLOCK_REALTIME (ns) em que o mestre aceitou a mensagem
+    char canal[TAMANHO_NOME_CANAL];
+    char texto[];                        // Sem '\0'
+} MensagemChat;
+
+#define TAMANHO_MENSAGEM_CHAT(m) (((int)sizeof(MensagemChat) + (m)->comprimento + 7) & ~7)
 
-// Sistema de mensagens/chat
-#define MAX_MENSAGENS 50
 typedef struct {
     int remetente;
     char conteudo[MAX_TEXTO];
     char timestamp[20];
+    char canal[TAMANHO_NOME_CANAL];
+    int sequencia;
 } Mensagem;
 
 Mensagem chat_mensagens[MAX_MENSAGENS];  // Buffer circular de mensagens
 int chat_count = 0;                      // Contador de mensagens
 int chat_inicio = 0;                     // Índice do início do buffer circular
 
+// Página do histórico de um canal pedida ao mestre
+typedef struct {
+    int total;                           // Mensagens já publicadas no canal (sequência da última)
+    int primeira_guardada;               // Sequência mais antiga que o mestre ainda guarda
+    int quantidade;
+    Mensagem mensagens[MENSAGENS_POR_PAGINA];
+} PaginaHistorico;
+
+// Canais no mestre
+typedef struct {
+    char nome[TAMANHO_NOME_CANAL];
+    char* membros;                       // Indexado pelo rank
+    MensagemChat** historico;            // Anel: a mensagem de sequência s fica em (s - 1) % MAX_HISTORICO_CANAL
+    int capacidade_historico;
+    int total;
+} Canal;
+
+struct {
+    Canal* canais;
+    int num_canais;
+    Pacote* entrega;                     // Mensagens acumuladas para cada usuário
+    int64_t ultima_entrega;
+} salas;
+
+// Tela da visualização em tempo real e da exibição do documento
+#define LARGURA_DOCUMENTO  76        // Colunas da caixa do documento, bordas incluídas
+#define LINHAS_RESUMO      20        // Linhas exibidas a cada atualização fora da visualização em tempo real
+#define SALTO_MAXIMO_TELA  6         // Células iguais reescritas para evitar um novo movimento de cursor
+
+// Cores das células (índices em cores_tela)
+#define COR_TELA_PADRAO    0
+#define COR_TELA_MAGENTA   1
+#define COR_TELA_AMARELO   2
+#define COR_TELA_VERMELHO  3
+#define COR_TELA_VERDE     4
+#define COR_TELA_CIANO     5
+
+// Teclas especiais devolvidas por ler_tecla (acima de qualquer byte)
+#define TECLA_CIMA          0x101
+#define TECLA_BAIXO         0x102
+#define TECLA_PAGINA_ACIMA  0x103
+#define TECLA_PAGINA_ABAIXO 0x104
+#define TECLA_INICIO        0x105
+#define TECLA_FIM           0x106
+#define ESPERA_ESCAPE_MS    50      // Depois de um ESC, prazo para o resto de uma sequência de escape
+
+typedef struct {
+    char bytes[4];                       // Um caractere UTF-8
+    uint8_t tamanho;
+    uint8_t cor;                         // Um dos COR_TELA_*
+} Celula;
+
+typedef struct {
+    Celula* celulas;                     // linhas x colunas, linha a linha
+    int linhas;
+    int colunas;
+} QuadroTela;
+
+struct {
+    QuadroTela exibido;                  // O que o terminal mostra (vazio = redesenhar tudo)
+    QuadroTela proximo;                  // Quadro em montagem
+    char* saida;                         // Sequências acumuladas para um único write()
+    int tamanho_saida;
+    int capacidade_saida;
+    struct termios termios_original;
+    int termios_alterado;
+} tela;
+
+// Eventos recebidos pelo trabalhador e ainda não mostrados na interface
+#define MAX_PENDENTES 10
+typedef struct {
+    int finalizado;                      // Recebeu TAG_FINALIZAR
+    int documento_mudou;
+    int num_mensagens;
+    int remetentes[MAX_PENDENTES];
+    char canais[MAX_PENDENTES][TAMANHO_NOME_CANAL];
+    char mensagens[MAX_PENDENTES][MAX_TEXTO];
+} EventosPendentes;
+
+// Motor de progresso dos trabalhadores: uma thread recebe atualizações, mensagens e a
+// finalização assim que chegam e acorda a interface por um pipe multiplexado com stdin.
+// Requer MPI_THREAD_MULTIPLE; sem ele, a interface volta a sondar entre interações.
+#define ESPERA_MINIMA_PROGRESSO_US 20
+#define SONDAGENS_ANTES_DE_DORMIR  2000  // Coordenador: sondagens vazias seguidas antes de recuar
+#define ESPERA_MAXIMA_PROGRESSO_US 1000  // Limita a latência de exibição quando ocioso
+struct {
+    pthread_t thread;
+    int ativo;
+    int aviso[2];                        // Pipe: [0] lido pela interface, [1] escrito pela thread
+    pthread_mutex_t mutex;               // Protege o documento local, o chat e os pendentes
+    EventosPendentes pendentes;
+    MPI_Request recepcao_finalizar;      // Recepção pré-postada da finalização (versões finais em fim_fluxo)
+} progresso = { .mutex = PTHREAD_MUTEX_INITIALIZER, .aviso = {-1, -1} };
+
+// Réplica compartilhada por nó (--replica-compartilhada): os usuários de um mesmo nó leem uma
+// única janela de memória compartilhada do MPI-3. Só o menor rank do nó (o escritor) recebe
+// os deltas, aplica na sua réplica e reflete a mudança na janela; os demais não guardam cópia
+// e são avisados pela troca de versão. Um seqlock (sequência ímpar durante a escrita) faz o
+// leitor repetir uma leitura que cruzou com uma escrita. Se o documento deixa de caber, a
+// janela nunca mostra um documento cortado: a sequência fica ímpar, o escritor manda a sua
+// réplica a cada leitor e passa a repassar-lhes os deltas, e cada um volta a ter a sua
+#define FOLGA_LINHAS_JANELA   4                  // Linhas e ids em múltiplos do documento inicial
+#define MINIMO_LINHAS_JANELA  16384
+#define FOLGA_TEXTO_JANELA    16                 // Arena de texto em múltiplos do documento serializado
+#define MINIMO_TEXTO_JANELA   (4 * 1024 * 1024)
+#define TEXTO_INTEIRO         0x7fffffff         // limite_texto de replica_ler: copia o texto todo
+
+// Início da janela, seguido de LinhaJanela[capacidade_linhas], int[capacidade_ids], das versões
+// aplicadas (int[num_coordenadores]) e da arena de texto
+typedef struct {
+    uint64_t sequencia;        // Seqlock: ímpar enquanto o escritor altera a janela
+    int total_linhas;
+    int capacidade_linhas;
+    int capacidade_ids;
+    int reservado;
+    int64_t capacidade_texto;
+    int64_t texto_usado;       // Fim da arena; textos substituídos só voltam a ser usados ao republicar
+} CabecalhoJanela;
+
+typedef struct {
+    int id;
+    int dono_bloqueio;
+    int revisao;
+    int comprimento;
+    int64_t deslocamento;      // Início do texto na arena
+} LinhaJanela;
+
+// Linha copiada da réplica (privada ou compartilhada) para uso sem nenhuma trava
+typedef struct {
+    int posicao;
+    int id;
+    int dono_bloqueio;
+    int revisao;
+    int comprimento;           // Comprimento real, mesmo que o texto copiado tenha sido cortado
+    char* texto;               // Cópia terminada em '\0' (NULL sem texto); liberada por replica_liberar
+} LinhaLida;
+
+struct {
+    int ativa;                 // --replica-compartilhada
+    int escritor;              // Este rank aplica os deltas na janela do nó
+    int escrevendo;            // Sequência ímpar até o fim do pacote de deltas
+    int esgotada;              // A janela não comporta mais o documento: cada usuário do nó terá a sua réplica
+    MPI_Comm no;               // Trabalhadores deste nó (MPI_COMM_NULL nos coordenadores)
+    MPI_Comm membros;          // Quem recebe os deltas: coordenadores e escritores
+    MPI_Win janela;
+    CabecalhoJanela* cabecalho; // NULL = a réplica é o 'documento' deste processo
+    LinhaJanela* linhas;       // Em ordem no documento
+    int* posicao_por_id;       // -1 = id sem linha na janela
+    int* versoes;              // Versão de cada partição já refletida na janela
+    char* texto;
+    int capacidade_linhas;
+    int capacidade_ids;
+    int64_t capacidade_texto;
+    uint64_t sequencia_vista;  // Leitores: última versão já avisada à interface
+    int* leitores;             // Escritor: ranks dos demais usuários do nó
+    int num_leitores;
+} replica_no;
+
+// Ranks que participam da árvore de difusão dos deltas, em ordem crescente
+int* membros_difusao;
+int num_membros_difusao;
+int* posicao_difusao;          // Índice de cada rank em membros_difusao (-1 = lê a janela do nó)
+
+// Reservas do mestre: os últimos ranks recebem os deltas na árvore como qualquer membro (o
+// fluxo ordenado das operações aplicadas), atendem as buscas e ressincronizações do principal
+// e, se o mestre silenciar, a primeira delas assume o papel dele
+#define RESERVA_PULSO           1    // Mestre -> reservas: segue vivo
+#define RESERVA_PROMOCAO        2    // Nova mestre -> todos: {_, versão do principal ao assumir, mestre antigo}
+#define RESERVA_BARREIRA        3    // Encerramento sem coletivas em MPI_COMM_WORLD (um rank pode ter morrido)
+#define RESERVA_RELATORIO       4    // Mestre -> coordenadores e reservas: enviem as estatísticas do benchmark
+#define RESERVA_FIM             5    // Coordenador -> coordenadores e reservas: usuários saíram; {_, versão final, partição}
+#define PRAZO_RESERVA_PADRAO_MS 2000 // Silêncio do mestre antes de a primeira reserva assumir
+#define INTERVALO_PULSO_MS      250
+#define TOLERANCIA_INICIO       5    // Multiplica o prazo enquanto o primeiro pulso não chega
+#define SALTO_PROMOCAO          (1 << 20) // Versões puladas ao assumir: as da nova mestre nunca coincidem com as perdidas
+#define MAX_RESSINCRONIZACOES_ADIADAS 64
+
+typedef struct {
+    int rank;
+    int versao;                // Versão do principal que o estado enviado precisa alcançar
+    int64_t prazo;             // Depois dele vai o estado que houver
+} RessincronizacaoAdiada;
+
+struct {
+    int num;                   // --reservas=N
+    int primeira;              // Ranks [primeira, size_global) são reservas
+    int prazo_ms;              // --prazo-reserva=MS
+    int64_t ultimo_pulso;      // Reserva: último sinal do mestre (CLOCK_MONOTONIC)
+    int pulsou;                // Reserva: já recebeu um pulso (antes disso o mestre pode estar iniciando)
+    int64_t proximo_pulso;     // Mestre: quando pulsar de novo
+    char* perdido;             // Ranks dados como mortos, por rank
+    int num_perdidos;
+    RessincronizacaoAdiada adiadas[MAX_RESSINCRONIZACOES_ADIADAS]; // Pedidas antes de o delta chegar aqui
+    int num_adiadas;
+} reservas = { .prazo_ms = PRAZO_RESERVA_PADRAO_MS };
+int rank_mestre = MASTER;      // Rank no papel de mestre (dono da partição 0); muda na promoção
+
+// Fim do fluxo de deltas: quando os usuários saem, cada coordenador avisa os demais e as
+// reservas da versão final da sua partição (RESERVA_FIM), e o mestre repassa todas aos
+// usuários em TAG_FINALIZAR. Ninguém deixa de receber deltas antes de alcançá-las
+struct {
+    int* finais;               // Versão final de cada partição (-1 = o aviso ainda não chegou)
+    int avisou;                // Coordenador: já enviou o seu aviso
+    int finalizando;           // Usuário: TAG_FINALIZAR chegou
+    int64_t ultimo_aviso;      // Quando chegou o último aviso; o prazo para os deltas conta dele
+} fim_fluxo;
+
+// Motor do documento
+Linha* documento_linha(Documento* doc, int indice);      // Localiza a linha pela posição em O(log n)
+Linha* documento_por_id(Documento* doc, int id);         // Localiza a linha pelo identificador estável
+int documento_indice(Linha* linha);                      // Posição atual da linha no documento
+Linha* documento_primeira(Documento* doc);
+Linha* documento_proxima(Linha* linha);                  // Percorre as linhas em ordem
+Linha* documento_inserir_linha(Documento* doc, int indice, int id, const char* texto, int comprimento);
+void documento_remover_linha(Documento* doc, int indice);
+void documento_alterar_texto(Linha* linha, const char* texto, int comprimento);
+void documento_editar_trecho(Linha* linha, int posicao, int apagar, const char* texto, int comprimento);
+Linha* documento_dividir_linha(Documento* doc, int indice, int deslocamento, int id_novo);
+void documento_juntar_linhas(Documento* doc, int indice); // Une a linha com a seguinte
+void documento_construir(Documento* doc, Linha** linhas, int total); // Monta a árvore a partir de linhas em ordem
+void documento_limpar(Documento* doc);
+void indice_busca_iniciar();            // Indexa o documento do mestre e passa a acompanhar as alterações
+void indice_busca_atualizar();          // Reindexa as linhas alteradas desde a última busca
+void indice_busca_finalizar();
+static void indice_marcar(int id);      // Linha alterada, inserida ou removida: reindexar antes da próxima busca
+static int buscar_documento(const char* texto, int comprimento, int* ocorrencias, int* quantidade); // Retorna o total
+char* serializar_documento(Documento* doc, int* tamanho);
+char* serializar_particao(Documento* doc, int coordenador, int* tamanho); // Só as linhas do coordenador
+Linha* linha_da_particao(Linha* linha, int coordenador); // Primeira linha da partição a partir desta
+int medir_linhas(Documento* doc, int coordenador, int* quantidade); // Bytes que a serialização ocuparia
+char* serializar_fatia(Documento* doc, int coordenador, int quantidade, Linha** linha, int limite, int* tamanho);
+char* serializar_selecao(Documento* doc, Linha** linhas, int quantidade, int com_bloqueios, int* tamanho);
+void aplicar_particao(Documento* doc, const char* buffer, int tamanho);
+void desserializar_documento(Documento* doc, const char* buffer, int tamanho);
+void desserializar_documento_mapeado(Documento* doc, char* buffer, int tamanho); // Linhas apontam para o buffer
+
 // Declaração das funções principais
+void ler_argumentos(int argc, char** argv);
+int coordenador_da_linha(int id);        // Rank do coordenador dono da linha
+int eh_coordenador(int rank);
+int rank_da_particao(int particao);      // Rank que serve a partição agora (a 0 acompanha o mestre)
+int eh_reserva(int rank);
+int eh_usuario(int rank);
+static int rank_leitura();               // Trabalhador: reserva que atende as suas leituras (ou o mestre)
 void gerar_documento_inicial();
+int importar_documento(const char* caminho);   // Mestre: documento a partir de um arquivo de texto mapeado
+void liberar_importacao();
+int exportar_documento(const char* caminho);   // Grava o documento em uso como texto; -1 em erro
+uint64_t hash_documento();                    // Resumo da réplica: igual em todas as que aplicaram os mesmos deltas
 void mostrar_documento();
-void registrar_log(int rank_usuario, int linha, const char* texto);
+void journal_iniciar(const char* caminho);
+void journal_registrar(const Atualizacao* at, int rank_usuario, int linha, const char* texto, int comprimento);
+void journal_finalizar();
+int exportar_journal(const char* caminho, FILE* saida); // Converte o journal binário para texto legível
+int carregar_snapshot(const char* caminho, SnapshotMapeado* snap);
+void liberar_snapshot(SnapshotMapeado* snap);
+int gravar_snapshot();
+void iniciar_snapshot_periodico();
+void finalizar_snapshot_periodico();
+int retomar_sessao(int* snapshot_em_dia);
 void loop_mestre();
+static void tratadores_iniciar();       // Tratadores de pedidos do coordenador (--tratadores)
+static void tratadores_finalizar();
+static void travar_documento(int exclusivo); // Com tratadores: leitura (quadros em paralelo) ou escrita
+static void destravar_documento();
+static void tratar_pacote(int remetente, char* pacote, int tamanho); // Trata e libera um pacote de pedidos
+static void reserva_manutencao();       // Mestre pulsa; reserva atende as ressincronizações adiadas e vigia o mestre
+static void reserva_atender_adiadas(int todas); // Estados pedidos antes de a reserva alcançar a versão
+static void reserva_promover();         // Reserva assume como mestre
+static void reserva_receber(const int* sinal, int remetente); // Sinal de TAG_RESERVA em qualquer rank
+static int fluxo_aguardando_fim();      // Coordenador ou reserva: ainda faltam avisos de fim ou os deltas até eles
+static int fluxo_alcancado();           // A réplica do principal já chegou às versões finais de todas as partições
+static void abandonar_envios();         // Esquece os envios pendentes (algum pode ter como destino um rank morto)
 void loop_trabalhador();
 int verificar_mensagens_e_atualizacoes();
-void visualizacao_tempo_real(); // Nova função para visualização em tempo real
-void adicionar_mensagem_chat(int remetente, const char* conteudo); // Adiciona mensagem ao chat
+void loop_headless();                   // Usuário automático guiado pela carga configurada
+int progresso_iniciar(int nivel_thread); // Thread que recebe eventos do trabalhador sem sondagem da interface
+void progresso_finalizar();
+static void coletar_eventos(EventosPendentes* ev);
+static int aguardar_eventos(int com_entrada, const char* prompt); // Multiplexa stdin com o aviso da thread
+static void editar_trecho_interativo();
+static void editar_intervalo_interativo(int primeira, int ultima);
+static void buscar_interativo();
+int relatorio_benchmark();              // Soma as medições de todos os ranks e imprime no mestre; 1 se réplicas divergiram
+int64_t instante_ns(clockid_t relogio);
+void registrar_latencia(long* histograma, int64_t ns);
+static BlocoMetricas* metricas_locais();         // Bloco de contadores da thread atual, criado no primeiro uso
+static void metrica_somar(uint64_t* contador, uint64_t valor);
+static void metrica_mensagem(int sentido, int tag, int bytes);
+static void metrica_tempo(HistogramaMetricas* histograma, int64_t ns);
+static void metrica_bloqueio(int resultado);
+void metricas_escrever(FILE* saida);            // Formato de texto do Prometheus
+void metricas_talvez_gravar();                  // Grava metricas_<rank>.prom quando passa o intervalo
+void metricas_finalizar();
+static void responder_metricas(int destino);
+void consultar_metricas();                      // Menu: mostra as métricas de um coordenador
+void difundir_atualizacao(Atualizacao* at, const char* texto, int comprimento); // Envia um delta para todos os trabalhadores
+void enviar_estado_completo(int destino);       // Enfileira documento e bloqueios completos para ressincronizar
+int transferencias_progredir();                 // Envia mais um bloco de cada estado pendente; devolve quantos restam
+void transferencias_finalizar();                // Descarta os estados ainda não enviados
+char* comprimir_estado(const char* dados, int tamanho, int* tamanho_comprimido); // Blocos comprimidos em paralelo
+int descomprimir_estado(const char* comprimido, int tamanho_comprimido, char* destino, int tamanho); // 0 se corrompido
+static int receber_bloco_estado(Atualizacao* at, int origem); // 1 quando o estado fica completo e é aplicado
+static void guardar_delta_pendente(RecepcaoEstado* recepcao, const Atualizacao* at);
+void recepcoes_liberar(RecepcaoEstado* recepcoes);
+int aplicar_atualizacao(Atualizacao* at);       // Aplica um delta na réplica local do documento
+int receber_atualizacao();                      // Recebe e aplica uma atualização pendente do mestre
+static int processar_atualizacao(Atualizacao* at, int origem);
+static int processar_pacote(char* pacote, int tamanho); // Aplica os deltas de um pacote recebido
+static int retransmitir_pacote(char* pacote, int tamanho); // Repassa os deltas aos filhos na árvore de difusão
+void encerrar_difusao();                        // Conclui os envios pendentes antes do MPI_Finalize
+static int filhos_na_arvore(int raiz, int* filhos);
+static void enviar_sem_bloquear(void* buffer, int tamanho, const int* destinos, int num_destinos, int tag);
+static int recolher_envios();                   // Libera as vagas concluídas; devolve quantas seguem ocupadas
+static void* pacote_reservar(Pacote* pacote, int tipo, int comprimento, uint32_t sequencia); // Devolve o corpo do novo quadro
+static const Quadro* proximo_quadro(const char* pacote, int tamanho, int* posicao); // NULL no fim do pacote
+static void correio_enfileirar(int destino, int tipo, const void* corpo, int comprimento);
+static void correio_despachar();                     // Envia os pacotes pendentes, um por destino
+static void difusao_despachar();                     // Difunde os deltas acumulados pelo coordenador
+static void responder(int destino, int id_pedido, int estado, int id_linha);
+static int tratar_quadro(int remetente, const Quadro* quadro); // Pedido recebido pelo coordenador; 1 = usuário saiu
+static void tratar_envio_texto(int remetente, int tipo, char* corpo, int comprimento); // Texto editado recebido pelo coordenador
+static void tratar_edicao_trecho(int remetente, char* corpo, int comprimento); // Edição por trecho recebida pelo coordenador
+static BloqueioAtivo* bloqueio_ativo(int id_linha);    // Entrada da linha na tabela de bloqueios, ou NULL
+static void conceder_bloqueio(Linha* linha, int rank);
+static void liberar_bloqueio(Linha* linha, int difundir); // Passa ao próximo da fila ou deixa livre
+static void expirar_bloqueios();
+static void liberar_bloqueios_de(int rank);           // Usuário saiu: solta os bloqueios e deixa as filas
+static void tratar_pedido_intervalo(int remetente, const int* pedido, int quantidade); // Bloqueio de várias linhas de uma vez
+static void tratar_edicao_lote(int remetente, char* corpo, int comprimento); // Texto de várias linhas aplicado como um único delta
+static void tratar_operacao_linha(int remetente, const int* pedido); // Inserir, remover, dividir ou juntar linhas
+static void tratar_busca(int remetente, const char* corpo, int comprimento); // Busca no documento pedida por um usuário
+void registrar_trecho(Linha* linha, int posicao, int apagar, int inserir);
+int cliente_editar_trecho(int id_linha, int revisao_base, int posicao, int apagar, const char* texto, int comprimento,
+                          RetornoOperacao retorno, void* contexto);
+int cliente_pedir_bloqueio(int indice, int id_linha, RetornoOperacao retorno, void* contexto);
+int cliente_enviar_texto(int id_linha, const char* texto, int comprimento, int direta, RetornoOperacao retorno, void* contexto);
+int cliente_progredir();                // Conclui as operações cujas respostas já chegaram
+int cliente_aguardar(int id_pedido, Conclusao* conclusao);
+void cliente_renovar_bloqueios();       // Estende o prazo dos bloqueios mantidos por este usuário
+int cliente_bloquear_intervalo(const int* ids, int num_linhas, RetornoOperacao retorno, void* contexto);
+int cliente_editar_lote(const int* ids, char* const* textos, const int* comprimentos, int num_linhas, int direta,
+                        RetornoOperacao retorno, void* contexto);
+int cliente_operacao_linha(int tipo, int indice, int id_linha, int deslocamento, int id_seguinte,
+                           RetornoOperacao retorno, void* contexto);
+int cliente_buscar(const char* texto, int comprimento, ResultadoBusca* resultado, RetornoOperacao retorno, void* contexto);
+void cliente_sair();                    // Avisa todos os coordenadores que este usuário saiu
+void replica_no_iniciar();              // Separa os usuários por nó e define quem recebe os deltas (coletiva)
+void replica_no_publicar();             // Cria a janela do nó com o documento inicial (coletiva no nó)
+void replica_no_finalizar();
+int replica_total_linhas();
+int replica_ler(int primeira, int quantidade, LinhaLida* linhas, int limite_texto);
+int replica_ler_id(int id, int quantidade, LinhaLida* linhas, int limite_texto); // A partir da linha com o id
+void replica_liberar(LinhaLida* linhas, int quantidade);
+static int replica_mudou();             // Leitor da janela: o escritor publicou uma nova versão
+static void janela_refletir(const Atualizacao* at);
+static void janela_concluir_escrita();
+static void janela_entregar_replicas(); // Escritor: janela esgotada, cada leitor do nó recebe a sua réplica
+void visualizacao_tempo_real();         // Viewport rolável, redesenhado só onde o quadro mudou
+void adicionar_mensagem_chat(const MensagemChat* mensagem); // Guarda no anel das últimas mensagens recebidas
+static void converter_mensagem_chat(Mensagem* destino, const MensagemChat* origem);
 void visualizar_mensagens_chat(); // Exibe histórico de mensagens
 void listar_usuarios_disponiveis(); // Lista usuários para envio de mensagem
+void salas_iniciar();                   // Mestre: cria o canal geral com todos os usuários
+void salas_finalizar();
+static void salas_despachar(int forcar); // Entrega as mensagens acumuladas, no máximo uma vez por intervalo
+static void tratar_chat(int remetente, const char* corpo, int comprimento);
+static void tratar_canal(int remetente, const int* pedido, int comprimento);
+static void tratar_historico(int remetente, const int* pedido, int comprimento);
+static void salas_remover_membro(int rank);      // Usuário saiu: deixa todos os canais
+static void receber_entrega_chat(EventosPendentes* ev, const char* pacote, int tamanho);
+int cliente_enviar_chat(const char* canal, const char* texto, int comprimento, RetornoOperacao retorno, void* contexto);
+int cliente_canal(int operacao, const char* canal, RetornoOperacao retorno, void* contexto);
+int cliente_historico(const char* canal, int antes_de, PaginaHistorico* pagina, RetornoOperacao retorno, void* contexto);
+static void menu_canais();
+void documentos_iniciar();              // Registra o documento principal (todos os ranks)
+void documentos_finalizar();            // Volta ao principal e libera os demais documentos
+static void documento_carregar(int id); // Troca o estado das variáveis globais pelo do documento
+static void documento_ativar(int id);   // Mestre: despacha os deltas pendentes e carrega o documento
+static void tratar_abrir_documento(int remetente, const char* corpo, int comprimento);
+static void tratar_fechar_documento(int remetente, int id);
+static void documentos_remover_usuario(int rank); // Usuário saiu: deixa os documentos e solta os bloqueios neles
+static void expirar_bloqueios_hospedados();
+static int documento_disponivel(const Atualizacao* at); // Trabalhador: carrega o documento do delta, se aberto
+int documento_usar(int id);             // Trabalhador: passa a editar e exibir o documento
+int cliente_abrir_documento(const char* nome, RetornoOperacao retorno, void* contexto);
+void cliente_fechar_documento(int id);
+static void menu_documentos();
+void versoes_iniciar();                 // Coordenadores: reserva o anel do histórico de versões
+void versoes_finalizar();
+static void versoes_guardar(Linha* linha, int autor, int prefixo, int sufixo, const char* meio, int comprimento);
+static void versoes_mudanca(Linha* linha, int autor, int prefixo, int sufixo); // Guarda e empilha para desfazer
+static void versoes_substituicao(Linha* linha, int autor, const char* novo, int comprimento);
+static void tratar_versoes_linha(int remetente, const int* campos, int num_campos);
+static void tratar_desfazer(int remetente, const int* campos, int num_campos);
+int cliente_desfazer(int refazer, RetornoOperacao retorno, void* contexto);
+int cliente_versoes_linha(int id_linha, int revisao, VersoesLinha* resultado, RetornoOperacao retorno, void* contexto);
+static void menu_historico_linha();
 
 int main(int argc, char** argv) {
     int provided;
-    // Inicialização MPI com suporte a threads (necessário para OpenMP)
-    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    // Modo utilitário: converte um journal binário para texto, sem iniciar o MPI
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--exportar-log=", 15) == 0) {
+            return exportar_journal(argv[i] + 15, stdout);
+        }
+    }
+
+    // Inicialização MPI com suporte a threads (OpenMP no mestre, thread de progresso nos trabalhadores)
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank_global);  // Obtém ID do processo atual
     MPI_Comm_size(MPI_COMM_WORLD, &size_global);  // Obtém total de processos
+    ler_argumentos(argc, argv);
+    difusao_em_arvore = provided >= MPI_THREAD_MULTIPLE;  // Repasses dependem da thread de progresso
+    if (replica_no.ativa && provided < MPI_THREAD_MULTIPLE) {
+        // Sem a thread de progresso o escritor só aplicaria deltas entre interações do seu usuário
+        if (rank_global == MASTER) {
+            fprintf(stderr, "Aviso: --replica-compartilhada requer MPI_THREAD_MULTIPLE; cada usuário manterá sua réplica.\n");
+        }
+        replica_no.ativa = 0;
+    }
+    if (tratadores.num > 0 && provided < MPI_THREAD_MULTIPLE) {
+        if (rank_global == MASTER) {
+            fprintf(stderr, "Aviso: --tratadores requer MPI_THREAD_MULTIPLE; cada coordenador tratará os pedidos em uma só thread.\n");
+        }
+        tratadores.num = 0;
+    }
+#ifdef NANO_SIMULACAO
+    if (replica_no.ativa) {
+        if (rank_global == MASTER) {
+            fprintf(stderr, "Aviso: --replica-compartilhada requer janelas MPI-3, ausentes na simulação; cada usuário manterá sua réplica.\n");
+        }
+        replica_no.ativa = 0;
+    }
+#endif
 
     // Verifica se há pelo menos 2 processos (1 mestre + 1 trabalhador)
     if (size_global < 2) {
@@ -73,451 +1360,7437 @@ int main(int argc, char** argv) {
         MPI_Finalize();
         return 1;
     }
+    if (num_coordenadores < 1 || num_coordenadores >= size_global) {
+        if (rank_global == MASTER) {
+            fprintf(stderr, "Erro: --coordenadores deve estar entre 1 e %d (é preciso ao menos 1 trabalhador).\n", size_global - 1);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (reservas.num < 0 || num_coordenadores + reservas.num >= size_global) {
+        if (rank_global == MASTER) {
+            fprintf(stderr, "Erro: --reservas deve estar entre 0 e %d (é preciso ao menos 1 trabalhador).\n",
+                    size_global - num_coordenadores - 1);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    reservas.primeira = size_global - reservas.num;
+    reservas.perdido = calloc(size_global, 1);
+    if (reservas.num > 0) {
+        // Com a janela do nó, um escritor morto deixaria os leitores dele sem deltas
+        if (replica_no.ativa && rank_global == MASTER) {
+            fprintf(stderr, "Aviso: --replica-compartilhada não é usada com --reservas; cada usuário manterá sua réplica.\n");
+        }
+        replica_no.ativa = 0;
+        // Um envio a um rank morto devolve erro em vez de abortar os sobreviventes
+        MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
+    }
+    particao_local = eh_coordenador(rank_global) ? rank_global : eh_reserva(rank_global) ? 0 : -1;
+
+    versao_coordenador = calloc(num_coordenadores, sizeof(int));
+    fim_fluxo.finais = malloc(num_coordenadores * sizeof(int));
+    for (int p = 0; p < num_coordenadores; p++) fim_fluxo.finais[p] = -1;
+    aguardando_ressincronizacao = calloc(num_coordenadores, sizeof(int));
+    recepcao_estado = calloc(num_coordenadores, sizeof(RecepcaoEstado));
+    correio.saida = calloc(size_global, sizeof(Pacote));
+    correio.enviados = calloc(size_global, sizeof(uint32_t));
+    correio.recebidos = calloc(size_global, sizeof(uint32_t));
+    documentos_iniciar();
+    if (rank_global == MASTER) {
+        strcpy(nome_processo, "MESTRE");
+    } else if (eh_coordenador(rank_global)) {
+        sprintf(nome_processo, "COORDENADOR_%d", rank_global);
+    } else if (eh_reserva(rank_global)) {
+        sprintf(nome_processo, "RESERVA_%d", rank_global);
+    } else {
+        sprintf(nome_processo, "Usuario_%d", rank_global);
+    }
 
-    // Processo mestre inicializa o documento e cria arquivo de log
+    // Processo mestre retoma a sessão anterior ou gera o documento, e grava o snapshot
+    // desta sessão; o documento inicial é difundido direto da região mapeada do snapshot
+    SnapshotMapeado snapshot_difusao = {0};
+    int tamanho_serializado = 0;
+    char* serializado = NULL;
     if (rank_global == MASTER) {
-        printf("[MESTRE] Iniciando e gerando documento...\n");
-        gerar_documento_inicial();
-        FILE* f = fopen("log_editor.txt", "w");
-        if(f) fclose(f);
+        int snapshot_em_dia = 0;
+        if (!retomar || !retomar_sessao(&snapshot_em_dia)) {
+            if (verbosidade >= VERBOSIDADE_EVENTOS) {
+                printf("[MESTRE] Iniciando e gerando documento...\n");
+            }
+            if (!arquivo_importar || !importar_documento(arquivo_importar)) {
+                gerar_documento_inicial();
+            }
+        }
+        if (!snapshot_em_dia) {
+            gravar_snapshot();
+        }
+        if (carregar_snapshot(ARQUIVO_SNAPSHOT, &snapshot_difusao)) {
+            serializado = snapshot_difusao.documento;
+            tamanho_serializado = snapshot_difusao.tamanho_documento;
+        } else {
+            serializado = serializar_documento(&documento, &tamanho_serializado);  // Sem disco: difunde da memória
+        }
+    }
+
+    // Sincroniza versões, tamanho e conteúdo do documento inicial. O conteúdo só vai a quem
+    // recebe os deltas; com a réplica compartilhada, os demais usuários leem a janela do nó
+    replica_no_iniciar();
+    MPI_Bcast(versao_coordenador, num_coordenadores, MPI_INT, MASTER, MPI_COMM_WORLD);
+    // O conteúdo segue em blocos comprimidos, comprimidos e descomprimidos em paralelo
+    int tamanhos_difusao[2] = {tamanho_serializado, 0};
+    char* comprimido = NULL;
+    if (rank_global == MASTER) {
+        comprimido = comprimir_estado(serializado, tamanho_serializado, &tamanhos_difusao[1]);
+        if (verbosidade >= VERBOSIDADE_EVENTOS) {
+            printf("[MESTRE] Documento inicial: %d bytes, %d comprimidos\n", tamanhos_difusao[0], tamanhos_difusao[1]);
+        }
+    }
+    MPI_Bcast(tamanhos_difusao, 2, MPI_INT, MASTER, MPI_COMM_WORLD);
+    tamanho_serializado = tamanhos_difusao[0];
+    if (posicao_difusao[rank_global] >= 0) {
+        if (rank_global != MASTER) {
+            comprimido = malloc(tamanhos_difusao[1]);
+        }
+        MPI_Bcast(comprimido, tamanhos_difusao[1], MPI_BYTE, MASTER, replica_no.membros);
+        if (rank_global != MASTER) {
+            serializado = malloc(tamanho_serializado);
+            if (!descomprimir_estado(comprimido, tamanhos_difusao[1], serializado, tamanho_serializado)) {
+                fprintf(stderr, "Erro: documento inicial corrompido na difusão.\n");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+    }
+    free(comprimido);
+    if (rank_global == MASTER && snapshot_difusao.base) {
+        liberar_snapshot(&snapshot_difusao);
+    } else if (serializado) {
+        if (rank_global != MASTER) {
+            desserializar_documento(&documento, serializado, tamanho_serializado);
+        }
+        free(serializado);
     }
+    replica_no_publicar();
 
-    // Sincroniza o documento inicial entre todos os processos
-    MPI_Bcast(documento, MAX_LINHAS * MAX_TEXTO, MPI_CHAR, MASTER, MPI_COMM_WORLD);
-    MPI_Bcast(linhas_em_uso, MAX_LINHAS, MPI_INT, MASTER, MPI_COMM_WORLD);
+    // Cada coordenador abre seu journal só depois da sincronização: o mestre já
+    // terminou de ler os journais da sessão anterior
+    if (eh_coordenador(rank_global)) {
+        const char* base = formato_log == FORMATO_LOG_TEXTO ? "log_editor" : "journal_editor";
+        const char* extensao = formato_log == FORMATO_LOG_TEXTO ? "txt" : "bin";
+        if (rank_global == MASTER) {
+            sprintf(arquivo_log, "%s.%s", base, extensao);
+        } else {
+            sprintf(arquivo_log, "%s_%d.%s", base, rank_global, extensao);
+        }
+        journal_iniciar(arquivo_log);
+    }
+
+    if (eh_usuario(rank_global)) {
+        progresso_iniciar(provided);
+    }
 
     // Executa função específica baseada no tipo de processo
+    if (rank_global == MASTER || eh_reserva(rank_global)) {
+        indice_busca_iniciar();  // As reservas respondem buscas desde o início
+    }
     if (rank_global == MASTER) {
-        loop_mestre();      // Gerencia documento e coordena colaboração
+        salas_iniciar();
+    }
+    if (!eh_usuario(rank_global)) {
+        versoes_iniciar();
+        tratadores_iniciar();
+        loop_mestre();      // Gerencia documento e coordena colaboração (mestre, coordenadores e reservas)
+    } else if (modo_headless) {
+        loop_headless();    // Usuário automático para medições
     } else {
         loop_trabalhador(); // Interface de usuário para edição
     }
+    progresso_finalizar();
+    indice_busca_finalizar();
+    salas_finalizar();
+    metricas_finalizar();
+    int codigo_saida = 0;
+    if (modo_headless) {
+        codigo_saida = relatorio_benchmark();  // Réplicas divergentes (--verificar-convergencia) saem com erro
+    }
+    documentos_finalizar();
+    versoes_finalizar();
+    if (rank_global == rank_mestre && arquivo_exportar) {
+        int gravadas = exportar_documento(arquivo_exportar);
+        if (gravadas < 0) {
+            fprintf(stderr, "Erro: não foi possível exportar o documento para %s\n", arquivo_exportar);
+        } else if (verbosidade >= VERBOSIDADE_EVENTOS) {
+            printf("[MESTRE] Documento exportado para %s (%d linhas).\n", arquivo_exportar, gravadas);
+        }
+    }
 
-    MPI_Barrier(MPI_COMM_WORLD);  // Sincroniza todos os processos antes de finalizar
+    documento_limpar(&documento);
+    liberar_snapshot(&snapshot_sessao);  // Só depois de liberar as linhas que apontam para ele
+    liberar_importacao();
+    free(versao_coordenador);
+    free(aguardando_ressincronizacao);
+    recepcoes_liberar(recepcao_estado);
+    encerrar_difusao();  // Sincroniza todos os processos antes de finalizar, concluindo os repasses
+    replica_no_finalizar();
+    free(reservas.perdido);
+    if (reservas.num_perdidos > 0) {
+        // O MPI_Finalize faz um fence com todos os ranks e nunca volta com um morto;
+        // com --enable-recovery o mpirun aceita a saída dos sobreviventes sem ele
+        return codigo_saida;
+    }
     MPI_Finalize();
-    return 0;
+    return codigo_saida;
+}
+
+// Lê as opções de linha de comando (após o MPI remover as suas)
+void ler_argumentos(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--coordenadores=", 16) == 0) {
+            num_coordenadores = atoi(argv[i] + 16);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            modo_headless = 1;
+        } else if (strncmp(argv[i], "--verbosidade=", 14) == 0) {
+            verbosidade = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--metricas-a-cada=", 18) == 0) {
+            metricas.a_cada_s = atoi(argv[i] + 18);
+        } else if (strncmp(argv[i], "--taxa-edicao=", 14) == 0) {
+            carga.taxa_edicao = atof(argv[i] + 14);
+        } else if (strncmp(argv[i], "--taxa-mensagens=", 17) == 0) {
+            carga.taxa_mensagens = atof(argv[i] + 17);
+        } else if (strncmp(argv[i], "--taxa-buscas=", 14) == 0) {
+            carga.taxa_buscas = atof(argv[i] + 14);
+        } else if (strncmp(argv[i], "--duracao=", 10) == 0) {
+            carga.duracao = atof(argv[i] + 10);
+        } else if (strcmp(argv[i], "--distribuicao=uniforme") == 0) {
+            carga.distribuicao = DISTRIBUICAO_UNIFORME;
+        } else if (strcmp(argv[i], "--distribuicao=quente") == 0) {
+            carga.distribuicao = DISTRIBUICAO_QUENTE;
+        } else if (strncmp(argv[i], "--linhas-quentes=", 17) == 0) {
+            carga.linhas_quentes = atoi(argv[i] + 17);
+        } else if (strncmp(argv[i], "--semente=", 10) == 0) {
+            carga.semente = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--em-voo=", 9) == 0) {
+            carga.em_voo = atoi(argv[i] + 9);
+            if (carga.em_voo < 1) carga.em_voo = 1;
+            if (carga.em_voo > MAX_OPERACOES) carga.em_voo = MAX_OPERACOES;
+        } else if (strcmp(argv[i], "--verificar-convergencia") == 0) {
+            carga.verificar_convergencia = 1;
+        } else if (strcmp(argv[i], "--edicao-direta") == 0) {
+            carga.edicao_direta = 1;
+        } else if (strcmp(argv[i], "--edicao-trecho") == 0) {
+            edicao_por_trecho = 1;
+        } else if (strncmp(argv[i], "--prazo-bloqueio=", 17) == 0) {
+            prazo_bloqueio_s = atoi(argv[i] + 17);
+            if (prazo_bloqueio_s < 0) prazo_bloqueio_s = 0;
+        } else if (strcmp(argv[i], "--sem-fila") == 0) {
+            fila_bloqueio = 0;
+        } else if (strncmp(argv[i], "--tratadores=", 13) == 0) {
+            tratadores.num = atoi(argv[i] + 13);
+            if (tratadores.num < 0) tratadores.num = 0;
+            if (tratadores.num > MAX_TRATADORES) tratadores.num = MAX_TRATADORES;
+        } else if (strncmp(argv[i], "--orcamento-historico=", 22) == 0) {
+            int megabytes = atoi(argv[i] + 22);
+            anel_versoes.capacidade = megabytes > 0 ? (int64_t)megabytes << 20 : 0;
+        } else if (strncmp(argv[i], "--lote=", 7) == 0) {
+            carga.lote = atoi(argv[i] + 7);
+            if (carga.lote < 1) carga.lote = 1;
+        } else if (strcmp(argv[i], "--replica-compartilhada") == 0) {
+            replica_no.ativa = 1;
+        } else if (strncmp(argv[i], "--reservas=", 11) == 0) {
+            reservas.num = atoi(argv[i] + 11);
+        } else if (strncmp(argv[i], "--prazo-reserva=", 16) == 0) {
+            reservas.prazo_ms = atoi(argv[i] + 16);
+            if (reservas.prazo_ms < 2 * INTERVALO_PULSO_MS) reservas.prazo_ms = 2 * INTERVALO_PULSO_MS;
+        } else if (strncmp(argv[i], "--importar=", 11) == 0) {
+            arquivo_importar = argv[i] + 11;
+        } else if (strncmp(argv[i], "--exportar=", 11) == 0) {
+            arquivo_exportar = argv[i] + 11;
+        } else if (strcmp(argv[i], "--retomar") == 0) {
+            retomar = 1;
+        } else if (strncmp(argv[i], "--snapshot-a-cada=", 18) == 0) {
+            snapshot_a_cada = atoi(argv[i] + 18);
+        } else if (strcmp(argv[i], "--formato-log=texto") == 0) {
+            formato_log = FORMATO_LOG_TEXTO;
+        } else if (strcmp(argv[i], "--formato-log=binario") == 0) {
+            formato_log = FORMATO_LOG_BINARIO;
+        } else if (strcmp(argv[i], "--fsync=sempre") == 0) {
+            politica_fsync = FSYNC_SEMPRE;
+        } else if (strcmp(argv[i], "--fsync=periodico") == 0) {
+            politica_fsync = FSYNC_PERIODICO;
+        } else if (strcmp(argv[i], "--fsync=nunca") == 0) {
+            politica_fsync = FSYNC_NUNCA;
+        } else if (rank_global == MASTER) {
+            fprintf(stderr, "Aviso: opção desconhecida ignorada: %s\n", argv[i]);
+        }
+    }
+}
+
+// Partição por hash do id estável: não muda quando linhas mudam de posição. Só o principal é
+// particionado; os demais documentos ficam inteiros no mestre
+int coordenador_da_linha(int id) {
+    if (documento_ativo != DOCUMENTO_PRINCIPAL) return rank_da_particao(0);
+    return rank_da_particao(id % num_coordenadores);
+}
+
+// Partições são numeradas pelos ranks dos coordenadores; a 0 vai com o papel de mestre
+// quando uma reserva assume
+int rank_da_particao(int particao) {
+    return particao == 0 ? __atomic_load_n(&rank_mestre, __ATOMIC_SEQ_CST) : particao;
+}
+
+int eh_coordenador(int rank) {
+    return rank < num_coordenadores;
+}
+
+int eh_reserva(int rank) {
+    return rank >= reservas.primeira;
+}
+
+int eh_usuario(int rank) {
+    return !eh_coordenador(rank) && !eh_reserva(rank);
+}
+
+// Buscas e ressincronizações do principal vão a uma das reservas que ainda seguem o mestre,
+// sempre a mesma para cada usuário; sem reservas, ao próprio mestre
+static int rank_leitura() {
+    int mestre = __atomic_load_n(&rank_mestre, __ATOMIC_SEQ_CST);
+    int primeira = mestre >= reservas.primeira ? mestre + 1 : reservas.primeira;
+    int seguidoras = size_global - primeira;
+    if (seguidoras <= 0) return mestre;
+    return primeira + rank_global % seguidoras;
 }
 
 // Gera o documento inicial com texto padrão usando paralelização OpenMP
 void gerar_documento_inicial() {
-    #pragma omp parallel for  // Paraleliza a inicialização das linhas
-    for (int i = 0; i < MAX_LINHAS; i++) {
-        sprintf(documento[i], "Linha %d: texto inicial gerado automaticamente.", i);
-        linhas_em_uso[i] = -1;  // Marca todas as linhas como livres
+    Linha* linhas[LINHAS_INICIAIS];
+
+    #pragma omp parallel for  // Paraleliza a criação das linhas
+    for (int i = 0; i < LINHAS_INICIAIS; i++) {
+        char texto[64];
+        int comprimento = sprintf(texto, "Linha %d: texto inicial gerado automaticamente.", i);
+        linhas[i] = calloc(1, sizeof(Linha));
+        linhas[i]->id = i;
+        linhas[i]->dono_bloqueio = -1;  // Marca todas as linhas como livres
+        documento_alterar_texto(linhas[i], texto, comprimento);
     }
+    documento_construir(&documento, linhas, LINHAS_INICIAIS);
 }
 
-// Exibe o documento atual com interface colorida e status de bloqueio
-void mostrar_documento() {
-    printf(ANSI_COLOR_MAGENTA "\n  +--------------------------------------------------------------------------+\n" ANSI_COLOR_RESET);
-    printf(ANSI_COLOR_MAGENTA "  |                           Visualizacao do Documento                        |\n" ANSI_COLOR_RESET);
-    printf(ANSI_COLOR_MAGENTA "  +--------------------------------------------------------------------------+\n" ANSI_COLOR_RESET);
-    
-    // Mostra apenas as primeiras 20 linhas para melhor visualização
-    for (int i = 0; i < 20; i++) {
-        char linha_completa[MAX_TEXTO + 50];
-        char status_linha[50] = "";
-        
-        // Indica se a linha está bloqueada por algum usuário
-        if (linhas_em_uso[i] != -1) {
-            sprintf(status_linha, ANSI_COLOR_RED " (Bloqueada por Usuario_%d)" ANSI_COLOR_RESET, linhas_em_uso[i]);
-        }
-        sprintf(linha_completa, "%s%s", documento[i], status_linha);
-        
-        printf(ANSI_COLOR_MAGENTA "  | " ANSI_COLOR_YELLOW "[%02d]" ANSI_COLOR_RESET " %-70s" ANSI_COLOR_MAGENTA "|\n", i, linha_completa);
-    }
-    printf(ANSI_COLOR_MAGENTA "  +--------------------------------------------------------------------------+\n" ANSI_COLOR_RESET);
+// ---------------------------------------------------------------------------
+// Motor do documento: treap implícita de linhas de tamanho variável
+// ---------------------------------------------------------------------------
+
+static unsigned int semente_treap = 2463534242u;
+
+// Gerador xorshift simples para as prioridades da treap
+static unsigned int prioridade_aleatoria() {
+    semente_treap ^= semente_treap << 13;
+    semente_treap ^= semente_treap >> 17;
+    semente_treap ^= semente_treap << 5;
+    return semente_treap;
 }
 
-// Registra todas as edições em arquivo de log com timestamp
-void registrar_log(int rank_usuario, int linha, const char* texto) {
-    FILE *log = fopen("log_editor.txt", "a");
-    if (log) {
-        time_t agora = time(NULL);
-        struct tm *t = localtime(&agora);
-        char timestamp[20];
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", t);
-        fprintf(log, "[%s] [Usuario_%d] editou a linha %d: \"%s\"\n", timestamp, rank_usuario, linha, texto);
-        fclose(log);
-    }
+static int tamanho_arvore(Linha* no) {
+    return no ? no->tamanho_subarvore : 0;
 }
 
-// Loop principal do processo mestre - coordena todas as operações colaborativas
-void loop_mestre() {
-    int trabalhadores_ativos = size_global - 1;
-    MPI_Status status;
-    int buffer_int[2];      // Buffer para receber dados inteiros
-    char buffer_texto[MAX_TEXTO];  // Buffer para receber texto
-    
-    MPI_Request requests[size_global * 2];  // Para comunicação não-bloqueante
-    int req_count;
+// Recalcula o tamanho da subárvore e acerta o ponteiro de pai dos filhos
+static void recalcular_no(Linha* no) {
+    no->tamanho_subarvore = 1 + tamanho_arvore(no->esq) + tamanho_arvore(no->dir);
+    if (no->esq) no->esq->pai = no;
+    if (no->dir) no->dir->pai = no;
+}
+
+// Concatena duas árvores (todas as linhas de 'a' vêm antes das de 'b')
+static Linha* mesclar_arvores(Linha* a, Linha* b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->prioridade > b->prioridade) {
+        a->dir = mesclar_arvores(a->dir, b);
+        recalcular_no(a);
+        return a;
+    }
+    b->esq = mesclar_arvores(a, b->esq);
+    recalcular_no(b);
+    return b;
+}
+
+// Separa a árvore: as 'k' primeiras linhas vão para 'a', o restante para 'b'
+static void separar_arvore(Linha* no, int k, Linha** a, Linha** b) {
+    if (!no) {
+        *a = *b = NULL;
+        return;
+    }
+    if (tamanho_arvore(no->esq) < k) {
+        separar_arvore(no->dir, k - tamanho_arvore(no->esq) - 1, &no->dir, b);
+        recalcular_no(no);
+        *a = no;
+    } else {
+        separar_arvore(no->esq, k, a, &no->esq);
+        recalcular_no(no);
+        *b = no;
+    }
+}
+
+static void definir_raiz(Documento* doc, Linha* raiz) {
+    doc->raiz = raiz;
+    if (raiz) raiz->pai = NULL;
+}
+
+// Registra a linha na tabela de identificadores, crescendo a tabela se necessário
+static void registrar_id(Documento* doc, Linha* linha) {
+    if (linha->id >= doc->capacidade_ids) {
+        int nova_capacidade = doc->capacidade_ids ? doc->capacidade_ids : 128;
+        while (nova_capacidade <= linha->id) nova_capacidade *= 2;
+        doc->por_id = realloc(doc->por_id, nova_capacidade * sizeof(Linha*));
+        memset(doc->por_id + doc->capacidade_ids, 0, (nova_capacidade - doc->capacidade_ids) * sizeof(Linha*));
+        doc->capacidade_ids = nova_capacidade;
+    }
+    doc->por_id[linha->id] = linha;
+    if (linha->id >= doc->proximo_id) doc->proximo_id = linha->id + 1;
+}
+
+static Linha* criar_linha(int id, const char* texto, int comprimento) {
+    Linha* linha = calloc(1, sizeof(Linha));
+    linha->id = id;
+    linha->dono_bloqueio = -1;
+    linha->prioridade = prioridade_aleatoria();
+    linha->tamanho_subarvore = 1;
+    documento_alterar_texto(linha, texto, comprimento);
+    linha->revisao = 0;
+    return linha;
+}
+
+// Cria uma linha cujo texto aponta para um buffer externo (snapshot ou arquivo mapeado), sem
+// cópia. A prioridade fica para documento_construir, então pode ser chamada em várias threads
+static Linha* criar_linha_mapeada(int id, char* texto, int comprimento) {
+    Linha* linha = calloc(1, sizeof(Linha));
+    linha->id = id;
+    linha->dono_bloqueio = -1;
+    linha->tamanho_subarvore = 1;
+    linha->texto = texto;
+    linha->comprimento = comprimento;
+    linha->texto_externo = 1;
+    return linha;
+}
+
+static void liberar_linha(Linha* linha) {
+    if (!linha->texto_externo) free(linha->texto);
+    free(linha);
+}
+
+// Copia para o heap um texto que ainda aponta para o snapshot mapeado
+static void materializar_texto(Linha* linha) {
+    if (!linha->texto_externo) return;
+    char* copia = malloc(linha->comprimento + 1);
+    memcpy(copia, linha->texto, linha->comprimento);
+    copia[linha->comprimento] = '\0';
+    linha->texto = copia;
+    linha->texto_externo = 0;
+}
+
+Linha* documento_linha(Documento* doc, int indice) {
+    if (indice < 0 || indice >= doc->total_linhas) return NULL;
+    Linha* no = doc->raiz;
+    while (no) {
+        int esquerda = tamanho_arvore(no->esq);
+        if (indice < esquerda) {
+            no = no->esq;
+        } else if (indice == esquerda) {
+            return no;
+        } else {
+            indice -= esquerda + 1;
+            no = no->dir;
+        }
+    }
+    return NULL;
+}
+
+Linha* documento_por_id(Documento* doc, int id) {
+    if (id < 0 || id >= doc->capacidade_ids) return NULL;
+    return doc->por_id[id];
+}
+
+int documento_indice(Linha* linha) {
+    int indice = tamanho_arvore(linha->esq);
+    while (linha->pai) {
+        if (linha == linha->pai->dir) {
+            indice += tamanho_arvore(linha->pai->esq) + 1;
+        }
+        linha = linha->pai;
+    }
+    return indice;
+}
+
+Linha* documento_primeira(Documento* doc) {
+    Linha* no = doc->raiz;
+    while (no && no->esq) no = no->esq;
+    return no;
+}
+
+Linha* documento_proxima(Linha* linha) {
+    if (linha->dir) {
+        linha = linha->dir;
+        while (linha->esq) linha = linha->esq;
+        return linha;
+    }
+    while (linha->pai && linha == linha->pai->dir) linha = linha->pai;
+    return linha->pai;
+}
+
+// Insere uma linha na posição 'indice' (0..total_linhas). Com id < 0 usa o próximo identificador livre.
+Linha* documento_inserir_linha(Documento* doc, int indice, int id, const char* texto, int comprimento) {
+    Linha *antes, *depois;
+    Linha* nova = criar_linha(id < 0 ? doc->proximo_id : id, texto, comprimento);
+    separar_arvore(doc->raiz, indice, &antes, &depois);
+    definir_raiz(doc, mesclar_arvores(mesclar_arvores(antes, nova), depois));
+    doc->total_linhas++;
+    registrar_id(doc, nova);
+    indice_marcar(nova->id);
+    indice_busca.posicoes_validas = 0;
+    return nova;
+}
+
+void documento_remover_linha(Documento* doc, int indice) {
+    Linha *antes, *resto, *alvo, *depois;
+    separar_arvore(doc->raiz, indice, &antes, &resto);
+    separar_arvore(resto, 1, &alvo, &depois);
+    definir_raiz(doc, mesclar_arvores(antes, depois));
+    if (alvo) {
+        doc->por_id[alvo->id] = NULL;
+        doc->total_linhas--;
+        indice_marcar(alvo->id);
+        indice_busca.posicoes_validas = 0;
+        liberar_linha(alvo);
+    }
+}
+
+void documento_alterar_texto(Linha* linha, const char* texto, int comprimento) {
+    if (linha->texto_externo) {
+        linha->texto = NULL;  // O texto mapeado não é do heap: passa a ter cópia própria
+        linha->texto_externo = 0;
+    }
+    linha->texto = realloc(linha->texto, comprimento + 1);
+    memcpy(linha->texto, texto, comprimento);
+    linha->texto[comprimento] = '\0';
+    linha->comprimento = comprimento;
+    linha->revisao++;
+    indice_marcar(linha->id);
+}
+
+// Substitui 'apagar' caracteres a partir de 'posicao' pelo texto dado (limitados à linha)
+void documento_editar_trecho(Linha* linha, int posicao, int apagar, const char* texto, int comprimento) {
+    if (posicao < 0) posicao = 0;
+    if (posicao > linha->comprimento) posicao = linha->comprimento;
+    if (apagar < 0) apagar = 0;
+    if (apagar > linha->comprimento - posicao) apagar = linha->comprimento - posicao;
+
+    materializar_texto(linha);
+    int novo_comprimento = linha->comprimento - apagar + comprimento;
+    int cauda = linha->comprimento - posicao - apagar;
+    if (novo_comprimento > linha->comprimento) {
+        linha->texto = realloc(linha->texto, novo_comprimento + 1);
+    }
+    memmove(linha->texto + posicao + comprimento, linha->texto + posicao + apagar, cauda);
+    memcpy(linha->texto + posicao, texto, comprimento);
+    linha->texto[novo_comprimento] = '\0';
+    linha->comprimento = novo_comprimento;
+    linha->revisao++;
+    indice_marcar(linha->id);
+}
+
+// Divide a linha no deslocamento: o trecho final vira uma nova linha logo abaixo
+Linha* documento_dividir_linha(Documento* doc, int indice, int deslocamento, int id_novo) {
+    Linha* linha = documento_linha(doc, indice);
+    if (!linha) return NULL;
+    if (deslocamento < 0) deslocamento = 0;
+    if (deslocamento > linha->comprimento) deslocamento = linha->comprimento;
+
+    materializar_texto(linha);
+    Linha* nova = documento_inserir_linha(doc, indice + 1, id_novo, linha->texto + deslocamento, linha->comprimento - deslocamento);
+    linha->comprimento = deslocamento;
+    linha->texto[deslocamento] = '\0';
+    linha->revisao++;
+    indice_marcar(linha->id);
+    return nova;
+}
+
+void documento_juntar_linhas(Documento* doc, int indice) {
+    Linha* linha = documento_linha(doc, indice);
+    Linha* seguinte = documento_linha(doc, indice + 1);
+    if (!linha || !seguinte) return;
+
+    materializar_texto(linha);
+    linha->texto = realloc(linha->texto, linha->comprimento + seguinte->comprimento + 1);
+    memcpy(linha->texto + linha->comprimento, seguinte->texto, seguinte->comprimento);
+    linha->comprimento += seguinte->comprimento;
+    linha->texto[linha->comprimento] = '\0';
+    linha->revisao++;
+    indice_marcar(linha->id);
+    documento_remover_linha(doc, indice + 1);
+}
+
+// Monta uma árvore perfeitamente balanceada; a prioridade decresce com a profundidade
+// para manter a propriedade de heap da treap sem rotações
+static Linha* construir_subarvore(Linha** linhas, int inicio, int fim, int profundidade) {
+    if (inicio >= fim) return NULL;
+    int meio = inicio + (fim - inicio) / 2;
+    Linha* no = linhas[meio];
+    no->prioridade = ((unsigned int)(48 - profundidade) << 24) | (prioridade_aleatoria() & 0xFFFFFF);
+    no->esq = construir_subarvore(linhas, inicio, meio, profundidade + 1);
+    no->dir = construir_subarvore(linhas, meio + 1, fim, profundidade + 1);
+    recalcular_no(no);
+    return no;
+}
+
+// Substitui o conteúdo do documento pelas linhas dadas, em ordem, em O(n)
+void documento_construir(Documento* doc, Linha** linhas, int total) {
+    documento_limpar(doc);
+    definir_raiz(doc, construir_subarvore(linhas, 0, total, 0));
+    doc->total_linhas = total;
+    for (int i = 0; i < total; i++) {
+        registrar_id(doc, linhas[i]);
+    }
+}
+
+void documento_limpar(Documento* doc) {
+    for (int i = 0; i < doc->capacidade_ids; i++) {
+        if (doc->por_id[i]) liberar_linha(doc->por_id[i]);
+    }
+    free(doc->por_id);
+    memset(doc, 0, sizeof(Documento));
+    indice_busca.reconstruir = 1;  // O índice só acompanha o documento do mestre: inofensivo nos demais
+}
+
+// Formato serializado: [total_linhas][proximo_id] e, para cada linha em ordem,
+// [id][dono_bloqueio][revisao][comprimento][texto sem '\0'] (inteiros nativos de 4 bytes).
+// Com coordenador >= 0, inclui apenas as linhas daquela partição.
+
+// A própria linha ou a primeira depois dela que pertence à partição (todas com coordenador < 0)
+Linha* linha_da_particao(Linha* linha, int coordenador) {
+    while (linha && coordenador >= 0 && coordenador_da_linha(linha->id) != coordenador) {
+        linha = documento_proxima(linha);
+    }
+    return linha;
+}
+
+// Bytes do estado serializado e quantidade de linhas, sem montá-lo
+int medir_linhas(Documento* doc, int coordenador, int* quantidade) {
+    int total = 2 * sizeof(int);
+    *quantidade = 0;
+    for (Linha* l = linha_da_particao(documento_primeira(doc), coordenador); l;
+         l = linha_da_particao(documento_proxima(l), coordenador)) {
+        total += 4 * sizeof(int) + l->comprimento;
+        (*quantidade)++;
+    }
+    return total;
+}
+
+// Serializa as linhas a partir de *linha até passar de 'limite' bytes; com quantidade >= 0
+// o cabeçalho sai na frente. *linha passa a ser a próxima linha da partição (NULL no fim)
+char* serializar_fatia(Documento* doc, int coordenador, int quantidade, Linha** linha, int limite, int* tamanho) {
+    int total = quantidade >= 0 ? 2 * sizeof(int) : 0;
+    Linha* fim = *linha;
+    while (fim && total < limite) {
+        total += 4 * sizeof(int) + fim->comprimento;
+        fim = linha_da_particao(documento_proxima(fim), coordenador);
+    }
+
+    char* buffer = malloc(total > 0 ? total : 1);
+    char* p = buffer;
+    if (quantidade >= 0) {
+        memcpy(p, &quantidade, sizeof(int)); p += sizeof(int);
+        memcpy(p, &doc->proximo_id, sizeof(int)); p += sizeof(int);
+    }
+    for (Linha* l = *linha; l != fim; l = linha_da_particao(documento_proxima(l), coordenador)) {
+        memcpy(p, &l->id, sizeof(int)); p += sizeof(int);
+        memcpy(p, &l->dono_bloqueio, sizeof(int)); p += sizeof(int);
+        memcpy(p, &l->revisao, sizeof(int)); p += sizeof(int);
+        memcpy(p, &l->comprimento, sizeof(int)); p += sizeof(int);
+        memcpy(p, l->texto, l->comprimento); p += l->comprimento;
+    }
+    *linha = fim;
+    *tamanho = total;
+    return buffer;
+}
+
+static char* serializar_linhas(Documento* doc, int coordenador, int* tamanho) {
+    int quantidade;
+    medir_linhas(doc, coordenador, &quantidade);
+    Linha* primeira = linha_da_particao(documento_primeira(doc), coordenador);
+    return serializar_fatia(doc, coordenador, quantidade, &primeira, INT_MAX, tamanho);
+}
+
+char* serializar_documento(Documento* doc, int* tamanho) {
+    return serializar_linhas(doc, -1, tamanho);
+}
+
+// Serializa só as linhas indicadas, no mesmo formato (aplicado com aplicar_particao).
+// Sem com_bloqueios, grava todas como livres
+char* serializar_selecao(Documento* doc, Linha** linhas, int quantidade, int com_bloqueios, int* tamanho) {
+    int total = 2 * sizeof(int);
+    for (int i = 0; i < quantidade; i++) {
+        total += 4 * sizeof(int) + linhas[i]->comprimento;
+    }
+
+    char* buffer = malloc(total);
+    char* p = buffer;
+    memcpy(p, &quantidade, sizeof(int)); p += sizeof(int);
+    memcpy(p, &doc->proximo_id, sizeof(int)); p += sizeof(int);
+    for (int i = 0; i < quantidade; i++) {
+        Linha* l = linhas[i];
+        int dono = com_bloqueios ? l->dono_bloqueio : -1;
+        memcpy(p, &l->id, sizeof(int)); p += sizeof(int);
+        memcpy(p, &dono, sizeof(int)); p += sizeof(int);
+        memcpy(p, &l->revisao, sizeof(int)); p += sizeof(int);
+        memcpy(p, &l->comprimento, sizeof(int)); p += sizeof(int);
+        memcpy(p, l->texto, l->comprimento); p += l->comprimento;
+    }
+    *tamanho = total;
+    return buffer;
+}
+
+char* serializar_particao(Documento* doc, int coordenador, int* tamanho) {
+    return serializar_linhas(doc, coordenador, tamanho);
+}
+
+// Atualiza texto e bloqueio das linhas de uma partição, localizando cada uma pelo id
+void aplicar_particao(Documento* doc, const char* buffer, int tamanho) {
+    const char* p = buffer;
+    int total;
+    memcpy(&total, p, sizeof(int)); p += 2 * sizeof(int);
+    for (int i = 0; i < total && p < buffer + tamanho; i++) {
+        int id, dono, revisao, comprimento;
+        memcpy(&id, p, sizeof(int)); p += sizeof(int);
+        memcpy(&dono, p, sizeof(int)); p += sizeof(int);
+        memcpy(&revisao, p, sizeof(int)); p += sizeof(int);
+        memcpy(&comprimento, p, sizeof(int)); p += sizeof(int);
+        Linha* linha = documento_por_id(doc, id);
+        if (linha) {
+            documento_alterar_texto(linha, p, comprimento);
+            linha->dono_bloqueio = dono;
+            linha->revisao = revisao;
+        }
+        p += comprimento;
+    }
+}
+
+// Com sem_copia, os textos das linhas apontam direto para o buffer (que deve sobreviver ao documento)
+static void desserializar_linhas(Documento* doc, const char* buffer, int tamanho, int sem_copia) {
+    const char* p = buffer;
+    int total, proximo_id;
+    memcpy(&total, p, sizeof(int)); p += sizeof(int);
+    memcpy(&proximo_id, p, sizeof(int)); p += sizeof(int);
+
+    Linha** linhas = malloc(total * sizeof(Linha*));
+    int lidas = 0;
+    for (int i = 0; i < total && p < buffer + tamanho; i++, lidas++) {
+        int id, dono, revisao, comprimento;
+        memcpy(&id, p, sizeof(int)); p += sizeof(int);
+        memcpy(&dono, p, sizeof(int)); p += sizeof(int);
+        memcpy(&revisao, p, sizeof(int)); p += sizeof(int);
+        memcpy(&comprimento, p, sizeof(int)); p += sizeof(int);
+        if (sem_copia) {
+            linhas[i] = criar_linha_mapeada(id, (char*)p, comprimento);
+        } else {
+            linhas[i] = criar_linha(id, p, comprimento);
+        }
+        linhas[i]->dono_bloqueio = dono;
+        linhas[i]->revisao = revisao;
+        p += comprimento;
+    }
+    documento_construir(doc, linhas, lidas);
+    if (proximo_id > doc->proximo_id) doc->proximo_id = proximo_id;
+    free(linhas);
+}
+
+void desserializar_documento(Documento* doc, const char* buffer, int tamanho) {
+    desserializar_linhas(doc, buffer, tamanho, 0);
+}
+
+void desserializar_documento_mapeado(Documento* doc, char* buffer, int tamanho) {
+    desserializar_linhas(doc, buffer, tamanho, 1);
+}
+
+// ---------------------------------------------------------------------------
+// Importação e exportação de arquivos de texto: o mestre mapeia o arquivo e as linhas
+// apontam direto para o mapeamento; a exportação grava o documento em blocos grandes
+// ---------------------------------------------------------------------------
+
+// Cria as linhas terminadas pelas quebras em [inicio, fim), a primeira com o id dado; 'linha'
+// é o começo da primeira delas, que pode estar antes do bloco
+static void importar_bloco(char* linha, char* inicio, char* fim, int id, Linha** linhas) {
+    char* quebra;
+    while (inicio < fim && (quebra = memchr(inicio, '\n', fim - inicio)) != NULL) {
+        int comprimento = (int)(quebra - linha);
+        if (comprimento > 0 && linha[comprimento - 1] == '\r') comprimento--;  // Fim de linha CRLF
+        linhas[id] = criar_linha_mapeada(id, linha, comprimento);
+        id++;
+        linha = inicio = quebra + 1;
+    }
+}
+
+// Substitui o documento pelas linhas do arquivo. O arquivo é mapeado em memória e dividido em
+// blocos, um por thread: cada uma conta as quebras do seu (memchr vetorizado da glibc) e, com
+// a posição da primeira linha do bloco, cria as linhas sem copiar os textos
+int importar_documento(const char* caminho) {
+    double inicio_importacao = MPI_Wtime();
+    int fd = open(caminho, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        fprintf(stderr, "Erro: não foi possível abrir %s para importar\n", caminho);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    size_t tamanho = info.st_size;
+    char* base = tamanho > 0 ? mmap(NULL, tamanho, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);  // O mapeamento continua válido sem o descritor
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Erro: não foi possível mapear %s\n", caminho);
+        return 0;
+    }
+    if (tamanho > 0) madvise(base, tamanho, MADV_WILLNEED);  // Leitura antecipada de todo o arquivo
+
+    // Passo 1: quebras de linha de cada bloco, somadas em prefixo
+    int num_blocos = tamanho >= BLOCO_MINIMO_IMPORTACAO * 2 ? omp_get_max_threads() : 1;
+    long* antes = calloc(num_blocos + 1, sizeof(long));
+    char** comeco = calloc(num_blocos + 1, sizeof(char*));  // Começo da linha que segue a última quebra do bloco
+    #pragma omp parallel for schedule(static, 1)
+    for (int b = 0; b < num_blocos; b++) {
+        char* p = base + tamanho * b / num_blocos;
+        char* fim = base + tamanho * (b + 1) / num_blocos;
+        long quebras = 0;
+        while (p < fim && (p = memchr(p, '\n', fim - p)) != NULL) {
+            quebras++;
+            comeco[b + 1] = ++p;
+        }
+        antes[b + 1] = quebras;
+    }
+    // A primeira linha de um bloco começa depois da última quebra dos blocos anteriores
+    comeco[0] = base;
+    for (int b = 0; b < num_blocos; b++) {
+        antes[b + 1] += antes[b];
+        if (!comeco[b + 1]) comeco[b + 1] = comeco[b];
+    }
+    int ultima_sem_quebra = tamanho == 0 || base[tamanho - 1] != '\n';
+    long total = antes[num_blocos] + ultima_sem_quebra;
+
+    // O documento inicial é difundido e gravado no snapshot serializado, limitado a 2 GiB
+    if ((double)tamanho + total * 4.0 * sizeof(int) + 2 * sizeof(int) > INT_MAX) {
+        fprintf(stderr, "Erro: %s é grande demais para importar (%ld linhas, %zu bytes)\n", caminho, total, tamanho);
+        free(antes);
+        free(comeco);
+        if (base) munmap(base, tamanho);
+        return 0;
+    }
+
+    // Passo 2: a mesma divisão cria as linhas
+    Linha** linhas = malloc(total * sizeof(Linha*));
+    #pragma omp parallel for schedule(static, 1)
+    for (int b = 0; b < num_blocos; b++) {
+        importar_bloco(comeco[b], base + tamanho * b / num_blocos, base + tamanho * (b + 1) / num_blocos,
+                       (int)antes[b], linhas);
+    }
+    if (ultima_sem_quebra) {
+        char* linha = tamanho > 0 ? comeco[num_blocos] : "";
+        int comprimento = tamanho > 0 ? (int)(base + tamanho - linha) : 0;
+        linhas[total - 1] = criar_linha_mapeada((int)total - 1, linha, comprimento);
+    }
+    documento_construir(&documento, linhas, (int)total);
+    free(linhas);
+    free(antes);
+    free(comeco);
+
+    if (arquivo_importado.base) munmap(arquivo_importado.base, arquivo_importado.tamanho);
+    arquivo_importado.base = base;
+    arquivo_importado.tamanho = tamanho;
+    if (verbosidade >= VERBOSIDADE_EVENTOS) {
+        printf("[MESTRE] Importadas %ld linhas de %s (%.1f MB) em %.3f s com %d blocos.\n", total, caminho,
+               tamanho / 1048576.0, MPI_Wtime() - inicio_importacao, num_blocos);
+    }
+    return 1;
+}
+
+void liberar_importacao() {
+    if (arquivo_importado.base) munmap(arquivo_importado.base, arquivo_importado.tamanho);
+    memset(&arquivo_importado, 0, sizeof(arquivo_importado));
+}
+
+typedef struct {
+    int fd;
+    char* buffer;
+    size_t usado;
+    int erro;
+} EscritaEmBloco;
+
+static void escrita_esvaziar(EscritaEmBloco* escrita, const char* dados, size_t tamanho) {
+    while (tamanho > 0 && !escrita->erro) {
+        ssize_t escritos = write(escrita->fd, dados, tamanho);
+        if (escritos < 0) {
+            escrita->erro = 1;
+            break;
+        }
+        dados += escritos;
+        tamanho -= escritos;
+    }
+}
+
+// Acumula no buffer e grava quando ele enche; textos maiores que o buffer vão direto
+static void escrita_acrescentar(EscritaEmBloco* escrita, const char* dados, size_t tamanho) {
+    if (escrita->usado + tamanho > BUFFER_EXPORTACAO) {
+        escrita_esvaziar(escrita, escrita->buffer, escrita->usado);
+        escrita->usado = 0;
+    }
+    if (tamanho >= BUFFER_EXPORTACAO) {
+        escrita_esvaziar(escrita, dados, tamanho);
+        return;
+    }
+    memcpy(escrita->buffer + escrita->usado, dados, tamanho);
+    escrita->usado += tamanho;
+}
+
+// Grava o documento em uso como texto, uma linha por linha do documento. A réplica própria é
+// percorrida sem cópias (o estado visto é o de um único instante); na réplica compartilhada,
+// as linhas são lidas da janela do nó em blocos. Retorna as linhas gravadas, ou -1
+int exportar_documento(const char* caminho) {
+    EscritaEmBloco escrita = { .fd = open(caminho, O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+    if (escrita.fd < 0) return -1;
+    escrita.buffer = malloc(BUFFER_EXPORTACAO);
+    int gravadas = 0;
+    if (!replica_no.cabecalho) {
+        pthread_mutex_lock(&progresso.mutex);
+        for (Linha* linha = documento_primeira(&documento); linha && !escrita.erro; linha = documento_proxima(linha)) {
+            escrita_acrescentar(&escrita, linha->texto, linha->comprimento);
+            escrita_acrescentar(&escrita, "\n", 1);
+            gravadas++;
+        }
+        pthread_mutex_unlock(&progresso.mutex);
+    } else {
+        LinhaLida* lidas = malloc(LINHAS_POR_LEITURA_EXPORTACAO * sizeof(LinhaLida));
+        int quantidade;
+        while (!escrita.erro &&
+               (quantidade = replica_ler(gravadas, LINHAS_POR_LEITURA_EXPORTACAO, lidas, TEXTO_INTEIRO)) > 0) {
+            for (int i = 0; i < quantidade; i++) {
+                escrita_acrescentar(&escrita, lidas[i].texto, lidas[i].comprimento);
+                escrita_acrescentar(&escrita, "\n", 1);
+            }
+            replica_liberar(lidas, quantidade);
+            gravadas += quantidade;
+        }
+        free(lidas);
+    }
+    escrita_esvaziar(&escrita, escrita.buffer, escrita.usado);
+    free(escrita.buffer);
+    if (close(escrita.fd) < 0) escrita.erro = 1;
+    return escrita.erro ? -1 : gravadas;
+}
+
+static uint64_t fnv1a_64(uint64_t hash, const void* dados, int tamanho) {
+    for (int i = 0; i < tamanho; i++) {
+        hash = (hash ^ ((const unsigned char*)dados)[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// FNV-1a de 64 bits do documento em uso: id, bloqueio e texto de cada linha, em ordem
+uint64_t hash_documento() {
+    uint64_t hash = 14695981039346656037ULL;
+    LinhaLida* lidas = malloc(LINHAS_POR_LEITURA_EXPORTACAO * sizeof(LinhaLida));
+    int total = 0;
+    int quantidade;
+    while ((quantidade = replica_ler(total, LINHAS_POR_LEITURA_EXPORTACAO, lidas, TEXTO_INTEIRO)) > 0) {
+        for (int i = 0; i < quantidade; i++) {
+            hash = fnv1a_64(hash, &lidas[i].id, sizeof(int));
+            hash = fnv1a_64(hash, &lidas[i].dono_bloqueio, sizeof(int));
+            hash = fnv1a_64(hash, &lidas[i].comprimento, sizeof(int));
+            if (lidas[i].texto) hash = fnv1a_64(hash, lidas[i].texto, lidas[i].comprimento);
+        }
+        replica_liberar(lidas, quantidade);
+        total += quantidade;
+    }
+    free(lidas);
+    return hash;
+}
+
+// ---------------------------------------------------------------------------
+// Journal de edições: o loop do coordenador apenas enfileira registros num anel
+// em memória; uma thread dedicada grava em lote (group commit) num arquivo que
+// fica aberto durante toda a sessão e aplica a política de fsync configurada.
+// ---------------------------------------------------------------------------
+
+// Texto da ação registrada para cada tipo de operação (formato legível)
+static const char* acao_operacao(int tipo) {
+    switch (tipo) {
+        case ATUALIZACAO_INSERIR: return "inseriu";
+        case ATUALIZACAO_REMOVER: return "removeu";
+        case ATUALIZACAO_DIVIDIR: return "dividiu";
+        case ATUALIZACAO_JUNTAR:  return "juntou com a seguinte";
+    }
+    return "alterou";
+}
+
+// Escreve um registro no formato legível do antigo log_editor.txt
+static void formatar_registro_texto(FILE* saida, const RegistroJournal* reg, const char* texto) {
+    time_t instante = (time_t)reg->timestamp;
+    struct tm t;
+    char timestamp[20];
+    localtime_r(&instante, &t);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &t);
+    if (reg->tipo == ATUALIZACAO_TEXTO) {
+        fprintf(saida, "[%s] [Usuario_%d] editou a linha %d: \"%.*s\"\n", timestamp, reg->rank, reg->linha, reg->comprimento, texto);
+    } else if (reg->tipo == ATUALIZACAO_LOTE) {
+        // O texto está no formato serializado: [total][proximo_id] e, por linha,
+        // [id][dono][revisao][comprimento][texto]
+        const char* p = texto;
+        int total;
+        memcpy(&total, p, sizeof(int)); p += 2 * sizeof(int);
+        fprintf(saida, "[%s] [Usuario_%d] editou %d linhas em lote a partir da linha %d:\n", timestamp, reg->rank, total, reg->linha);
+        for (int i = 0; i < total && p < texto + reg->comprimento; i++) {
+            int comprimento;
+            memcpy(&comprimento, p + 3 * sizeof(int), sizeof(int)); p += 4 * sizeof(int);
+            fprintf(saida, "    \"%.*s\"\n", comprimento, p);
+            p += comprimento;
+        }
+    } else {
+        fprintf(saida, "[%s] [Usuario_%d] %s a linha %d\n", timestamp, reg->rank, acao_operacao(reg->tipo), reg->linha);
+    }
+}
+
+static void* thread_journal(void* arg) {
+    (void)arg;
+    struct timespec ultimo_fsync;
+    clock_gettime(CLOCK_MONOTONIC, &ultimo_fsync);
+
+    pthread_mutex_lock(&journal.mutex);
+    while (1) {
+        while (journal.inicio == journal.fim && !journal.encerrar) {
+            pthread_cond_wait(&journal.nao_vazio, &journal.mutex);
+        }
+        int inicio = journal.inicio, fim = journal.fim;
+        int encerrar = journal.encerrar;
+        pthread_mutex_unlock(&journal.mutex);
+
+        // Grava todo o lote pendente de uma vez; o produtor nunca toca nesses slots. Cada
+        // registro vai ao journal do seu documento
+        FILE* gravados[MAX_DOCUMENTOS];
+        int num_gravados = 0;
+        for (int i = inicio; i != fim; i = (i + 1) % CAPACIDADE_JOURNAL) {
+            EntradaJournal* e = &journal.anel[i];
+            if (formato_log == FORMATO_LOG_TEXTO) {
+                formatar_registro_texto(e->arquivo, &e->reg, e->texto);
+            } else {
+                fwrite(&e->reg, sizeof(RegistroJournal), 1, e->arquivo);
+                fwrite(e->texto, 1, e->reg.comprimento, e->arquivo);
+            }
+            free(e->texto);
+            int visto = 0;
+            for (int j = 0; j < num_gravados && !visto; j++) {
+                visto = gravados[j] == e->arquivo;
+            }
+            if (!visto && num_gravados < MAX_DOCUMENTOS) {
+                gravados[num_gravados++] = e->arquivo;
+            }
+        }
+        if (inicio != fim) {
+            struct timespec agora;
+            clock_gettime(CLOCK_MONOTONIC, &agora);
+            long decorrido_ms = (agora.tv_sec - ultimo_fsync.tv_sec) * 1000 + (agora.tv_nsec - ultimo_fsync.tv_nsec) / 1000000;
+            int sincronizar = politica_fsync == FSYNC_SEMPRE || (politica_fsync == FSYNC_PERIODICO && decorrido_ms >= INTERVALO_FSYNC_MS);
+            for (int j = 0; j < num_gravados; j++) {
+                fflush(gravados[j]);
+                if (sincronizar) fsync(fileno(gravados[j]));
+            }
+            if (sincronizar) ultimo_fsync = agora;
+        }
+
+        pthread_mutex_lock(&journal.mutex);
+        journal.inicio = fim;
+        pthread_cond_broadcast(&journal.nao_cheio);
+        if (encerrar && journal.inicio == journal.fim) break;
+    }
+    pthread_mutex_unlock(&journal.mutex);
+    return NULL;
+}
+
+// Abre o arquivo do journal (truncando a sessão anterior) e inicia a thread gravadora
+void journal_iniciar(const char* caminho) {
+    journal.arquivo = fopen(caminho, formato_log == FORMATO_LOG_TEXTO ? "w" : "wb");
+    if (!journal.arquivo) {
+        fprintf(stderr, "Erro: não foi possível abrir o journal %s\n", caminho);
+        return;
+    }
+    setvbuf(journal.arquivo, NULL, _IOFBF, 1 << 16);
+    if (formato_log == FORMATO_LOG_BINARIO) {
+        fwrite(MAGICO_JOURNAL, 1, 4, journal.arquivo);
+    }
+    journal.destino = journal.arquivo;
+    pthread_mutex_init(&journal.mutex, NULL);
+    pthread_cond_init(&journal.nao_vazio, NULL);
+    pthread_cond_init(&journal.nao_cheio, NULL);
+    journal.inicio = journal.fim = journal.encerrar = 0;
+    pthread_create(&journal.thread, NULL, thread_journal, NULL);
+    journal.ativo = 1;
+}
+
+// Enfileira um registro; só bloqueia se o anel estiver cheio (o disco não acompanha)
+void journal_registrar(const Atualizacao* at, int rank_usuario, int linha, const char* texto, int comprimento) {
+    if (!journal.ativo || !journal.destino) return;
+    EntradaJournal entrada;
+    memset(&entrada.reg, 0, sizeof(RegistroJournal));
+    entrada.reg.tipo = at->tipo;
+    entrada.reg.versao = at->versao;
+    entrada.reg.rank = rank_usuario;
+    entrada.reg.linha = linha;
+    entrada.reg.id = at->id;
+    entrada.reg.id_novo = at->id_novo;
+    entrada.reg.deslocamento = at->deslocamento;
+    entrada.reg.comprimento = comprimento;
+    entrada.reg.timestamp = (int64_t)time(NULL);
+    entrada.texto = malloc(comprimento + 1);
+    memcpy(entrada.texto, texto, comprimento);
+    entrada.arquivo = journal.destino;
+
+    pthread_mutex_lock(&journal.mutex);
+    while ((journal.fim + 1) % CAPACIDADE_JOURNAL == journal.inicio) {
+        pthread_cond_wait(&journal.nao_cheio, &journal.mutex);
+    }
+    journal.anel[journal.fim] = entrada;
+    journal.fim = (journal.fim + 1) % CAPACIDADE_JOURNAL;
+    pthread_cond_signal(&journal.nao_vazio);
+    pthread_mutex_unlock(&journal.mutex);
+}
+
+// Drena o anel, força os dados para o disco e encerra a thread gravadora
+void journal_finalizar() {
+    if (!journal.ativo) return;
+    pthread_mutex_lock(&journal.mutex);
+    journal.encerrar = 1;
+    pthread_cond_signal(&journal.nao_vazio);
+    pthread_mutex_unlock(&journal.mutex);
+    pthread_join(journal.thread, NULL);
+
+    fflush(journal.arquivo);
+    if (politica_fsync != FSYNC_NUNCA) {
+        fsync(fileno(journal.arquivo));
+    }
+    fclose(journal.arquivo);
+    journal.ativo = 0;
+}
+
+// Converte um journal binário para o formato legível (o mesmo do antigo log_editor.txt)
+int exportar_journal(const char* caminho, FILE* saida) {
+    FILE* entrada = fopen(caminho, "rb");
+    if (!entrada) {
+        fprintf(stderr, "Erro: não foi possível abrir %s\n", caminho);
+        return 1;
+    }
+    char magico[4];
+    if (fread(magico, 1, 4, entrada) != 4 || memcmp(magico, MAGICO_JOURNAL, 4) != 0) {
+        fprintf(stderr, "Erro: %s não é um journal binário do editor\n", caminho);
+        fclose(entrada);
+        return 1;
+    }
+
+    RegistroJournal reg;
+    char* texto = NULL;
+    while (fread(&reg, sizeof(RegistroJournal), 1, entrada) == 1) {
+        texto = realloc(texto, reg.comprimento + 1);
+        if (fread(texto, 1, reg.comprimento, entrada) != (size_t)reg.comprimento) break;  // Registro truncado
+        formatar_registro_texto(saida, &reg, texto);
+    }
+    free(texto);
+    fclose(entrada);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Snapshots: o documento serializado (mesmo formato da sincronização MPI) é gravado
+// com um pequeno cabeçalho e pode ser mapeado em memória na inicialização. O journal
+// gravado depois do snapshot é reaplicado para retomar exatamente o estado anterior.
+// Layout: [MAGICO_SNAPSHOT][num_versoes][versoes...][tamanho_documento][documento serializado]
+// ---------------------------------------------------------------------------
+
+// Mapeia o snapshot e localiza o cabeçalho e o documento serializado dentro do mapa
+int carregar_snapshot(const char* caminho, SnapshotMapeado* snap) {
+    memset(snap, 0, sizeof(SnapshotMapeado));
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size < 12) {
+        close(fd);
+        return 0;
+    }
+    char* base = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);  // O mapeamento continua válido sem o descritor
+    if (base == MAP_FAILED) return 0;
+
+    snap->base = base;
+    snap->tamanho_arquivo = info.st_size;
+    const char* p = base + 4;
+    memcpy(&snap->num_versoes, p, sizeof(int)); p += sizeof(int);
+    long necessario = 4 + (2L + snap->num_versoes) * sizeof(int);
+    if (memcmp(base, MAGICO_SNAPSHOT, 4) != 0 || snap->num_versoes < 1 || necessario > info.st_size) {
+        fprintf(stderr, "Erro: %s não é um snapshot válido\n", caminho);
+        liberar_snapshot(snap);
+        return 0;
+    }
+    snap->versoes = malloc(snap->num_versoes * sizeof(int));
+    memcpy(snap->versoes, p, snap->num_versoes * sizeof(int)); p += snap->num_versoes * sizeof(int);
+    memcpy(&snap->tamanho_documento, p, sizeof(int)); p += sizeof(int);
+    snap->documento = (char*)p;
+    if (snap->documento + snap->tamanho_documento > base + info.st_size) {
+        fprintf(stderr, "Erro: snapshot %s truncado\n", caminho);
+        liberar_snapshot(snap);
+        return 0;
+    }
+    return 1;
+}
+
+void liberar_snapshot(SnapshotMapeado* snap) {
+    if (snap->base) munmap(snap->base, snap->tamanho_arquivo);
+    free(snap->versoes);
+    memset(snap, 0, sizeof(SnapshotMapeado));
+}
+
+// Grava em arquivo temporário, força para o disco e renomeia: o snapshot antigo
+// só é substituído quando o novo está completo
+static int escrever_snapshot(const char* serializado, int tamanho, const int* versoes, int num_versoes) {
+    char temporario[80];
+    snprintf(temporario, sizeof(temporario), "%s.tmp", ARQUIVO_SNAPSHOT);
+    FILE* f = fopen(temporario, "wb");
+    if (!f) {
+        fprintf(stderr, "Erro: não foi possível gravar %s\n", temporario);
+        return 0;
+    }
+    fwrite(MAGICO_SNAPSHOT, 1, 4, f);
+    fwrite(&num_versoes, sizeof(int), 1, f);
+    fwrite(versoes, sizeof(int), num_versoes, f);
+    fwrite(&tamanho, sizeof(int), 1, f);
+    fwrite(serializado, 1, tamanho, f);
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+    return rename(temporario, ARQUIVO_SNAPSHOT) == 0;
+}
+
+// Grava um snapshot do documento atual, bloqueando até terminar
+int gravar_snapshot() {
+    int tamanho;
+    char* serializado = serializar_documento(&documento, &tamanho);
+    int ok = escrever_snapshot(serializado, tamanho, versao_coordenador, num_coordenadores);
+    free(serializado);
+    return ok;
+}
+
+typedef struct {
+    char* serializado;
+    int tamanho;
+    int* versoes;
+} TarefaSnapshot;
+
+static void* thread_snapshot(void* arg) {
+    TarefaSnapshot* tarefa = arg;
+    escrever_snapshot(tarefa->serializado, tarefa->tamanho, tarefa->versoes, num_coordenadores);
+    free(tarefa->serializado);
+    free(tarefa->versoes);
+    free(tarefa);
+    __atomic_store_n(&snapshot_periodico.em_andamento, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Snapshot periódico: a serialização (cópia em memória) é feita no loop do mestre para
+// capturar um estado consistente; a gravação e o fsync ficam numa thread à parte
+void iniciar_snapshot_periodico() {
+    if (snapshot_periodico.thread_ativa) {
+        if (__atomic_load_n(&snapshot_periodico.em_andamento, __ATOMIC_ACQUIRE)) return;  // Anterior ainda gravando
+        pthread_join(snapshot_periodico.thread, NULL);
+        snapshot_periodico.thread_ativa = 0;
+    }
+    TarefaSnapshot* tarefa = malloc(sizeof(TarefaSnapshot));
+    tarefa->serializado = serializar_documento(&documento, &tarefa->tamanho);
+    tarefa->versoes = malloc(num_coordenadores * sizeof(int));
+    memcpy(tarefa->versoes, versao_coordenador, num_coordenadores * sizeof(int));
+
+    snapshot_periodico.em_andamento = 1;
+    snapshot_periodico.atualizacoes_desde_ultimo = 0;
+    pthread_create(&snapshot_periodico.thread, NULL, thread_snapshot, tarefa);
+    snapshot_periodico.thread_ativa = 1;
+}
+
+void finalizar_snapshot_periodico() {
+    if (snapshot_periodico.thread_ativa) {
+        pthread_join(snapshot_periodico.thread, NULL);
+        snapshot_periodico.thread_ativa = 0;
+    }
+}
+
+// Reaplica os registros de um journal binário posteriores à versão do snapshot.
+// Retorna quantos registros foram aplicados e a última versão encontrada.
+static int reproduzir_journal(const char* caminho, int versao_snapshot, int* ultima_versao) {
+    FILE* entrada = fopen(caminho, "rb");
+    if (!entrada) return 0;
+    char magico[4];
+    if (fread(magico, 1, 4, entrada) != 4 || memcmp(magico, MAGICO_JOURNAL, 4) != 0) {
+        fclose(entrada);
+        return 0;
+    }
+
+    RegistroJournal reg;
+    int aplicados = 0;
+    while (fread(&reg, sizeof(RegistroJournal), 1, entrada) == 1) {
+        Atualizacao* at = calloc(1, sizeof(Atualizacao) + reg.comprimento);
+        if (fread(at->texto, 1, reg.comprimento, entrada) != (size_t)reg.comprimento) {
+            free(at);  // Registro truncado pela queda: é o fim do journal
+            break;
+        }
+        if (reg.versao > versao_snapshot) {
+            at->tipo = reg.tipo;
+            at->versao = reg.versao;
+            at->linha = reg.linha;
+            at->id = reg.id;
+            at->id_novo = reg.id_novo;
+            at->deslocamento = reg.deslocamento;
+            at->comprimento = reg.comprimento;
+            at->dono_bloqueio = -1;
+            aplicar_atualizacao(at);
+            aplicados++;
+        }
+        if (reg.versao > *ultima_versao) *ultima_versao = reg.versao;
+        free(at);
+    }
+    fclose(entrada);
+    return aplicados;
+}
+
+// Retoma a sessão anterior: mapeia o snapshot (os textos das linhas apontam direto
+// para o mapa, sem cópia) e reaplica os journals de todos os coordenadores.
+// Retorna 0 se não há snapshot. Em *snapshot_em_dia indica se o arquivo já
+// corresponde ao estado retomado e pode ser difundido sem regravação.
+int retomar_sessao(int* snapshot_em_dia) {
+    if (!carregar_snapshot(ARQUIVO_SNAPSHOT, &snapshot_sessao)) return 0;
+
+    desserializar_documento_mapeado(&documento, snapshot_sessao.documento, snapshot_sessao.tamanho_documento);
+    for (Linha* l = documento_primeira(&documento); l; l = documento_proxima(l)) {
+        l->dono_bloqueio = -1;  // Bloqueios não sobrevivem ao reinício
+    }
+
+    // Os journals da sessão anterior seguem a quantidade de coordenadores gravada no snapshot
+    int aplicados = 0;
+    int* ultimas = calloc(snapshot_sessao.num_versoes, sizeof(int));
+    for (int c = 0; c < snapshot_sessao.num_versoes; c++) {
+        char caminho[64];
+        if (c == MASTER) {
+            strcpy(caminho, "journal_editor.bin");
+        } else {
+            sprintf(caminho, "journal_editor_%d.bin", c);
+        }
+        ultimas[c] = snapshot_sessao.versoes[c];
+        aplicados += reproduzir_journal(caminho, snapshot_sessao.versoes[c], &ultimas[c]);
+    }
+
+    // Com a mesma quantidade de coordenadores as sequências de versão continuam
+    if (snapshot_sessao.num_versoes == num_coordenadores) {
+        memcpy(versao_coordenador, ultimas, num_coordenadores * sizeof(int));
+    }
+    *snapshot_em_dia = aplicados == 0 && snapshot_sessao.num_versoes == num_coordenadores;
+    if (verbosidade >= VERBOSIDADE_EVENTOS) {
+        printf("[MESTRE] Sessão retomada: %d linhas, %d operações reaplicadas do journal.\n",
+               documento.total_linhas, aplicados);
+    }
+    free(ultimas);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Tratadores do coordenador (--tratadores=N)
+// ---------------------------------------------------------------------------
+
+// Sem tratadores o loop é a única thread que mexe no documento e as travas não fazem nada
+static void travar_documento(int exclusivo) {
+    if (tratadores.num == 0) return;
+    if (exclusivo) {
+        pthread_rwlock_wrlock(&tratadores.documento);
+    } else {
+        pthread_rwlock_rdlock(&tratadores.documento);
+    }
+}
+
+static void destravar_documento() {
+    if (tratadores.num == 0) return;
+    pthread_rwlock_unlock(&tratadores.documento);
+}
+
+// Faixa de bloqueios que basta travar para tratar o quadro junto com os de outras linhas:
+// FAIXAS_BLOQUEIO = nenhuma (a renovação trava uma faixa de cada vez), -1 = só sozinho,
+// com a trava de escrita. Quadros que mudam a estrutura, tocam várias linhas ou estado
+// compartilhado (lotes, trechos, busca, chat, documentos) e os de outro documento são -1
+static int faixa_do_quadro(int remetente, const Quadro* quadro) {
+    if (rank_global == rank_mestre && documentos.do_remetente[remetente] != DOCUMENTO_PRINCIPAL) return -1;
+    const int* campos = (const int*)CORPO_QUADRO(quadro);
+    switch (quadro->tipo) {
+        case QUADRO_PEDIDO_BLOQUEIO:
+            return quadro->comprimento >= 4 * (int)sizeof(int) ? (int)FAIXA_DA_LINHA(campos[1]) : -1;
+        case QUADRO_TEXTO:
+        case QUADRO_EDICAO_DIRETA:
+            return quadro->comprimento >= (int)sizeof(EnvioTexto) ? (int)FAIXA_DA_LINHA(((const EnvioTexto*)campos)->id) : -1;
+        case QUADRO_RENOVAR_BLOQUEIO:
+            return FAIXAS_BLOQUEIO;
+        default:
+            return -1;
+    }
+}
+
+// Trata quadro a quadro um pacote de pedidos de um trabalhador (ou de outro coordenador)
+// e libera o pacote. Com tratadores, cada quadro segura só as travas que precisa
+static void tratar_pacote(int remetente, char* pacote, int tamanho) {
+    BlocoMetricas* bloco = metricas_locais();
+    int posicao = 0;
+    const Quadro* quadro;
+    while ((quadro = proximo_quadro(pacote, tamanho, &posicao)) != NULL) {
+        int tipo = quadro->tipo < NUM_TIPOS_QUADRO ? quadro->tipo : 0;
+        int64_t inicio_tratador = instante_ns(CLOCK_MONOTONIC);
+        int faixa = tratadores.num > 0 ? faixa_do_quadro(remetente, quadro) : -1;
+        if (faixa >= 0) {
+            travar_documento(0);
+            if (documentos.carregado != DOCUMENTO_PRINCIPAL || documento_ativo != DOCUMENTO_PRINCIPAL) {
+                destravar_documento();  // Outro documento carregado: não dá para tratar em paralelo
+                faixa = -1;
+            }
+        }
+        if (faixa < 0) {
+            travar_documento(1);
+        } else if (faixa < FAIXAS_BLOQUEIO) {
+            pthread_mutex_lock(&tratadores.travas_faixas[faixa]);
+        }
+        int saiu = tratar_quadro(remetente, quadro);
+        if (faixa >= 0 && faixa < FAIXAS_BLOQUEIO) {
+            pthread_mutex_unlock(&tratadores.travas_faixas[faixa]);
+        }
+        if (faixa < 0 && tratadores.num > 0 && documento_ativo != DOCUMENTO_PRINCIPAL) {
+            documento_ativar(DOCUMENTO_PRINCIPAL);  // Deixa o principal carregado para os quadros em paralelo
+        }
+        destravar_documento();
+        if (saiu) {
+            __atomic_sub_fetch(&tratadores.trabalhadores_ativos, 1, __ATOMIC_SEQ_CST);
+        }
+        metrica_tempo(&bloco->tratador[tipo], instante_ns(CLOCK_MONOTONIC) - inicio_tratador);
+        metrica_somar(&bloco->quadros[tipo], 1);
+    }
+    free(pacote);
+    // As respostas não esperam o lote de deltas: há um usuário aguardando cada uma. Os
+    // quadros do pacote foram respondidos juntos, em uma mensagem por destino
+    correio_despachar();
+}
+
+static void* thread_tratador(void* arg) {
+    FilaTratador* fila = (FilaTratador*)arg;
+    pthread_mutex_lock(&fila->mutex);
+    while (1) {
+        while (!fila->primeiro && !tratadores.encerrar) {
+            pthread_cond_wait(&fila->sinal, &fila->mutex);
+        }
+        PacoteRecebido* recebido = fila->primeiro;
+        if (!recebido) break;  // Encerrando e sem pacotes pendentes
+        fila->primeiro = recebido->proximo;
+        if (!fila->primeiro) fila->ultimo = NULL;
+        int vazia = fila->primeiro == NULL;
+        pthread_mutex_unlock(&fila->mutex);
+
+        tratar_pacote(recebido->remetente, recebido->dados, recebido->tamanho);
+        free(recebido);
+        if (vazia) {
+            // Fila vazia: os deltas acumulados não esperam a próxima volta do loop
+            travar_documento(0);
+            difusao_despachar();
+            destravar_documento();
+        }
+        pthread_mutex_lock(&fila->mutex);
+    }
+    pthread_mutex_unlock(&fila->mutex);
+    return NULL;
+}
+
+// Envia os pacotes de deltas na ordem em que os tratadores os fecharam
+static void* thread_difusao(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&tratadores.difusao_mutex);
+    while (1) {
+        while (!tratadores.primeira && !tratadores.encerrar_difusao) {
+            pthread_cond_wait(&tratadores.difusao_sinal, &tratadores.difusao_mutex);
+        }
+        DifusaoPendente* pendente = tratadores.primeira;
+        if (!pendente) break;
+        tratadores.primeira = pendente->proximo;
+        if (!tratadores.primeira) tratadores.ultima = NULL;
+        pthread_mutex_unlock(&tratadores.difusao_mutex);
+
+        enviar_sem_bloquear(pendente->dados, pendente->tamanho, pendente->destinos, pendente->num_destinos, TAG_ATUALIZACAO);
+        free(pendente->destinos);
+        free(pendente);
+        pthread_mutex_lock(&tratadores.difusao_mutex);
+    }
+    pthread_mutex_unlock(&tratadores.difusao_mutex);
+    return NULL;
+}
+
+// Cria a thread de difusão e os tratadores. Sem threads, o loop trata tudo sozinho
+static void tratadores_iniciar() {
+    for (int f = 0; f < FAIXAS_BLOQUEIO; f++) {
+        pthread_mutex_init(&tratadores.travas_faixas[f], NULL);
+    }
+    tratadores.trabalhadores_ativos = reservas.primeira - num_coordenadores;  // Cada usuário avisa também as reservas
+    if (tratadores.num == 0) return;
+
+    // Escritor primeiro: com os tratadores sempre lendo, a manutenção do loop nunca entraria
+    pthread_rwlockattr_t atributos;
+    pthread_rwlockattr_init(&atributos);
+    pthread_rwlockattr_setkind_np(&atributos, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&tratadores.documento, &atributos);
+    pthread_rwlockattr_destroy(&atributos);
+
+    if (pthread_create(&tratadores.thread_difusao, NULL, thread_difusao, NULL) != 0) {
+        fprintf(stderr, "Erro: não foi possível criar a thread de difusão; %s tratará os pedidos sozinho.\n", nome_processo);
+        tratadores.num = 0;
+        return;
+    }
+    tratadores.filas = calloc(tratadores.num, sizeof(FilaTratador));
+    for (int i = 0; i < tratadores.num; i++) {
+        FilaTratador* fila = &tratadores.filas[i];
+        pthread_mutex_init(&fila->mutex, NULL);
+        pthread_cond_init(&fila->sinal, NULL);
+        if (pthread_create(&fila->thread, NULL, thread_tratador, fila) != 0) {
+            fprintf(stderr, "Erro: %s criou só %d de %d tratadores.\n", nome_processo, i, tratadores.num);
+            if (i == 0) {
+                // Nenhum tratador: a difusão volta para o loop
+                pthread_mutex_lock(&tratadores.difusao_mutex);
+                tratadores.encerrar_difusao = 1;
+                pthread_cond_signal(&tratadores.difusao_sinal);
+                pthread_mutex_unlock(&tratadores.difusao_mutex);
+                pthread_join(tratadores.thread_difusao, NULL);
+            }
+            tratadores.num = i;
+            break;
+        }
+    }
+    if (verbosidade >= VERBOSIDADE_EVENTOS && tratadores.num > 0) {
+        printf("[%s] %d tratadores de pedidos em paralelo.\n", nome_processo, tratadores.num);
+    }
+}
+
+// Os tratadores terminam os pacotes já recebidos e a difusão envia os deltas que restam;
+// depois disso o loop volta a fazer tudo sozinho
+static void tratadores_finalizar() {
+    if (tratadores.num == 0) return;
+    for (int i = 0; i < tratadores.num; i++) {
+        pthread_mutex_lock(&tratadores.filas[i].mutex);
+        tratadores.encerrar = 1;
+        pthread_cond_signal(&tratadores.filas[i].sinal);
+        pthread_mutex_unlock(&tratadores.filas[i].mutex);
+    }
+    for (int i = 0; i < tratadores.num; i++) {
+        pthread_join(tratadores.filas[i].thread, NULL);
+        pthread_mutex_destroy(&tratadores.filas[i].mutex);
+        pthread_cond_destroy(&tratadores.filas[i].sinal);
+    }
+    free(tratadores.filas);
+    tratadores.filas = NULL;
+
+    documento_ativar(DOCUMENTO_PRINCIPAL);
+    difusao_despachar();
+    pthread_mutex_lock(&tratadores.difusao_mutex);
+    tratadores.encerrar_difusao = 1;
+    pthread_cond_signal(&tratadores.difusao_sinal);
+    pthread_mutex_unlock(&tratadores.difusao_mutex);
+    pthread_join(tratadores.thread_difusao, NULL);
+    tratadores.num = 0;
+}
+
+// Loop principal do processo mestre - coordena todas as operações colaborativas
+void loop_mestre() {
+    MPI_Status status;
+    
+    MPI_Request requests[size_global];  // Para comunicação não-bloqueante
+    int req_count;
+    int espera_us = ESPERA_MINIMA_PROGRESSO_US;
+    int sondagens_vazias = 0;
+    int pacotes_desde_despacho = 0;
+    int64_t proxima_manutencao = 0;
 
     // Loop principal de coordenação
-    while (trabalhadores_ativos > 0) {
-        // Recebe solicitações de qualquer trabalhador
-        MPI_Recv(buffer_int, 2, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-        
-        int remetente = status.MPI_SOURCE;
-        int tag = status.MPI_TAG;
-        int linha_req = buffer_int[0];
-
-        switch (tag) {
-            case TAG_PEDIDO_BLOQUEIO:
-                // Processa solicitação de bloqueio de linha para edição
-                printf("[MESTRE] Recebido pedido de Usuario_%d para bloquear a linha %d\n", remetente, linha_req);
-                int resposta = 0;
-                // Verifica se a linha é válida e está disponível
-                if (linha_req >= 0 && linha_req < MAX_LINHAS && linhas_em_uso[linha_req] == -1) {
-                    linhas_em_uso[linha_req] = remetente;  // Bloqueia para o usuário
-                    resposta = 1;  // Aprovado
+    while (__atomic_load_n(&tratadores.trabalhadores_ativos, __ATOMIC_SEQ_CST) > 0 || fluxo_aguardando_fim()) {
+        // Com tratadores, a manutenção para todos eles: no máximo a cada INTERVALO_MANUTENCAO_US
+        int64_t agora = tratadores.num > 0 ? instante_ns(CLOCK_MONOTONIC) : 0;
+        if (tratadores.num == 0 || agora >= proxima_manutencao) {
+            proxima_manutencao = agora + INTERVALO_MANUTENCAO_US * 1000LL;
+            travar_documento(1);
+            // O mestre grava snapshots periódicos para acelerar uma eventual retomada
+            if (rank_global == rank_mestre && snapshot_a_cada > 0 && snapshot_periodico.atualizacoes_desde_ultimo >= snapshot_a_cada) {
+                documento_ativar(DOCUMENTO_PRINCIPAL);  // O snapshot guarda só o principal
+                iniciar_snapshot_periodico();
+            }
+            expirar_bloqueios_hospedados();
+            metricas_talvez_gravar();
+            if (reservas.num > 0) {
+                reserva_manutencao();
+            }
+            if (rank_global == rank_mestre) {
+                salas_despachar(0);  // Lote de chat de cada usuário, no máximo a cada INTERVALO_ENTREGA_CHAT_MS
+            }
+            if (tratadores.num > 0) {
+                documento_ativar(DOCUMENTO_PRINCIPAL);  // Os quadros em paralelo só valem para o principal
+                indice_busca_atualizar();               // O loop nunca fica ocioso enquanto há tratadores
+            }
+            destravar_documento();
+        }
+
+        // Estados completos a caminho: mais um bloco de cada, travando o documento só por bloco
+        int transferindo = transferencias_progredir();
+
+        // Sonda qualquer mensagem; deltas de outros coordenadores mantêm a réplica local em dia.
+        // Sob carga continua sondando; ocioso recua como a thread de progresso, acordando a
+        // tempo de expirar prazos
+        int flag;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+        if (!flag || pacotes_desde_despacho >= MENSAGENS_POR_DESPACHO || correio.difusao.tamanho >= LIMITE_PACOTE) {
+            // Nada mais na fila (ou carga contínua): os deltas acumulados saem em um único pacote,
+            // e as concessões feitas por expiração vão aos usuários que esperavam na fila
+            travar_documento(0);
+            difusao_despachar();
+            destravar_documento();
+            correio_despachar();
+            pacotes_desde_despacho = 0;
+        }
+        if (!flag) {
+            if (tratadores.num == 0) {
+                indice_busca_atualizar();  // Ocioso: as linhas alteradas não pesam na próxima busca
+            }
+            if (!transferindo && ++sondagens_vazias >= SONDAGENS_ANTES_DE_DORMIR) {
+                usleep(espera_us);
+                espera_us = espera_us * 2 < ESPERA_MAXIMA_PROGRESSO_US ? espera_us * 2 : ESPERA_MAXIMA_PROGRESSO_US;
+            }
+            continue;
+        }
+        sondagens_vazias = 0;
+        espera_us = ESPERA_MINIMA_PROGRESSO_US;
+        if (status.MPI_TAG == TAG_ATUALIZACAO) {
+            travar_documento(1);
+            receber_atualizacao();
+            destravar_documento();
+            continue;
+        }
+        if (status.MPI_TAG == TAG_METRICAS) {
+            int vazio;
+            MPI_Recv(&vazio, 0, MPI_INT, status.MPI_SOURCE, TAG_METRICAS, MPI_COMM_WORLD, &status);
+            metrica_mensagem(METRICA_RECEBIDA, TAG_METRICAS, 0);
+            travar_documento(1);
+            responder_metricas(status.MPI_SOURCE);
+            destravar_documento();
+            continue;
+        }
+        if (status.MPI_TAG == TAG_RESERVA) {
+            int sinal[3];
+            MPI_Recv(sinal, sizeof(sinal), MPI_BYTE, status.MPI_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &status);
+            metrica_mensagem(METRICA_RECEBIDA, TAG_RESERVA, sizeof(sinal));
+            travar_documento(1);
+            reserva_receber(sinal, status.MPI_SOURCE);
+            destravar_documento();
+            continue;
+        }
+        if (status.MPI_TAG != TAG_QUADROS) {
+            continue;  // Entregas de chat e finalização não são endereçadas a coordenadores
+        }
+
+        // Pacote de pedidos de um trabalhador (ou de outro coordenador)
+        int tamanho;
+        MPI_Get_count(&status, MPI_BYTE, &tamanho);
+        char* pacote = malloc(tamanho);
+        MPI_Recv(pacote, tamanho, MPI_BYTE, status.MPI_SOURCE, TAG_QUADROS, MPI_COMM_WORLD, &status);
+        metrica_mensagem(METRICA_RECEBIDA, TAG_QUADROS, tamanho);
+        if (tratadores.num > 0) {
+            // Sempre ao mesmo tratador: os quadros de um remetente são tratados em ordem
+            FilaTratador* fila = &tratadores.filas[status.MPI_SOURCE % tratadores.num];
+            PacoteRecebido* recebido = malloc(sizeof(PacoteRecebido));
+            recebido->remetente = status.MPI_SOURCE;
+            recebido->tamanho = tamanho;
+            recebido->dados = pacote;
+            recebido->proximo = NULL;
+            pthread_mutex_lock(&fila->mutex);
+            if (fila->ultimo) {
+                fila->ultimo->proximo = recebido;
+            } else {
+                fila->primeiro = recebido;
+            }
+            fila->ultimo = recebido;
+            pthread_cond_signal(&fila->sinal);
+            pthread_mutex_unlock(&fila->mutex);
+        } else {
+            tratar_pacote(status.MPI_SOURCE, pacote, tamanho);
+        }
+        pacotes_desde_despacho++;
+    }
+    tratadores_finalizar();
+    if (eh_reserva(rank_global) && rank_global != rank_mestre) {
+        documento_ativar(DOCUMENTO_PRINCIPAL);
+        reserva_atender_adiadas(1);  // Quem ainda espera o estado não fica sem ele
+    }
+    transferencias_finalizar();
+    documento_ativar(DOCUMENTO_PRINCIPAL);
+    difusao_despachar();
+    
+    journal_finalizar();
+    if (rank_global == rank_mestre) {
+        finalizar_snapshot_periodico();
+        gravar_snapshot();  // Encerramento limpo: a próxima retomada não precisa do journal
+    }
+
+    // Só o mestre sinaliza a finalização; os demais coordenadores e as reservas apenas encerram o loop
+    if (rank_global != rank_mestre) {
+        return;
+    }
+
+    // Quando todos saem e os deltas de todas as partições chegaram, envia o sinal de
+    // finalização (depois das últimas mensagens de chat) com as versões finais: cada
+    // usuário ainda recebe e repassa deltas até alcançá-las
+    salas_despachar(1);
+    if (verbosidade >= VERBOSIDADE_EVENTOS) {
+        printf("[MESTRE] Todos os trabalhadores saíram. Enviando sinal para finalizar.\n");
+    }
+    req_count = 0;
+    for (int i = num_coordenadores; i < reservas.primeira; i++) {
+        MPI_Isend(fim_fluxo.finais, num_coordenadores, MPI_INT, i, TAG_FINALIZAR, MPI_COMM_WORLD, &requests[req_count++]);
+        metrica_mensagem(METRICA_ENVIADA, TAG_FINALIZAR, num_coordenadores * sizeof(int));
+    }
+    MPI_Waitall(req_count, requests, MPI_STATUSES_IGNORE);
+}
+
+// ---------------------------------------------------------------------------
+// Reservas do mestre: seguem o fluxo de deltas, atendem leituras do principal e
+// assumem o papel do mestre se ele silenciar
+// ---------------------------------------------------------------------------
+
+// Sinal {tipo, valor, rank} em TAG_RESERVA, sem bloquear
+static void reserva_sinalizar(const int* destinos, int num_destinos, int tipo, int valor, int rank) {
+    int* sinal = malloc(3 * sizeof(int));
+    sinal[0] = tipo;
+    sinal[1] = valor;
+    sinal[2] = rank;
+    enviar_sem_bloquear(sinal, 3 * sizeof(int), destinos, num_destinos, TAG_RESERVA);
+}
+
+// Reservas que ainda seguem o mestre atual (as anteriores a ele já assumiram ou morreram)
+static int primeira_seguidora() {
+    return rank_mestre >= reservas.primeira ? rank_mestre + 1 : reservas.primeira;
+}
+
+// Um rank morreu: sai da difusão, que passa a ir direto da origem a cada membro (quem
+// ainda não soube da perda não repassa numa árvore diferente da dos demais), e os envios
+// pendentes, que podem ter a ele como destino, são esquecidos
+static void esquecer_rank(int rank) {
+    reservas.perdido[rank] = 1;
+    __atomic_store_n(&difusao_em_arvore, 0, __ATOMIC_SEQ_CST);
+    int membros = 0;
+    for (int i = 0; i < num_membros_difusao; i++) {
+        if (membros_difusao[i] != rank) membros_difusao[membros++] = membros_difusao[i];
+    }
+    num_membros_difusao = membros;
+    for (int i = 0; i < size_global; i++) {
+        posicao_difusao[i] = -1;
+    }
+    for (int i = 0; i < membros; i++) {
+        posicao_difusao[membros_difusao[i]] = i;
+    }
+    pthread_mutex_lock(&correio.mutex);
+    free(correio.saida[rank].dados);
+    memset(&correio.saida[rank], 0, sizeof(Pacote));
+    pthread_mutex_unlock(&correio.mutex);
+    abandonar_envios();
+    __atomic_add_fetch(&reservas.num_perdidos, 1, __ATOMIC_SEQ_CST);  // Por último: o cliente já vê o novo mestre
+}
+
+// Outro rank assumiu como mestre. Quem aplicou exatamente as versões do principal que a
+// nova mestre tinha ao assumir salta junto com ela; quem viu mais (deltas que não chegaram
+// a ela) ou menos recebe o estado dela
+static void mestre_substituido(int novo, int antigo, int versao_base) {
+    if (antigo == novo || reservas.perdido[antigo]) return;
+    __atomic_store_n(&rank_mestre, novo, __ATOMIC_SEQ_CST);
+    esquecer_rank(antigo);
+    if (verbosidade >= VERBOSIDADE_EVENTOS) {
+        printf("[%s] Rank %d assumiu como mestre no lugar do rank %d.\n", nome_processo, novo, antigo);
+    }
+    EstadoDocumento* principal = documentos.estados[DOCUMENTO_PRINCIPAL];  // Mesmos vetores das variáveis globais
+    RecepcaoEstado* recepcao = &principal->recepcao[0];
+    free(recepcao->estado);  // Um estado pela metade do mestre antigo não termina mais
+    recepcao->estado = NULL;
+    if (!principal->aguardando[0] && principal->versoes[0] == versao_base) {
+        principal->versoes[0] = versao_base + SALTO_PROMOCAO;
+    } else {
+        int pedido[3] = {principal->versoes[0], DOCUMENTO_PRINCIPAL, versao_base + SALTO_PROMOCAO};
+        correio_enfileirar(novo, QUADRO_RESSINCRONIZACAO, pedido, sizeof(pedido));
+        correio_despachar();
+        principal->aguardando[0] = 1;
+    }
+}
+
+// Sinal de TAG_RESERVA recebido (com o documento travado, ou o mutex da thread de progresso)
+static void reserva_receber(const int* sinal, int remetente) {
+    if (sinal[0] == RESERVA_PULSO && remetente == rank_mestre) {
+        reservas.ultimo_pulso = instante_ns(CLOCK_MONOTONIC);
+        reservas.pulsou = 1;
+    } else if (sinal[0] == RESERVA_PROMOCAO) {
+        mestre_substituido(remetente, sinal[2], sinal[1]);
+        reservas.ultimo_pulso = instante_ns(CLOCK_MONOTONIC);
+    } else if (sinal[0] == RESERVA_FIM && sinal[2] >= 0 && sinal[2] < num_coordenadores &&
+               remetente == rank_da_particao(sinal[2])) {
+        fim_fluxo.finais[sinal[2]] = sinal[1];
+        fim_fluxo.ultimo_aviso = instante_ns(CLOCK_MONOTONIC);
+    }
+}
+
+// Os usuários saíram: com o documento travado, despacha os últimos deltas desta partição e
+// avisa a versão final deles aos outros coordenadores e às reservas que seguem o mestre
+static void fluxo_avisar_fim() {
+    travar_documento(1);
+    documento_ativar(DOCUMENTO_PRINCIPAL);
+    difusao_despachar();
+    int versao = versao_coordenador[particao_local];
+    fim_fluxo.finais[particao_local] = versao;
+    fim_fluxo.ultimo_aviso = instante_ns(CLOCK_MONOTONIC);
+    destravar_documento();
+
+    int destinos[size_global];
+    int num_destinos = 0;
+    for (int p = 0; p < num_coordenadores; p++) {
+        int rank = rank_da_particao(p);
+        if (rank != rank_global && !reservas.perdido[rank]) destinos[num_destinos++] = rank;
+    }
+    for (int rank = primeira_seguidora(); rank < size_global; rank++) {
+        if (!reservas.perdido[rank]) destinos[num_destinos++] = rank;
+    }
+    reserva_sinalizar(destinos, num_destinos, RESERVA_FIM, versao, particao_local);
+    fim_fluxo.avisou = 1;
+}
+
+// Verdadeiro quando a réplica do principal aplicou os deltas de cada partição viva até a
+// versão final avisada. Se todos os avisos chegaram mas um delta não vem no prazo, desiste
+// da partição com um erro: a verificação de convergência acusará a diferença
+static int fluxo_alcancado() {
+    int* versoes = documentos.estados[DOCUMENTO_PRINCIPAL]->versoes;
+    CabecalhoJanela* cabecalho = __atomic_load_n(&replica_no.cabecalho, __ATOMIC_ACQUIRE);
+    if (cabecalho && !replica_no.escritor && !(__atomic_load_n(&cabecalho->sequencia, __ATOMIC_ACQUIRE) & 1)) {
+        versoes = replica_no.versoes;  // Leitor da janela: vale o que o escritor do nó já refletiu nela
+    }
+    int avisos_completos = 1;
+    int alcancado = 1;
+    for (int p = 0; p < num_coordenadores; p++) {
+        if (reservas.perdido[rank_da_particao(p)]) continue;
+        if (fim_fluxo.finais[p] < 0) {
+            avisos_completos = alcancado = 0;
+        } else if (versoes[p] < fim_fluxo.finais[p]) {
+            alcancado = 0;
+        }
+    }
+    if (alcancado || !avisos_completos) return alcancado;
+    if (instante_ns(CLOCK_MONOTONIC) - fim_fluxo.ultimo_aviso <= (int64_t)reservas.prazo_ms * 1000000LL) return 0;
+    for (int p = 0; p < num_coordenadores; p++) {
+        if (fim_fluxo.finais[p] >= 0 && versoes[p] < fim_fluxo.finais[p]) {
+            fprintf(stderr, "Erro: rank %d encerrou na versão %d da partição %d; o coordenador dela terminou na %d.\n",
+                    rank_global, versoes[p], p, fim_fluxo.finais[p]);
+            fim_fluxo.finais[p] = versoes[p];
+        }
+    }
+    return 1;
+}
+
+// Condição extra do loop depois que os usuários saem. Cada coordenador (e a reserva que
+// assumiu como mestre) avisa o fim da sua partição uma vez, e todos, reservas incluídas,
+// só deixam o loop ao alcançar as versões finais de todas as partições: os últimos deltas
+// de outro coordenador, como as liberações de bloqueio das saídas, podem chegar depois dos
+// avisos de saída. Uma reserva sem o aviso do mestre segue esperando; o silêncio dele a
+// promove como sempre
+static int fluxo_aguardando_fim() {
+    int produz = eh_coordenador(rank_global) || rank_global == rank_mestre;
+    if (!produz && !eh_reserva(rank_global)) return 0;
+    if (produz && !fim_fluxo.avisou) {
+        fluxo_avisar_fim();
+    }
+    travar_documento(0);
+    int alcancado = fluxo_alcancado();
+    destravar_documento();
+    return !alcancado;
+}
+
+// Envia o estado aos pedidos de ressincronização adiados que esta reserva já alcançou ou
+// cujo prazo venceu (todos, com todas = 1)
+static void reserva_atender_adiadas(int todas) {
+    int64_t agora = instante_ns(CLOCK_MONOTONIC);
+    for (int i = reservas.num_adiadas - 1; i >= 0; i--) {
+        RessincronizacaoAdiada* adiada = &reservas.adiadas[i];
+        if (!todas && versao_coordenador[0] < adiada->versao && agora < adiada->prazo) continue;
+        enviar_estado_completo(adiada->rank);
+        *adiada = reservas.adiadas[--reservas.num_adiadas];
+    }
+}
+
+// Chamada na manutenção do loop, com o documento travado para escrita. O mestre pulsa para
+// as reservas; cada reserva envia os estados adiados que já pode e, se o mestre ficar em
+// silêncio pelo prazo (multiplicado pela posição na fila, para que só uma assuma), assume
+static void reserva_manutencao() {
+    int64_t agora = instante_ns(CLOCK_MONOTONIC);
+    if (rank_global == rank_mestre) {
+        if (agora < reservas.proximo_pulso) return;
+        reservas.proximo_pulso = agora + INTERVALO_PULSO_MS * 1000000LL;
+        int destinos[size_global];
+        int num_destinos = 0;
+        for (int rank = primeira_seguidora(); rank < size_global; rank++) {
+            destinos[num_destinos++] = rank;
+        }
+        reserva_sinalizar(destinos, num_destinos, RESERVA_PULSO, 0, rank_global);
+        return;
+    }
+    if (!eh_reserva(rank_global)) return;
+
+    reserva_atender_adiadas(0);
+    if (fim_fluxo.finais[0] >= 0) return;  // O mestre encerrou: o silêncio dele não é morte
+
+    if (reservas.ultimo_pulso == 0) {
+        reservas.ultimo_pulso = agora;  // O prazo conta a partir da entrada no loop
+    }
+    int posicao = rank_global - primeira_seguidora();
+    int64_t prazo = (int64_t)reservas.prazo_ms * (posicao + 1) * 1000000LL;
+    if (!reservas.pulsou) {
+        prazo *= TOLERANCIA_INICIO;
+    }
+    if (agora - reservas.ultimo_pulso > prazo) {
+        reserva_promover();
+    }
+}
+
+// Esta reserva assume o papel do mestre: a partição 0, a estrutura do documento, o chat,
+// o journal e os snapshots. A réplica já está em dia até a última versão que chegou aqui;
+// os bloqueios vêm do estado replicado, com prazos novos, e as filas de espera se perdem
+static void reserva_promover() {
+    int antigo = rank_mestre;
+    long silencio_ms = (long)((instante_ns(CLOCK_MONOTONIC) - reservas.ultimo_pulso) / 1000000);
+    documento_ativar(DOCUMENTO_PRINCIPAL);
+    int versao_base = versao_coordenador[0];
+    __atomic_store_n(&rank_mestre, rank_global, __ATOMIC_SEQ_CST);
+    esquecer_rank(antigo);
+    strcpy(nome_processo, "MESTRE");
+    fprintf(stderr, "Aviso: mestre (rank %d) em silêncio há %ld ms; rank %d assume como mestre na versão %d.\n",
+            antigo, silencio_ms, rank_global, versao_base);
+
+    // As versões seguem adiante de qualquer uma que o mestre antigo possa ter difundido
+    versao_coordenador[0] = versao_base + SALTO_PROMOCAO;
+    aguardando_ressincronizacao[0] = 0;
+    for (int id = 0; id < documento.capacidade_ids; id++) {
+        Linha* linha = documento.por_id[id];
+        if (linha && linha->dono_bloqueio >= 0 && coordenador_da_linha(id) == rank_global) {
+            conceder_bloqueio(linha, linha->dono_bloqueio);
+        }
+    }
+    reserva_atender_adiadas(1);
+    salas_iniciar();  // O histórico do chat ficava só no mestre antigo
+
+    // Snapshot do estado assumido e journal novo a partir dele: uma retomada parte daqui
+    gravar_snapshot();
+    const char* base = formato_log == FORMATO_LOG_TEXTO ? "log_editor" : "journal_editor";
+    sprintf(arquivo_log, "%s.%s", base, formato_log == FORMATO_LOG_TEXTO ? "txt" : "bin");
+    journal_iniciar(arquivo_log);
+
+    int destinos[size_global];
+    int num_destinos = 0;
+    for (int rank = 0; rank < size_global; rank++) {
+        if (rank != rank_global && !reservas.perdido[rank]) destinos[num_destinos++] = rank;
+    }
+    reserva_sinalizar(destinos, num_destinos, RESERVA_PROMOCAO, versao_base, antigo);
+}
+
+// Trata um quadro de pedido recebido pelo coordenador. As respostas e os deltas gerados
+// são acumulados e saem no próximo despacho. Retorna 1 se o remetente saiu do editor
+static int tratar_quadro(int remetente, const Quadro* quadro) {
+    char* corpo = CORPO_QUADRO(quadro);
+    const int* campos = (const int*)corpo;
+    int comprimento = quadro->comprimento;
+    int num_campos = comprimento / (int)sizeof(int);
+
+    // Números de quadro fora de sequência indicam um pacote perdido ou reordenado
+    if (quadro->sequencia != correio.recebidos[remetente] + 1) {
+        fprintf(stderr, "Erro: quadro %u de %d fora de sequência (esperado %u).\n", quadro->sequencia, remetente,
+                correio.recebidos[remetente] + 1);
+    }
+    correio.recebidos[remetente] = quadro->sequencia;
+
+    // No mestre, cada quadro se refere ao documento em que o remetente está trabalhando
+    if (rank_global == rank_mestre) {
+        documento_ativar(documentos.do_remetente[remetente]);
+    }
+
+    // Reserva que ainda segue o mestre: só leituras do principal e o aviso de saída
+    if (eh_reserva(rank_global) && rank_global != rank_mestre && quadro->tipo != QUADRO_BUSCA &&
+        quadro->tipo != QUADRO_RESSINCRONIZACAO && quadro->tipo != QUADRO_SAIR) {
+        return 0;
+    }
+
+    switch (quadro->tipo) {
+        case QUADRO_PEDIDO_BLOQUEIO: {
+            // Processa solicitação de bloqueio de linha para edição:
+            // {posição vista, id estável, id do pedido, aceita esperar na fila}
+            if (num_campos < 4) break;
+            if (verbosidade >= VERBOSIDADE_PEDIDOS) {
+                printf("[%s] Recebido pedido de Usuario_%d para bloquear a linha %d\n", nome_processo, remetente, campos[0]);
+            }
+            int estado = BLOQUEIO_NEGADO;
+            int id_resposta = -1;
+            int ja_dono = 0;  // Renovação: o dono não muda e não há delta a difundir
+            // Verifica se a linha existe, pertence a este coordenador e está disponível
+            Linha* linha = documento_por_id(&documento, campos[1]);
+            if (linha && coordenador_da_linha(linha->id) == rank_global) {
+                id_resposta = linha->id;
+                BloqueioAtivo* bloqueio = bloqueio_ativo(linha->id);
+                int ja_na_fila = 0;
+                for (PedidoEmEspera* e = bloqueio ? bloqueio->primeiro : NULL; e && !ja_na_fila; e = e->proximo) {
+                    ja_na_fila = e->rank == remetente;
+                }
+                ja_dono = linha->dono_bloqueio == remetente;
+                if (linha->dono_bloqueio == -1 || ja_dono) {
+                    // Quem já é o dono recebe a concessão de novo com o prazo estendido,
+                    // em vez de esperar na fila pelo próprio bloqueio
+                    conceder_bloqueio(linha, remetente);  // Bloqueia para o usuário
+                    estado = BLOQUEIO_CONCEDIDO;
+                } else if (campos[3] && bloqueio && !ja_na_fila) {
+                    // Ocupada: entra na fila e recebe a concessão quando a linha for liberada.
+                    // Um segundo pedido do mesmo usuário é negado: a fila teria de entregar a
+                    // linha duas vezes ao mesmo rank
+                    PedidoEmEspera* espera = malloc(sizeof(PedidoEmEspera));
+                    espera->rank = remetente;
+                    espera->id_pedido = campos[2];
+                    espera->proximo = NULL;
+                    if (bloqueio->ultimo) {
+                        bloqueio->ultimo->proximo = espera;
+                    } else {
+                        bloqueio->primeiro = espera;
+                    }
+                    bloqueio->ultimo = espera;
+                    estado = BLOQUEIO_NA_FILA;
+                }
+            }
+            responder(remetente, campos[2], estado, id_resposta);
+            metrica_bloqueio(estado == BLOQUEIO_CONCEDIDO ? RESULTADO_CONCEDIDO : estado == BLOQUEIO_NA_FILA ? RESULTADO_NA_FILA : RESULTADO_NEGADO);
+            if (estado == BLOQUEIO_CONCEDIDO && !ja_dono) {
+                // Avisa que a linha está bloqueada
+                Atualizacao at = { .tipo = ATUALIZACAO_BLOQUEIO, .id = linha->id, .dono_bloqueio = remetente, .autor = remetente };
+                difundir_atualizacao(&at, NULL, 0);
+            }
+            break;
+        }
+
+        case QUADRO_TEXTO:
+        case QUADRO_EDICAO_DIRETA:
+            tratar_envio_texto(remetente, quadro->tipo, corpo, comprimento);
+            break;
+
+        case QUADRO_TRECHO:
+            tratar_edicao_trecho(remetente, corpo, comprimento);
+            break;
+
+        case QUADRO_PEDIDO_INTERVALO:
+            tratar_pedido_intervalo(remetente, campos, num_campos);
+            break;
+
+        case QUADRO_LOTE:
+            tratar_edicao_lote(remetente, corpo, comprimento);
+            break;
+
+        case QUADRO_OPERACAO_LINHA:
+            if (num_campos >= 6) tratar_operacao_linha(remetente, campos);
+            break;
+
+        case QUADRO_BUSCA:
+            tratar_busca(remetente, corpo, comprimento);
+            break;
+
+        case QUADRO_CHAT:
+            tratar_chat(remetente, corpo, comprimento);
+            break;
+
+        case QUADRO_CANAL:
+            tratar_canal(remetente, campos, comprimento);
+            break;
+
+        case QUADRO_HISTORICO:
+            tratar_historico(remetente, campos, comprimento);
+            break;
+
+        case QUADRO_DESFAZER:
+            tratar_desfazer(remetente, campos, num_campos);
+            break;
+
+        case QUADRO_VERSOES_LINHA:
+            tratar_versoes_linha(remetente, campos, num_campos);
+            break;
+
+        case QUADRO_ABRIR_DOCUMENTO:
+            tratar_abrir_documento(remetente, corpo, comprimento);
+            break;
+
+        case QUADRO_FECHAR_DOCUMENTO:
+            if (num_campos >= 1) tratar_fechar_documento(remetente, campos[0]);
+            break;
+
+        case QUADRO_DOCUMENTO:
+            // Contexto dos próximos quadros: só o principal ou um documento que o remetente assina
+            if (num_campos >= 1 && campos[0] >= 0 && campos[0] < documentos.num_documentos &&
+                (campos[0] == DOCUMENTO_PRINCIPAL || documentos.estados[campos[0]]->assinantes[remetente])) {
+                documentos.do_remetente[remetente] = campos[0];
+            }
+            break;
+
+        case QUADRO_RESSINCRONIZACAO:
+            // Trabalhador detectou uma lacuna de versões e precisa do estado completo do documento
+            if (rank_global == rank_mestre && num_campos >= 2) {
+                if (campos[1] < 0 || campos[1] >= documentos.num_documentos ||
+                    (campos[1] != DOCUMENTO_PRINCIPAL && !documentos.estados[campos[1]]->assinantes[remetente])) {
+                    break;
+                }
+                documento_ativar(campos[1]);
+            } else if (eh_reserva(rank_global) && rank_global != rank_mestre) {
+                // O terceiro campo é a versão que revelou a lacuna: um estado anterior a ela
+                // deixaria a lacuna no lugar, então espera o delta chegar aqui também
+                if (num_campos < 2 || campos[1] != DOCUMENTO_PRINCIPAL) break;
+                if (num_campos >= 3 && versao_coordenador[0] < campos[2] &&
+                    reservas.num_adiadas < MAX_RESSINCRONIZACOES_ADIADAS) {
+                    RessincronizacaoAdiada* adiada = &reservas.adiadas[reservas.num_adiadas++];
+                    adiada->rank = remetente;
+                    adiada->versao = campos[2];
+                    adiada->prazo = instante_ns(CLOCK_MONOTONIC) + (int64_t)reservas.prazo_ms * 1000000LL;
+                    break;
+                }
+            }
+            if (verbosidade >= VERBOSIDADE_EVENTOS) {
+                printf("[%s] Usuario_%d pediu ressincronização (versão local %d, atual %d)\n", nome_processo, remetente,
+                       num_campos > 0 ? campos[0] : -1, versao_coordenador[particao_local]);
+            }
+            enviar_estado_completo(remetente);
+            break;
+
+        case QUADRO_RENOVAR_BLOQUEIO: {
+            // Estende o prazo de todas as linhas que o remetente bloqueia aqui (um intervalo
+            // bloqueado de uma vez é renovado com um único quadro)
+            int64_t prazo = instante_ns(CLOCK_MONOTONIC) + (int64_t)prazo_bloqueio_s * 1000000000LL;
+            // Tratado em paralelo (ver faixa_do_quadro): trava uma faixa de cada vez
+            for (int f = 0; f < FAIXAS_BLOQUEIO; f++) {
+                FaixaBloqueios* faixa = &tabela_bloqueios.faixas[f];
+                pthread_mutex_lock(&tratadores.travas_faixas[f]);
+                for (int i = 0; i < faixa->total; i++) {
+                    BloqueioAtivo* bloqueio = &faixa->entradas[i];
+                    if (bloqueio->dono == remetente && bloqueio->prazo) {
+                        bloqueio->prazo = prazo;
+                    }
+                }
+                pthread_mutex_unlock(&tratadores.travas_faixas[f]);
+            }
+            break;
+        }
+
+        case QUADRO_SAIR:
+            // Usuário notifica que está saindo do editor (cada coordenador recebe o aviso)
+            if (verbosidade >= VERBOSIDADE_EVENTOS) {
+                printf("[%s] Usuario_%d saiu.\n", nome_processo, remetente);
+            }
+            if (rank_global == rank_mestre) {
+                documentos_remover_usuario(remetente);  // Volta ao principal, cujos bloqueios são soltos abaixo
+                salas_remover_membro(remetente);
+            }
+            liberar_bloqueios_de(remetente);
+            return 1;
+
+        default:
+            fprintf(stderr, "Erro: quadro de tipo %d desconhecido recebido de %d.\n", quadro->tipo, remetente);
+            break;
+    }
+    return 0;
+}
+
+// Operação estrutural: {id do pedido, tipo, posição vista, id, deslocamento, id da seguinte}.
+// Como no pedido de bloqueio, a linha é a do id estável: a posição vista pode ter mudado com
+// inserções e remoções de outros. Uma inserção vai antes da linha do id (-1 = no fim), e
+// juntar exige que a seguinte ainda seja a que o usuário viu
+static void tratar_operacao_linha(int remetente, const int* pedido) {
+    int tipo = pedido[1];
+    Linha* linha = pedido[3] >= 0 ? documento_por_id(&documento, pedido[3]) : NULL;
+    int indice = linha ? documento_indice(linha) : tipo == ATUALIZACAO_INSERIR && pedido[3] < 0 ? documento.total_linhas : -1;
+    Linha* seguinte = linha ? documento_proxima(linha) : NULL;
+    if (tipo == ATUALIZACAO_JUNTAR && seguinte && seguinte->id != pedido[5]) {
+        seguinte = NULL;  // Outra linha entrou ou saiu entre as duas
+    }
+    Atualizacao at = { .tipo = tipo, .linha = indice, .dono_bloqueio = -1, .deslocamento = pedido[4], .autor = remetente };
+    const char* acao = NULL;
+
+    // Linhas bloqueadas por alguém não podem ser removidas, divididas nem unidas.
+    // Com vários coordenadores a estrutura do principal fica fixa: o mestre não conhece
+    // com segurança os bloqueios das outras partições.
+    if ((num_coordenadores > 1 && documento_ativo == DOCUMENTO_PRINCIPAL) || rank_global != rank_mestre) {
+        acao = NULL;
+    } else if (tipo == ATUALIZACAO_INSERIR && indice >= 0) {
+        at.id_novo = documento.proximo_id;
+        acao = "inseriu";
+    } else if (tipo == ATUALIZACAO_REMOVER && linha && linha->dono_bloqueio == -1 && documento.total_linhas > 1) {
+        at.id = linha->id;
+        acao = "removeu";
+    } else if (tipo == ATUALIZACAO_DIVIDIR && linha && linha->dono_bloqueio == -1) {
+        at.id = linha->id;
+        at.id_novo = documento.proximo_id;
+        acao = "dividiu";
+    } else if (tipo == ATUALIZACAO_JUNTAR && linha && seguinte && linha->dono_bloqueio == -1 && seguinte->dono_bloqueio == -1) {
+        at.id = linha->id;
+        acao = "juntou com a seguinte";
+    }
+
+    if (acao) {
+        if (verbosidade >= VERBOSIDADE_PEDIDOS) {
+            printf("[MESTRE] Usuario_%d %s a linha %d\n", remetente, acao, indice);
+        }
+        int comprimento_anterior = linha ? linha->comprimento : 0;
+        // Dividir e juntar também mudam o texto: entram no histórico, mas não podem ser desfeitos
+        if (tipo == ATUALIZACAO_DIVIDIR) {
+            int deslocamento = at.deslocamento < 0 ? 0 : at.deslocamento > linha->comprimento ? linha->comprimento : at.deslocamento;
+            versoes_guardar(linha, remetente, deslocamento, 0, linha->texto + deslocamento, linha->comprimento - deslocamento);
+        } else if (tipo == ATUALIZACAO_JUNTAR) {
+            versoes_guardar(linha, remetente, linha->comprimento, 0, "", 0);
+        }
+        aplicar_atualizacao(&at);
+        // Dividir e juntar mudam o texto da linha: edições por trecho pendentes são transformadas
+        if (tipo == ATUALIZACAO_DIVIDIR) {
+            registrar_trecho(linha, linha->comprimento, comprimento_anterior - linha->comprimento, 0);
+        } else if (tipo == ATUALIZACAO_JUNTAR) {
+            registrar_trecho(linha, comprimento_anterior, 0, linha->comprimento - comprimento_anterior);
+        }
+        difundir_atualizacao(&at, NULL, 0);
+        journal_registrar(&at, remetente, indice, NULL, 0);
+    }
+    responder(remetente, pedido[0], acao != NULL, at.id);
+}
+
+// Recebe um texto editado (cabeçalho e bytes em um único quadro), aplica, responde com
+// o id do pedido e difunde. Em QUADRO_TEXTO o remetente precisa ter o bloqueio da
+// linha; em QUADRO_EDICAO_DIRETA ela precisa estar livre, e bloqueio, escrita e liberação
+// acontecem de uma vez
+static void tratar_envio_texto(int remetente, int tipo, char* corpo, int tamanho) {
+    EnvioTexto* envio = (EnvioTexto*)corpo;
+    if (tamanho < (int)sizeof(EnvioTexto)) return;
+    int comprimento = tamanho - (int)sizeof(EnvioTexto);
+    if (envio->comprimento < comprimento) {
+        comprimento = envio->comprimento;
+    }
+
+    // O trabalhador identifica a linha pelo id, pois a posição pode ter mudado com
+    // inserções/remoções feitas por outros
+    Linha* linha = documento_por_id(&documento, envio->id);
+    int permitido = 0;
+    if (linha && coordenador_da_linha(linha->id) == rank_global) {
+        permitido = tipo == QUADRO_EDICAO_DIRETA
+            ? linha->dono_bloqueio == -1 || linha->dono_bloqueio == remetente
+            : linha->dono_bloqueio == remetente;
+    }
+
+    responder(remetente, envio->id_pedido, permitido, envio->id);
+    if (permitido) {
+        int indice = documento_indice(linha);
+        if (verbosidade >= VERBOSIDADE_PEDIDOS) {
+            printf("[%s] Recebido novo texto para linha %d. Distribuindo para todos.\n", nome_processo, indice);
+        }
+        int comprimento_anterior = linha->comprimento;
+        versoes_substituicao(linha, remetente, envio->texto, comprimento);
+        documento_alterar_texto(linha, envio->texto, comprimento);  // Atualiza documento
+        registrar_trecho(linha, 0, comprimento_anterior, comprimento);  // Substituição da linha inteira
+        liberar_bloqueio(linha, 0);  // Libera ou passa ao primeiro da fila; o delta leva o novo dono
+
+        // Distribui apenas a linha alterada para todos os trabalhadores
+        Atualizacao at = { .tipo = ATUALIZACAO_TEXTO, .id = linha->id, .dono_bloqueio = linha->dono_bloqueio,
+                           .autor = remetente, .revisao = linha->revisao };
+        at.instante_origem = envio->instante_origem;
+        difundir_atualizacao(&at, linha->texto, linha->comprimento);
+        at.dono_bloqueio = -1;  // Bloqueios não sobrevivem ao reinício
+        journal_registrar(&at, remetente, indice, linha->texto, linha->comprimento);  // Só enfileira
+    }
+}
+
+// Recebe o texto de várias linhas em um quadro e aplica tudo ou nada: cada linha precisa
+// estar bloqueada pelo remetente (ou livre, com direta). O lote é difundido e registrado no
+// journal como um único delta, qualquer que seja o número de linhas
+static void tratar_edicao_lote(int remetente, char* corpo, int tamanho) {
+    EnvioLote* lote = (EnvioLote*)corpo;
+    if (tamanho < (int)sizeof(EnvioLote)) return;
+    if (lote->comprimento > tamanho - (int)sizeof(EnvioLote)) {
+        lote->comprimento = tamanho - (int)sizeof(EnvioLote);
+    }
+
+    // Valida todas as linhas antes de alterar qualquer uma
+    int num_linhas = lote->num_linhas > 0 ? lote->num_linhas : 0;
+    Linha** linhas = malloc((num_linhas + 1) * sizeof(Linha*));
+    const char** textos = malloc((num_linhas + 1) * sizeof(char*));
+    int* comprimentos = malloc((num_linhas + 1) * sizeof(int));
+    const char* p = lote->dados;
+    const char* fim = lote->dados + lote->comprimento;
+    int permitido = num_linhas > 0;
+    for (int i = 0; i < num_linhas && permitido; i++) {
+        int id;
+        if (p + 2 * sizeof(int) > fim) {
+            permitido = 0;
+            break;
+        }
+        memcpy(&id, p, sizeof(int)); p += sizeof(int);
+        memcpy(&comprimentos[i], p, sizeof(int)); p += sizeof(int);
+        textos[i] = p;
+        p += comprimentos[i];
+        linhas[i] = documento_por_id(&documento, id);
+        permitido = comprimentos[i] >= 0 && p <= fim && linhas[i] && coordenador_da_linha(id) == rank_global &&
+                    (linhas[i]->dono_bloqueio == remetente || (lote->direta && linhas[i]->dono_bloqueio == -1));
+    }
+
+    responder(remetente, lote->id_pedido, permitido, permitido ? linhas[0]->id : -1);
+    if (permitido) {
+        int indice = documento_indice(linhas[0]);
+        if (verbosidade >= VERBOSIDADE_PEDIDOS) {
+            printf("[%s] Recebido lote de %d linhas a partir da linha %d. Distribuindo para todos.\n", nome_processo, num_linhas, indice);
+        }
+        for (int i = 0; i < num_linhas; i++) {
+            int comprimento_anterior = linhas[i]->comprimento;
+            versoes_substituicao(linhas[i], remetente, textos[i], comprimentos[i]);
+            documento_alterar_texto(linhas[i], textos[i], comprimentos[i]);
+            registrar_trecho(linhas[i], 0, comprimento_anterior, comprimentos[i]);
+        }
+        for (int i = 0; i < num_linhas; i++) {
+            if (linhas[i]->dono_bloqueio == remetente) {
+                liberar_bloqueio(linhas[i], 0);  // Libera ou passa ao primeiro da fila; o delta leva o novo dono
+            }
+        }
+
+        int comprimento;
+        char* serializado = serializar_selecao(&documento, linhas, num_linhas, 1, &comprimento);
+        Atualizacao at = { .tipo = ATUALIZACAO_LOTE, .id = linhas[0]->id, .dono_bloqueio = -1, .autor = remetente,
+                           .instante_origem = lote->instante_origem };
+        difundir_atualizacao(&at, serializado, comprimento);
+        free(serializado);
+        serializado = serializar_selecao(&documento, linhas, num_linhas, 0, &comprimento);  // Bloqueios não sobrevivem ao reinício
+        journal_registrar(&at, remetente, indice, serializado, comprimento);
+        free(serializado);
+    }
+    free(linhas);
+    free(textos);
+    free(comprimentos);
+}
+
+// ---------------------------------------------------------------------------
+// Tabela de bloqueios do coordenador: concessões com prazo renovável e fila de espera
+// por linha. linha->dono_bloqueio continua sendo o estado replicado; a tabela guarda
+// só o que o coordenador precisa para expirar e repassar os bloqueios
+// ---------------------------------------------------------------------------
+
+// Total de bloqueios ativos em todas as faixas de uma tabela
+static int bloqueios_total(const TabelaBloqueios* tabela) {
+    int total = 0;
+    for (int f = 0; f < FAIXAS_BLOQUEIO; f++) {
+        total += tabela->faixas[f].total;
+    }
+    return total;
+}
+
+// Entrada da linha na tabela, ou NULL se ela está livre. As linhas bloqueadas ao mesmo
+// tempo são poucas e ainda se dividem entre as faixas: uma busca linear basta
+static BloqueioAtivo* bloqueio_ativo(int id_linha) {
+    FaixaBloqueios* faixa = &tabela_bloqueios.faixas[FAIXA_DA_LINHA(id_linha)];
+    for (int i = 0; i < faixa->total; i++) {
+        if (faixa->entradas[i].id_linha == id_linha) {
+            return &faixa->entradas[i];
+        }
+    }
+    return NULL;
+}
+
+static void conceder_bloqueio(Linha* linha, int rank) {
+    BloqueioAtivo* bloqueio = bloqueio_ativo(linha->id);
+    if (!bloqueio) {
+        FaixaBloqueios* faixa = &tabela_bloqueios.faixas[FAIXA_DA_LINHA(linha->id)];
+        if (faixa->total == faixa->capacidade) {
+            faixa->capacidade = faixa->capacidade ? faixa->capacidade * 2 : 16;
+            faixa->entradas = realloc(faixa->entradas, faixa->capacidade * sizeof(BloqueioAtivo));
+        }
+        bloqueio = &faixa->entradas[faixa->total++];
+        bloqueio->id_linha = linha->id;
+        bloqueio->primeiro = bloqueio->ultimo = NULL;
+    }
+    bloqueio->dono = rank;
+    bloqueio->prazo = prazo_bloqueio_s > 0 ? instante_ns(CLOCK_MONOTONIC) + (int64_t)prazo_bloqueio_s * 1000000000LL : 0;
+    linha->dono_bloqueio = rank;
+}
+
+// Solta o bloqueio da linha. Havendo fila, o primeiro recebe a concessão (uma resposta
+// ao pedido que ficou esperando); senão a linha fica livre. Com difundir = 0 quem chamou
+// difunde o novo dono no próprio delta
+static void liberar_bloqueio(Linha* linha, int difundir) {
+    BloqueioAtivo* bloqueio = bloqueio_ativo(linha->id);
+    PedidoEmEspera* proximo = bloqueio ? bloqueio->primeiro : NULL;
+    if (proximo) {
+        bloqueio->primeiro = proximo->proximo;
+        if (!bloqueio->primeiro) bloqueio->ultimo = NULL;
+        conceder_bloqueio(linha, proximo->rank);
+        responder(proximo->rank, proximo->id_pedido, BLOQUEIO_CONCEDIDO, linha->id);
+        metrica_bloqueio(RESULTADO_CONCEDIDO_FILA);
+        free(proximo);
+    } else {
+        if (bloqueio) {
+            FaixaBloqueios* faixa = &tabela_bloqueios.faixas[FAIXA_DA_LINHA(linha->id)];
+            *bloqueio = faixa->entradas[--faixa->total];
+        }
+        linha->dono_bloqueio = -1;
+    }
+    if (difundir) {
+        Atualizacao at = { .tipo = ATUALIZACAO_BLOQUEIO, .id = linha->id, .dono_bloqueio = linha->dono_bloqueio, .autor = linha->dono_bloqueio };
+        difundir_atualizacao(&at, NULL, 0);
+    }
+}
+
+// Solta os bloqueios cujo prazo venceu sem renovação (usuário travado ou morto)
+static void expirar_bloqueios() {
+    if (prazo_bloqueio_s == 0) return;
+    int64_t agora = instante_ns(CLOCK_MONOTONIC);
+    if (agora - tabela_bloqueios.ultima_verificacao < INTERVALO_EXPIRACAO_MS * 1000000LL) return;
+    tabela_bloqueios.ultima_verificacao = agora;
+
+    // De trás para frente: liberar pode mover a última entrada da faixa para a posição atual
+    for (int f = 0; f < FAIXAS_BLOQUEIO; f++) {
+        FaixaBloqueios* faixa = &tabela_bloqueios.faixas[f];
+        for (int i = faixa->total - 1; i >= 0; i--) {
+            BloqueioAtivo* bloqueio = &faixa->entradas[i];
+            if (bloqueio->prazo == 0 || bloqueio->prazo > agora) continue;
+            Linha* linha = documento_por_id(&documento, bloqueio->id_linha);
+            metrica_bloqueio(RESULTADO_EXPIRADO);
+            if (verbosidade >= VERBOSIDADE_EVENTOS) {
+                printf("[%s] Prazo do bloqueio de Usuario_%d na linha %d expirou.\n", nome_processo, bloqueio->dono,
+                       linha ? documento_indice(linha) : -1);
+            }
+            if (linha) {
+                liberar_bloqueio(linha, 1);
+            }
+        }
+    }
+}
+
+// O usuário saiu: deixa as filas em que esperava e solta as linhas que ainda bloqueava
+static void liberar_bloqueios_de(int rank) {
+    for (int f = 0; f < FAIXAS_BLOQUEIO; f++) {
+        FaixaBloqueios* faixa = &tabela_bloqueios.faixas[f];
+        for (int i = 0; i < faixa->total; i++) {
+            BloqueioAtivo* bloqueio = &faixa->entradas[i];
+            PedidoEmEspera** elo = &bloqueio->primeiro;
+            bloqueio->ultimo = NULL;
+            while (*elo) {
+                if ((*elo)->rank == rank) {
+                    PedidoEmEspera* removido = *elo;
+                    *elo = removido->proximo;
+                    free(removido);
+                } else {
+                    bloqueio->ultimo = *elo;
+                    elo = &(*elo)->proximo;
+                }
+            }
+        }
+        for (int i = faixa->total - 1; i >= 0; i--) {
+            if (faixa->entradas[i].dono != rank) continue;
+            Linha* linha = documento_por_id(&documento, faixa->entradas[i].id_linha);
+            if (linha) {
+                liberar_bloqueio(linha, 1);
+            }
+        }
+    }
+}
+
+// Bloqueia de uma vez linhas consecutivas: {id do pedido, quantidade, ids...}. Tudo ou
+// nada: basta uma linha ocupada, inexistente, de outro coordenador ou fora de ordem
+// (alguém inseriu ou removeu linhas no meio) para negar. Não entra em fila: esperar por
+// várias linhas ao mesmo tempo abriria espaço para impasses entre intervalos
+static void tratar_pedido_intervalo(int remetente, const int* pedido, int quantidade) {
+    if (quantidade < 2) return;
+    int num_linhas = pedido[1] < quantidade - 2 ? pedido[1] : quantidade - 2;
+    const int* ids = pedido + 2;
+
+    Linha* primeira = num_linhas > 0 ? documento_por_id(&documento, ids[0]) : NULL;
+    int inicio = primeira ? documento_indice(primeira) : -1;
+    int permitido = primeira != NULL;
+    for (int i = 0; i < num_linhas && permitido; i++) {
+        Linha* linha = documento_por_id(&documento, ids[i]);
+        permitido = linha && coordenador_da_linha(linha->id) == rank_global && linha->dono_bloqueio == -1 &&
+                    documento_indice(linha) == inicio + i;
+    }
+    if (verbosidade >= VERBOSIDADE_PEDIDOS) {
+        printf("[%s] Usuario_%d pediu o bloqueio das linhas %d a %d: %s\n", nome_processo, remetente,
+               inicio, inicio + num_linhas - 1, permitido ? "concedido" : "negado");
+    }
+
+    if (permitido) {
+        for (int i = 0; i < num_linhas; i++) {
+            conceder_bloqueio(documento_por_id(&documento, ids[i]), remetente);
+        }
+    }
+    responder(remetente, pedido[0], permitido ? BLOQUEIO_CONCEDIDO : BLOQUEIO_NEGADO, num_linhas > 0 ? ids[0] : -1);
+    metrica_bloqueio(permitido ? RESULTADO_CONCEDIDO : RESULTADO_NEGADO);
+    if (permitido) {
+        // Um único delta leva o novo dono de todas as linhas
+        Atualizacao at = { .tipo = ATUALIZACAO_BLOQUEIOS, .id = ids[0], .dono_bloqueio = remetente, .autor = remetente };
+        difundir_atualizacao(&at, (const char*)ids, num_linhas * sizeof(int));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Histórico de versões das linhas: cadeias de deltas reversos no anel do coordenador,
+// consulta de uma linha numa revisão e desfazer/refazer por usuário
+// ---------------------------------------------------------------------------
+
+// Coordenadores: reserva o anel do orçamento (as páginas só são ocupadas conforme o uso)
+void versoes_iniciar() {
+    if (anel_versoes.capacidade <= 0) {
+        anel_versoes.capacidade = 0;
+        return;
+    }
+    anel_versoes.capacidade -= anel_versoes.capacidade % ALINHAMENTO_VERSAO;
+    anel_versoes.dados = malloc(anel_versoes.capacidade);
+    if (!anel_versoes.dados) {
+        fprintf(stderr, "Erro: sem memória para o histórico de versões de %s; seguindo sem ele.\n", nome_processo);
+        anel_versoes.capacidade = 0;
+    }
+}
+
+static void historico_linhas_liberar(HistoricoLinhas* cadeias) {
+    free(cadeias->cabeca);
+    free(cadeias->desfazer);
+    free(cadeias->refazer);
+    memset(cadeias, 0, sizeof(HistoricoLinhas));
+}
+
+void versoes_finalizar() {
+    historico_linhas_liberar(&historico_linhas_principal);
+    free(anel_versoes.dados);
+    anel_versoes.dados = NULL;
+    anel_versoes.capacidade = 0;
+}
+
+static RegistroVersao* registro_versao(int64_t posicao) {
+    return (RegistroVersao*)(anel_versoes.dados + posicao % anel_versoes.capacidade);
+}
+
+static void versoes_garantir_id(int id) {
+    if (id < historico_linhas->capacidade_ids) return;
+    int capacidade = historico_linhas->capacidade_ids ? historico_linhas->capacidade_ids : 1024;
+    while (capacidade <= id) capacidade *= 2;
+    historico_linhas->cabeca = realloc(historico_linhas->cabeca, capacidade * sizeof(int64_t));
+    for (int i = historico_linhas->capacidade_ids; i < capacidade; i++) {
+        historico_linhas->cabeca[i] = -1;
+    }
+    historico_linhas->capacidade_ids = capacidade;
+}
+
+static void pilha_empilhar(PilhaMudancas* pilha, int id_linha, int revisao) {
+    pilha->itens[pilha->topo % CAPACIDADE_DESFAZER] = (MudancaUsuario){ .id_linha = id_linha, .revisao = revisao };
+    pilha->topo++;
+    if (pilha->topo - pilha->base > CAPACIDADE_DESFAZER) {
+        pilha->base = pilha->topo - CAPACIDADE_DESFAZER;
+    }
+}
+
+static int pilha_desempilhar(PilhaMudancas* pilha, MudancaUsuario* mudanca) {
+    if (pilha->topo == pilha->base) return 0;
+    pilha->topo--;
+    *mudanca = pilha->itens[pilha->topo % CAPACIDADE_DESFAZER];
+    return 1;
+}
+
+// Guarda o que refaz a revisão atual da linha a partir da que a mudança em curso vai produzir:
+// 'prefixo' e 'sufixo' bytes em comum e o meio atual. Chamada antes de alterar a linha
+static void versoes_guardar(Linha* linha, int autor, int prefixo, int sufixo, const char* meio, int comprimento) {
+    if (anel_versoes.capacidade == 0 || linha->id < 0) return;
+    int tamanho = (int)sizeof(RegistroVersao) + comprimento;
+    tamanho += (ALINHAMENTO_VERSAO - tamanho % ALINHAMENTO_VERSAO) % ALINHAMENTO_VERSAO;
+
+    pthread_mutex_lock(&anel_versoes.mutex);
+    versoes_garantir_id(linha->id);
+    if (tamanho > anel_versoes.capacidade / 2) {
+        // Descartaria quase todo o histórico: a cadeia da linha recomeça na próxima mudança
+        historico_linhas->cabeca[linha->id] = -1;
+        pthread_mutex_unlock(&anel_versoes.mutex);
+        return;
+    }
+
+    // Nenhum registro atravessa o fim do anel: o espaço que sobra lá vira um registro vazio
+    int64_t sobra = anel_versoes.capacidade - anel_versoes.fim % anel_versoes.capacidade;
+    int64_t necessario = tamanho + (sobra < tamanho ? sobra : 0);
+    while (anel_versoes.fim + necessario - anel_versoes.inicio > anel_versoes.capacidade) {
+        RegistroVersao* antigo = registro_versao(anel_versoes.inicio);
+        if (antigo->id_linha >= 0) anel_versoes.descartados++;
+        anel_versoes.inicio += antigo->tamanho;
+    }
+    if (sobra < tamanho) {
+        RegistroVersao* vazio = registro_versao(anel_versoes.fim);
+        vazio->tamanho = (int)sobra;
+        vazio->id_linha = -1;
+        anel_versoes.fim += sobra;
+    }
+
+    RegistroVersao* registro = registro_versao(anel_versoes.fim);
+    registro->tamanho = tamanho;
+    registro->id_linha = linha->id;
+    registro->revisao = linha->revisao + 1;
+    registro->autor = autor;
+    registro->prefixo = prefixo;
+    registro->sufixo = sufixo;
+    registro->comprimento = comprimento;
+    registro->reservado = 0;
+    registro->instante = (int64_t)time(NULL);
+    registro->anterior = historico_linhas->cabeca[linha->id];
+    memcpy(registro->meio, meio, comprimento);
+    historico_linhas->cabeca[linha->id] = anel_versoes.fim;
+    anel_versoes.fim += tamanho;
+    pthread_mutex_unlock(&anel_versoes.mutex);
+}
+
+// Bytes do início e do fim que o texto atual da linha e o novo têm em comum
+static void diferenca_texto(const Linha* linha, const char* novo, int comprimento, int* prefixo, int* sufixo) {
+    int p = 0;
+    while (p < linha->comprimento && p < comprimento && linha->texto[p] == novo[p]) p++;
+    int s = 0;
+    while (s < linha->comprimento - p && s < comprimento - p &&
+           linha->texto[linha->comprimento - 1 - s] == novo[comprimento - 1 - s]) {
+        s++;
+    }
+    *prefixo = p;
+    *sufixo = s;
+}
+
+// Mudança de texto feita por um usuário: guarda a revisão atual e empilha a mudança para
+// ser desfeita. Uma mudança nova descarta o que ele ainda podia refazer
+static void versoes_mudanca(Linha* linha, int autor, int prefixo, int sufixo) {
+    const char* meio = linha->texto ? linha->texto + prefixo : "";
+    versoes_guardar(linha, autor, prefixo, sufixo, meio, linha->comprimento - prefixo - sufixo);
+    if (anel_versoes.capacidade == 0 || autor < 0 || autor >= size_global) return;
+    pthread_mutex_lock(&anel_versoes.mutex);
+    if (!historico_linhas->desfazer) {
+        historico_linhas->desfazer = calloc(size_global, sizeof(PilhaMudancas));
+        historico_linhas->refazer = calloc(size_global, sizeof(PilhaMudancas));
+    }
+    pilha_empilhar(&historico_linhas->desfazer[autor], linha->id, linha->revisao + 1);
+    historico_linhas->refazer[autor].base = historico_linhas->refazer[autor].topo;
+    pthread_mutex_unlock(&anel_versoes.mutex);
+}
+
+// Mudança que troca o texto inteiro da linha: só o trecho que difere vai para o histórico
+static void versoes_substituicao(Linha* linha, int autor, const char* novo, int comprimento) {
+    if (anel_versoes.capacidade == 0) return;
+    int prefixo, sufixo;
+    diferenca_texto(linha, novo, comprimento, &prefixo, &sufixo);
+    versoes_mudanca(linha, autor, prefixo, sufixo);
+}
+
+// Percorre a cadeia da linha a partir da revisão atual, chamando 'visitar' com cada registro
+// enquanto ele existe e continua a sequência de revisões. Retorna a última revisão alcançada
+static int versoes_percorrer(const Linha* linha, int ate_revisao, int (*visitar)(const RegistroVersao*, void*), void* contexto) {
+    int atual = linha->revisao;
+    int64_t posicao = linha->id >= 0 && linha->id < historico_linhas->capacidade_ids ? historico_linhas->cabeca[linha->id] : -1;
+    while (atual > ate_revisao && posicao >= anel_versoes.inicio) {
+        const RegistroVersao* registro = registro_versao(posicao);
+        if (registro->id_linha != linha->id || registro->revisao != atual || !visitar(registro, contexto)) break;
+        atual--;
+        posicao = registro->anterior;
+    }
+    return atual;
+}
+
+typedef struct {
+    char* texto;
+    int comprimento;
+} TextoRefeito;
+
+static int refazer_revisao(const RegistroVersao* registro, void* contexto) {
+    TextoRefeito* refeito = (TextoRefeito*)contexto;
+    if (registro->prefixo + registro->sufixo > refeito->comprimento) return 0;
+    int comprimento = registro->prefixo + registro->comprimento + registro->sufixo;
+    char* anterior = malloc(comprimento + 1);
+    memcpy(anterior, refeito->texto, registro->prefixo);
+    memcpy(anterior + registro->prefixo, registro->meio, registro->comprimento);
+    memcpy(anterior + registro->prefixo + registro->comprimento,
+           refeito->texto + refeito->comprimento - registro->sufixo, registro->sufixo);
+    free(refeito->texto);
+    refeito->texto = anterior;
+    refeito->comprimento = comprimento;
+    return 1;
+}
+
+// Texto da linha na revisão pedida, refeito a partir do atual. NULL se a cadeia não chega
+// até ela; o texto devolvido (terminado em '\0') é liberado por quem chamou
+static char* versoes_texto(const Linha* linha, int revisao, int* comprimento) {
+    if (anel_versoes.capacidade == 0 || revisao < 0 || revisao > linha->revisao) return NULL;
+    TextoRefeito refeito = { .texto = malloc(linha->comprimento + 1), .comprimento = linha->comprimento };
+    memcpy(refeito.texto, linha->texto ? linha->texto : "", linha->comprimento);
+    pthread_mutex_lock(&anel_versoes.mutex);
+    int alcancada = versoes_percorrer(linha, revisao, refazer_revisao, &refeito);
+    pthread_mutex_unlock(&anel_versoes.mutex);
+    if (alcancada != revisao) {
+        free(refeito.texto);
+        return NULL;
+    }
+    refeito.texto[refeito.comprimento] = '\0';
+    *comprimento = refeito.comprimento;
+    return refeito.texto;
+}
+
+// 1 se a linha ainda tem o texto que a revisão deixou: nada mudou depois, ou só desfazer e
+// refazer, que voltam a textos anteriores. 0 se mudou, -1 se a revisão saiu do histórico
+static int versoes_inalterada(const Linha* linha, int revisao) {
+    if (linha->revisao == revisao) return 1;
+    int comprimento;
+    char* texto = versoes_texto(linha, revisao, &comprimento);
+    if (!texto) return -1;
+    int igual = comprimento == linha->comprimento && memcmp(texto, linha->texto ? linha->texto : "", comprimento) == 0;
+    free(texto);
+    return igual;
+}
+
+typedef struct {
+    RevisaoLinha* revisoes;
+    int quantidade;
+    int maximo;
+} ListaRevisoes;
+
+static int listar_revisao(const RegistroVersao* registro, void* contexto) {
+    ListaRevisoes* lista = (ListaRevisoes*)contexto;
+    if (lista->quantidade == lista->maximo) return 0;
+    RevisaoLinha* revisao = &lista->revisoes[lista->quantidade++];
+    revisao->revisao = registro->revisao;
+    revisao->autor = registro->autor;
+    revisao->instante = registro->instante;
+    return 1;
+}
+
+// Consulta de versões: {id do pedido, id da linha, revisão pedida (-1 = só a lista)}. A resposta
+// leva as mudanças mais recentes ainda guardadas (quem fez e quando) e o texto pedido
+static void tratar_versoes_linha(int remetente, const int* campos, int num_campos) {
+    if (num_campos < 3) return;
+    int cabecalho[6] = {campos[0], 0, 0, -1, 0, 0};
+    Linha* linha = documento_por_id(&documento, campos[1]);
+    if (!linha || coordenador_da_linha(linha->id) != rank_global || anel_versoes.capacidade == 0) {
+        correio_enfileirar(remetente, QUADRO_VERSOES, cabecalho, sizeof(cabecalho));
+        return;
+    }
+
+    RevisaoLinha revisoes[MAX_REVISOES_LISTADAS];
+    ListaRevisoes lista = { .revisoes = revisoes, .quantidade = 0, .maximo = MAX_REVISOES_LISTADAS };
+    pthread_mutex_lock(&anel_versoes.mutex);
+    versoes_percorrer(linha, -1, listar_revisao, &lista);
+    pthread_mutex_unlock(&anel_versoes.mutex);
+    int comprimento = 0;
+    char* texto = campos[2] >= 0 ? versoes_texto(linha, campos[2], &comprimento) : NULL;
+
+    cabecalho[1] = 1;
+    cabecalho[2] = linha->revisao;
+    cabecalho[3] = texto ? campos[2] : -1;
+    cabecalho[4] = lista.quantidade;
+    cabecalho[5] = comprimento;
+    int tamanho = sizeof(cabecalho) + lista.quantidade * sizeof(RevisaoLinha) + comprimento;
+    char* resposta = malloc(tamanho);
+    memcpy(resposta, cabecalho, sizeof(cabecalho));
+    memcpy(resposta + sizeof(cabecalho), revisoes, lista.quantidade * sizeof(RevisaoLinha));
+    memcpy(resposta + sizeof(cabecalho) + lista.quantidade * sizeof(RevisaoLinha), texto, comprimento);
+    correio_enfileirar(remetente, QUADRO_VERSOES, resposta, tamanho);
+    free(resposta);
+    free(texto);
+}
+
+// Desfaz (ou refaz) a última mudança de texto do remetente no documento: {id do pedido, refazer}.
+// A linha precisa continuar com o texto que a mudança produziu e estar livre ou bloqueada pelo
+// próprio remetente. O resultado é uma edição comum: difundida, registrada no journal e no
+// histórico, e empilhada para ser refeita (ou desfeita de novo)
+static void tratar_desfazer(int remetente, const int* campos, int num_campos) {
+    if (num_campos < 2) return;
+    int estado = DESFAZER_VAZIO;
+    int id_linha = -1;
+    MudancaUsuario mudanca;
+    PilhaMudancas* origem = NULL;
+    PilhaMudancas* destino = NULL;
+    if (historico_linhas->desfazer) {
+        origem = campos[1] ? &historico_linhas->refazer[remetente] : &historico_linhas->desfazer[remetente];
+        destino = campos[1] ? &historico_linhas->desfazer[remetente] : &historico_linhas->refazer[remetente];
+    }
+
+    if (origem && pilha_desempilhar(origem, &mudanca)) {
+        id_linha = mudanca.id_linha;
+        Linha* linha = documento_por_id(&documento, mudanca.id_linha);
+        char* texto = NULL;
+        int comprimento = 0;
+        int inalterada = linha && coordenador_da_linha(linha->id) == rank_global ? versoes_inalterada(linha, mudanca.revisao) : 0;
+        if (inalterada < 0) {
+            estado = DESFAZER_DESCARTADO;
+        } else if (!inalterada) {
+            estado = DESFAZER_CONFLITO;  // Outra mudança veio depois: esta não pode mais ser desfeita
+        } else if (linha->dono_bloqueio != -1 && linha->dono_bloqueio != remetente) {
+            estado = DESFAZER_CONFLITO;
+            pilha_empilhar(origem, mudanca.id_linha, mudanca.revisao);  // Vale de novo quando a linha for liberada
+        } else if (!(texto = versoes_texto(linha, mudanca.revisao - 1, &comprimento))) {
+            estado = DESFAZER_DESCARTADO;
+        } else {
+            int prefixo, sufixo;
+            diferenca_texto(linha, texto, comprimento, &prefixo, &sufixo);
+            versoes_guardar(linha, remetente, prefixo, sufixo, linha->texto ? linha->texto + prefixo : "",
+                            linha->comprimento - prefixo - sufixo);
+            int indice = documento_indice(linha);
+            int comprimento_anterior = linha->comprimento;
+            documento_alterar_texto(linha, texto, comprimento);
+            registrar_trecho(linha, 0, comprimento_anterior, comprimento);
+            pilha_empilhar(destino, linha->id, linha->revisao);
+            if (verbosidade >= VERBOSIDADE_PEDIDOS) {
+                printf("[%s] Usuario_%d %s a linha %d (revisão %d).\n", nome_processo, remetente,
+                       campos[1] ? "refez" : "desfez", indice, linha->revisao);
+            }
+
+            Atualizacao at = { .tipo = ATUALIZACAO_TEXTO, .id = linha->id, .dono_bloqueio = linha->dono_bloqueio,
+                               .autor = remetente, .revisao = linha->revisao };
+            difundir_atualizacao(&at, linha->texto, linha->comprimento);
+            at.dono_bloqueio = -1;
+            journal_registrar(&at, remetente, indice, linha->texto, linha->comprimento);
+            estado = DESFAZER_FEITO;
+        }
+        free(texto);
+    }
+    responder(remetente, campos[0], estado, id_linha);
+}
+
+// ---------------------------------------------------------------------------
+// Edição por trecho sem bloqueio: o coordenador ordena as edições de cada linha e
+// transforma as feitas sobre revisões antigas contra as que já aplicou
+// ---------------------------------------------------------------------------
+
+// Guarda no histórico o trecho que levou a linha à revisão atual
+void registrar_trecho(Linha* linha, int posicao, int apagar, int inserir) {
+    pthread_mutex_lock(&historico_mutex);  // Tratadores registram juntos; quem lê tem a trava de escrita do documento
+    TrechoAplicado* registro = &historico->registros[historico->total % CAPACIDADE_HISTORICO];
+    registro->id = linha->id;
+    registro->revisao = linha->revisao;
+    registro->posicao = posicao;
+    registro->apagar = apagar;
+    registro->inserir = inserir;
+    historico->total++;
+    pthread_mutex_unlock(&historico_mutex);
+}
+
+// Ajusta a edição para valer depois de um trecho já aplicado. Edições concorrentes no mesmo
+// ponto ficam na ordem em que o coordenador as recebeu; um trecho apagado por outro usuário
+// some da remoção, e uma remoção que cobre por completo o ponto de outra inserção a engole
+static void transformar_trecho(EnvioTrecho* op, const TrechoAplicado* aplicado) {
+    int a_inicio = aplicado->posicao;
+    int a_fim = aplicado->posicao + aplicado->apagar;
+    int diferenca = aplicado->inserir - aplicado->apagar;
+    int inicio = op->posicao;
+    int fim = op->posicao + op->apagar;
+
+    if (inicio < a_inicio) {
+        // Começa antes: mantém a posição
+    } else if (inicio <= a_fim) {
+        inicio = a_inicio + aplicado->inserir;  // Dentro (ou no mesmo ponto): vai para depois do trecho aplicado
+    } else {
+        inicio += diferenca;
+    }
+
+    if (fim <= a_inicio) {
+        // Termina antes: mantém
+    } else if (fim <= a_fim) {
+        fim = a_inicio;  // O que sobrava já foi apagado
+    } else {
+        fim += diferenca;
+    }
+
+    op->posicao = inicio;
+    op->apagar = fim > inicio ? fim - inicio : 0;
+}
+
+// Transforma a edição contra todos os trechos aplicados na linha depois da sua revisão base.
+// Retorna 0 se o histórico já não cobre a revisão base (o cliente deve refazer a edição)
+static int transformar_contra_historico(EnvioTrecho* op, Linha* linha) {
+    int faltantes = linha->revisao - op->revisao_base;
+    if (faltantes == 0) return 1;
+    if (faltantes < 0 || faltantes > CAPACIDADE_HISTORICO) return 0;
+
+    // Percorre do mais recente para o mais antigo guardando os trechos desta linha
+    long* indices = malloc(faltantes * sizeof(long));
+    int encontrados = 0;
+    long limite = historico->total > CAPACIDADE_HISTORICO ? historico->total - CAPACIDADE_HISTORICO : 0;
+    for (long i = historico->total - 1; i >= limite && encontrados < faltantes; i--) {
+        TrechoAplicado* registro = &historico->registros[i % CAPACIDADE_HISTORICO];
+        if (registro->id == linha->id && registro->revisao > op->revisao_base) {
+            indices[encontrados++] = i;
+        }
+    }
+    if (encontrados == faltantes) {
+        for (int k = encontrados - 1; k >= 0; k--) {
+            transformar_trecho(op, &historico->registros[indices[k] % CAPACIDADE_HISTORICO]);
+        }
+    }
+    free(indices);
+    return encontrados == faltantes;
+}
+
+// Recebe uma edição por trecho, transforma contra o que já foi aplicado, aplica, responde
+// e difunde. Só é recusada se outro usuário bloqueou a linha inteira ou se a revisão base
+// é mais antiga que o histórico
+static void tratar_edicao_trecho(int remetente, char* corpo, int tamanho) {
+    EnvioTrecho* op = (EnvioTrecho*)corpo;
+    if (tamanho < (int)sizeof(EnvioTrecho)) return;
+    if (op->comprimento > tamanho - (int)sizeof(EnvioTrecho)) {
+        op->comprimento = tamanho - (int)sizeof(EnvioTrecho);
+    }
+
+    Linha* linha = documento_por_id(&documento, op->id);
+    int permitido = linha && coordenador_da_linha(linha->id) == rank_global &&
+                    (linha->dono_bloqueio == -1 || linha->dono_bloqueio == remetente) &&
+                    transformar_contra_historico(op, linha);
+
+    if (permitido) {
+        // Limita ao texto atual, como documento_editar_trecho fará nas réplicas
+        if (op->posicao < 0) op->posicao = 0;
+        if (op->posicao > linha->comprimento) op->posicao = linha->comprimento;
+        if (op->apagar < 0) op->apagar = 0;
+        if (op->apagar > linha->comprimento - op->posicao) op->apagar = linha->comprimento - op->posicao;
+        versoes_mudanca(linha, remetente, op->posicao, linha->comprimento - op->posicao - op->apagar);
+        documento_editar_trecho(linha, op->posicao, op->apagar, op->texto, op->comprimento);
+        registrar_trecho(linha, op->posicao, op->apagar, op->comprimento);
+    }
+    responder(remetente, op->id_pedido, permitido, op->id);
+
+    if (permitido) {
+        Atualizacao at = { .tipo = ATUALIZACAO_TRECHO, .id = linha->id, .dono_bloqueio = linha->dono_bloqueio,
+                           .deslocamento = op->posicao, .apagar = op->apagar, .revisao = linha->revisao,
+                           .autor = remetente, .instante_origem = op->instante_origem };
+        difundir_atualizacao(&at, op->texto, op->comprimento);
+
+        // O journal guarda a linha resultante: a reprodução não depende do histórico
+        Atualizacao registro = { .tipo = ATUALIZACAO_TEXTO, .versao = at.versao, .id = linha->id, .dono_bloqueio = -1 };
+        journal_registrar(&registro, remetente, documento_indice(linha), linha->texto, linha->comprimento);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Busca no documento: o mestre mantém um índice de trigramas atualizado a cada
+// alteração aceita e responde às buscas dos usuários com linhas e deslocamentos
+// ---------------------------------------------------------------------------
+
+static uint32_t balde_trigrama(const char* texto) {
+    uint32_t trigrama = (uint8_t)texto[0] | (uint32_t)(uint8_t)texto[1] << 8 | (uint32_t)(uint8_t)texto[2] << 16;
+    return (trigrama * 2654435761u) >> (32 - BITS_BALDES_TRIGRAMAS);
+}
+
+static void indice_garantir_id(int id) {
+    if (id < indice_busca.capacidade_ids) return;
+    int capacidade = indice_busca.capacidade_ids ? indice_busca.capacidade_ids : 1024;
+    while (capacidade <= id) capacidade *= 2;
+    indice_busca.geracao = realloc(indice_busca.geracao, capacidade * sizeof(int));
+    indice_busca.entradas_linha = realloc(indice_busca.entradas_linha, capacidade * sizeof(int));
+    indice_busca.pendente = realloc(indice_busca.pendente, capacidade);
+    indice_busca.posicao = realloc(indice_busca.posicao, capacidade * sizeof(int));
+    indice_busca.posicoes_validas = 0;
+    int novos = capacidade - indice_busca.capacidade_ids;
+    memset(indice_busca.geracao + indice_busca.capacidade_ids, 0, novos * sizeof(int));
+    memset(indice_busca.entradas_linha + indice_busca.capacidade_ids, 0, novos * sizeof(int));
+    memset(indice_busca.pendente + indice_busca.capacidade_ids, 0, novos);
+    indice_busca.capacidade_ids = capacidade;
+}
+
+static void indice_marcar(int id) {
+    if (!indice_busca.ativo) return;
+    pthread_mutex_lock(&indice_busca.mutex);
+    indice_garantir_id(id);
+    if (!indice_busca.pendente[id]) {
+        indice_busca.pendente[id] = 1;
+        if (indice_busca.num_pendentes == indice_busca.capacidade_pendentes) {
+            indice_busca.capacidade_pendentes = indice_busca.capacidade_pendentes ? indice_busca.capacidade_pendentes * 2 : 256;
+            indice_busca.pendentes = realloc(indice_busca.pendentes, indice_busca.capacidade_pendentes * sizeof(int));
+        }
+        indice_busca.pendentes[indice_busca.num_pendentes++] = id;
+    }
+    pthread_mutex_unlock(&indice_busca.mutex);
+}
+
+// Invalida as entradas atuais da linha e, se ela ainda existe, acrescenta uma entrada da
+// nova geração em cada balde dos seus trigramas
+static void indice_reindexar(int id) {
+    indice_busca.entradas_validas -= indice_busca.entradas_linha[id];
+    indice_busca.entradas_obsoletas += indice_busca.entradas_linha[id];
+    indice_busca.entradas_linha[id] = 0;
+    int geracao = ++indice_busca.geracao[id];
+    Linha* linha = documento_por_id(&documento, id);
+    if (!linha) return;
+
+    if (++indice_busca.marca_atual == 0) {
+        memset(indice_busca.marca, 0, BALDES_TRIGRAMAS * sizeof(uint32_t));
+        indice_busca.marca_atual = 1;
+    }
+    for (int i = 0; i + 3 <= linha->comprimento; i++) {
+        uint32_t b = balde_trigrama(linha->texto + i);
+        if (indice_busca.marca[b] == indice_busca.marca_atual) continue;  // Trigrama repetido na linha
+        indice_busca.marca[b] = indice_busca.marca_atual;
+        BaldeIndice* balde = &indice_busca.baldes[b];
+        if (balde->tamanho == balde->capacidade) {
+            balde->capacidade = balde->capacidade ? balde->capacidade * 2 : 4;
+            balde->entradas = realloc(balde->entradas, balde->capacidade * sizeof(EntradaIndice));
+        }
+        balde->entradas[balde->tamanho++] = (EntradaIndice){ .id = id, .geracao = geracao };
+        indice_busca.entradas_linha[id]++;
+    }
+    indice_busca.entradas_validas += indice_busca.entradas_linha[id];
+}
+
+// Esvazia os baldes (mantendo a memória) e indexa todas as linhas do documento
+static void indice_reconstruir() {
+    for (int b = 0; b < BALDES_TRIGRAMAS; b++) {
+        indice_busca.baldes[b].tamanho = 0;
+    }
+    indice_busca.entradas_validas = 0;
+    indice_busca.entradas_obsoletas = 0;
+    indice_garantir_id(documento.capacidade_ids);
+    memset(indice_busca.entradas_linha, 0, indice_busca.capacidade_ids * sizeof(int));
+    for (Linha* l = documento_primeira(&documento); l; l = documento_proxima(l)) {
+        indice_reindexar(l->id);
+    }
+    for (int i = 0; i < indice_busca.num_pendentes; i++) {
+        indice_busca.pendente[indice_busca.pendentes[i]] = 0;
+    }
+    indice_busca.num_pendentes = 0;
+    indice_busca.reconstruir = 0;
+    indice_busca.posicoes_validas = 0;
+}
+
+void indice_busca_iniciar() {
+    indice_busca.baldes = calloc(BALDES_TRIGRAMAS, sizeof(BaldeIndice));
+    indice_busca.marca = calloc(BALDES_TRIGRAMAS, sizeof(uint32_t));
+    indice_busca.ativo = 1;
+    indice_reconstruir();
+}
+
+// Chamada pelo mestre ocioso e antes de cada busca: o custo de uma edição é reindexar
+// só a linha alterada. Com mais entradas obsoletas que válidas, reconstrói tudo
+void indice_busca_atualizar() {
+    if (!indice_busca.ativo) return;
+    if (indice_busca.reconstruir || indice_busca.entradas_obsoletas > indice_busca.entradas_validas + MINIMO_OBSOLETAS_INDICE) {
+        indice_reconstruir();
+        return;
+    }
+    for (int i = 0; i < indice_busca.num_pendentes; i++) {
+        int id = indice_busca.pendentes[i];
+        indice_busca.pendente[id] = 0;
+        indice_reindexar(id);
+    }
+    indice_busca.num_pendentes = 0;
+}
+
+void indice_busca_finalizar() {
+    if (!indice_busca.ativo) return;
+    for (int b = 0; b < BALDES_TRIGRAMAS; b++) {
+        free(indice_busca.baldes[b].entradas);
+    }
+    free(indice_busca.baldes);
+    free(indice_busca.marca);
+    free(indice_busca.geracao);
+    free(indice_busca.entradas_linha);
+    free(indice_busca.pendente);
+    free(indice_busca.pendentes);
+    free(indice_busca.posicao);
+    memset(&indice_busca, 0, sizeof(indice_busca));
+}
+
+// Próxima ocorrência do texto em [inicio, fim), ou NULL. O memchr da glibc procura o
+// primeiro byte com instruções vetoriais; em linhas curtas sai mais barato que o memmem,
+// que monta uma tabela de saltos a cada chamada
+static const char* achar_trecho(const char* inicio, const char* fim, const char* texto, int comprimento) {
+    while (fim - inicio >= comprimento) {
+        const char* candidato = memchr(inicio, texto[0], fim - inicio - comprimento + 1);
+        if (!candidato) return NULL;
+        if (memcmp(candidato + 1, texto + 1, comprimento - 1) == 0) return candidato;
+        inicio = candidato + 1;
+    }
+    return NULL;
+}
+
+// Ocorrências sem sobreposição do texto na linha
+static int contar_ocorrencias(const Linha* linha, const char* texto, int comprimento) {
+    int total = 0;
+    const char* inicio = linha->texto;
+    const char* fim = linha->texto + linha->comprimento;
+    const char* achado;
+    while ((achado = achar_trecho(inicio, fim, texto, comprimento)) != NULL) {
+        total++;
+        inicio = achado + comprimento;
+    }
+    return total;
+}
+
+// Acrescenta as ocorrências da linha (na posição dada) aos pares (linha, deslocamento)
+static void coletar_ocorrencias(const Linha* linha, int posicao, const char* texto, int comprimento, int* ocorrencias,
+                                int* quantidade) {
+    const char* inicio = linha->texto;
+    const char* fim = linha->texto + linha->comprimento;
+    const char* achado;
+    while (*quantidade < MAX_RESULTADOS_BUSCA && (achado = achar_trecho(inicio, fim, texto, comprimento)) != NULL) {
+        ocorrencias[2 * *quantidade] = posicao;
+        ocorrencias[2 * *quantidade + 1] = (int)(achado - linha->texto);
+        (*quantidade)++;
+        inicio = achado + comprimento;
+    }
+}
+
+typedef struct {
+    int posicao;
+    Linha* linha;
+} LinhaEncontrada;
+
+static int comparar_encontradas(const void* a, const void* b) {
+    return ((const LinhaEncontrada*)a)->posicao - ((const LinhaEncontrada*)b)->posicao;
+}
+
+// Busca o texto (comparação exata de bytes) no documento local. Com o índice, as candidatas
+// são as linhas válidas do balde mais curto entre os trigramas do texto. Textos com menos
+// de 3 bytes, ou só com trigramas comuns, varrem todas as linhas em paralelo (OpenMP).
+// Grava até MAX_RESULTADOS_BUSCA pares (linha, deslocamento) em ordem e retorna o total
+static int buscar_documento(const char* texto, int comprimento, int* ocorrencias, int* quantidade) {
+    *quantidade = 0;
+    if (comprimento <= 0) return 0;
+    indice_busca_atualizar();
+
+    BaldeIndice* menor = NULL;
+    if (indice_busca.ativo) {
+        for (int i = 0; i + 3 <= comprimento; i++) {
+            BaldeIndice* balde = &indice_busca.baldes[balde_trigrama(texto + i)];
+            if (!menor || balde->tamanho < menor->tamanho) menor = balde;
+        }
+    }
+    int total = 0;
+
+    if (menor && menor->tamanho <= documento.total_linhas / FRACAO_VARREDURA_BUSCA) {
+        // Poucas candidatas: a posição de cada linha encontrada vem da tabela de posições,
+        // refeita num percurso em ordem só se a estrutura do documento mudou
+        if (!indice_busca.posicoes_validas) {
+            int posicao = 0;
+            for (Linha* l = documento_primeira(&documento); l; l = documento_proxima(l)) {
+                indice_busca.posicao[l->id] = posicao++;
+            }
+            indice_busca.posicoes_validas = 1;
+        }
+        int num_candidatas = menor->tamanho;
+        LinhaEncontrada* encontradas = malloc((num_candidatas + 1) * sizeof(LinhaEncontrada));
+        int num_encontradas = 0;
+        for (int i = 0; i < num_candidatas; i++) {
+            EntradaIndice entrada = menor->entradas[i];
+            if (entrada.geracao != indice_busca.geracao[entrada.id]) continue;  // Entrada obsoleta
+            Linha* linha = documento_por_id(&documento, entrada.id);
+            int ocorrencias_linha = linha ? contar_ocorrencias(linha, texto, comprimento) : 0;
+            if (ocorrencias_linha == 0) continue;
+            total += ocorrencias_linha;
+            encontradas[num_encontradas].posicao = indice_busca.posicao[entrada.id];
+            encontradas[num_encontradas++].linha = linha;
+        }
+        qsort(encontradas, num_encontradas, sizeof(LinhaEncontrada), comparar_encontradas);
+        for (int i = 0; i < num_encontradas && *quantidade < MAX_RESULTADOS_BUSCA; i++) {
+            coletar_ocorrencias(encontradas[i].linha, encontradas[i].posicao, texto, comprimento, ocorrencias, quantidade);
+        }
+        free(encontradas);
+        return total;
+    }
+
+    // Varredura: a tabela por id é um vetor, então as threads dividem as linhas sem percorrer
+    // a árvore. As posições saem de um percurso em ordem que para ao juntar as ocorrências
+    // devolvidas; num texto comum isso acontece nas primeiras linhas
+    int capacidade = documento.capacidade_ids;
+    int* contagem = calloc(capacidade > 0 ? capacidade : 1, sizeof(int));
+    int linhas_encontradas = 0;
+    #pragma omp parallel for schedule(static) reduction(+:total, linhas_encontradas) if (capacidade > 4096)
+    for (int id = 0; id < capacidade; id++) {
+        Linha* linha = documento.por_id[id];
+        if (!linha) continue;
+        contagem[id] = contar_ocorrencias(linha, texto, comprimento);
+        total += contagem[id];
+        linhas_encontradas += contagem[id] > 0;
+    }
+    int posicao = 0;
+    for (Linha* l = documento_primeira(&documento); l && linhas_encontradas > 0 && *quantidade < MAX_RESULTADOS_BUSCA;
+         l = documento_proxima(l), posicao++) {
+        if (contagem[l->id] == 0) continue;
+        coletar_ocorrencias(l, posicao, texto, comprimento, ocorrencias, quantidade);
+        linhas_encontradas--;
+    }
+    free(contagem);
+    return total;
+}
+
+// Busca pedida por um usuário: {id do pedido, comprimento, texto}. A resposta leva o total
+// de ocorrências e as primeiras delas, e sai junto com as demais respostas do pacote
+static void tratar_busca(int remetente, const char* corpo, int comprimento) {
+    const int* campos = (const int*)corpo;
+    if (comprimento < 2 * (int)sizeof(int) || campos[1] < 0 || campos[1] > comprimento - 2 * (int)sizeof(int)) {
+        return;
+    }
+    int resposta[4 + 2 * MAX_RESULTADOS_BUSCA];
+    int quantidade;
+    int64_t inicio = instante_ns(CLOCK_MONOTONIC);
+    resposta[0] = campos[0];
+    resposta[1] = buscar_documento(corpo + 2 * sizeof(int), campos[1], resposta + 4, &quantidade);
+    resposta[2] = quantidade;
+    resposta[3] = (int)((instante_ns(CLOCK_MONOTONIC) - inicio) / 1000);
+    correio_enfileirar(remetente, QUADRO_RESULTADO_BUSCA, resposta, (4 + 2 * quantidade) * sizeof(int));
+}
+
+// ---------------------------------------------------------------------------
+// Chat: o mestre guarda o histórico dos canais e entrega as mensagens em lotes,
+// um pacote por usuário a cada INTERVALO_ENTREGA_CHAT_MS
+// ---------------------------------------------------------------------------
+
+static Canal* canal_buscar(const char* nome) {
+    for (int i = 0; i < salas.num_canais; i++) {
+        if (strcmp(salas.canais[i].nome, nome) == 0) return &salas.canais[i];
+    }
+    return NULL;
+}
+
+static Canal* canal_criar(const char* nome) {
+    if (salas.num_canais == MAX_CANAIS) return NULL;
+    Canal* canal = &salas.canais[salas.num_canais++];
+    memset(canal, 0, sizeof(Canal));
+    snprintf(canal->nome, sizeof(canal->nome), "%s", nome);
+    canal->membros = calloc(size_global, 1);
+    return canal;
+}
+
+// Nome do canal no pedido: "@rank" é a conversa privada com aquele usuário, criada no
+// primeiro uso. Retorna NULL se o canal não existe (ou o destino da conversa é inválido)
+static Canal* canal_do_pedido(int remetente, const char* nome) {
+    if (nome[0] != '@') return canal_buscar(nome);
+    int destino = atoi(nome + 1);
+    if (destino < num_coordenadores || destino >= reservas.primeira || destino == remetente) return NULL;
+    char privado[TAMANHO_NOME_CANAL];
+    snprintf(privado, sizeof(privado), "@%d-%d", remetente < destino ? remetente : destino, remetente < destino ? destino : remetente);
+    Canal* canal = canal_buscar(privado);
+    if (!canal && (canal = canal_criar(privado)) != NULL) {
+        canal->membros[remetente] = canal->membros[destino] = 1;
+    }
+    return canal;
+}
+
+// Copia o nome recebido num quadro, que pode não ter o '\0'
+static void nome_canal(char* destino, const char* origem) {
+    memcpy(destino, origem, TAMANHO_NOME_CANAL);
+    destino[TAMANHO_NOME_CANAL - 1] = '\0';
+}
+
+void salas_iniciar() {
+    salas.canais = calloc(MAX_CANAIS, sizeof(Canal));
+    salas.entrega = calloc(size_global, sizeof(Pacote));
+    salas.ultima_entrega = instante_ns(CLOCK_MONOTONIC);
+    Canal* geral = canal_criar(CANAL_GERAL);
+    for (int rank = num_coordenadores; rank < reservas.primeira; rank++) {
+        geral->membros[rank] = 1;
+    }
+}
+
+void salas_finalizar() {
+    for (int i = 0; i < salas.num_canais; i++) {
+        Canal* canal = &salas.canais[i];
+        for (int j = 0; j < canal->capacidade_historico; j++) {
+            free(canal->historico[j]);
+        }
+        free(canal->historico);
+        free(canal->membros);
+    }
+    free(salas.canais);
+    free(salas.entrega);
+    memset(&salas, 0, sizeof(salas));
+}
+
+// Mensagem para um canal (ou "@rank"): entra no histórico e segue no próximo lote de cada
+// membro, menos o remetente. Quem envia a um canal com 50 membros manda um só quadro
+static void tratar_chat(int remetente, const char* corpo, int comprimento) {
+    const EnvioChat* envio = (const EnvioChat*)corpo;
+    if (comprimento < (int)sizeof(EnvioChat) || envio->comprimento < 0 ||
+        envio->comprimento > comprimento - (int)sizeof(EnvioChat)) {
+        return;
+    }
+    char nome[TAMANHO_NOME_CANAL];
+    nome_canal(nome, envio->canal);
+    Canal* canal = canal_do_pedido(remetente, nome);
+    if (!canal || !canal->membros[remetente]) {
+        responder(remetente, envio->id_pedido, 0, -1);
+        return;
+    }
+
+    int texto = envio->comprimento < MAX_TEXTO - 1 ? envio->comprimento : MAX_TEXTO - 1;
+    MensagemChat* mensagem = malloc(sizeof(MensagemChat) + texto);
+    memset(mensagem, 0, sizeof(MensagemChat));
+    mensagem->sequencia = ++canal->total;
+    mensagem->remetente = remetente;
+    mensagem->comprimento = texto;
+    mensagem->instante = instante_ns(CLOCK_REALTIME);
+    memcpy(mensagem->canal, canal->nome, TAMANHO_NOME_CANAL);
+    memcpy(mensagem->texto, envio->texto, texto);
+
+    // Anel do histórico: cresce até MAX_HISTORICO_CANAL e depois sobrescreve a mais antiga
+    int posicao = (mensagem->sequencia - 1) % MAX_HISTORICO_CANAL;
+    if (posicao >= canal->capacidade_historico) {
+        int capacidade = canal->capacidade_historico ? canal->capacidade_historico * 2 : 64;
+        if (capacidade > MAX_HISTORICO_CANAL) capacidade = MAX_HISTORICO_CANAL;
+        canal->historico = realloc(canal->historico, capacidade * sizeof(MensagemChat*));
+        memset(canal->historico + canal->capacidade_historico, 0, (capacidade - canal->capacidade_historico) * sizeof(MensagemChat*));
+        canal->capacidade_historico = capacidade;
+    }
+    free(canal->historico[posicao]);
+    canal->historico[posicao] = mensagem;
+
+    for (int rank = num_coordenadores; rank < reservas.primeira; rank++) {
+        if (!canal->membros[rank] || rank == remetente) continue;
+        void* destino = pacote_reservar(&salas.entrega[rank], QUADRO_MENSAGEM_CHAT, sizeof(MensagemChat) + texto, mensagem->sequencia);
+        memcpy(destino, mensagem, sizeof(MensagemChat) + texto);
+    }
+    responder(remetente, envio->id_pedido, 1, -1);
+}
+
+// Entrar ou sair de um canal: {id do pedido, CANAL_*, nome}. Entrar cria o canal se preciso;
+// conversas privadas e o canal geral não aceitam entradas e saídas
+static void tratar_canal(int remetente, const int* pedido, int comprimento) {
+    if (comprimento < 2 * (int)sizeof(int) + TAMANHO_NOME_CANAL) return;
+    char nome[TAMANHO_NOME_CANAL];
+    nome_canal(nome, (const char*)(pedido + 2));
+    int aceito = 0;
+    if (nome[0] != '\0' && nome[0] != '@' && strcmp(nome, CANAL_GERAL) != 0) {
+        Canal* canal = canal_buscar(nome);
+        if (pedido[1] == CANAL_ENTRAR) {
+            if (!canal) canal = canal_criar(nome);
+            if (canal) {
+                canal->membros[remetente] = 1;
+                aceito = 1;
+            }
+        } else if (pedido[1] == CANAL_SAIR && canal && canal->membros[remetente]) {
+            canal->membros[remetente] = 0;
+            aceito = 1;
+        }
+    }
+    responder(remetente, pedido[0], aceito, -1);
+}
+
+// Página do histórico: {id do pedido, antes da sequência (0 = mais recentes), quantidade, nome}.
+// Só membros leem o histórico. A resposta leva as mensagens de sequência imediatamente
+// anterior, da mais antiga para a mais nova, ainda guardadas pelo mestre
+static void tratar_historico(int remetente, const int* pedido, int comprimento) {
+    if (comprimento < 3 * (int)sizeof(int) + TAMANHO_NOME_CANAL) return;
+    char nome[TAMANHO_NOME_CANAL];
+    nome_canal(nome, (const char*)(pedido + 3));
+    Canal* canal = canal_do_pedido(remetente, nome);
+    int cabecalho[6] = {pedido[0], 0, 0, 0, 0, 0};
+    if (!canal || !canal->membros[remetente]) {
+        correio_enfileirar(remetente, QUADRO_PAGINA_HISTORICO, cabecalho, sizeof(cabecalho));
+        return;
+    }
+
+    int primeira_guardada = canal->total > MAX_HISTORICO_CANAL ? canal->total - MAX_HISTORICO_CANAL + 1 : 1;
+    int fim = pedido[1] > 0 && pedido[1] <= canal->total + 1 ? pedido[1] : canal->total + 1;  // Exclusivo
+    int quantidade = pedido[2] > 0 && pedido[2] < MENSAGENS_POR_PAGINA ? pedido[2] : MENSAGENS_POR_PAGINA;
+    int inicio = fim - quantidade > primeira_guardada ? fim - quantidade : primeira_guardada;
+    if (inicio > fim) inicio = fim;
+
+    int tamanho = sizeof(cabecalho);
+    for (int s = inicio; s < fim; s++) {
+        tamanho += TAMANHO_MENSAGEM_CHAT(canal->historico[(s - 1) % MAX_HISTORICO_CANAL]);
+    }
+    char* resposta = calloc(1, tamanho);
+    cabecalho[1] = 1;
+    cabecalho[2] = canal->total;
+    cabecalho[3] = primeira_guardada;
+    cabecalho[4] = fim - inicio;
+    memcpy(resposta, cabecalho, sizeof(cabecalho));
+    char* p = resposta + sizeof(cabecalho);
+    for (int s = inicio; s < fim; s++) {
+        MensagemChat* mensagem = canal->historico[(s - 1) % MAX_HISTORICO_CANAL];
+        memcpy(p, mensagem, sizeof(MensagemChat) + mensagem->comprimento);
+        p += TAMANHO_MENSAGEM_CHAT(mensagem);
+    }
+    correio_enfileirar(remetente, QUADRO_PAGINA_HISTORICO, resposta, tamanho);
+    free(resposta);
+}
+
+static void salas_remover_membro(int rank) {
+    for (int i = 0; i < salas.num_canais; i++) {
+        salas.canais[i].membros[rank] = 0;
+    }
+}
+
+// Envia a cada usuário, num único pacote, as mensagens acumuladas desde a última entrega.
+// Sem forcar, no máximo uma vez a cada INTERVALO_ENTREGA_CHAT_MS
+static void salas_despachar(int forcar) {
+    if (!salas.entrega) return;
+    int64_t agora = instante_ns(CLOCK_MONOTONIC);
+    if (!forcar && agora - salas.ultima_entrega < (int64_t)INTERVALO_ENTREGA_CHAT_MS * 1000000) return;
+    salas.ultima_entrega = agora;
+    for (int destino = 0; destino < size_global; destino++) {
+        Pacote* pacote = &salas.entrega[destino];
+        if (pacote->tamanho == 0) continue;
+        enviar_sem_bloquear(pacote->dados, pacote->tamanho, &destino, 1, TAG_CHAT);
+        memset(pacote, 0, sizeof(Pacote));
+    }
+}
+
+// Acrescenta o delta ao pacote de difusão do coordenador; ele sai no próximo despacho,
+// junto com os demais deltas produzidos pelos pedidos do mesmo lote de mensagens
+void difundir_atualizacao(Atualizacao* at, const char* texto, int comprimento) {
+    // Versão e posição no pacote juntas: os deltas saem na ordem das versões
+    pthread_mutex_lock(&correio.difusao_mutex);
+    at->coordenador = particao_local;
+    at->documento = documento_ativo;
+    at->versao = ++versao_coordenador[particao_local];  // Cada coordenador tem sua própria sequência de versões (por documento)
+    if (documento_ativo == DOCUMENTO_PRINCIPAL) {
+        snapshot_periodico.atualizacoes_desde_ultimo++;
+    }
+    at->comprimento = comprimento;
+    Atualizacao* quadro = pacote_reservar(&correio.difusao, QUADRO_ATUALIZACAO, sizeof(Atualizacao) + comprimento, at->versao);
+    memcpy(quadro, at, sizeof(Atualizacao));
+    if (comprimento > 0) {
+        memcpy(quadro->texto, texto, comprimento);
+    }
+    pthread_mutex_unlock(&correio.difusao_mutex);
+}
+
+// Envia o pacote de deltas do principal só aos filhos na árvore binomial; os demais recebem
+// por repasse. Os de outro documento vão direto aos assinantes dele, e a mais ninguém.
+// Com tratadores, o pacote vai para a fila da thread de difusão
+static void difusao_despachar() {
+    pthread_mutex_lock(&correio.difusao_mutex);
+    if (correio.difusao.tamanho == 0) {
+        pthread_mutex_unlock(&correio.difusao_mutex);
+        return;
+    }
+    int filhos[size_global];
+    int num_filhos = 0;
+    if (documento_ativo == DOCUMENTO_PRINCIPAL) {
+        num_filhos = filhos_na_arvore(rank_global, filhos);
+    } else {
+        const char* assinantes = documentos.estados[documento_ativo]->assinantes;
+        for (int rank = 0; rank < size_global; rank++) {
+            if (assinantes[rank]) filhos[num_filhos++] = rank;
+        }
+    }
+    if (tratadores.num > 0) {
+        DifusaoPendente* pendente = malloc(sizeof(DifusaoPendente));
+        pendente->dados = correio.difusao.dados;
+        pendente->tamanho = correio.difusao.tamanho;
+        pendente->num_destinos = num_filhos;
+        pendente->destinos = malloc((num_filhos + 1) * sizeof(int));
+        memcpy(pendente->destinos, filhos, num_filhos * sizeof(int));
+        pendente->proximo = NULL;
+        pthread_mutex_lock(&tratadores.difusao_mutex);
+        if (tratadores.ultima) {
+            tratadores.ultima->proximo = pendente;
+        } else {
+            tratadores.primeira = pendente;
+        }
+        tratadores.ultima = pendente;
+        pthread_cond_signal(&tratadores.difusao_sinal);
+        pthread_mutex_unlock(&tratadores.difusao_mutex);
+    } else {
+        enviar_sem_bloquear(correio.difusao.dados, correio.difusao.tamanho, filhos, num_filhos, TAG_ATUALIZACAO);
+    }
+    memset(&correio.difusao, 0, sizeof(Pacote));
+    pthread_mutex_unlock(&correio.difusao_mutex);
+}
+
+// ---------------------------------------------------------------------------
+// Documentos hospedados: registro por nome no mestre, assinaturas e troca do
+// documento carregado nas variáveis globais
+// ---------------------------------------------------------------------------
+
+// FNV-1a do nome: balde inicial na tabela de nomes
+static unsigned int hash_nome_documento(const char* nome) {
+    unsigned int hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)nome; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+// Nomes viram parte do nome do journal: só letras, dígitos, '-' e '_'
+static int nome_documento_valido(const char* nome) {
+    int comprimento = strlen(nome);
+    if (comprimento == 0 || comprimento >= TAMANHO_NOME_DOCUMENTO) return 0;
+    for (int i = 0; i < comprimento; i++) {
+        if (!isalnum((unsigned char)nome[i]) && nome[i] != '-' && nome[i] != '_') return 0;
+    }
+    return 1;
+}
+
+static EstadoDocumento* estado_criar(const char* nome) {
+    EstadoDocumento* estado = calloc(1, sizeof(EstadoDocumento));
+    snprintf(estado->nome, sizeof(estado->nome), "%s", nome);
+    estado->historico = calloc(1, sizeof(HistoricoTrechos));
+    estado->versoes = calloc(num_coordenadores, sizeof(int));
+    estado->aguardando = calloc(num_coordenadores, sizeof(int));
+    estado->recepcao = calloc(num_coordenadores, sizeof(RecepcaoEstado));
+    estado->historico_linhas = calloc(1, sizeof(HistoricoLinhas));
+    estado->assinantes = calloc(size_global, 1);
+    return estado;
+}
+
+static void estado_liberar(EstadoDocumento* estado) {
+    documento_limpar(&estado->documento);
+    for (int f = 0; f < FAIXAS_BLOQUEIO; f++) {
+        FaixaBloqueios* faixa = &estado->bloqueios.faixas[f];
+        for (int i = 0; i < faixa->total; i++) {
+            PedidoEmEspera* espera = faixa->entradas[i].primeiro;
+            while (espera) {
+                PedidoEmEspera* proximo = espera->proximo;
+                free(espera);
+                espera = proximo;
+            }
+        }
+        free(faixa->entradas);
+    }
+    free(estado->historico);
+    free(estado->versoes);
+    free(estado->aguardando);
+    recepcoes_liberar(estado->recepcao);
+    historico_linhas_liberar(estado->historico_linhas);
+    free(estado->historico_linhas);
+    free(estado->assinantes);
+    if (estado->journal) fclose(estado->journal);
+    free(estado);
+}
+
+// Id do documento com o nome, ou -1 (sondagem linear a partir do balde do hash)
+static int documento_buscar(const char* nome) {
+    for (unsigned int b = hash_nome_documento(nome) % BALDES_DOCUMENTOS; documentos.baldes[b];
+         b = (b + 1) % BALDES_DOCUMENTOS) {
+        int id = documentos.baldes[b] - 1;
+        if (strcmp(documentos.estados[id]->nome, nome) == 0) return id;
+    }
+    return -1;
+}
+
+static void documento_registrar_nome(int id) {
+    unsigned int b = hash_nome_documento(documentos.estados[id]->nome) % BALDES_DOCUMENTOS;
+    while (documentos.baldes[b]) {
+        b = (b + 1) % BALDES_DOCUMENTOS;
+    }
+    documentos.baldes[b] = id + 1;
+}
+
+void documentos_iniciar() {
+    // O estado do principal já está nas variáveis globais: o registro guarda os mesmos
+    // ponteiros, que continuam sendo liberados (ou não) por quem os criou
+    EstadoDocumento* principal = calloc(1, sizeof(EstadoDocumento));
+    snprintf(principal->nome, sizeof(principal->nome), "%s", NOME_DOCUMENTO_PRINCIPAL);
+    principal->historico = historico;
+    principal->versoes = versao_coordenador;
+    principal->aguardando = aguardando_ressincronizacao;
+    principal->recepcao = recepcao_estado;
+    principal->historico_linhas = historico_linhas;
+    principal->assinantes = calloc(size_global, 1);
+    documentos.estados[DOCUMENTO_PRINCIPAL] = principal;
+    documentos.num_documentos = 1;
+    documentos.carregado = DOCUMENTO_PRINCIPAL;
+    if (rank_global == MASTER || eh_reserva(rank_global)) {  // Uma reserva pode vir a hospedar documentos
+        documento_registrar_nome(DOCUMENTO_PRINCIPAL);
+        documentos.do_remetente = calloc(size_global, sizeof(int));
+    }
+}
+
+void documentos_finalizar() {
+    documento_carregar(DOCUMENTO_PRINCIPAL);
+    documento_ativo = DOCUMENTO_PRINCIPAL;
+    for (int id = 0; id < MAX_DOCUMENTOS; id++) {
+        if (!documentos.estados[id]) continue;
+        if (id == DOCUMENTO_PRINCIPAL) {
+            // Réplica, históricos, versões e journal do principal continuam nas variáveis globais
+            free(documentos.estados[id]->assinantes);
+            free(documentos.estados[id]);
+        } else {
+            estado_liberar(documentos.estados[id]);
+        }
+        documentos.estados[id] = NULL;
+    }
+    free(documentos.do_remetente);
+    memset(&documentos, 0, sizeof(documentos));
+}
+
+// Guarda o estado do documento carregado no registro e põe o do documento id no lugar. O
+// índice de busca acompanha só o principal: fica desligado enquanto outro está carregado
+static void documento_carregar(int id) {
+    if (id == documentos.carregado) return;
+    EstadoDocumento* atual = documentos.estados[documentos.carregado];
+    EstadoDocumento* novo = documentos.estados[id];
+    if (documentos.carregado == DOCUMENTO_PRINCIPAL) {
+        documentos.indice_principal = indice_busca.ativo;
+        indice_busca.ativo = 0;
+    }
+    atual->documento = documento;
+    atual->bloqueios = tabela_bloqueios;
+    atual->historico = historico;
+    atual->versoes = versao_coordenador;
+    atual->aguardando = aguardando_ressincronizacao;
+    atual->recepcao = recepcao_estado;
+    atual->historico_linhas = historico_linhas;
+    atual->journal = journal.destino;
+
+    documento = novo->documento;
+    tabela_bloqueios = novo->bloqueios;
+    historico = novo->historico;
+    versao_coordenador = novo->versoes;
+    aguardando_ressincronizacao = novo->aguardando;
+    recepcao_estado = novo->recepcao;
+    historico_linhas = novo->historico_linhas;
+    journal.destino = novo->journal;
+    if (id == DOCUMENTO_PRINCIPAL) {
+        indice_busca.ativo = documentos.indice_principal;
+    }
+    documentos.carregado = id;
+}
+
+// Os deltas acumulados pertencem ao documento carregado e saem para a audiência dele
+// antes da troca
+static void documento_ativar(int id) {
+    if (id == documento_ativo && id == documentos.carregado) return;
+    difusao_despachar();
+    documento_carregar(id);
+    documento_ativo = id;
+}
+
+// Cria o documento com linhas vazias e o journal próprio (journal_editor_<nome>.bin)
+static int documento_hospedar(const char* nome) {
+    if (!nome_documento_valido(nome) || documentos.num_documentos == MAX_DOCUMENTOS) return -1;
+    int id = documentos.num_documentos++;
+    EstadoDocumento* estado = estado_criar(nome);
+    documentos.estados[id] = estado;
+    documento_registrar_nome(id);
+    if (journal.ativo) {
+        char caminho[128];
+        snprintf(caminho, sizeof(caminho), "%s_%s.%s", formato_log == FORMATO_LOG_TEXTO ? "log_editor" : "journal_editor", nome,
+                 formato_log == FORMATO_LOG_TEXTO ? "txt" : "bin");
+        estado->journal = fopen(caminho, formato_log == FORMATO_LOG_TEXTO ? "w" : "wb");
+        if (!estado->journal) {
+            fprintf(stderr, "Erro: não foi possível abrir o journal %s\n", caminho);
+        } else if (formato_log == FORMATO_LOG_BINARIO) {
+            fwrite(MAGICO_JOURNAL, 1, 4, estado->journal);
+        }
+    }
+    documento_ativar(id);
+    for (int i = 0; i < LINHAS_DOCUMENTO_NOVO; i++) {
+        documento_inserir_linha(&documento, i, i, "", 0);
+    }
+    if (verbosidade >= VERBOSIDADE_EVENTOS) {
+        printf("[MESTRE] Documento '%s' criado (id %d).\n", nome, id);
+    }
+    return id;
+}
+
+// Abertura: {id do pedido, nome}. Cria o documento no primeiro uso, inclui o remetente entre
+// os assinantes e envia a ele o estado completo; a resposta leva o id do documento
+static void tratar_abrir_documento(int remetente, const char* corpo, int comprimento) {
+    if (comprimento < (int)sizeof(int) + TAMANHO_NOME_DOCUMENTO) return;
+    int id_pedido;
+    char nome[TAMANHO_NOME_DOCUMENTO];
+    memcpy(&id_pedido, corpo, sizeof(int));
+    memcpy(nome, corpo + sizeof(int), TAMANHO_NOME_DOCUMENTO);
+    nome[TAMANHO_NOME_DOCUMENTO - 1] = '\0';
+
+    // A janela do nó reflete só o principal: com ela os usuários não abrem outros documentos
+    int id = documento_buscar(nome);
+    if (id < 0 && !replica_no.ativa) {
+        id = documento_hospedar(nome);
+    }
+    if (id < 0 || (id != DOCUMENTO_PRINCIPAL && replica_no.ativa)) {
+        responder(remetente, id_pedido, 0, -1);
+        return;
+    }
+    if (id != DOCUMENTO_PRINCIPAL) {
+        EstadoDocumento* estado = documentos.estados[id];
+        documento_ativar(id);
+        if (!estado->assinantes[remetente]) {
+            estado->assinantes[remetente] = 1;
+            estado->num_assinantes++;
+        }
+        enviar_estado_completo(remetente);
+        if (verbosidade >= VERBOSIDADE_PEDIDOS) {
+            printf("[MESTRE] Usuario_%d abriu '%s' (%d assinantes)\n", remetente, nome, estado->num_assinantes);
+        }
+    }
+    responder(remetente, id_pedido, 1, id);
+}
+
+// O remetente deixa de receber os deltas do documento e solta o que bloqueava nele
+static void tratar_fechar_documento(int remetente, int id) {
+    if (id <= DOCUMENTO_PRINCIPAL || id >= documentos.num_documentos) return;
+    EstadoDocumento* estado = documentos.estados[id];
+    if (!estado->assinantes[remetente]) return;
+    documento_ativar(id);
+    estado->assinantes[remetente] = 0;
+    estado->num_assinantes--;
+    liberar_bloqueios_de(remetente);
+    if (documentos.do_remetente[remetente] == id) {
+        documentos.do_remetente[remetente] = DOCUMENTO_PRINCIPAL;
+    }
+}
+
+static void documentos_remover_usuario(int rank) {
+    for (int id = 1; id < documentos.num_documentos; id++) {
+        if (documentos.estados[id]->assinantes[rank]) {
+            tratar_fechar_documento(rank, id);
+        }
+    }
+    documentos.do_remetente[rank] = DOCUMENTO_PRINCIPAL;
+    documento_ativar(DOCUMENTO_PRINCIPAL);
+}
+
+// Confere os prazos de cada documento com bloqueios, carregando um de cada vez
+static void expirar_bloqueios_hospedados() {
+    for (int id = 0; id < documentos.num_documentos; id++) {
+        const TabelaBloqueios* tabela = id == documentos.carregado ? &tabela_bloqueios : &documentos.estados[id]->bloqueios;
+        if (bloqueios_total(tabela) == 0) continue;
+        if (id != documentos.carregado) {
+            if (instante_ns(CLOCK_MONOTONIC) - tabela->ultima_verificacao < INTERVALO_EXPIRACAO_MS * 1000000LL) continue;
+            documento_ativar(id);
+        }
+        expirar_bloqueios();
+    }
+}
+
+// Delta recebido por um trabalhador (ou por um coordenador): carrega o documento a que se
+// refere. Documentos não abertos aqui são ignorados; o estado completo de um recém-aberto
+// cria a réplica local
+static int documento_disponivel(const Atualizacao* at) {
+    if (at->documento < 0 || at->documento >= MAX_DOCUMENTOS) return 0;
+    if (!documentos.estados[at->documento]) {
+        if ((at->tipo != ATUALIZACAO_COMPLETA && at->tipo != ATUALIZACAO_BLOCO_ESTADO) || eh_coordenador(rank_global)) return 0;
+        documentos.estados[at->documento] = estado_criar("");
+    }
+    documento_carregar(at->documento);
+    return 1;
+}
+
+// Troca o documento editado e exibido por este usuário. Só sem operações em voo nem
+// bloqueios mantidos: os pedidos seguintes vão ao mestre com o novo contexto
+int documento_usar(int id) {
+    if (id == documento_ativo) return 1;
+    if (id < 0 || id >= MAX_DOCUMENTOS || cliente.em_voo > 0 || cliente.num_mantidos > 0) return 0;
+    pthread_mutex_lock(&progresso.mutex);
+    int recebido = documentos.estados[id] && (id == DOCUMENTO_PRINCIPAL || documentos.estados[id]->recebido);
+    if (recebido) {
+        documento_carregar(id);
+        documento_ativo = id;
+    }
+    pthread_mutex_unlock(&progresso.mutex);
+    if (recebido) {
+        correio_enfileirar(rank_da_particao(0), QUADRO_DOCUMENTO, &id, sizeof(int));
+        correio_despachar();
+    }
+    return recebido;
+}
+
+// (Re)começa a transferência na versão atual do documento carregado. Os blocos de uma
+// versão anterior que já saíram são descartados pelo destino, que confere a versão
+static void transferencia_recomecar(Transferencia* t) {
+    t->versao = versao_coordenador[particao_local];
+    t->tamanho = medir_linhas(&documento, t->coordenador, &t->quantidade);
+    Linha* primeira = linha_da_particao(documento_primeira(&documento), t->coordenador);
+    t->proxima_linha = primeira ? primeira->id : -1;
+    t->enviado = 0;
+}
+
+static int transferencia_concluida(const Transferencia* t) {
+    return t->enviado >= t->tamanho || (t->enviado > 0 && t->proxima_linha < 0);
+}
+
+// Serializa, comprime e envia o próximo bloco de um estado completo (com o documento
+// carregado e travado), num pacote próprio e direto ao destino: estados completos não
+// são repassados na árvore
+static void transferencia_enviar_bloco(Transferencia* t) {
+    Linha* linha = t->proxima_linha >= 0 ? documento_por_id(&documento, t->proxima_linha) : NULL;
+    int comprimento;
+    char* fatia = serializar_fatia(&documento, t->coordenador, t->enviado == 0 ? t->quantidade : -1, &linha,
+                                   TAMANHO_BLOCO_ESTADO, &comprimento);
+    t->proxima_linha = linha ? linha->id : -1;
+    uLongf comprimido = compressBound(comprimento);
+    char* temporario = malloc(comprimido);
+    compress2((Bytef*)temporario, &comprimido, (const Bytef*)fatia, comprimento, Z_BEST_SPEED);
+    free(fatia);
+
+    Pacote pacote = {0};
+    Atualizacao* mensagem = pacote_reservar(&pacote, QUADRO_ATUALIZACAO,
+                                            sizeof(Atualizacao) + sizeof(BlocoEstado) + comprimido, t->versao);
+    memset(mensagem, 0, sizeof(Atualizacao));
+    mensagem->tipo = ATUALIZACAO_BLOCO_ESTADO;
+    mensagem->coordenador = particao_local;
+    mensagem->documento = t->documento;
+    mensagem->versao = t->versao;
+    mensagem->comprimento = sizeof(BlocoEstado) + comprimido;
+    BlocoEstado bloco = {t->tipo_estado, t->tamanho, t->enviado, comprimento};
+    memcpy(mensagem->texto, &bloco, sizeof(BlocoEstado));
+    memcpy(mensagem->texto + sizeof(BlocoEstado), temporario, comprimido);
+    free(temporario);
+    enviar_sem_bloquear(pacote.dados, pacote.tamanho, &t->destino, 1, TAG_ATUALIZACAO);
+    t->enviado += comprimento;
+    t->comprimido += comprimido;
+}
+
+// Envia o documento e os bloqueios a um trabalhador que perdeu alguma versão (ou acabou
+// de abrir o documento). Com vários coordenadores, cada um envia apenas o estado oficial
+// da sua partição. O primeiro bloco sai já, à frente dos deltas posteriores a esta versão;
+// os demais são serializados aos poucos por transferencias_progredir
+void enviar_estado_completo(int destino) {
+    Transferencia* t = calloc(1, sizeof(Transferencia));
+    t->destino = destino;
+    t->documento = documento_ativo;
+    t->tipo_estado = num_coordenadores > 1 && documento_ativo == DOCUMENTO_PRINCIPAL ? ATUALIZACAO_PARTICAO : ATUALIZACAO_COMPLETA;
+    t->coordenador = t->tipo_estado == ATUALIZACAO_PARTICAO ? rank_da_particao(particao_local) : -1;  // Numa reserva, a do mestre
+    transferencia_recomecar(t);
+    transferencia_enviar_bloco(t);
+    if (transferencia_concluida(t)) {
+        free(t);
+        return;
+    }
+    pthread_mutex_lock(&transferencias.mutex);
+    if (transferencias.ultima) {
+        transferencias.ultima->proxima = t;
+    } else {
+        transferencias.primeira = t;
+    }
+    transferencias.ultima = t;
+    pthread_mutex_unlock(&transferencias.mutex);
+}
+
+// Envia mais um bloco de cada estado pendente, se houver vagas de envio sobrando.
+// Chamada pelo loop do coordenador fora das travas do documento: trava-o a cada bloco
+int transferencias_progredir() {
+    pthread_mutex_lock(&transferencias.mutex);
+    Transferencia* lista = transferencias.primeira;
+    transferencias.primeira = transferencias.ultima = NULL;
+    pthread_mutex_unlock(&transferencias.mutex);
+    if (!lista) return 0;
+
+    Transferencia* restantes = NULL;
+    Transferencia* ultima = NULL;
+    int ativas = 0;
+    while (lista) {
+        Transferencia* t = lista;
+        lista = t->proxima;
+        pthread_mutex_lock(&envios_mutex);
+        int ocupadas = recolher_envios();
+        pthread_mutex_unlock(&envios_mutex);
+        if ((ocupadas < VAGAS_ENVIO / 2 || t->de_uma_vez) && !reservas.perdido[t->destino]) {
+            travar_documento(1);
+            documento_ativar(t->documento);
+            if (versao_coordenador[particao_local] != t->versao ||
+                (t->proxima_linha >= 0 && !documento_por_id(&documento, t->proxima_linha))) {
+                // O documento mudou entre dois blocos: o restante não combina com o que já
+                // foi. Recomeça na versão atual e, para que uma edição a cada volta do loop
+                // não o faça recomeçar para sempre, envia todos os blocos nesta passada
+                transferencia_recomecar(t);
+                t->de_uma_vez = 1;
+                if (verbosidade >= VERBOSIDADE_EVENTOS) {
+                    printf("[%s] Estado para Usuario_%d recomeçado na versão %d\n", nome_processo, t->destino, t->versao);
+                }
+            }
+            do {
+                transferencia_enviar_bloco(t);
+            } while (t->de_uma_vez && !transferencia_concluida(t));
+            if (tratadores.num > 0 && documento_ativo != DOCUMENTO_PRINCIPAL) {
+                documento_ativar(DOCUMENTO_PRINCIPAL);  // Deixa o principal carregado para os quadros em paralelo
+            }
+            destravar_documento();
+        }
+        if (transferencia_concluida(t) || reservas.perdido[t->destino]) {
+            if (verbosidade >= VERBOSIDADE_EVENTOS) {
+                printf("[%s] Estado enviado a Usuario_%d: %d bytes, %ld comprimidos\n", nome_processo, t->destino,
+                       t->tamanho, t->comprimido);
+            }
+            free(t);
+            continue;
+        }
+        t->proxima = NULL;
+        if (ultima) {
+            ultima->proxima = t;
+        } else {
+            restantes = t;
+        }
+        ultima = t;
+        ativas++;
+    }
+
+    // Os que chegaram enquanto isso ficam depois dos que já estavam a caminho
+    if (restantes) {
+        pthread_mutex_lock(&transferencias.mutex);
+        ultima->proxima = transferencias.primeira;
+        if (!transferencias.primeira) transferencias.ultima = ultima;
+        transferencias.primeira = restantes;
+        pthread_mutex_unlock(&transferencias.mutex);
+    }
+    return ativas;
+}
+
+// Descarta os estados ainda não enviados: no encerramento ninguém mais espera por eles
+void transferencias_finalizar() {
+    pthread_mutex_lock(&transferencias.mutex);
+    while (transferencias.primeira) {
+        Transferencia* t = transferencias.primeira;
+        transferencias.primeira = t->proxima;
+        free(t);
+    }
+    transferencias.ultima = NULL;
+    pthread_mutex_unlock(&transferencias.mutex);
+}
+
+// Comprime o estado serializado em blocos de TAMANHO_BLOCO_ESTADO, em paralelo. O resultado
+// começa pelo tamanho comprimido de cada bloco, seguido dos blocos na ordem
+char* comprimir_estado(const char* dados, int tamanho, int* tamanho_comprimido) {
+    int num_blocos = (tamanho + TAMANHO_BLOCO_ESTADO - 1) / TAMANHO_BLOCO_ESTADO;
+    char** blocos = malloc((num_blocos + 1) * sizeof(char*));
+    int* tamanhos = malloc((num_blocos + 1) * sizeof(int));
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < num_blocos; b++) {
+        int comprimento = tamanho - b * TAMANHO_BLOCO_ESTADO < TAMANHO_BLOCO_ESTADO ? tamanho - b * TAMANHO_BLOCO_ESTADO : TAMANHO_BLOCO_ESTADO;
+        uLongf comprimido = compressBound(comprimento);
+        blocos[b] = malloc(comprimido);
+        compress2((Bytef*)blocos[b], &comprimido, (const Bytef*)dados + (long)b * TAMANHO_BLOCO_ESTADO, comprimento, Z_BEST_SPEED);
+        tamanhos[b] = comprimido;
+    }
+
+    long total = (long)num_blocos * sizeof(int);
+    for (int b = 0; b < num_blocos; b++) {
+        total += tamanhos[b];
+    }
+    char* resultado = malloc(total > 0 ? total : 1);
+    memcpy(resultado, tamanhos, num_blocos * sizeof(int));
+    long posicao = (long)num_blocos * sizeof(int);
+    for (int b = 0; b < num_blocos; b++) {
+        memcpy(resultado + posicao, blocos[b], tamanhos[b]);
+        posicao += tamanhos[b];
+        free(blocos[b]);
+    }
+    free(blocos);
+    free(tamanhos);
+    *tamanho_comprimido = total;
+    return resultado;
+}
+
+// Desfaz comprimir_estado em destino, que tem o tamanho original; blocos em paralelo
+int descomprimir_estado(const char* comprimido, int tamanho_comprimido, char* destino, int tamanho) {
+    int num_blocos = (tamanho + TAMANHO_BLOCO_ESTADO - 1) / TAMANHO_BLOCO_ESTADO;
+    if ((long)num_blocos * sizeof(int) > (unsigned long)tamanho_comprimido) return 0;
+    long* inicio = malloc((num_blocos + 1) * sizeof(long));
+    inicio[0] = (long)num_blocos * sizeof(int);
+    for (int b = 0; b < num_blocos; b++) {
+        int bloco;
+        memcpy(&bloco, comprimido + b * sizeof(int), sizeof(int));
+        inicio[b + 1] = inicio[b] + bloco;
+    }
+    int valido = inicio[num_blocos] == tamanho_comprimido;
+
+    #pragma omp parallel for schedule(dynamic) reduction(&&:valido)
+    for (int b = 0; b < num_blocos; b++) {
+        if (!valido) continue;
+        uLongf comprimento = tamanho - b * TAMANHO_BLOCO_ESTADO < TAMANHO_BLOCO_ESTADO ? tamanho - b * TAMANHO_BLOCO_ESTADO : TAMANHO_BLOCO_ESTADO;
+        uLongf esperado = comprimento;
+        if (uncompress((Bytef*)destino + (long)b * TAMANHO_BLOCO_ESTADO, &comprimento,
+                       (const Bytef*)comprimido + inicio[b], inicio[b + 1] - inicio[b]) != Z_OK || comprimento != esperado) {
+            valido = 0;
+        }
+    }
+    free(inicio);
+    return valido;
+}
+
+static int comparar_versao_delta(const void* a, const void* b) {
+    const Atualizacao* x = *(Atualizacao* const*)a;
+    const Atualizacao* y = *(Atualizacao* const*)b;
+    return (x->versao > y->versao) - (x->versao < y->versao);
+}
+
+// Guarda uma cópia do delta para reaplicá-lo sobre o estado completo que está a caminho
+static void guardar_delta_pendente(RecepcaoEstado* recepcao, const Atualizacao* at) {
+    if (recepcao->num_pendentes == MAX_DELTAS_PENDENTES) return;  // A lacuna reaparece depois do estado e é pedida de novo
+    if (recepcao->num_pendentes == recepcao->capacidade_pendentes) {
+        recepcao->capacidade_pendentes = recepcao->capacidade_pendentes ? recepcao->capacidade_pendentes * 2 : 64;
+        recepcao->pendentes = realloc(recepcao->pendentes, recepcao->capacidade_pendentes * sizeof(Atualizacao*));
+    }
+    Atualizacao* copia = malloc(sizeof(Atualizacao) + at->comprimento);
+    memcpy(copia, at, sizeof(Atualizacao) + at->comprimento);
+    recepcao->pendentes[recepcao->num_pendentes++] = copia;
+}
+
+// Monta o estado completo de um coordenador bloco a bloco. No último bloco o estado é
+// aplicado como um delta COMPLETA/PARTICAO, e os deltas guardados desde o pedido são
+// reaplicados em ordem: os anteriores ao estado são ignorados pela versão
+static int receber_bloco_estado(Atualizacao* at, int origem) {
+    RecepcaoEstado* recepcao = &recepcao_estado[origem];
+    BlocoEstado bloco;
+    if (at->comprimento < (int)sizeof(BlocoEstado)) return 0;
+    memcpy(&bloco, at->texto, sizeof(BlocoEstado));
+    if (bloco.total < 0 || bloco.comprimento < 0) return 0;
+
+    if (bloco.deslocamento == 0) {
+        // Primeiro bloco: recomeça, mesmo que um estado anterior não tenha terminado. Os
+        // deltas que chegarem antes do último bloco ficam guardados, sem novo pedido
+        free(recepcao->estado);
+        recepcao->estado = malloc(sizeof(Atualizacao) + bloco.total);
+        *recepcao->estado = *at;
+        recepcao->estado->tipo = bloco.tipo_estado;
+        recepcao->estado->comprimento = bloco.total;
+        recepcao->total = bloco.total;
+        recepcao->recebidos = 0;
+        aguardando_ressincronizacao[origem] = 1;
+    }
+    if (!recepcao->estado || at->versao != recepcao->estado->versao || bloco.deslocamento != recepcao->recebidos ||
+        bloco.total != recepcao->total || bloco.comprimento > recepcao->total - recepcao->recebidos) {
+        return 0;  // Bloco de um estado já substituído por outro
+    }
+    uLongf comprimento = bloco.comprimento;
+    if (uncompress((Bytef*)recepcao->estado->texto + bloco.deslocamento, &comprimento,
+                   (const Bytef*)at->texto + sizeof(BlocoEstado), at->comprimento - sizeof(BlocoEstado)) != Z_OK ||
+        comprimento != (uLongf)bloco.comprimento) {
+        fprintf(stderr, "Erro: bloco de estado corrompido recebido de %d.\n", origem);
+        free(recepcao->estado);
+        recepcao->estado = NULL;
+        return 0;
+    }
+    recepcao->recebidos += bloco.comprimento;
+    if (recepcao->recebidos < recepcao->total) return 0;
+
+    Atualizacao* estado = recepcao->estado;
+    recepcao->estado = NULL;
+    processar_atualizacao(estado, origem);
+    if (estado->tipo == ATUALIZACAO_COMPLETA) {
+        documentos.estados[at->documento]->recebido = 1;
+    }
+    free(estado);
+
+    Atualizacao** pendentes = recepcao->pendentes;
+    int num_pendentes = recepcao->num_pendentes;
+    recepcao->pendentes = NULL;
+    recepcao->num_pendentes = recepcao->capacidade_pendentes = 0;
+    qsort(pendentes, num_pendentes, sizeof(Atualizacao*), comparar_versao_delta);
+    for (int i = 0; i < num_pendentes; i++) {
+        processar_atualizacao(pendentes[i], origem);
+        free(pendentes[i]);
+    }
+    free(pendentes);
+    return 1;
+}
+
+// Libera as recepções de um documento, uma por coordenador de origem
+void recepcoes_liberar(RecepcaoEstado* recepcoes) {
+    if (!recepcoes) return;
+    for (int c = 0; c < num_coordenadores; c++) {
+        free(recepcoes[c].estado);
+        for (int i = 0; i < recepcoes[c].num_pendentes; i++) {
+            free(recepcoes[c].pendentes[i]);
+        }
+        free(recepcoes[c].pendentes);
+    }
+    free(recepcoes);
+}
+
+// Aplica um delta na réplica local. O mestre usa a mesma função antes de difundir,
+// garantindo que todas as réplicas executem exatamente as mesmas operações.
+int aplicar_atualizacao(Atualizacao* at) {
+    Linha* linha = documento_por_id(&documento, at->id);
+
+    switch (at->tipo) {
+        case ATUALIZACAO_TEXTO:
+            if (!linha) return 0;
+            documento_alterar_texto(linha, at->texto, at->comprimento);
+            linha->dono_bloqueio = at->dono_bloqueio;
+            if (at->revisao > 0) linha->revisao = at->revisao;  // Journal não traz a revisão: conta localmente
+            return 1;
+        case ATUALIZACAO_TRECHO:
+            if (!linha) return 0;
+            documento_editar_trecho(linha, at->deslocamento, at->apagar, at->texto, at->comprimento);
+            if (at->revisao > 0) linha->revisao = at->revisao;
+            return 1;
+        case ATUALIZACAO_BLOQUEIO:
+            if (!linha) return 0;
+            linha->dono_bloqueio = at->dono_bloqueio;
+            return 1;
+        case ATUALIZACAO_BLOQUEIOS:
+            for (int i = 0; i < at->comprimento / (int)sizeof(int); i++) {
+                int id;
+                memcpy(&id, at->texto + i * sizeof(int), sizeof(int));
+                Linha* bloqueada = documento_por_id(&documento, id);
+                if (bloqueada) bloqueada->dono_bloqueio = at->dono_bloqueio;
+            }
+            return 1;
+        case ATUALIZACAO_LOTE:
+            aplicar_particao(&documento, at->texto, at->comprimento);  // Mesmo formato, linhas localizadas pelo id
+            return 1;
+        case ATUALIZACAO_INSERIR:
+            documento_inserir_linha(&documento, at->linha, at->id_novo, "", 0);
+            return 1;
+        case ATUALIZACAO_REMOVER:
+            if (!linha) return 0;
+            documento_remover_linha(&documento, documento_indice(linha));
+            return 1;
+        case ATUALIZACAO_DIVIDIR:
+            if (!linha) return 0;
+            documento_dividir_linha(&documento, documento_indice(linha), at->deslocamento, at->id_novo);
+            return 1;
+        case ATUALIZACAO_JUNTAR:
+            if (!linha) return 0;
+            documento_juntar_linhas(&documento, documento_indice(linha));
+            return 1;
+    }
+    return 0;
+}
+
+// Recebe um pacote de atualizações pendente de qualquer coordenador e aplica na cópia local.
+// Retorna 1 se o documento local mudou, 0 se todas as atualizações foram descartadas.
+int receber_atualizacao() {
+    MPI_Status status;
+    int tamanho;
+    MPI_Probe(MPI_ANY_SOURCE, TAG_ATUALIZACAO, MPI_COMM_WORLD, &status);
+    MPI_Get_count(&status, MPI_BYTE, &tamanho);
+
+    char* pacote = malloc(tamanho);
+    MPI_Recv(pacote, tamanho, MPI_BYTE, status.MPI_SOURCE, TAG_ATUALIZACAO, MPI_COMM_WORLD, &status);
+    metrica_mensagem(METRICA_RECEBIDA, TAG_ATUALIZACAO, tamanho);
+    // Sem a thread de progresso nenhum outro envio concorre: repassa antes de aplicar, e os filhos não esperam
+    int repassado = retransmitir_pacote(pacote, tamanho);
+    int64_t inicio = instante_ns(CLOCK_MONOTONIC);
+    int aplicada = processar_pacote(pacote, tamanho);
+    metrica_tempo(&metricas_locais()->aplicacao, instante_ns(CLOCK_MONOTONIC) - inicio);
+    if (!repassado) {
+        free(pacote);
+    }
+    return aplicada;
+}
+
+// Aplica, na ordem, os deltas de um pacote, cada um na réplica do seu documento. Retorna 1
+// se algum mudou o documento em uso
+static int processar_pacote(char* pacote, int tamanho) {
+    int aplicada = 0;
+    int posicao = 0;
+    const Quadro* quadro;
+    while ((quadro = proximo_quadro(pacote, tamanho, &posicao)) != NULL) {
+        if (quadro->tipo != QUADRO_ATUALIZACAO || quadro->comprimento < sizeof(Atualizacao)) continue;
+        Atualizacao* at = (Atualizacao*)CORPO_QUADRO(quadro);
+        if (at->comprimento > (int)(quadro->comprimento - sizeof(Atualizacao))) {
+            at->comprimento = quadro->comprimento - sizeof(Atualizacao);
+        }
+        if (!documento_disponivel(at)) continue;
+        if (processar_atualizacao(at, at->coordenador)) {
+            aplicada |= at->documento == documento_ativo;
+            if (at->tipo == ATUALIZACAO_COMPLETA) {
+                documentos.estados[at->documento]->recebido = 1;
+            }
+        }
+    }
+    documento_carregar(documento_ativo);
+    if (replica_no.escritor && replica_no.esgotada && replica_no.cabecalho) {
+        janela_entregar_replicas();
+    } else if (replica_no.escritor) {
+        janela_concluir_escrita();  // Os leitores do nó veem o pacote inteiro como uma única versão
+    }
+    return aplicada;
+}
+
+// Aplica uma atualização já recebida de um coordenador. As versões são acompanhadas
+// separadamente por coordenador de origem; lacunas disparam um pedido de ressincronização.
+static int processar_atualizacao(Atualizacao* at, int origem) {
+    int aplicada = 0;
+
+    if (at->tipo == ATUALIZACAO_BLOCO_ESTADO) {
+        return receber_bloco_estado(at, origem);  // Aplicado só quando o último bloco chega
+    }
+
+    if (at->tipo == ATUALIZACAO_REPLICA) {
+        // A janela do nó esgotou: a réplica do escritor, com as versões de todas as partições,
+        // passa a ser a deste leitor, e os deltas chegam repassados por ele
+        int tamanho_versoes = num_coordenadores * sizeof(int);
+        if (!replica_no.cabecalho || replica_no.escritor || at->comprimento < tamanho_versoes) return 0;
+        memcpy(versao_coordenador, at->texto, tamanho_versoes);
+        desserializar_documento(&documento, at->texto + tamanho_versoes, at->comprimento - tamanho_versoes);
+        __atomic_store_n(&replica_no.cabecalho, NULL, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    if (at->tipo == ATUALIZACAO_COMPLETA || at->tipo == ATUALIZACAO_PARTICAO) {
+        // Substitui a cópia local (ou a partição da origem) e retoma a sequência a partir desta versão
+        if (at->tipo == ATUALIZACAO_COMPLETA) {
+            desserializar_documento(&documento, at->texto, at->comprimento);
+        } else {
+            aplicar_particao(&documento, at->texto, at->comprimento);
+        }
+        versao_coordenador[origem] = at->versao;
+        aguardando_ressincronizacao[origem] = 0;
+        aplicada = 1;
+    } else if (at->versao == versao_coordenador[origem] + 1) {
+        // Delta na sequência esperada: aplica no lugar
+        aplicar_atualizacao(at);
+        versao_coordenador[origem] = at->versao;
+        snapshot_periodico.atualizacoes_desde_ultimo++;
+        estatisticas.contadores[CONTADOR_ATUALIZACOES]++;
+        if ((at->tipo == ATUALIZACAO_TEXTO || at->tipo == ATUALIZACAO_TRECHO || at->tipo == ATUALIZACAO_LOTE) &&
+            at->instante_origem && at->autor != rank_global) {
+            registrar_latencia(estatisticas.latencia_propagacao, instante_ns(CLOCK_REALTIME) - at->instante_origem);
+        }
+        if (aguardando_ressincronizacao[origem]) {
+            // A lacuna pode ter sido só reordenação: o estado pedido talvez seja anterior a este delta
+            guardar_delta_pendente(&recepcao_estado[origem], at);
+        }
+        aplicada = 1;
+    } else if (at->versao > versao_coordenador[origem] + 1) {
+        // Lacuna de versões: pede o estado completo uma única vez e guarda os deltas até
+        // recebê-lo. Sai na hora: quem detecta a lacuna pode ser a thread de progresso ou um coordenador
+        if (!aguardando_ressincronizacao[origem]) {
+            // As lacunas do principal no que vem do mestre são atendidas por uma reserva, se houver
+            int destino = rank_da_particao(origem);
+            if (origem == 0 && documentos.carregado == DOCUMENTO_PRINCIPAL && eh_usuario(rank_global)) {
+                destino = rank_leitura();
+            }
+            int pedido[3] = {versao_coordenador[origem], documentos.carregado, at->versao - 1};
+            correio_enfileirar(destino, QUADRO_RESSINCRONIZACAO, pedido, sizeof(pedido));
+            correio_despachar();
+            aguardando_ressincronizacao[origem] = 1;
+        }
+        guardar_delta_pendente(&recepcao_estado[origem], at);
+    }
+    // Versões antigas ou repetidas são simplesmente ignoradas
+
+    if (aplicada && replica_no.escritor) {
+        janela_refletir(at);
+    }
+    return aplicada;
+}
+
+// Loop principal dos processos trabalhadores - interface de usuário
+void loop_trabalhador() {
+    char nome_usuario[50];
+    sprintf(nome_usuario, "Usuario_%d", rank_global);
+    int usuario_ativo = 1;
+
+    while (1) {
+        // Verifica mensagens recebidas (atualizações, mensagens privadas, finalização)
+        if (verificar_mensagens_e_atualizacoes()) {
+            break;  // Recebeu sinal de finalização
+        }
+
+        if (!usuario_ativo) {
+            // Usuário saiu, aguarda finalização
+            if (progresso.ativo) {
+                aguardar_eventos(0, NULL);
+            } else {
+                sleep(1);
+            }
+            continue;
+        }
+
+        // Interface do menu principal
+        printf("\n[%s] Menu:\n", nome_usuario);
+        printf("1. Visualizar documento em tempo real\n");
+        printf("2. Editar linha\n");
+        printf("3. Enviar mensagem privada\n");
+        printf("4. Visualizar mensagens recebidas\n");
+        printf("5. Sair\n");
+        printf("6. Inserir, remover, dividir ou juntar linhas\n");
+        printf("7. Buscar texto\n");
+        printf("8. Canais de chat\n");
+        printf("9. Métricas do coordenador\n");
+        printf("10. Documentos\n");
+        printf("11. Histórico da linha e desfazer\n");
+        printf("12. Exportar documento para arquivo\n> ");
+        if (aguardar_eventos(1, "> ")) {
+            break;  // Finalizado enquanto esperava a escolha
+        }
+
+        int opcao;
+        if (scanf(" %d", &opcao) != 1) { 
+            while (getchar() != '\n');
+            printf("Opção inválida. Por favor, digite um número.\n");
+            continue;
+        }
+
+        if (opcao == 1) {
+            // Opção 1: Visualização em tempo real do documento
+            visualizacao_tempo_real();
+            
+        } else if (opcao == 2 && edicao_por_trecho) {
+            // Opção 2 com --edicao-trecho: edita um trecho sem bloquear a linha
+            editar_trecho_interativo();
+
+        } else if (opcao == 2) {
+            // Opção 2: Editar uma linha específica
+            printf("Digite o numero da linha para editar (0 a %d), ou um intervalo como 3-7: ", replica_total_linhas() - 1);
+            int linha_para_editar, ultima_linha = -1;
+            scanf(" %d", &linha_para_editar);
+            int seguinte = getchar();
+            if (seguinte == '-') {
+                scanf("%d", &ultima_linha);
+            } else {
+                ungetc(seguinte, stdin);
+            }
+            if (ultima_linha > linha_para_editar) {
+                editar_intervalo_interativo(linha_para_editar, ultima_linha);
+                continue;
+            }
+
+            // Solicita bloqueio da linha ao coordenador dono dela
+            LinhaLida escolhida;
+            int existe = replica_ler(linha_para_editar, 1, &escolhida, 0);
+            int id_escolhido = existe ? escolhida.id : -1;
+            int dono_atual = existe ? escolhida.dono_bloqueio : -1;
+            Conclusao bloqueio = { .sucesso = 0 };
+            if (id_escolhido >= 0 && fila_bloqueio && dono_atual != -1 && dono_atual != rank_global) {
+                printf(ANSI_COLOR_YELLOW "Linha em uso por Usuario_%d: você entrará na fila e receberá o bloqueio quando ela for liberada...\n" ANSI_COLOR_RESET, dono_atual);
+                fflush(stdout);
+            }
+            if (id_escolhido >= 0) {
+                // Aguarda resposta do coordenador com o id estável da linha
+                cliente_aguardar(cliente_pedir_bloqueio(linha_para_editar, id_escolhido, NULL, NULL), &bloqueio);
+            }
+
+            if (bloqueio.sucesso) {
+                // Bloqueio concedido - permite edição
+                LinhaLida atual;
+                if (replica_ler_id(bloqueio.id_linha, 1, &atual, TEXTO_INTEIRO)) {
+                    printf("Texto atual: %s\n", atual.texto);
+                    replica_liberar(&atual, 1);
+                }
+                printf(ANSI_COLOR_GREEN "Permissão concedida! Digite o novo texto:\n> " ANSI_COLOR_RESET);
+                char* novo_texto = NULL;  // Sem limite de tamanho: getline aloca o necessário
+                size_t capacidade = 0;
+                getchar(); 
+                if (getline(&novo_texto, &capacidade, stdin) < 0) {
+                    novo_texto = realloc(novo_texto, 1);
+                    novo_texto[0] = '\0';
+                }
+                novo_texto[strcspn(novo_texto, "\n")] = 0;  // Remove quebra de linha
+
+                // Envia o novo texto ao coordenador da linha, identificando-a pelo id
+                Conclusao edicao;
+                cliente_aguardar(cliente_enviar_texto(bloqueio.id_linha, novo_texto, strlen(novo_texto), 0, NULL, NULL), &edicao);
+                free(novo_texto);
+                
+                if (edicao.sucesso) {
+                    printf(ANSI_COLOR_GREEN "Alteração aplicada. O documento será atualizado em breve.\n" ANSI_COLOR_RESET);
+                } else {
+                    printf(ANSI_COLOR_RED "Alteração recusada: o bloqueio da linha foi perdido.\n" ANSI_COLOR_RESET);
+                }
+
+            } else {
+                // Bloqueio negado - linha ocupada por outro usuário
+                printf(ANSI_COLOR_RED "Acesso negado! A linha pode estar em uso.\n" ANSI_COLOR_RESET);
+            }
+            
+        } else if (opcao == 3) {
+            // Opção 3: Enviar mensagem privada para outro usuário
+            listar_usuarios_disponiveis(); // Lista usuários disponíveis
+            printf("\nDigite o rank do destinatário: ");
+            int destino;
+            scanf(" %d", &destino);
+            
+            if (!eh_coordenador(destino) && destino < reservas.primeira && destino != rank_global) {
+                char msg[MAX_TEXTO];
+                printf("Digite sua mensagem para Usuario_%d:\n> ", destino);
+                getchar(); 
+                fgets(msg, sizeof(msg), stdin);
+                
+                // Remove quebra de linha
+                msg[strcspn(msg, "\n")] = 0;
+                
+                // A conversa privada também passa pelo mestre, que guarda o histórico
+                char canal[TAMANHO_NOME_CANAL];
+                snprintf(canal, sizeof(canal), "@%d", destino);
+                Conclusao envio;
+                cliente_aguardar(cliente_enviar_chat(canal, msg, strlen(msg), NULL, NULL), &envio);
+                if (envio.sucesso) {
+                    printf(ANSI_COLOR_GREEN "Mensagem enviada para Usuario_%d!\n" ANSI_COLOR_RESET, destino);
+                } else {
+                    printf(ANSI_COLOR_RED "Mensagem recusada: Usuario_%d já saiu do editor.\n" ANSI_COLOR_RESET, destino);
+                }
+            } else {
+                printf(ANSI_COLOR_RED "Rank de destino inválido.\n" ANSI_COLOR_RESET);
+            }
+            
+        } else if (opcao == 4) {
+            // Opção 4: Visualizar mensagens recebidas (chat)
+            pthread_mutex_lock(&progresso.mutex);
+            visualizar_mensagens_chat();
+            pthread_mutex_unlock(&progresso.mutex);
+            
+        } else if (opcao == 5) {
+            // Opção 5: Sair do editor (todos os coordenadores precisam saber)
+            cliente_sair();
+            usuario_ativo = 0; 
+            printf("Você saiu. Aguardando o encerramento seguro do programa...\n");
+
+        } else if (opcao == 6) {
+            // Opção 6: Alterar a estrutura do documento
+            if (num_coordenadores > 1 && documento_ativo == DOCUMENTO_PRINCIPAL) {
+                printf(ANSI_COLOR_RED "Operações de linha no documento principal não estão disponíveis com vários coordenadores.\n" ANSI_COLOR_RESET);
+                continue;
+            }
+            printf("1. Inserir linha vazia\n2. Remover linha\n3. Dividir linha\n4. Juntar linha com a seguinte\n> ");
+            int operacao, linha_alvo, deslocamento = 0;
+            scanf(" %d", &operacao);
+            printf("Digite o numero da linha (0 a %d): ", replica_total_linhas() - 1);
+            scanf(" %d", &linha_alvo);
+            if (operacao == 3) {
+                printf("Dividir a partir de qual caractere? ");
+                scanf(" %d", &deslocamento);
+            }
+
+            int tipos[] = {0, ATUALIZACAO_INSERIR, ATUALIZACAO_REMOVER, ATUALIZACAO_DIVIDIR, ATUALIZACAO_JUNTAR};
+            // A linha vista (e a seguinte, para juntar) segue pelo id: se outro usuário mudar a
+            // estrutura antes, o mestre recusa em vez de operar sobre outra linha
+            LinhaLida vistas[2];
+            int lidas = linha_alvo >= 0 ? replica_ler(linha_alvo, 2, vistas, 0) : 0;
+            int id_alvo = lidas > 0 ? vistas[0].id : -1;
+            int id_seguinte = lidas > 1 ? vistas[1].id : -1;
+            int alvo_valido = lidas > 0 || (operacao == 1 && linha_alvo == replica_total_linhas());
+            if (operacao >= 1 && operacao <= 4 && alvo_valido) {
+                Conclusao resposta;
+                if (cliente_aguardar(cliente_operacao_linha(tipos[operacao], linha_alvo, id_alvo, deslocamento, id_seguinte, NULL, NULL), &resposta)) {
+                    printf(ANSI_COLOR_GREEN "Operação aplicada. O documento será atualizado em breve.\n" ANSI_COLOR_RESET);
+                } else {
+                    printf(ANSI_COLOR_RED "Operação recusada! A linha pode estar em uso ou não existir.\n" ANSI_COLOR_RESET);
+                }
+            } else {
+                printf(ANSI_COLOR_RED "Operação inválida.\n" ANSI_COLOR_RESET);
+            }
+
+        } else if (opcao == 7) {
+            // Opção 7: Buscar texto no documento (respondida pelo índice do mestre)
+            buscar_interativo();
+
+        } else if (opcao == 8) {
+            // Opção 8: Entrar e sair de canais, enviar a um canal e ler o histórico
+            menu_canais();
+
+        } else if (opcao == 9) {
+            // Opção 9: Contadores e histogramas do coordenador (os mesmos do arquivo .prom dele)
+            consultar_metricas();
+
+        } else if (opcao == 10) {
+            // Opção 10: Abrir, trocar e fechar documentos hospedados no mestre
+            menu_documentos();
+
+        } else if (opcao == 11) {
+            // Opção 11: Revisões de uma linha, texto antigo, desfazer e refazer
+            menu_historico_linha();
+
+        } else if (opcao == 12) {
+            // Opção 12: Grava a réplica do documento em uso num arquivo de texto local
+            char caminho[256];
+            printf("Arquivo de destino: ");
+            scanf(" %255s", caminho);
+            getchar();  // Fim da linha do nome
+            double inicio = MPI_Wtime();
+            int gravadas = exportar_documento(caminho);
+            if (gravadas < 0) {
+                printf(ANSI_COLOR_RED "Não foi possível gravar %s.\n" ANSI_COLOR_RESET, caminho);
+            } else {
+                printf(ANSI_COLOR_GREEN "%d linhas gravadas em %s (%.3f s).\n" ANSI_COLOR_RESET, gravadas, caminho,
+                       MPI_Wtime() - inicio);
+            }
+        }
+    }
+    printf("[%s] Saindo...\n", nome_usuario);
+}
+
+// Pede linha, posição, quantos caracteres apagar e o texto a inserir, e envia a edição
+// por trecho; concorrentes na mesma linha são combinados pelo coordenador
+static void editar_trecho_interativo() {
+    printf("Digite o numero da linha para editar (0 a %d): ", replica_total_linhas() - 1);
+    int indice;
+    scanf(" %d", &indice);
+
+    LinhaLida linha;
+    if (!replica_ler(indice, 1, &linha, TEXTO_INTEIRO)) {
+        printf(ANSI_COLOR_RED "Linha inexistente.\n" ANSI_COLOR_RESET);
+        return;
+    }
+    int id_linha = linha.id;
+    int revisao = linha.revisao;
+    int comprimento = linha.comprimento;
+    printf("Texto atual: %s\n", linha.texto);
+    replica_liberar(&linha, 1);
+
+    int posicao, apagar;
+    printf("Posição inicial do trecho (0 a %d): ", comprimento);
+    scanf(" %d", &posicao);
+    printf("Quantos caracteres apagar a partir dela: ");
+    scanf(" %d", &apagar);
+    printf("Texto a inserir no lugar:\n> ");
+    char* texto = NULL;
+    size_t capacidade = 0;
+    getchar();
+    if (getline(&texto, &capacidade, stdin) < 0) {
+        texto = realloc(texto, 1);
+        texto[0] = '\0';
+    }
+    texto[strcspn(texto, "\n")] = 0;
+
+    Conclusao edicao;
+    cliente_aguardar(cliente_editar_trecho(id_linha, revisao, posicao, apagar, texto, strlen(texto), NULL, NULL), &edicao);
+    free(texto);
+    if (edicao.sucesso) {
+        printf(ANSI_COLOR_GREEN "Trecho aplicado. O documento será atualizado em breve.\n" ANSI_COLOR_RESET);
+    } else {
+        printf(ANSI_COLOR_RED "Edição recusada: a linha está bloqueada por outro usuário ou mudou demais. Tente de novo.\n" ANSI_COLOR_RESET);
+    }
+}
+
+// Bloqueia as linhas [primeira, ultima] com um só pedido, pede o novo texto de cada uma
+// (ENTER mantém o atual) e envia todas em um único lote
+static void editar_intervalo_interativo(int primeira, int ultima) {
+    int quantidade = ultima - primeira + 1;
+    int* ids = malloc(quantidade * sizeof(int));
+    LinhaLida* linhas = malloc(quantidade * sizeof(LinhaLida));
+    int valido = primeira >= 0 && replica_ler(primeira, quantidade, linhas, 0) == quantidade;
+    for (int i = 0; i < quantidade && valido; i++) {
+        ids[i] = linhas[i].id;
+    }
+    free(linhas);
+    if (!valido) {
+        printf(ANSI_COLOR_RED "Intervalo inválido.\n" ANSI_COLOR_RESET);
+        free(ids);
+        return;
+    }
+
+    Conclusao bloqueio;
+    cliente_aguardar(cliente_bloquear_intervalo(ids, quantidade, NULL, NULL), &bloqueio);
+    if (!bloqueio.sucesso) {
+        printf(ANSI_COLOR_RED "Acesso negado! Alguma linha do intervalo está em uso.\n" ANSI_COLOR_RESET);
+        free(ids);
+        return;
+    }
+
+    printf(ANSI_COLOR_GREEN "Permissão concedida para as linhas %d a %d! Digite o novo texto de cada uma (ENTER mantém o atual):\n" ANSI_COLOR_RESET,
+           primeira, ultima);
+    char** textos = calloc(quantidade, sizeof(char*));
+    int* comprimentos = malloc(quantidade * sizeof(int));
+    getchar();
+    for (int i = 0; i < quantidade; i++) {
+        LinhaLida atual;
+        char* texto_atual = replica_ler_id(ids[i], 1, &atual, TEXTO_INTEIRO) ? atual.texto : strdup("");
+        printf("[%02d] %s\n> ", primeira + i, texto_atual);
+        size_t capacidade = 0;
+        if (getline(&textos[i], &capacidade, stdin) < 0 || textos[i][0] == '\n') {
+            free(textos[i]);
+            textos[i] = texto_atual;
+        } else {
+            textos[i][strcspn(textos[i], "\n")] = 0;
+            free(texto_atual);
+        }
+        comprimentos[i] = strlen(textos[i]);
+    }
+
+    Conclusao edicao;
+    cliente_aguardar(cliente_editar_lote(ids, textos, comprimentos, quantidade, 0, NULL, NULL), &edicao);
+    if (edicao.sucesso) {
+        printf(ANSI_COLOR_GREEN "Alterações aplicadas. O documento será atualizado em breve.\n" ANSI_COLOR_RESET);
+    } else {
+        printf(ANSI_COLOR_RED "Alterações recusadas: o bloqueio do intervalo foi perdido.\n" ANSI_COLOR_RESET);
+    }
+    for (int i = 0; i < quantidade; i++) {
+        free(textos[i]);
+    }
+    free(textos);
+    free(comprimentos);
+    free(ids);
+}
+
+// Pede um texto, busca no mestre e lista as ocorrências com um trecho de cada linha
+static void buscar_interativo() {
+    printf("Texto a buscar:\n> ");
+    char* texto = NULL;
+    size_t capacidade = 0;
+    getchar();
+    if (getline(&texto, &capacidade, stdin) < 0) {
+        free(texto);
+        return;
+    }
+    texto[strcspn(texto, "\n")] = 0;
+    int comprimento = strlen(texto);
+    if (comprimento == 0) {
+        printf(ANSI_COLOR_RED "Busca vazia.\n" ANSI_COLOR_RESET);
+        free(texto);
+        return;
+    }
+
+    ResultadoBusca* resultado = malloc(sizeof(ResultadoBusca));
+    Conclusao conclusao;
+    cliente_aguardar(cliente_buscar(texto, comprimento, resultado, NULL, NULL), &conclusao);
+    printf(ANSI_COLOR_GREEN "%d ocorrência(s) de \"%s\" (busca de %d µs no mestre)\n" ANSI_COLOR_RESET, resultado->total, texto,
+           resultado->microssegundos);
+
+    // Até LINHAS_RESUMO ocorrências, com o contexto da réplica local em volta do texto achado
+    const int contexto = 30;
+    int exibidas = resultado->quantidade < LINHAS_RESUMO ? resultado->quantidade : LINHAS_RESUMO;
+    for (int i = 0; i < exibidas; i++) {
+        LinhaLida linha;
+        if (!replica_ler(resultado->linhas[i], 1, &linha, TEXTO_INTEIRO)) continue;
+        int deslocamento = resultado->deslocamentos[i];
+        if (deslocamento > linha.comprimento) deslocamento = linha.comprimento;
+        int fim_achado = deslocamento + comprimento < linha.comprimento ? deslocamento + comprimento : linha.comprimento;
+        int inicio = deslocamento > contexto ? deslocamento - contexto : 0;
+        int fim = fim_achado + contexto < linha.comprimento ? fim_achado + contexto : linha.comprimento;
+        // Não corta um caractere UTF-8 ao meio
+        while (inicio > 0 && ((unsigned char)linha.texto[inicio] & 0xc0) == 0x80) inicio--;
+        while (fim < linha.comprimento && ((unsigned char)linha.texto[fim] & 0xc0) == 0x80) fim++;
+        printf(ANSI_COLOR_YELLOW "[%02d:%d]" ANSI_COLOR_RESET " %s%.*s" ANSI_COLOR_CYAN "%.*s" ANSI_COLOR_RESET "%.*s%s\n",
+               resultado->linhas[i], resultado->deslocamentos[i], inicio > 0 ? "..." : "", deslocamento - inicio,
+               linha.texto + inicio, fim_achado - deslocamento, linha.texto + deslocamento, fim - fim_achado,
+               linha.texto + fim_achado, fim < linha.comprimento ? "..." : "");
+        replica_liberar(&linha, 1);
+    }
+    if (resultado->total > exibidas) {
+        printf("... e mais %d ocorrência(s).\n", resultado->total - exibidas);
+    }
+    free(resultado);
+    free(texto);
+}
+
+// Canais de chat: entrar, sair, enviar a um canal e ler o histórico página a página
+static void menu_canais() {
+    printf("1. Entrar em um canal\n2. Sair de um canal\n3. Enviar mensagem a um canal\n4. Ler o histórico de um canal\n> ");
+    int operacao;
+    scanf(" %d", &operacao);
+    if (operacao < 1 || operacao > 4) {
+        printf(ANSI_COLOR_RED "Operação inválida.\n" ANSI_COLOR_RESET);
+        return;
+    }
+    char canal[TAMANHO_NOME_CANAL];
+    printf("Nome do canal (%s reúne todos os usuários; @rank é a conversa privada): ", CANAL_GERAL);
+    scanf(" %31s", canal);
+    getchar();  // Fim da linha do nome
+
+    if (operacao == 1 || operacao == 2) {
+        Conclusao conclusao;
+        cliente_aguardar(cliente_canal(operacao == 1 ? CANAL_ENTRAR : CANAL_SAIR, canal, NULL, NULL), &conclusao);
+        if (conclusao.sucesso) {
+            printf(ANSI_COLOR_GREEN "Você %s #%s.\n" ANSI_COLOR_RESET, operacao == 1 ? "entrou em" : "saiu de", canal);
+        } else {
+            printf(ANSI_COLOR_RED "Pedido recusado: conversas privadas e #%s não aceitam entradas e saídas, e há no máximo %d canais.\n" ANSI_COLOR_RESET,
+                   CANAL_GERAL, MAX_CANAIS);
+        }
+
+    } else if (operacao == 3) {
+        char msg[MAX_TEXTO];
+        printf("Digite sua mensagem para #%s:\n> ", canal);
+        if (!fgets(msg, sizeof(msg), stdin)) return;
+        msg[strcspn(msg, "\n")] = 0;
+        Conclusao envio;
+        cliente_aguardar(cliente_enviar_chat(canal, msg, strlen(msg), NULL, NULL), &envio);
+        if (envio.sucesso) {
+            printf(ANSI_COLOR_GREEN "Mensagem enviada para #%s!\n" ANSI_COLOR_RESET, canal);
+        } else {
+            printf(ANSI_COLOR_RED "Mensagem recusada: o canal não existe ou você não é membro.\n" ANSI_COLOR_RESET);
+        }
+
+    } else {
+        // Da página mais recente para trás; cada página pede as anteriores à primeira exibida
+        PaginaHistorico pagina;
+        int antes_de = 0;
+        while (1) {
+            Conclusao conclusao;
+            cliente_aguardar(cliente_historico(canal, antes_de, &pagina, NULL, NULL), &conclusao);
+            if (!conclusao.sucesso) {
+                printf(ANSI_COLOR_RED "O canal não existe ou você não é membro.\n" ANSI_COLOR_RESET);
+                return;
+            }
+            if (pagina.quantidade == 0) {
+                printf(ANSI_COLOR_YELLOW "Nenhuma mensagem em #%s.\n" ANSI_COLOR_RESET, canal);
+                return;
+            }
+            int primeira = pagina.mensagens[0].sequencia;
+            printf(ANSI_COLOR_CYAN "\n=== #%s: mensagens %d a %d de %d ===\n" ANSI_COLOR_RESET, canal, primeira,
+                   pagina.mensagens[pagina.quantidade - 1].sequencia, pagina.total);
+            for (int i = 0; i < pagina.quantidade; i++) {
+                Mensagem* msg = &pagina.mensagens[i];
+                printf(ANSI_COLOR_YELLOW "[%s]" ANSI_COLOR_GREEN " Usuario_%d: " ANSI_COLOR_RESET "%s\n", msg->timestamp,
+                       msg->remetente, msg->conteudo);
+            }
+            if (primeira <= pagina.primeira_guardada) {
+                printf(ANSI_COLOR_YELLOW "Início do histórico guardado.\n" ANSI_COLOR_RESET);
+                return;
+            }
+            printf("ENTER para a página anterior, Q para voltar: ");
+            char resposta[16];
+            if (!fgets(resposta, sizeof(resposta), stdin) || resposta[0] == 'q' || resposta[0] == 'Q') {
+                return;
+            }
+            antes_de = primeira;
+        }
+    }
+}
+
+// Id do documento aberto aqui com o nome, ou -1
+static int documento_local_por_nome(const char* nome) {
+    int encontrado = -1;
+    pthread_mutex_lock(&progresso.mutex);
+    for (int id = 0; id < MAX_DOCUMENTOS && encontrado < 0; id++) {
+        if (documentos.estados[id] && strcmp(documentos.estados[id]->nome, nome) == 0) encontrado = id;
+    }
+    pthread_mutex_unlock(&progresso.mutex);
+    return encontrado;
+}
+
+static int documento_recebido(int id) {
+    pthread_mutex_lock(&progresso.mutex);
+    int recebido = id == DOCUMENTO_PRINCIPAL || (documentos.estados[id] && documentos.estados[id]->recebido);
+    pthread_mutex_unlock(&progresso.mutex);
+    return recebido;
+}
+
+// Documentos hospedados no mestre: abrir (ou criar) pelo nome, trocar o documento em uso e fechar
+static void menu_documentos() {
+    if (replica_no.ativa) {
+        printf(ANSI_COLOR_RED "Com --replica-compartilhada só o documento principal está disponível.\n" ANSI_COLOR_RESET);
+        return;
+    }
+    pthread_mutex_lock(&progresso.mutex);
+    printf("Documentos abertos:");
+    for (int id = 0; id < MAX_DOCUMENTOS; id++) {
+        if (!documentos.estados[id] || !documentos.estados[id]->nome[0]) continue;
+        printf(id == documento_ativo ? " [%s]" : " %s", documentos.estados[id]->nome);
+    }
+    pthread_mutex_unlock(&progresso.mutex);
+    printf("\n1. Abrir ou criar um documento\n2. Trocar de documento\n3. Fechar um documento\n> ");
+    int operacao;
+    scanf(" %d", &operacao);
+    if (operacao < 1 || operacao > 3) {
+        printf(ANSI_COLOR_RED "Operação inválida.\n" ANSI_COLOR_RESET);
+        return;
+    }
+    char nome[TAMANHO_NOME_DOCUMENTO];
+    printf("Nome do documento (%s é o documento inicial): ", NOME_DOCUMENTO_PRINCIPAL);
+    scanf(" %31s", nome);
+    getchar();  // Fim da linha do nome
+
+    int id = documento_local_por_nome(nome);
+    if (operacao == 1 && id < 0) {
+        Conclusao abertura;
+        cliente_aguardar(cliente_abrir_documento(nome, NULL, NULL), &abertura);
+        if (!abertura.sucesso) {
+            printf(ANSI_COLOR_RED "Documento recusado: use só letras, dígitos, '-' e '_' (até %d caracteres); há no máximo %d documentos.\n" ANSI_COLOR_RESET,
+                   TAMANHO_NOME_DOCUMENTO - 1, MAX_DOCUMENTOS);
+            return;
+        }
+        // O estado completo segue a resposta pela difusão
+        id = abertura.id_linha;
+        while (!documento_recebido(id)) {
+            if (progresso.ativo) {
+                aguardar_eventos(0, NULL);
+            } else {
+                receber_atualizacao();
+            }
+        }
+        pthread_mutex_lock(&progresso.mutex);
+        snprintf(documentos.estados[id]->nome, TAMANHO_NOME_DOCUMENTO, "%s", nome);
+        pthread_mutex_unlock(&progresso.mutex);
+    } else if (id < 0) {
+        printf(ANSI_COLOR_RED "O documento '%s' não está aberto.\n" ANSI_COLOR_RESET, nome);
+        return;
+    }
+
+    if (operacao == 3) {
+        if (id == DOCUMENTO_PRINCIPAL) {
+            printf(ANSI_COLOR_RED "O documento principal não pode ser fechado.\n" ANSI_COLOR_RESET);
+            return;
+        }
+        cliente_fechar_documento(id);
+        printf(ANSI_COLOR_GREEN "Documento '%s' fechado.\n" ANSI_COLOR_RESET, nome);
+    } else if (documento_usar(id)) {
+        printf(ANSI_COLOR_GREEN "Editando o documento '%s' (%d linhas).\n" ANSI_COLOR_RESET, nome, replica_total_linhas());
+    } else {
+        printf(ANSI_COLOR_RED "Não foi possível trocar de documento agora.\n" ANSI_COLOR_RESET);
+    }
+}
+
+// Lista as revisões guardadas de uma linha, mostra o texto dela numa revisão anterior ou
+// desfaz/refaz a última mudança de texto do usuário no documento em uso
+static void menu_historico_linha() {
+    printf("1. Listar revisões de uma linha\n2. Ver uma linha numa revisão\n3. Desfazer minha última mudança\n4. Refazer\n> ");
+    int operacao;
+    scanf(" %d", &operacao);
+    if (operacao == 3 || operacao == 4) {
+        Conclusao desfeita;
+        cliente_aguardar(cliente_desfazer(operacao == 4, NULL, NULL), &desfeita);
+        if (desfeita.sucesso == DESFAZER_FEITO) {
+            printf(ANSI_COLOR_GREEN "Mudança %s. O documento será atualizado em breve.\n" ANSI_COLOR_RESET,
+                   operacao == 4 ? "refeita" : "desfeita");
+        } else if (desfeita.sucesso == DESFAZER_VAZIO) {
+            printf(ANSI_COLOR_YELLOW "Nada a %s.\n" ANSI_COLOR_RESET, operacao == 4 ? "refazer" : "desfazer");
+        } else if (desfeita.sucesso == DESFAZER_CONFLITO) {
+            printf(ANSI_COLOR_RED "A linha mudou depois dessa mudança ou está bloqueada por outro usuário.\n" ANSI_COLOR_RESET);
+        } else {
+            printf(ANSI_COLOR_RED "A revisão anterior já saiu do histórico.\n" ANSI_COLOR_RESET);
+        }
+        return;
+    }
+    if (operacao != 1 && operacao != 2) {
+        printf(ANSI_COLOR_RED "Operação inválida.\n" ANSI_COLOR_RESET);
+        return;
+    }
+
+    printf("Número da linha (0 a %d): ", replica_total_linhas() - 1);
+    int indice;
+    scanf(" %d", &indice);
+    LinhaLida linha;
+    if (!replica_ler(indice, 1, &linha, 0)) {
+        printf(ANSI_COLOR_RED "Linha inexistente.\n" ANSI_COLOR_RESET);
+        return;
+    }
+    int id_linha = linha.id;
+    replica_liberar(&linha, 1);
+    int revisao = -1;
+    if (operacao == 2) {
+        printf("Revisão: ");
+        scanf(" %d", &revisao);
+    }
+
+    VersoesLinha versoes = {0};
+    Conclusao consulta;
+    cliente_aguardar(cliente_versoes_linha(id_linha, revisao, &versoes, NULL, NULL), &consulta);
+    if (!consulta.sucesso) {
+        printf(ANSI_COLOR_RED "Histórico indisponível para essa linha.\n" ANSI_COLOR_RESET);
+    } else if (operacao == 1) {
+        printf("Linha %d, revisão atual %d. Mudanças guardadas:\n", indice, versoes.revisao_atual);
+        for (int i = 0; i < versoes.quantidade; i++) {
+            time_t instante = (time_t)versoes.revisoes[i].instante;
+            char quando[32];
+            strftime(quando, sizeof(quando), "%H:%M:%S", localtime(&instante));
+            printf("  revisão %d: Usuario_%d às %s\n", versoes.revisoes[i].revisao, versoes.revisoes[i].autor, quando);
+        }
+        if (versoes.quantidade == 0) {
+            printf("  (nenhuma)\n");
+        }
+    } else if (versoes.revisao_texto < 0) {
+        printf(ANSI_COLOR_RED "A revisão %d não existe ou já saiu do histórico.\n" ANSI_COLOR_RESET, revisao);
+    } else {
+        printf("Linha %d na revisão %d: %s\n", indice, versoes.revisao_texto, versoes.texto);
+    }
+    free(versoes.texto);
+}
+
+// Função para verificar mensagens assíncronas (atualizações e mensagens de chat)
+int verificar_mensagens_e_atualizacoes() {
+    EventosPendentes eventos;
+    coletar_eventos(&eventos);
+    if (eventos.finalizado) {
+        return 1;  // Retorna 1 para sinalizar finalização
+    }
+
+    // Exibe notificação se houve atualização do documento
+    if (eventos.documento_mudou && !modo_headless) {
+        printf(ANSI_COLOR_YELLOW "\n>>> O estado do sistema foi atualizado. <<<\n" ANSI_COLOR_RESET);
+        mostrar_documento();
+    }
+
+    // Exibe mensagens privadas recebidas com interface formatada
+    if (eventos.num_mensagens > 0 && !modo_headless) {
+        for (int i = 0; i < eventos.num_mensagens; i++) {
+            printf("\n\n" ANSI_COLOR_MAGENTA "  +--------------------------------------------------------------------------+\n");
+            char titulo[96];
+            if (eventos.canais[i][0] == '@') {
+                snprintf(titulo, sizeof(titulo), "MENSAGEM PRIVADA RECEBIDA de Usuario_%d", eventos.remetentes[i]);
+            } else {
+                snprintf(titulo, sizeof(titulo), "MENSAGEM EM #%s de Usuario_%d", eventos.canais[i], eventos.remetentes[i]);
+            }
+            printf("  | >>> %-68s |\n", titulo);
+            printf("  +--------------------------------------------------------------------------+\n" ANSI_COLOR_RESET);
+            
+            // Formata a mensagem dentro da caixa com quebra de linha automática
+            char* texto_completo = eventos.mensagens[i];
+            char* linha_atual = strtok(texto_completo, "\n");
+
+            while (linha_atual != NULL) {
+                const int LARGURA_CAIXA = 72;
+                const char* ponteiro_linha = linha_atual;
+                while (strlen(ponteiro_linha) > 0) {
+                    int tamanho_a_imprimir = strlen(ponteiro_linha);
+                    if (tamanho_a_imprimir > LARGURA_CAIXA) {
+                        tamanho_a_imprimir = LARGURA_CAIXA;
+                        // Tenta quebrar em espaço para não cortar palavras
+                        while (tamanho_a_imprimir > 0 && ponteiro_linha[tamanho_a_imprimir] != ' ') {
+                            tamanho_a_imprimir--;
+                        }
+                        if (tamanho_a_imprimir == 0) {
+                            tamanho_a_imprimir = LARGURA_CAIXA;
+                        }
+                    }
+                    
+                    printf(ANSI_COLOR_MAGENTA "  | " ANSI_COLOR_RESET "%.*s", tamanho_a_imprimir, ponteiro_linha);
+                    for (int k = tamanho_a_imprimir; k < LARGURA_CAIXA; k++) {
+                        printf(" ");
+                    }
+                    printf(ANSI_COLOR_MAGENTA " |\n" ANSI_COLOR_RESET);
+
+                    ponteiro_linha += tamanho_a_imprimir;
+                    if (*ponteiro_linha == ' ') {
+                        ponteiro_linha++;
+                    }
+                }
+                linha_atual = strtok(NULL, "\n");
+            }
+
+            printf(ANSI_COLOR_MAGENTA "  +--------------------------------------------------------------------------+\n\n" ANSI_COLOR_RESET);
+        }
+    }
+
+    return 0;  // Continua execução normal
+}
+
+// ---------------------------------------------------------------------------
+// Tela: o conteúdo é montado num quadro de células (um caractere UTF-8 e uma cor
+// por coluna). A visualização em tempo real compara o novo quadro com o exibido
+// e envia só os movimentos de cursor e as células que mudaram, num único write()
+// ---------------------------------------------------------------------------
+
+static const char* const cores_tela[] = {
+    ANSI_COLOR_RESET, ANSI_COLOR_MAGENTA, ANSI_COLOR_YELLOW, ANSI_COLOR_RED, ANSI_COLOR_GREEN, ANSI_COLOR_CYAN
+};
+
+static void quadro_redimensionar(QuadroTela* quadro, int linhas, int colunas) {
+    quadro->celulas = realloc(quadro->celulas, (size_t)linhas * colunas * sizeof(Celula));
+    quadro->linhas = linhas;
+    quadro->colunas = colunas;
+}
+
+static void quadro_limpar(QuadroTela* quadro) {
+    for (int i = 0; i < quadro->linhas * quadro->colunas; i++) {
+        quadro->celulas[i] = (Celula){ .bytes = {' '}, .tamanho = 1, .cor = COR_TELA_PADRAO };
+    }
+}
+
+// Escreve o texto a partir da coluna, sem passar da coluna 'limite'. Retorna a coluna seguinte
+static int quadro_escrever_ate(QuadroTela* quadro, int linha, int coluna, int limite, int cor, const char* texto, int comprimento) {
+    if (linha < 0 || linha >= quadro->linhas) return coluna;
+    if (limite > quadro->colunas) limite = quadro->colunas;
+    int i = 0;
+    while (i < comprimento && coluna < limite) {
+        unsigned char byte = texto[i];
+        int tamanho = byte < 0x80 ? 1 : (byte & 0xe0) == 0xc0 ? 2 : (byte & 0xf0) == 0xe0 ? 3 : (byte & 0xf8) == 0xf0 ? 4 : 0;
+        int valido = tamanho > 0 && i + tamanho <= comprimento;
+        for (int j = 1; valido && j < tamanho; j++) {
+            valido = ((unsigned char)texto[i + j] & 0xc0) == 0x80;
+        }
+        Celula* celula = &quadro->celulas[linha * quadro->colunas + coluna++];
+        celula->cor = cor;
+        if (!valido || byte < 0x20 || byte == 0x7f) {
+            // Controles e bytes soltos não podem mover o cursor do terminal
+            celula->bytes[0] = '?';
+            celula->tamanho = 1;
+            i += valido ? tamanho : 1;
+        } else {
+            memcpy(celula->bytes, texto + i, tamanho);
+            celula->tamanho = tamanho;
+            i += tamanho;
+        }
+    }
+    return coluna;
+}
+
+static int quadro_escrever(QuadroTela* quadro, int linha, int coluna, int cor, const char* texto, int comprimento) {
+    return quadro_escrever_ate(quadro, linha, coluna, quadro->colunas, cor, texto, comprimento);
+}
+
+static int quadro_formatar(QuadroTela* quadro, int linha, int coluna, int cor, const char* formato, ...) {
+    char texto[MAX_TEXTO + 64];
+    va_list argumentos;
+    va_start(argumentos, formato);
+    int comprimento = vsnprintf(texto, sizeof(texto), formato, argumentos);
+    va_end(argumentos);
+    if (comprimento > (int)sizeof(texto) - 1) comprimento = sizeof(texto) - 1;
+    return quadro_escrever(quadro, linha, coluna, cor, texto, comprimento);
+}
+
+static int celulas_iguais(const Celula* a, const Celula* b) {
+    return a->cor == b->cor && a->tamanho == b->tamanho && memcmp(a->bytes, b->bytes, a->tamanho) == 0;
+}
+
+static void saida_acrescentar(const char* dados, int comprimento) {
+    if (tela.tamanho_saida + comprimento > tela.capacidade_saida) {
+        tela.capacidade_saida = (tela.tamanho_saida + comprimento) * 2;
+        tela.saida = realloc(tela.saida, tela.capacidade_saida);
+    }
+    memcpy(tela.saida + tela.tamanho_saida, dados, comprimento);
+    tela.tamanho_saida += comprimento;
+}
+
+static void saida_formatar(const char* formato, ...) {
+    char texto[64];
+    va_list argumentos;
+    va_start(argumentos, formato);
+    int comprimento = vsnprintf(texto, sizeof(texto), formato, argumentos);
+    va_end(argumentos);
+    saida_acrescentar(texto, comprimento);
+}
+
+// Acrescenta a célula à saída, trocando a cor só quando ela muda
+static void saida_celula(const Celula* celula, int* cor_atual) {
+    if (celula->cor != *cor_atual) {
+        saida_acrescentar(cores_tela[celula->cor], strlen(cores_tela[celula->cor]));
+        *cor_atual = celula->cor;
+    }
+    saida_acrescentar(celula->bytes, celula->tamanho);
+}
+
+// Envia a saída acumulada de uma vez (o stdio é esvaziado antes para não intercalar)
+static void saida_enviar() {
+    fflush(stdout);
+    for (int enviado = 0; enviado < tela.tamanho_saida;) {
+        ssize_t escrito = write(STDOUT_FILENO, tela.saida + enviado, tela.tamanho_saida - enviado);
+        if (escrito <= 0) break;
+        enviado += escrito;
+    }
+    tela.tamanho_saida = 0;
+}
+
+// Envia ao terminal só o que difere do quadro exibido. Trechos alterados separados por poucas
+// células iguais saem juntos: reescrever as iguais custa menos que um novo movimento de cursor
+static void tela_apresentar() {
+    QuadroTela* novo = &tela.proximo;
+    QuadroTela* exibido = &tela.exibido;
+    if (exibido->linhas != novo->linhas || exibido->colunas != novo->colunas) {
+        // Tamanho novo (ou primeira exibição): parte de uma tela limpa
+        quadro_redimensionar(exibido, novo->linhas, novo->colunas);
+        quadro_limpar(exibido);
+        saida_acrescentar(ANSI_COLOR_RESET "\033[2J", strlen(ANSI_COLOR_RESET "\033[2J"));
+    }
+
+    int cor_atual = -1;
+    for (int linha = 0; linha < novo->linhas; linha++) {
+        const Celula* antes = &exibido->celulas[linha * novo->colunas];
+        const Celula* depois = &novo->celulas[linha * novo->colunas];
+        int coluna = 0;
+        while (coluna < novo->colunas) {
+            if (celulas_iguais(&antes[coluna], &depois[coluna])) {
+                coluna++;
+                continue;
+            }
+            saida_formatar("\033[%d;%dH", linha + 1, coluna + 1);
+            int fim = coluna;
+            for (int i = coluna; i < novo->colunas && i - fim <= SALTO_MAXIMO_TELA; i++) {
+                if (!celulas_iguais(&antes[i], &depois[i])) fim = i;
+            }
+            for (; coluna <= fim; coluna++) {
+                saida_celula(&depois[coluna], &cor_atual);
+            }
+        }
+    }
+    if (cor_atual != COR_TELA_PADRAO && cor_atual != -1) {
+        saida_acrescentar(ANSI_COLOR_RESET, strlen(ANSI_COLOR_RESET));
+    }
+    memcpy(exibido->celulas, novo->celulas, (size_t)novo->linhas * novo->colunas * sizeof(Celula));
+    saida_enviar();
+}
+
+// Desenha a caixa do documento a partir da linha 'topo' do quadro, com 'altura' linhas do
+// documento a partir de 'primeira'. 'destaque' ({linha, deslocamento, comprimento}, ou NULL)
+// marca um trecho em ciano. Retorna o total de linhas do documento
+static int desenhar_documento(QuadroTela* quadro, int topo, int primeira, int altura, const int* destaque) {
+    char borda[LARGURA_DOCUMENTO + 1];
+    memset(borda, '-', LARGURA_DOCUMENTO);
+    borda[0] = borda[LARGURA_DOCUMENTO - 1] = '+';
+    borda[LARGURA_DOCUMENTO] = '\0';
+    quadro_formatar(quadro, topo, 2, COR_TELA_MAGENTA, "%s", borda);
+    char titulo[64] = "Visualizacao do Documento";
+    if (documento_ativo != DOCUMENTO_PRINCIPAL) {
+        snprintf(titulo, sizeof(titulo), "Documento %s", documentos.estados[documento_ativo]->nome);
+    }
+    int centro = (LARGURA_DOCUMENTO - 2 + (int)strlen(titulo)) / 2;  // Título centralizado
+    quadro_formatar(quadro, topo + 1, 2, COR_TELA_MAGENTA, "|%*s%*s|", centro, titulo,
+                    LARGURA_DOCUMENTO - 2 - centro, "");
+    quadro_formatar(quadro, topo + 2, 2, COR_TELA_MAGENTA, "%s", borda);
+
+    LinhaLida linhas[altura];
+    int lidas = replica_ler(primeira, altura, linhas, MAX_TEXTO);
+    for (int i = 0; i < altura; i++) {
+        int linha = topo + 3 + i;
+        quadro_escrever(quadro, linha, 2, COR_TELA_MAGENTA, "|", 1);
+        quadro_escrever(quadro, linha, LARGURA_DOCUMENTO + 1, COR_TELA_MAGENTA, "|", 1);
+        if (i >= lidas) continue;
+        // O texto é cortado antes da borda direita para caber o aviso de bloqueio
+        char bloqueio[48] = "";
+        if (linhas[i].dono_bloqueio != -1) {
+            snprintf(bloqueio, sizeof(bloqueio), " (Bloqueada por Usuario_%d)", linhas[i].dono_bloqueio);
+        }
+        const char* texto = linhas[i].texto;
+        int tamanho = strlen(texto);
+        int inicio_destaque = tamanho, fim_destaque = tamanho;
+        if (destaque && destaque[0] == primeira + i && destaque[1] < tamanho) {
+            inicio_destaque = destaque[1];
+            fim_destaque = destaque[1] + destaque[2] < tamanho ? destaque[1] + destaque[2] : tamanho;
+        }
+        int limite = LARGURA_DOCUMENTO - (int)strlen(bloqueio);
+        int coluna = quadro_formatar(quadro, linha, 4, COR_TELA_AMARELO, "[%02d]", primeira + i) + 1;
+        coluna = quadro_escrever_ate(quadro, linha, coluna, limite, COR_TELA_PADRAO, texto, inicio_destaque);
+        coluna = quadro_escrever_ate(quadro, linha, coluna, limite, COR_TELA_CIANO, texto + inicio_destaque,
+                                     fim_destaque - inicio_destaque);
+        coluna = quadro_escrever_ate(quadro, linha, coluna, limite, COR_TELA_PADRAO, texto + fim_destaque, tamanho - fim_destaque);
+        quadro_escrever_ate(quadro, linha, coluna, LARGURA_DOCUMENTO, COR_TELA_VERMELHO, bloqueio, strlen(bloqueio));
+    }
+    replica_liberar(linhas, lidas);
+    quadro_formatar(quadro, topo + 3 + altura, 2, COR_TELA_MAGENTA, "%s", borda);
+    return replica_total_linhas();
+}
+
+// Dimensões atuais do terminal (24x80 quando a saída não é um terminal)
+static void tela_dimensoes(int* linhas, int* colunas) {
+    struct winsize tamanho;
+    *linhas = 24;
+    *colunas = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &tamanho) == 0 && tamanho.ws_row > 0 && tamanho.ws_col > 0) {
+        *linhas = tamanho.ws_row;
+        *colunas = tamanho.ws_col;
+    }
+}
+
+// Teclas entregues uma a uma e sem eco (termios), cursor escondido. Sem terminal não muda nada
+static void tela_modo_visualizacao(int ativar) {
+    if (ativar) {
+        if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &tela.termios_original) == 0) {
+            struct termios modo = tela.termios_original;
+            modo.c_lflag &= ~(ICANON | ECHO);
+            modo.c_cc[VMIN] = 1;
+            modo.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &modo);
+            tela.termios_alterado = 1;
+        }
+        saida_acrescentar("\033[?25l", 6);
+    } else {
+        if (tela.termios_alterado) {
+            tcsetattr(STDIN_FILENO, TCSANOW, &tela.termios_original);
+            tela.termios_alterado = 0;
+        }
+        saida_formatar("\033[%d;1H\033[?25h\n", tela.exibido.linhas);
+        free(tela.exibido.celulas);
+        memset(&tela.exibido, 0, sizeof(QuadroTela));  // A próxima visualização redesenha tudo
+    }
+    saida_enviar();
+}
+
+// Próximo byte de uma sequência de escape, se chegar dentro do prazo; -1 se não veio nada
+static int byte_de_escape() {
+    fd_set leitura;
+    FD_ZERO(&leitura);
+    FD_SET(STDIN_FILENO, &leitura);
+    struct timeval prazo = { 0, ESPERA_ESCAPE_MS * 1000 };
+    if (select(STDIN_FILENO + 1, &leitura, NULL, NULL, &prazo) <= 0) return -1;
+    return getchar();
+}
+
+// Lê uma tecla, traduzindo as sequências de escape das setas e de PgUp/PgDn/Home/End. Um
+// ESC sozinho volta como '\033' sem esperar (nem consumir) a tecla seguinte
+static int ler_tecla() {
+    int tecla = getchar();
+    if (tecla != '\033') return tecla;
+    if (byte_de_escape() != '[') return '\033';
+    int codigo = byte_de_escape();
+    switch (codigo) {
+        case 'A': return TECLA_CIMA;
+        case 'B': return TECLA_BAIXO;
+        case 'H': return TECLA_INICIO;
+        case 'F': return TECLA_FIM;
+        case '5': byte_de_escape(); return TECLA_PAGINA_ACIMA;   // Consome o '~'
+        case '6': byte_de_escape(); return TECLA_PAGINA_ABAIXO;
+    }
+    return '\033';
+}
+
+// Exibe as primeiras linhas do documento com o mesmo desenho da visualização em tempo real,
+// como texto corrido (sem posicionar o cursor) e num único write()
+void mostrar_documento() {
+    QuadroTela quadro = {0};
+    quadro_redimensionar(&quadro, LINHAS_RESUMO + 4, LARGURA_DOCUMENTO + 2);
+    quadro_limpar(&quadro);
+    desenhar_documento(&quadro, 0, 0, LINHAS_RESUMO, NULL);
+
+    saida_acrescentar("\n", 1);
+    for (int linha = 0; linha < quadro.linhas; linha++) {
+        const Celula* celulas = &quadro.celulas[linha * quadro.colunas];
+        int fim = quadro.colunas;
+        while (fim > 0 && celulas[fim - 1].bytes[0] == ' ') fim--;
+        int cor_atual = COR_TELA_PADRAO;
+        for (int coluna = 0; coluna < fim; coluna++) {
+            saida_celula(&celulas[coluna], &cor_atual);
+        }
+        if (cor_atual != COR_TELA_PADRAO) {
+            saida_acrescentar(ANSI_COLOR_RESET, strlen(ANSI_COLOR_RESET));
+        }
+        saida_acrescentar("\n", 1);
+    }
+    saida_enviar();
+    free(quadro.celulas);
+}
+
+// Leva o viewport à ocorrência 'atual' da busca e descreve a posição no aviso
+static int mostrar_ocorrencia(const ResultadoBusca* busca, int atual, const char* consulta, int altura, char* aviso, int tamanho) {
+    snprintf(aviso, tamanho, "Busca \"%s\": %d de %d (linha %d, %d µs)  n/N: próxima/anterior", consulta, atual + 1,
+             busca->total, busca->linhas[atual], busca->microssegundos);
+    return busca->linhas[atual] - altura / 2;  // Ajustada ao redesenhar
+}
+
+// Visualização em tempo real: viewport rolável sobre o documento inteiro. A cada evento o
+// quadro é montado de novo e só a diferença para o exibido vai ao terminal. '/' busca um
+// texto no mestre e leva o viewport às ocorrências
+void visualizacao_tempo_real() {
+    char aviso[MAX_TEXTO + 48] = "";   // Última mensagem recebida (ou estado da busca) durante a visualização
+    int primeira = 0;                  // Linha do documento no topo do viewport
+    int redesenhar = 1;
+    int sair = 0;
+    char consulta[MAX_TEXTO] = "";     // Texto da busca, digitado após '/'
+    int tamanho_consulta = 0;
+    int digitando = 0;
+    ResultadoBusca* busca = calloc(1, sizeof(ResultadoBusca));
+    int atual = -1;                    // Ocorrência destacada (-1 = nenhuma)
+
+    tela_modo_visualizacao(1);
+    while (!sair) {
+        // Recolhe atualizações do documento, mensagens e finalização
+        EventosPendentes eventos;
+        coletar_eventos(&eventos);
+        if (eventos.finalizado) {
+            break;
+        }
+        redesenhar |= eventos.documento_mudou;
+        for (int i = 0; i < eventos.num_mensagens; i++) {
+            if (eventos.canais[i][0] == '@') {
+                snprintf(aviso, sizeof(aviso), ">>> Nova mensagem de Usuario_%d: %s", eventos.remetentes[i], eventos.mensagens[i]);
+            } else {
+                snprintf(aviso, sizeof(aviso), ">>> #%s Usuario_%d: %s", eventos.canais[i], eventos.remetentes[i], eventos.mensagens[i]);
+            }
+            redesenhar = 1;
+        }
+
+        // Título, bordas e rodapé ocupam 7 linhas; o resto do terminal é o viewport
+        int linhas, colunas;
+        tela_dimensoes(&linhas, &colunas);
+        int altura = linhas > 8 ? linhas - 7 : 1;
+        if (altura + 7 != tela.exibido.linhas || colunas != tela.exibido.colunas) {
+            redesenhar = 1;
+        }
+        if (redesenhar) {
+            int total = replica_total_linhas();
+            if (primeira > total - altura) primeira = total - altura;
+            if (primeira < 0) primeira = 0;
+            int ultima = primeira + altura < total ? primeira + altura : total;
+
+            QuadroTela* quadro = &tela.proximo;
+            quadro_redimensionar(quadro, altura + 7, colunas);
+            quadro_limpar(quadro);
+            quadro_formatar(quadro, 0, 0, COR_TELA_VERDE, "=== MODO VISUALIZAÇÃO EM TEMPO REAL ===");
+            int destaque[3] = {-1, 0, tamanho_consulta};
+            if (atual >= 0) {
+                destaque[0] = busca->linhas[atual];
+                destaque[1] = busca->deslocamentos[atual];
+            }
+            desenhar_documento(quadro, 1, primeira, altura, destaque);
+            if (digitando) {
+                quadro_formatar(quadro, altura + 5, 0, COR_TELA_CIANO, "/%s", consulta);
+            } else {
+                quadro_escrever(quadro, altura + 5, 0, COR_TELA_AMARELO, aviso, strlen(aviso));
+            }
+            quadro_formatar(quadro, altura + 6, 0, COR_TELA_AMARELO,
+                            "[Usuario_%d] Linhas %d-%d de %d  setas/PgUp/PgDn/g/G  /: buscar  Q: sair",
+                            rank_global, primeira, ultima - 1, total);
+            tela_apresentar();
+            redesenhar = 0;
+        }
+
+        // Espera uma tecla ou, com a thread de progresso, o aviso de um novo evento. O prazo
+        // curto também percebe o terminal redimensionado; sem a thread, volta a sondar o MPI
+        fd_set readfds;
+        struct timeval timeout = { 0, progresso.ativo ? 250000 : 100000 };
+        int maior_fd = STDIN_FILENO;
+        FD_ZERO(&readfds);
+        FD_SET(STDIN_FILENO, &readfds);
+        if (progresso.ativo) {
+            FD_SET(progresso.aviso[0], &readfds);
+            maior_fd = progresso.aviso[0];
+        }
+        if (select(maior_fd + 1, &readfds, NULL, NULL, &timeout) <= 0 || !FD_ISSET(STDIN_FILENO, &readfds)) {
+            continue;
+        }
+        int anterior = primeira;
+        int tecla = ler_tecla();
+        if (digitando) {
+            // Linha de busca: ENTER busca, ESC cancela, backspace apaga um caractere UTF-8
+            if (tecla == '\n' || tecla == '\r') {
+                digitando = 0;
+                atual = -1;
+                if (tamanho_consulta > 0) {
+                    Conclusao conclusao;
+                    cliente_aguardar(cliente_buscar(consulta, tamanho_consulta, busca, NULL, NULL), &conclusao);
+                    if (busca->quantidade > 0) {
+                        atual = 0;
+                        primeira = mostrar_ocorrencia(busca, atual, consulta, altura, aviso, sizeof(aviso));
+                    } else {
+                        snprintf(aviso, sizeof(aviso), "Busca \"%s\": nenhuma ocorrência", consulta);
+                    }
                 }
-                MPI_Send(&resposta, 1, MPI_INT, remetente, TAG_RESPOSTA_BLOQUEIO, MPI_COMM_WORLD);
+            } else if (tecla == '\033' || tecla == EOF) {
+                digitando = 0;
+            } else if (tecla == 127 || tecla == '\b') {
+                while (tamanho_consulta > 0 && ((unsigned char)consulta[--tamanho_consulta] & 0xc0) == 0x80);
+                consulta[tamanho_consulta] = '\0';
+            } else if (tecla >= 0x20 && tecla < 0x100 && tamanho_consulta < MAX_TEXTO - 1) {
+                consulta[tamanho_consulta++] = (char)tecla;
+                consulta[tamanho_consulta] = '\0';
+            }
+            redesenhar = 1;
+            continue;
+        }
+        switch (tecla) {
+            case EOF:  // Entrada encerrada
+            case 'q':
+            case 'Q':
+                sair = 1;
+                break;
+            case 'j':
+            case TECLA_BAIXO:
+                primeira++;
+                break;
+            case 'k':
+            case TECLA_CIMA:
+                primeira--;
                 break;
-            
-            case TAG_ENVIAR_NOVO_TEXTO:
-                // Recebe texto editado e distribui para todos os usuários
-                MPI_Recv(buffer_texto, MAX_TEXTO, MPI_CHAR, remetente, TAG_ENVIAR_NOVO_TEXTO, MPI_COMM_WORLD, &status);
-                printf("[MESTRE] Recebido novo texto para linha %d. Distribuindo para todos.\n", linha_req);
-                
-                strcpy(documento[linha_req], buffer_texto);  // Atualiza documento
-                registrar_log(remetente, linha_req, buffer_texto);  // Registra no log
-                linhas_em_uso[linha_req] = -1;  // Libera o bloqueio da linha
-                
-                // Distribui atualização para todos os trabalhadores usando comunicação não-bloqueante
-                req_count = 0;
-                for (int i = 1; i < size_global; i++) {
-                    MPI_Isend(documento, MAX_LINHAS * MAX_TEXTO, MPI_CHAR, i, TAG_ATUALIZACAO, MPI_COMM_WORLD, &requests[req_count++]);
-                    MPI_Isend(linhas_em_uso, MAX_LINHAS, MPI_INT, i, TAG_ATUALIZACAO, MPI_COMM_WORLD, &requests[req_count++]);
-                }
+            case ' ':
+            case TECLA_PAGINA_ABAIXO:
+                primeira += altura;
+                break;
+            case 'b':
+            case TECLA_PAGINA_ACIMA:
+                primeira -= altura;
+                break;
+            case 'g':
+            case TECLA_INICIO:
+                primeira = 0;
+                break;
+            case 'G':
+            case TECLA_FIM:
+                primeira = replica_total_linhas();  // Ajustada ao redesenhar
+                break;
+            case '/':
+                digitando = 1;
+                tamanho_consulta = 0;
+                consulta[0] = '\0';
+                redesenhar = 1;
+                break;
+            case 'n':
+            case 'N':
+                if (atual < 0) break;
+                atual = (atual + (tecla == 'n' ? 1 : busca->quantidade - 1)) % busca->quantidade;
+                primeira = mostrar_ocorrencia(busca, atual, consulta, altura, aviso, sizeof(aviso));
+                redesenhar = 1;
+                break;
+        }
+        redesenhar |= primeira != anterior;
+    }
+
+    free(busca);
+    tela_modo_visualizacao(0);
+    printf(ANSI_COLOR_GREEN "Saindo da visualização em tempo real...\n" ANSI_COLOR_RESET);
+}
+
+// ---------------------------------------------------------------------------
+// Difusão das atualizações: árvore binomial com raiz no coordenador de origem
+// ---------------------------------------------------------------------------
+
+// Calcula os filhos deste rank na árvore binomial com a raiz dada, subárvores maiores
+// primeiro. A raiz envia a O(log N) ranks e cada rank repassa ao que lhe cabe.
+// Retorna o número de filhos escritos em filhos[]
+static int filhos_na_arvore(int raiz, int* filhos) {
+    // A árvore cobre só os membros da difusão (todos os ranks, sem a réplica compartilhada)
+    int membros = num_membros_difusao;
+    int posicao_raiz = posicao_difusao[raiz];
+    if (posicao_difusao[rank_global] < 0 || posicao_raiz < 0) return 0;
+    int relativo = (posicao_difusao[rank_global] - posicao_raiz + membros) % membros;
+    int total = 0;
+    if (!difusao_em_arvore) {
+        // Sem thread de progresso nos trabalhadores um repasse poderia ficar parado
+        // esperando o usuário digitar: a raiz envia diretamente a todos
+        if (relativo != 0) return 0;
+        for (int i = 1; i < membros; i++) {
+            filhos[total++] = membros_difusao[(posicao_raiz + i) % membros];
+        }
+        return total;
+    }
+    int mascara = 1;
+    while (mascara < membros && !(relativo & mascara)) {
+        mascara <<= 1;
+    }
+    for (mascara >>= 1; mascara > 0; mascara >>= 1) {
+        if (relativo + mascara < membros) {
+            filhos[total++] = membros_difusao[(posicao_raiz + relativo + mascara) % membros];
+        }
+    }
+    return total;
+}
+
+// Libera as vagas cujos envios já completaram (com envios_mutex travado).
+// Retorna quantas continuam ocupadas
+static int recolher_envios() {
+    int ocupadas = 0;
+    for (int i = 0; i < num_vagas_envio; i++) {
+        EnvioPendente* vaga = &envios[i];
+        if (!vaga->buffer) continue;
+        int concluidos;
+        MPI_Testall(vaga->num_pedidos, vaga->pedidos, &concluidos, MPI_STATUSES_IGNORE);
+        if (concluidos) {
+            free(vaga->buffer);
+            free(vaga->pedidos);
+            vaga->buffer = NULL;
+        } else {
+            ocupadas++;
+        }
+    }
+    return ocupadas;
+}
+
+// Um rank morreu: os envios que não completaram podem ter a ele como um dos destinos e
+// nunca completar. Os pedidos são soltos; o buffer fica sem liberar, porque o MPI ainda
+// pode lê-lo para os destinos vivos
+static void abandonar_envios() {
+    pthread_mutex_lock(&envios_mutex);
+    for (int i = 0; i < num_vagas_envio; i++) {
+        EnvioPendente* vaga = &envios[i];
+        if (!vaga->buffer) continue;
+        int concluidos;
+        MPI_Testall(vaga->num_pedidos, vaga->pedidos, &concluidos, MPI_STATUSES_IGNORE);
+        if (concluidos) {
+            free(vaga->buffer);
+        } else {
+            for (int j = 0; j < vaga->num_pedidos; j++) {
+                if (vaga->pedidos[j] != MPI_REQUEST_NULL) MPI_Request_free(&vaga->pedidos[j]);
+            }
+        }
+        free(vaga->pedidos);
+        vaga->buffer = NULL;
+    }
+    pthread_mutex_unlock(&envios_mutex);
+}
+
+// Envia o buffer aos destinos sem bloquear; o buffer passa a pertencer ao conjunto de
+// envios e é liberado quando todos completarem
+static void enviar_sem_bloquear(void* buffer, int tamanho, const int* destinos, int num_destinos, int tag) {
+    if (num_destinos == 0) {
+        free(buffer);
+        return;
+    }
+    int64_t inicio = instante_ns(CLOCK_MONOTONIC);
+    pthread_mutex_lock(&envios_mutex);
+    recolher_envios();
+    EnvioPendente* vaga = NULL;
+    for (int i = 0; i < num_vagas_envio && !vaga; i++) {
+        if (!envios[i].buffer) vaga = &envios[i];
+    }
+    if (!vaga) {
+        // Todas ocupadas: cresce em vez de esperar. Quem chama pode estar com correio.mutex
+        // travado, e o destinatário lento pode estar esperando justamente por ele
+        int capacidade = num_vagas_envio ? num_vagas_envio * 2 : VAGAS_ENVIO;
+        envios = realloc(envios, capacidade * sizeof(EnvioPendente));
+        memset(envios + num_vagas_envio, 0, (capacidade - num_vagas_envio) * sizeof(EnvioPendente));
+        vaga = &envios[num_vagas_envio];
+        num_vagas_envio = capacidade;
+    }
+    estatisticas.contadores[CONTADOR_ENVIOS_MPI] += num_destinos;
+    vaga->buffer = buffer;
+    vaga->num_pedidos = num_destinos;
+    vaga->pedidos = malloc(num_destinos * sizeof(MPI_Request));
+    for (int i = 0; i < num_destinos; i++) {
+        MPI_Isend(buffer, tamanho, MPI_BYTE, destinos[i], tag, MPI_COMM_WORLD, &vaga->pedidos[i]);
+        metrica_mensagem(METRICA_ENVIADA, tag, tamanho);
+    }
+    pthread_mutex_unlock(&envios_mutex);
+    if (tag == TAG_ATUALIZACAO) {
+        // Inclui recolher as vagas concluídas, que cresce com os envios lentos pendentes
+        metrica_tempo(&metricas_locais()->difusao, instante_ns(CLOCK_MONOTONIC) - inicio);
+    }
+}
+
+// Repassa um pacote de deltas recebido, sem remontá-lo, aos filhos deste rank na árvore
+// do coordenador que o montou. Estados completos vão direto ao destino e não são
+// repassados. Retorna 1 se o buffer passou a pertencer aos envios pendentes (quem chamou
+// não deve liberá-lo)
+static int retransmitir_pacote(char* pacote, int tamanho) {
+    int posicao = 0;
+    const Quadro* quadro = proximo_quadro(pacote, tamanho, &posicao);
+    if (!quadro || quadro->tipo != QUADRO_ATUALIZACAO || quadro->comprimento < sizeof(Atualizacao)) {
+        return 0;
+    }
+    const Atualizacao* at = (const Atualizacao*)CORPO_QUADRO(quadro);
+    if (at->tipo == ATUALIZACAO_COMPLETA || at->tipo == ATUALIZACAO_PARTICAO || at->tipo == ATUALIZACAO_BLOCO_ESTADO ||
+        at->documento != DOCUMENTO_PRINCIPAL) {
+        return 0;  // Os deltas de outros documentos já foram direto a cada assinante
+    }
+    int filhos[size_global];
+    int num_filhos = filhos_na_arvore(quadro->origem, filhos);
+    if (replica_no.escritor && replica_no.esgotada) {
+        // Janela esgotada: os leitores do nó mantêm as próprias réplicas com os deltas daqui
+        memcpy(filhos + num_filhos, replica_no.leitores, replica_no.num_leitores * sizeof(int));
+        num_filhos += replica_no.num_leitores;
+    }
+    if (num_filhos == 0) {
+        return 0;
+    }
+    enviar_sem_bloquear(pacote, tamanho, filhos, num_filhos, TAG_ATUALIZACAO);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Protocolo binário: montagem e leitura de pacotes de quadros
+// ---------------------------------------------------------------------------
+
+// Acrescenta um quadro ao pacote e devolve o corpo (com 'comprimento' bytes) para quem
+// chamou preencher. O próximo quadro começa alinhado a ALINHAMENTO_QUADRO
+static void* pacote_reservar(Pacote* pacote, int tipo, int comprimento, uint32_t sequencia) {
+    int ocupado = sizeof(Quadro) + (comprimento + ALINHAMENTO_QUADRO - 1) / ALINHAMENTO_QUADRO * ALINHAMENTO_QUADRO;
+    if (pacote->tamanho + ocupado > pacote->capacidade) {
+        int capacidade = pacote->capacidade ? pacote->capacidade * 2 : 256;
+        while (capacidade < pacote->tamanho + ocupado) capacidade *= 2;
+        pacote->dados = realloc(pacote->dados, capacidade);
+        pacote->capacidade = capacidade;
+    }
+    Quadro* quadro = (Quadro*)(pacote->dados + pacote->tamanho);
+    memset(quadro, 0, ocupado);
+    quadro->versao = VERSAO_PROTOCOLO;
+    quadro->tipo = tipo;
+    quadro->comprimento = comprimento;
+    quadro->sequencia = sequencia;
+    quadro->origem = rank_global;
+    pacote->tamanho += ocupado;
+    return CORPO_QUADRO(quadro);
+}
+
+// Devolve o quadro em *posicao e avança para o seguinte; NULL no fim do pacote ou se o
+// restante for inválido (truncado ou de outra versão do protocolo)
+static const Quadro* proximo_quadro(const char* pacote, int tamanho, int* posicao) {
+    if (*posicao + (int)sizeof(Quadro) > tamanho) {
+        return NULL;
+    }
+    const Quadro* quadro = (const Quadro*)(pacote + *posicao);
+    if (quadro->versao != VERSAO_PROTOCOLO) {
+        fprintf(stderr, "Erro: quadro na versão %d do protocolo (esperada %d); restante do pacote descartado.\n",
+                quadro->versao, VERSAO_PROTOCOLO);
+        return NULL;
+    }
+    long fim = (long)*posicao + sizeof(Quadro) +
+               ((long)quadro->comprimento + ALINHAMENTO_QUADRO - 1) / ALINHAMENTO_QUADRO * ALINHAMENTO_QUADRO;
+    if (fim > tamanho) {
+        fprintf(stderr, "Erro: quadro de %u bytes truncado no pacote; restante descartado.\n", quadro->comprimento);
+        return NULL;
+    }
+    *posicao = (int)fim;
+    return quadro;
+}
+
+// Numera o quadro e o acrescenta ao pacote do destino; sai no próximo correio_despachar
+static void correio_enfileirar(int destino, int tipo, const void* corpo, int comprimento) {
+    pthread_mutex_lock(&correio.mutex);
+    void* reservado = pacote_reservar(&correio.saida[destino], tipo, comprimento, ++correio.enviados[destino]);
+    if (comprimento > 0) {
+        memcpy(reservado, corpo, comprimento);
+    }
+    pthread_mutex_unlock(&correio.mutex);
+}
+
+// Envia cada pacote pendente em uma única mensagem ao seu destino
+static void correio_despachar() {
+    pthread_mutex_lock(&correio.mutex);
+    for (int destino = 0; destino < size_global; destino++) {
+        Pacote* pacote = &correio.saida[destino];
+        if (pacote->tamanho == 0) continue;
+        enviar_sem_bloquear(pacote->dados, pacote->tamanho, &destino, 1, TAG_QUADROS);
+        memset(pacote, 0, sizeof(Pacote));
+    }
+    pthread_mutex_unlock(&correio.mutex);
+}
+
+// Resposta do coordenador a um pedido: {id do pedido, estado, id estável da linha}
+static void responder(int destino, int id_pedido, int estado, int id_linha) {
+    int resposta[3] = {id_pedido, estado, id_linha};
+    correio_enfileirar(destino, QUADRO_RESPOSTA, resposta, sizeof(resposta));
+}
+
+// Com reservas a barreira é feita ponto a ponto pelo mestre atual, porque uma coletiva
+// esperaria para sempre um rank morto: cada rank avisa o mestre quando seus envios
+// completaram (ou, passado o prazo, os abandona), e o mestre responde a todos depois do
+// último aviso. Retorna 1 quando a barreira terminou para este rank
+static int barreira_reservas(int rodada, int* avisou, char* chegou, int64_t prazo) {
+    int flag;
+    MPI_Status status;
+    MPI_Iprobe(MPI_ANY_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &flag, &status);
+    if (flag) {
+        int sinal[3];
+        MPI_Recv(sinal, sizeof(sinal), MPI_BYTE, status.MPI_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &status);
+        if (sinal[0] == RESERVA_PROMOCAO) {
+            mestre_substituido(status.MPI_SOURCE, sinal[2], sinal[1]);
+            *avisou = 0;  // O aviso foi ao mestre morto: vai de novo ao novo
+        } else if (sinal[0] == RESERVA_BARREIRA && sinal[1] == rodada) {  // Um aviso atrasado de outra chamada não conta
+            if (rank_global != rank_mestre) return status.MPI_SOURCE == rank_mestre;
+            chegou[status.MPI_SOURCE] = 1;
+        }
+        return 0;
+    }
+    if (*avisou) {
+        // O mestre morreu durante o encerramento: depois de um bom prazo, sai sem a resposta
+        return rank_global != rank_mestre && instante_ns(CLOCK_MONOTONIC) > prazo + 4LL * reservas.prazo_ms * 1000000LL;
+    }
+    pthread_mutex_lock(&envios_mutex);
+    int ocupadas = recolher_envios();
+    pthread_mutex_unlock(&envios_mutex);
+    if (ocupadas > 0 && instante_ns(CLOCK_MONOTONIC) < prazo) return 0;
+    if (ocupadas > 0) {
+        abandonar_envios();  // Presos num rank que morreu
+    }
+    if (rank_global != rank_mestre) {
+        reserva_sinalizar(&rank_mestre, 1, RESERVA_BARREIRA, rodada, rank_global);
+        *avisou = 1;
+        return 0;
+    }
+    int destinos[size_global];
+    int num_destinos = 0;
+    for (int rank = 0; rank < size_global; rank++) {
+        if (rank == rank_global || reservas.perdido[rank]) continue;
+        if (!chegou[rank]) return 0;
+        destinos[num_destinos++] = rank;
+    }
+    reserva_sinalizar(destinos, num_destinos, RESERVA_BARREIRA, rodada, rank_global);
+    *avisou = 1;
+    return 0;  // Volta a esperar as próprias respostas completarem (abaixo, com *avisou)
+}
+
+// Conclui os envios deste rank antes do MPI_Finalize. Um rank só entra na barreira
+// não bloqueante depois que seus envios completaram, e continua descartando atualizações
+// até que todos tenham entrado: assim nenhum repasse fica esperando um rank que já saiu
+void encerrar_difusao() {
+    static int rodada = 0;
+    MPI_Request barreira = MPI_REQUEST_NULL;
+    int concluida = 0;
+    int avisou = 0;
+    rodada++;
+    char* chegou = reservas.num > 0 ? calloc(size_global, 1) : NULL;
+    int64_t prazo = instante_ns(CLOCK_MONOTONIC) + (int64_t)reservas.prazo_ms * 1000000LL;
+    while (!concluida) {
+        int flag;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_ATUALIZACAO, MPI_COMM_WORLD, &flag, &status);
+        if (!flag) {
+            MPI_Iprobe(MPI_ANY_SOURCE, TAG_CHAT, MPI_COMM_WORLD, &flag, &status);  // Lote de chat entregue depois da finalização
+        }
+        if (flag) {
+            int tamanho;
+            MPI_Get_count(&status, MPI_BYTE, &tamanho);
+            char* descarte = malloc(tamanho);
+            MPI_Recv(descarte, tamanho, MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
+            free(descarte);
+            continue;
+        }
+        if (chegou) {
+            if (rank_global == rank_mestre && avisou) {
+                // Respostas da barreira enviadas: o mestre só sai quando completarem
+                pthread_mutex_lock(&envios_mutex);
+                concluida = recolher_envios() == 0;
+                pthread_mutex_unlock(&envios_mutex);
+            } else {
+                concluida = barreira_reservas(rodada, &avisou, chegou, prazo);
+            }
+        } else if (barreira == MPI_REQUEST_NULL) {
+            pthread_mutex_lock(&envios_mutex);
+            int ocupadas = recolher_envios();
+            pthread_mutex_unlock(&envios_mutex);
+            if (ocupadas == 0) {
+                MPI_Ibarrier(MPI_COMM_WORLD, &barreira);
+            }
+        } else {
+            MPI_Test(&barreira, &concluida, MPI_STATUS_IGNORE);
+        }
+        if (!concluida) {
+            usleep(100);
+        }
+    }
+    free(chegou);
+}
+
+// ---------------------------------------------------------------------------
+// Réplica compartilhada por nó: janela MPI-3 escrita pelo escritor do nó e lida
+// pelos demais usuários sob um seqlock. Sem --replica-compartilhada, as mesmas
+// funções de leitura usam a réplica privada em 'documento'
+// ---------------------------------------------------------------------------
+
+// Separa os trabalhadores por nó (o menor rank de cada nó é o escritor) e monta a lista dos
+// membros da difusão: coordenadores e escritores, ou todos os ranks sem a opção
+void replica_no_iniciar() {
+    int membro = 1;
+    replica_no.no = MPI_COMM_NULL;
+    replica_no.membros = MPI_COMM_WORLD;
+    replica_no.janela = MPI_WIN_NULL;
+    if (replica_no.ativa) {
+        MPI_Comm mesmo_no;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank_global, MPI_INFO_NULL, &mesmo_no);
+        MPI_Comm_split(mesmo_no, eh_coordenador(rank_global) ? MPI_UNDEFINED : 0, rank_global, &replica_no.no);
+        MPI_Comm_free(&mesmo_no);
+        if (replica_no.no != MPI_COMM_NULL) {
+            int rank_no;
+            MPI_Comm_rank(replica_no.no, &rank_no);
+            replica_no.escritor = rank_no == 0;
+            membro = replica_no.escritor;
+        }
+    }
+
+    int* membros = malloc(size_global * sizeof(int));
+    if (replica_no.ativa) {
+        MPI_Allgather(&membro, 1, MPI_INT, membros, 1, MPI_INT, MPI_COMM_WORLD);
+        MPI_Comm_split(MPI_COMM_WORLD, membro ? 0 : MPI_UNDEFINED, rank_global, &replica_no.membros);
+    } else {
+        for (int i = 0; i < size_global; i++) membros[i] = 1;
+    }
+    membros_difusao = malloc(size_global * sizeof(int));
+    posicao_difusao = malloc(size_global * sizeof(int));
+    num_membros_difusao = 0;
+    for (int i = 0; i < size_global; i++) {
+        posicao_difusao[i] = membros[i] ? num_membros_difusao : -1;
+        if (membros[i]) membros_difusao[num_membros_difusao++] = i;
+    }
+    free(membros);
+}
+
+// Aponta as seções da janela a partir do cabeçalho
+static void janela_enderecos(char* base) {
+    replica_no.cabecalho = (CabecalhoJanela*)base;
+    replica_no.capacidade_linhas = replica_no.cabecalho->capacidade_linhas;
+    replica_no.capacidade_ids = replica_no.cabecalho->capacidade_ids;
+    replica_no.capacidade_texto = replica_no.cabecalho->capacidade_texto;
+    replica_no.linhas = (LinhaJanela*)(base + sizeof(CabecalhoJanela));
+    replica_no.posicao_por_id = (int*)(replica_no.linhas + replica_no.capacidade_linhas);
+    replica_no.versoes = replica_no.posicao_por_id + replica_no.capacidade_ids;
+    replica_no.texto = (char*)(replica_no.versoes + num_coordenadores);
+}
+
+// Escritor: sequência ímpar antes de qualquer alteração; fica aberta até o fim do pacote
+static void janela_iniciar_escrita() {
+    if (replica_no.escrevendo) return;
+    CabecalhoJanela* cabecalho = replica_no.cabecalho;
+    __atomic_store_n(&cabecalho->sequencia, cabecalho->sequencia + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    replica_no.escrevendo = 1;
+}
+
+// Fecha a escrita com as versões que a janela passou a refletir. Esgotada, a sequência
+// fica ímpar: os leitores esperam a réplica própria em vez de ler um documento cortado
+static void janela_concluir_escrita() {
+    if (!replica_no.escrevendo || replica_no.esgotada) return;
+    CabecalhoJanela* cabecalho = replica_no.cabecalho;
+    memcpy(replica_no.versoes, documentos.estados[DOCUMENTO_PRINCIPAL]->versoes, num_coordenadores * sizeof(int));
+    __atomic_store_n(&cabecalho->sequencia, cabecalho->sequencia + 1, __ATOMIC_RELEASE);
+    replica_no.escrevendo = 0;
+}
+
+static void janela_esgotar() {
+    if (replica_no.esgotada) return;
+    replica_no.esgotada = 1;
+    if (verbosidade >= VERBOSIDADE_EVENTOS) {
+        printf("[%s] Documento maior que a réplica compartilhada; os usuários do nó passam a ter réplicas próprias.\n",
+               nome_processo);
+    }
+}
+
+// Posição da linha na janela (-1 = ausente). Todo id do documento cabe na tabela, ou a janela esgota
+static int janela_posicao(int id) {
+    if (id < 0 || id >= replica_no.capacidade_ids) return -1;
+    return replica_no.posicao_por_id[id];
+}
+
+// Grava a linha na posição; com_texto acrescenta o texto ao fim da arena. Retorna 0 se a
+// arena não tem espaço para o texto ou se o id não cabe na tabela (que esgota a janela)
+static int janela_gravar_linha(int posicao, Linha* linha, int com_texto) {
+    CabecalhoJanela* cabecalho = replica_no.cabecalho;
+    LinhaJanela* destino = &replica_no.linhas[posicao];
+    if (linha->id >= replica_no.capacidade_ids) {
+        janela_esgotar();
+        return 0;
+    }
+    if (com_texto) {
+        if (linha->comprimento > replica_no.capacidade_texto - cabecalho->texto_usado) return 0;
+        memcpy(replica_no.texto + cabecalho->texto_usado, linha->texto, linha->comprimento);
+        destino->deslocamento = cabecalho->texto_usado;
+        destino->comprimento = linha->comprimento;
+        cabecalho->texto_usado += linha->comprimento;
+    }
+    destino->id = linha->id;
+    destino->dono_bloqueio = linha->dono_bloqueio;
+    destino->revisao = linha->revisao;
+    replica_no.posicao_por_id[linha->id] = posicao;
+    return 1;
+}
+
+// Regrava o documento inteiro, compactando a arena (estados completos, mudanças de estrutura
+// e arena cheia). Se nem assim couber, a janela esgota
+static void janela_publicar_tudo() {
+    CabecalhoJanela* cabecalho = replica_no.cabecalho;
+    janela_iniciar_escrita();
+    memset(replica_no.posicao_por_id, 0xff, replica_no.capacidade_ids * sizeof(int));  // Todos -1
+    cabecalho->texto_usado = 0;
+    int posicao = 0;
+    for (Linha* l = documento_primeira(&documento); l; l = documento_proxima(l), posicao++) {
+        if (posicao == replica_no.capacidade_linhas || !janela_gravar_linha(posicao, l, 1)) {
+            janela_esgotar();
+            return;
+        }
+    }
+    cabecalho->total_linhas = posicao;
+}
+
+// Leva à janela o estado de uma linha da réplica do escritor
+static void janela_refletir_linha(int id, int com_texto) {
+    Linha* linha = documento_por_id(&documento, id);
+    if (!linha || replica_no.esgotada) return;
+    int posicao = janela_posicao(id);
+    if (posicao < 0 || !janela_gravar_linha(posicao, linha, com_texto)) {
+        if (!replica_no.esgotada) janela_publicar_tudo();  // Arena cheia: republicar descarta os textos substituídos
+    }
+}
+
+// Escritor: reflete na janela um delta já aplicado em 'documento'. Alterações de texto e
+// bloqueio são copiadas linha a linha; as que mudam posições republicam o documento
+static void janela_refletir(const Atualizacao* at) {
+    if (replica_no.esgotada) return;
+    janela_iniciar_escrita();
+    switch (at->tipo) {
+        case ATUALIZACAO_TEXTO:
+        case ATUALIZACAO_TRECHO:
+            janela_refletir_linha(at->id, 1);
+            break;
+        case ATUALIZACAO_BLOQUEIO:
+            janela_refletir_linha(at->id, 0);
+            break;
+        case ATUALIZACAO_BLOQUEIOS:
+            for (int i = 0; i < at->comprimento / (int)sizeof(int); i++) {
+                int id;
+                memcpy(&id, at->texto + i * sizeof(int), sizeof(int));
+                janela_refletir_linha(id, 0);
+            }
+            break;
+        case ATUALIZACAO_LOTE: {
+            // Formato de serializar_linhas: só os ids e comprimentos interessam aqui
+            const char* p = at->texto + 2 * sizeof(int);
+            const char* fim = at->texto + at->comprimento;
+            while (p + 4 * (int)sizeof(int) <= fim) {
+                int id, comprimento;
+                memcpy(&id, p, sizeof(int));
+                memcpy(&comprimento, p + 3 * sizeof(int), sizeof(int));
+                janela_refletir_linha(id, 1);
+                p += 4 * sizeof(int) + comprimento;
+            }
+            break;
+        }
+        default:
+            janela_publicar_tudo();
+            break;
+    }
+}
+
+// Escritor, no fim do pacote que esgotou a janela: manda a cada leitor do nó a sua réplica
+// com as versões de todas as partições e, daqui em diante, repassa-lhes os deltas
+// (retransmitir_pacote). Na mesma tag e do mesmo remetente, a réplica chega antes deles
+static void janela_entregar_replicas() {
+    int tamanho_documento;
+    char* serializado = serializar_documento(&documento, &tamanho_documento);
+    int tamanho_versoes = num_coordenadores * sizeof(int);
+    Pacote pacote = {0};
+    Atualizacao* at = pacote_reservar(&pacote, QUADRO_ATUALIZACAO, sizeof(Atualizacao) + tamanho_versoes + tamanho_documento, 0);
+    at->tipo = ATUALIZACAO_REPLICA;
+    at->documento = DOCUMENTO_PRINCIPAL;
+    at->dono_bloqueio = -1;
+    at->comprimento = tamanho_versoes + tamanho_documento;
+    memcpy(at->texto, versao_coordenador, tamanho_versoes);
+    memcpy(at->texto + tamanho_versoes, serializado, tamanho_documento);
+    free(serializado);
+    enviar_sem_bloquear(pacote.dados, pacote.tamanho, replica_no.leitores, replica_no.num_leitores, TAG_ATUALIZACAO);
+    __atomic_store_n(&replica_no.cabecalho, NULL, __ATOMIC_RELEASE);  // O próprio escritor passa a ler a sua réplica
+}
+
+// Cria a janela do nó: o escritor a aloca com folga para o documento crescer e publica o
+// documento inicial; os demais apenas mapeiam a memória dele
+void replica_no_publicar() {
+    if (replica_no.no == MPI_COMM_NULL) return;
+    MPI_Aint tamanho = 0;
+    int capacidade_linhas = 0, capacidade_ids = 0;
+    int64_t capacidade_texto = 0;
+    if (replica_no.escritor) {
+        int64_t texto = 0;
+        for (Linha* l = documento_primeira(&documento); l; l = documento_proxima(l)) {
+            texto += l->comprimento;
+        }
+        capacidade_linhas = FOLGA_LINHAS_JANELA * documento.total_linhas;
+        if (capacidade_linhas < MINIMO_LINHAS_JANELA) capacidade_linhas = MINIMO_LINHAS_JANELA;
+        capacidade_ids = FOLGA_LINHAS_JANELA * documento.proximo_id;
+        if (capacidade_ids < MINIMO_LINHAS_JANELA) capacidade_ids = MINIMO_LINHAS_JANELA;
+        capacidade_texto = FOLGA_TEXTO_JANELA * texto;
+        if (capacidade_texto < MINIMO_TEXTO_JANELA) capacidade_texto = MINIMO_TEXTO_JANELA;
+        tamanho = sizeof(CabecalhoJanela) + (MPI_Aint)capacidade_linhas * sizeof(LinhaJanela) +
+                  (MPI_Aint)(capacidade_ids + num_coordenadores) * sizeof(int) + capacidade_texto;
+    }
+    int usuarios;
+    MPI_Comm_size(replica_no.no, &usuarios);
+    replica_no.leitores = malloc(usuarios * sizeof(int));
+    MPI_Allgather(&rank_global, 1, MPI_INT, replica_no.leitores, 1, MPI_INT, replica_no.no);
+    replica_no.num_leitores = usuarios - 1;
+    memmove(replica_no.leitores, replica_no.leitores + 1, replica_no.num_leitores * sizeof(int));  // O primeiro é o escritor
+
+    char* base;
+    MPI_Win_allocate_shared(tamanho, 1, MPI_INFO_NULL, replica_no.no, &base, &replica_no.janela);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, replica_no.janela);  // Acesso direto por load/store até o fim
+    if (replica_no.escritor) {
+        CabecalhoJanela* cabecalho = (CabecalhoJanela*)base;
+        memset(cabecalho, 0, sizeof(CabecalhoJanela));
+        cabecalho->capacidade_linhas = capacidade_linhas;
+        cabecalho->capacidade_ids = capacidade_ids;
+        cabecalho->capacidade_texto = capacidade_texto;
+        janela_enderecos(base);
+        janela_publicar_tudo();
+        janela_concluir_escrita();
+        MPI_Win_sync(replica_no.janela);
+        if (verbosidade >= VERBOSIDADE_EVENTOS) {
+            printf("[%s] Réplica compartilhada do nó: %.1f MiB para %d usuário(s)\n", nome_processo,
+                   tamanho / (1024.0 * 1024.0), usuarios);
+        }
+    }
+    MPI_Barrier(replica_no.no);  // Leitores só acessam a janela já preenchida
+    if (!replica_no.escritor) {
+        MPI_Aint tamanho_escritor;
+        int unidade;
+        MPI_Win_shared_query(replica_no.janela, 0, &tamanho_escritor, &unidade, &base);
+        MPI_Win_sync(replica_no.janela);
+        janela_enderecos(base);
+    }
+    replica_no.sequencia_vista = __atomic_load_n(&replica_no.cabecalho->sequencia, __ATOMIC_ACQUIRE);
+}
+
+// Libera a janela e os comunicadores (depois de encerrar_difusao: ninguém mais escreve)
+void replica_no_finalizar() {
+    if (replica_no.janela != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(replica_no.janela);
+        MPI_Win_free(&replica_no.janela);
+        replica_no.cabecalho = NULL;
+    }
+    if (replica_no.no != MPI_COMM_NULL) {
+        MPI_Comm_free(&replica_no.no);
+    }
+    if (replica_no.membros != MPI_COMM_WORLD && replica_no.membros != MPI_COMM_NULL) {
+        MPI_Comm_free(&replica_no.membros);
+    }
+    free(replica_no.leitores);
+    free(membros_difusao);
+    free(posicao_difusao);
+}
+
+// Copia os campos e até limite_texto bytes do texto (reaproveita a cópia de uma tentativa anterior)
+static void copiar_linha_lida(LinhaLida* destino, int posicao, int id, int dono_bloqueio, int revisao,
+                              const char* texto, int comprimento, int limite_texto) {
+    destino->posicao = posicao;
+    destino->id = id;
+    destino->dono_bloqueio = dono_bloqueio;
+    destino->revisao = revisao;
+    destino->comprimento = comprimento;
+    if (limite_texto > 0) {
+        int copiar = comprimento < limite_texto ? comprimento : limite_texto;
+        destino->texto = realloc(destino->texto, copiar + 1);
+        memcpy(destino->texto, texto, copiar);
+        destino->texto[copiar] = '\0';
+    }
+}
+
+// Lê até 'quantidade' linhas consecutivas a partir da posição 'primeira' ou, com id_primeira
+// >= 0, da linha com esse id. Na janela, repete a leitura se ela cruzou uma escrita
+static int ler_linhas(int primeira, int id_primeira, int quantidade, LinhaLida* linhas, int limite_texto) {
+    memset(linhas, 0, quantidade * sizeof(LinhaLida));
+    if (!replica_no.cabecalho) {
+        pthread_mutex_lock(&progresso.mutex);
+        Linha* linha = id_primeira >= 0 ? documento_por_id(&documento, id_primeira) : documento_linha(&documento, primeira);
+        int posicao = linha ? documento_indice(linha) : 0;
+        int lidas = 0;
+        for (; linha && lidas < quantidade; linha = documento_proxima(linha)) {
+            copiar_linha_lida(&linhas[lidas++], posicao++, linha->id, linha->dono_bloqueio, linha->revisao,
+                              linha->texto, linha->comprimento, limite_texto);
+        }
+        pthread_mutex_unlock(&progresso.mutex);
+        return lidas;
+    }
+
+    CabecalhoJanela* cabecalho = replica_no.cabecalho;
+    int preenchidas = 0;
+    while (1) {
+        uint64_t sequencia = __atomic_load_n(&cabecalho->sequencia, __ATOMIC_ACQUIRE);
+        if (sequencia & 1) {
+            if (!__atomic_load_n(&replica_no.cabecalho, __ATOMIC_ACQUIRE)) {
+                // A janela esgotou e a réplica própria já chegou: lê dela
+                replica_liberar(linhas, preenchidas);
+                return ler_linhas(primeira, id_primeira, quantidade, linhas, limite_texto);
+            }
+            sched_yield();  // Escrita em andamento (ou a réplica própria a caminho)
+            continue;
+        }
+        int total = cabecalho->total_linhas;
+        int posicao = id_primeira >= 0 ? janela_posicao(id_primeira) : primeira;
+        int lidas = 0;
+        for (int i = posicao; i >= 0 && i < total && i < replica_no.capacidade_linhas && lidas < quantidade; i++) {
+            LinhaJanela l = replica_no.linhas[i];
+            // Uma leitura cruzada com a escrita pode ver campos incoerentes: nunca sai da arena
+            if (l.comprimento < 0 || l.deslocamento < 0 || l.deslocamento + l.comprimento > replica_no.capacidade_texto) {
+                l.comprimento = 0;
+                l.deslocamento = 0;
+            }
+            copiar_linha_lida(&linhas[lidas++], i, l.id, l.dono_bloqueio, l.revisao,
+                              replica_no.texto + l.deslocamento, l.comprimento, limite_texto);
+        }
+        if (lidas > preenchidas) preenchidas = lidas;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&cabecalho->sequencia, __ATOMIC_RELAXED) == sequencia) {
+            replica_liberar(linhas + lidas, preenchidas - lidas);  // Sobras de uma tentativa mais longa
+            return lidas;
+        }
+    }
+}
+
+int replica_total_linhas() {
+    CabecalhoJanela* cabecalho = __atomic_load_n(&replica_no.cabecalho, __ATOMIC_ACQUIRE);
+    if (!cabecalho) return documento.total_linhas;
+    return __atomic_load_n(&cabecalho->total_linhas, __ATOMIC_RELAXED);
+}
+
+// Copia as linhas [primeira, primeira + quantidade) existentes; retorna quantas
+int replica_ler(int primeira, int quantidade, LinhaLida* linhas, int limite_texto) {
+    return ler_linhas(primeira, -1, quantidade, linhas, limite_texto);
+}
+
+int replica_ler_id(int id, int quantidade, LinhaLida* linhas, int limite_texto) {
+    if (id < 0) return 0;
+    return ler_linhas(0, id, quantidade, linhas, limite_texto);
+}
+
+void replica_liberar(LinhaLida* linhas, int quantidade) {
+    for (int i = 0; i < quantidade; i++) {
+        free(linhas[i].texto);
+        linhas[i].texto = NULL;
+    }
+}
+
+static int replica_mudou() {
+    if (!replica_no.cabecalho || replica_no.escritor) return 0;
+    uint64_t sequencia = __atomic_load_n(&replica_no.cabecalho->sequencia, __ATOMIC_ACQUIRE);
+    if (sequencia == replica_no.sequencia_vista || (sequencia & 1)) return 0;
+    replica_no.sequencia_vista = sequencia;
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Cliente assíncrono: cada pedido ao coordenador leva um id e é concluído por um
+// retorno (callback) ou por cliente_aguardar, permitindo várias operações em voo
+// ---------------------------------------------------------------------------
+
+// Reserva a vaga do próximo id; se ela ainda estiver ocupada, progride até liberar
+static int registrar_operacao(int tipo, int id_linha, int destino, RetornoOperacao retorno, void* contexto) {
+    int id_pedido = cliente.proximo_id++;
+    OperacaoPendente* op = &cliente.operacoes[id_pedido % MAX_OPERACOES];
+    while (op->ativa) {
+        cliente_progredir();
+    }
+    op->ativa = 1;
+    op->concluida = 0;
+    op->na_fila = 0;
+    op->retorno = retorno;
+    op->contexto = contexto;
+    op->resultado = NULL;
+    op->destino = destino;
+    op->conclusao.id_pedido = id_pedido;
+    op->conclusao.tipo = tipo;
+    op->conclusao.id_linha = id_linha;
+    op->conclusao.sucesso = 0;
+    op->conclusao.inicio = instante_ns(CLOCK_MONOTONIC);
+    cliente.em_voo++;
+    return id_pedido;
+}
+
+// Pede o bloqueio da linha ao coordenador dono dela. Se estiver ocupada, o pedido espera
+// na fila da linha e só é concluído quando ela for passada a este usuário (ou negado na
+// hora com --sem-fila). Retorna o id do pedido
+int cliente_pedir_bloqueio(int indice, int id_linha, RetornoOperacao retorno, void* contexto) {
+    int destino = coordenador_da_linha(id_linha);
+    int id_pedido = registrar_operacao(OPERACAO_BLOQUEIO, id_linha, destino, retorno, contexto);
+    int pedido[4] = {indice, id_linha, id_pedido, fila_bloqueio};
+    correio_enfileirar(destino, QUADRO_PEDIDO_BLOQUEIO, pedido, sizeof(pedido));
+    return id_pedido;
+}
+
+// Passa a renovar (ou deixa de renovar) o bloqueio de uma linha
+static void manter_bloqueio(int id_linha, int manter) {
+    pthread_mutex_lock(&cliente.mantidos_mutex);
+    int mantido = 0;
+    for (int i = 0; i < cliente.num_mantidos && !mantido; i++) {
+        mantido = cliente.mantidos[i] == id_linha;
+    }
+    if (manter) {
+        // Pedir de novo uma linha já bloqueada só estende o prazo: não duplica a entrada
+        if (!mantido && cliente.num_mantidos < MAX_OPERACOES) {
+            cliente.mantidos[cliente.num_mantidos++] = id_linha;
+        }
+    } else {
+        for (int i = 0; i < cliente.num_mantidos; i++) {
+            if (cliente.mantidos[i] == id_linha) {
+                cliente.mantidos[i] = cliente.mantidos[--cliente.num_mantidos];
                 break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cliente.mantidos_mutex);
+}
+
+// Renova os bloqueios mantidos a cada terço do prazo, para que só expirem se este
+// usuário travar ou morrer. Chamada pela thread de progresso e por cliente_progredir
+void cliente_renovar_bloqueios() {
+    if (prazo_bloqueio_s == 0) return;
+    int64_t agora = instante_ns(CLOCK_MONOTONIC);
+    pthread_mutex_lock(&cliente.mantidos_mutex);
+    if (cliente.num_mantidos > 0 && agora - cliente.ultima_renovacao >= (int64_t)prazo_bloqueio_s * 1000000000LL / 3) {
+        // Um quadro por coordenador renova todos os bloqueios deste usuário nele
+        int renovar[size_global];
+        memset(renovar, 0, sizeof(renovar));
+        for (int i = 0; i < cliente.num_mantidos; i++) {
+            renovar[coordenador_da_linha(cliente.mantidos[i])] = 1;
+        }
+        for (int rank = 0; rank < size_global; rank++) {
+            if (renovar[rank]) correio_enfileirar(rank, QUADRO_RENOVAR_BLOQUEIO, NULL, 0);
+        }
+        correio_despachar();  // A thread de progresso renova enquanto a interface espera o usuário
+        cliente.ultima_renovacao = agora;
+    }
+    pthread_mutex_unlock(&cliente.mantidos_mutex);
+}
+
+// Envia o novo texto de uma linha em um único quadro. Com direta = 0 a linha já deve
+// estar bloqueada por este usuário; com direta = 1 o coordenador bloqueia, grava e libera
+// de uma vez (uma ida e volta por edição). Retorna o id do pedido
+int cliente_enviar_texto(int id_linha, const char* texto, int comprimento, int direta, RetornoOperacao retorno, void* contexto) {
+    int destino = coordenador_da_linha(id_linha);
+    int id_pedido = registrar_operacao(direta ? OPERACAO_EDICAO_DIRETA : OPERACAO_TEXTO, id_linha, destino, retorno, contexto);
+    if (!direta) {
+        manter_bloqueio(id_linha, 0);  // O texto libera o bloqueio
+    }
+    int tamanho = sizeof(EnvioTexto) + comprimento;
+    EnvioTexto* envio = malloc(tamanho);
+    envio->id_pedido = id_pedido;
+    envio->id = id_linha;
+    envio->instante_origem = instante_ns(CLOCK_REALTIME);  // Permite medir a propagação nos outros ranks
+    envio->comprimento = comprimento;
+    memcpy(envio->texto, texto, comprimento);
+    correio_enfileirar(destino, direta ? QUADRO_EDICAO_DIRETA : QUADRO_TEXTO, envio, tamanho);
+    free(envio);
+    return id_pedido;
+}
+
+// Substitui um trecho da linha sem bloqueá-la, a partir da revisão vista na réplica local.
+// O coordenador transforma a edição contra as concorrentes. Retorna o id do pedido
+int cliente_editar_trecho(int id_linha, int revisao_base, int posicao, int apagar, const char* texto, int comprimento,
+                          RetornoOperacao retorno, void* contexto) {
+    int destino = coordenador_da_linha(id_linha);
+    int id_pedido = registrar_operacao(OPERACAO_TRECHO, id_linha, destino, retorno, contexto);
+    int tamanho = sizeof(EnvioTrecho) + comprimento;
+    EnvioTrecho* op = malloc(tamanho);
+    op->id_pedido = id_pedido;
+    op->id = id_linha;
+    op->revisao_base = revisao_base;
+    op->posicao = posicao;
+    op->apagar = apagar;
+    op->instante_origem = instante_ns(CLOCK_REALTIME);
+    op->comprimento = comprimento;
+    memcpy(op->texto, texto, comprimento);
+    correio_enfileirar(destino, QUADRO_TRECHO, op, tamanho);
+    free(op);
+    return id_pedido;
+}
+
+// Pede o bloqueio de linhas consecutivas (ids na ordem do documento, lidos da réplica
+// local). Concedido só se todas estiverem livres e ainda consecutivas; não entra em fila.
+// Retorna o id do pedido
+int cliente_bloquear_intervalo(const int* ids, int num_linhas, RetornoOperacao retorno, void* contexto) {
+    int destino = coordenador_da_linha(ids[0]);
+    int id_pedido = registrar_operacao(OPERACAO_INTERVALO, ids[0], destino, retorno, contexto);
+    int pedido[2 + num_linhas];
+    pedido[0] = id_pedido;
+    pedido[1] = num_linhas;
+    memcpy(pedido + 2, ids, num_linhas * sizeof(int));
+    correio_enfileirar(destino, QUADRO_PEDIDO_INTERVALO, pedido, sizeof(pedido));
+    return id_pedido;
+}
+
+// Envia o novo texto de várias linhas em um único quadro; o coordenador aplica tudo
+// ou nada e difunde um único delta. Com direta = 0 as linhas devem estar bloqueadas por
+// este usuário (e são liberadas); com direta = 1 basta que estejam livres. Retorna o id do pedido
+int cliente_editar_lote(const int* ids, char* const* textos, const int* comprimentos, int num_linhas, int direta,
+                        RetornoOperacao retorno, void* contexto) {
+    int destino = coordenador_da_linha(ids[0]);
+    int id_pedido = registrar_operacao(OPERACAO_LOTE, ids[0], destino, retorno, contexto);
+    int comprimento = 0;
+    for (int i = 0; i < num_linhas; i++) {
+        comprimento += 2 * sizeof(int) + comprimentos[i];
+        if (!direta) {
+            manter_bloqueio(ids[i], 0);
+        }
+    }
+    int tamanho = sizeof(EnvioLote) + comprimento;
+    EnvioLote* lote = malloc(tamanho);
+    lote->id_pedido = id_pedido;
+    lote->num_linhas = num_linhas;
+    lote->direta = direta;
+    lote->instante_origem = instante_ns(CLOCK_REALTIME);
+    lote->comprimento = comprimento;
+    char* p = lote->dados;
+    for (int i = 0; i < num_linhas; i++) {
+        memcpy(p, &ids[i], sizeof(int)); p += sizeof(int);
+        memcpy(p, &comprimentos[i], sizeof(int)); p += sizeof(int);
+        memcpy(p, textos[i], comprimentos[i]); p += comprimentos[i];
+    }
+    correio_enfileirar(destino, QUADRO_LOTE, lote, tamanho);
+    free(lote);
+    return id_pedido;
+}
+
+// Pede ao mestre para inserir, remover, dividir ou juntar linhas (tipo ATUALIZACAO_*). A
+// linha vai pelo id estável visto na réplica (na inserção, o da linha que ficará depois da
+// nova, ou -1 no fim; ao juntar, também o da seguinte). Retorna o id do pedido
+int cliente_operacao_linha(int tipo, int indice, int id_linha, int deslocamento, int id_seguinte,
+                           RetornoOperacao retorno, void* contexto) {
+    int destino = rank_da_particao(0);
+    int id_pedido = registrar_operacao(OPERACAO_ESTRUTURA, -1, destino, retorno, contexto);
+    int pedido[6] = {id_pedido, tipo, indice, id_linha, deslocamento, id_seguinte};
+    correio_enfileirar(destino, QUADRO_OPERACAO_LINHA, pedido, sizeof(pedido));
+    return id_pedido;
+}
+
+// Pede ao mestre as ocorrências do texto no documento. Elas são copiadas para 'resultado'
+// (se não for NULL) antes da conclusão, que é sempre aprovada. Retorna o id do pedido
+int cliente_buscar(const char* texto, int comprimento, ResultadoBusca* resultado, RetornoOperacao retorno, void* contexto) {
+    // No principal a busca vai a uma reserva, se houver, e alivia o mestre
+    int destino = documento_ativo == DOCUMENTO_PRINCIPAL ? rank_leitura() : rank_da_particao(0);
+    int id_pedido = registrar_operacao(OPERACAO_BUSCA, -1, destino, retorno, contexto);
+    cliente.operacoes[id_pedido % MAX_OPERACOES].resultado = resultado;
+    int tamanho = 2 * sizeof(int) + comprimento;
+    char* pedido = malloc(tamanho);
+    int campos[2] = {id_pedido, comprimento};
+    memcpy(pedido, campos, sizeof(campos));
+    memcpy(pedido + sizeof(campos), texto, comprimento);
+    correio_enfileirar(destino, QUADRO_BUSCA, pedido, tamanho);
+    free(pedido);
+    return id_pedido;
+}
+
+// Mensagem para um canal, ou para "@rank" (conversa privada), sempre pelo mestre
+int cliente_enviar_chat(const char* canal, const char* texto, int comprimento, RetornoOperacao retorno, void* contexto) {
+    int destino = rank_da_particao(0);
+    int id_pedido = registrar_operacao(OPERACAO_CHAT, -1, destino, retorno, contexto);
+    EnvioChat* envio = calloc(1, sizeof(EnvioChat) + comprimento);
+    envio->id_pedido = id_pedido;
+    envio->comprimento = comprimento;
+    snprintf(envio->canal, sizeof(envio->canal), "%s", canal);
+    memcpy(envio->texto, texto, comprimento);
+    correio_enfileirar(destino, QUADRO_CHAT, envio, sizeof(EnvioChat) + comprimento);
+    free(envio);
+    return id_pedido;
+}
+
+// Entra (CANAL_ENTRAR) ou sai (CANAL_SAIR) de um canal
+int cliente_canal(int operacao, const char* canal, RetornoOperacao retorno, void* contexto) {
+    int destino = rank_da_particao(0);
+    int id_pedido = registrar_operacao(OPERACAO_CHAT, -1, destino, retorno, contexto);
+    char pedido[2 * sizeof(int) + TAMANHO_NOME_CANAL] = {0};
+    int campos[2] = {id_pedido, operacao};
+    memcpy(pedido, campos, sizeof(campos));
+    snprintf(pedido + sizeof(campos), TAMANHO_NOME_CANAL, "%s", canal);
+    correio_enfileirar(destino, QUADRO_CANAL, pedido, sizeof(pedido));
+    return id_pedido;
+}
+
+// Pede a página de mensagens anteriores à sequência antes_de (0 = as mais recentes)
+int cliente_historico(const char* canal, int antes_de, PaginaHistorico* pagina, RetornoOperacao retorno, void* contexto) {
+    int destino = rank_da_particao(0);
+    int id_pedido = registrar_operacao(OPERACAO_CHAT, -1, destino, retorno, contexto);
+    cliente.operacoes[id_pedido % MAX_OPERACOES].resultado = pagina;
+    char pedido[3 * sizeof(int) + TAMANHO_NOME_CANAL] = {0};
+    int campos[3] = {id_pedido, antes_de, MENSAGENS_POR_PAGINA};
+    memcpy(pedido, campos, sizeof(campos));
+    snprintf(pedido + sizeof(campos), TAMANHO_NOME_CANAL, "%s", canal);
+    correio_enfileirar(destino, QUADRO_HISTORICO, pedido, sizeof(pedido));
+    return id_pedido;
+}
+
+// Abre (criando no primeiro uso) e assina o documento com o nome; o id vem em id_linha da
+// conclusão, e o estado completo chega pela difusão logo depois
+int cliente_abrir_documento(const char* nome, RetornoOperacao retorno, void* contexto) {
+    int destino = rank_da_particao(0);
+    int id_pedido = registrar_operacao(OPERACAO_DOCUMENTO, -1, destino, retorno, contexto);
+    char pedido[sizeof(int) + TAMANHO_NOME_DOCUMENTO] = {0};
+    memcpy(pedido, &id_pedido, sizeof(int));
+    snprintf(pedido + sizeof(int), TAMANHO_NOME_DOCUMENTO, "%s", nome);
+    correio_enfileirar(destino, QUADRO_ABRIR_DOCUMENTO, pedido, sizeof(pedido));
+    return id_pedido;
+}
+
+// Desfaz (refazer = 0) ou refaz a última mudança de texto deste usuário no documento em uso.
+// O sucesso da conclusão é um dos DESFAZER_* e id_linha, a linha afetada
+int cliente_desfazer(int refazer, RetornoOperacao retorno, void* contexto) {
+    int destino = rank_da_particao(0);
+    int id_pedido = registrar_operacao(OPERACAO_DESFAZER, -1, destino, retorno, contexto);
+    int pedido[2] = {id_pedido, refazer};
+    correio_enfileirar(destino, QUADRO_DESFAZER, pedido, sizeof(pedido));
+    return id_pedido;
+}
+
+// Pede ao coordenador da linha as revisões mais recentes dela e o texto na revisão dada
+// (-1 = só a lista), copiados para 'resultado' antes da conclusão. Retorna o id do pedido
+int cliente_versoes_linha(int id_linha, int revisao, VersoesLinha* resultado, RetornoOperacao retorno, void* contexto) {
+    int destino = coordenador_da_linha(id_linha);
+    int id_pedido = registrar_operacao(OPERACAO_VERSOES, id_linha, destino, retorno, contexto);
+    cliente.operacoes[id_pedido % MAX_OPERACOES].resultado = resultado;
+    int pedido[3] = {id_pedido, id_linha, revisao};
+    correio_enfileirar(destino, QUADRO_VERSOES_LINHA, pedido, sizeof(pedido));
+    return id_pedido;
+}
+
+// Cancela a assinatura e descarta a réplica local (volta ao principal se era o documento em uso)
+void cliente_fechar_documento(int id) {
+    if (id == DOCUMENTO_PRINCIPAL || id < 0 || id >= MAX_DOCUMENTOS || !documentos.estados[id]) return;
+    if (id == documento_ativo && !documento_usar(DOCUMENTO_PRINCIPAL)) return;
+    correio_enfileirar(rank_da_particao(0), QUADRO_FECHAR_DOCUMENTO, &id, sizeof(int));
+    correio_despachar();
+    pthread_mutex_lock(&progresso.mutex);
+    estado_liberar(documentos.estados[id]);
+    documentos.estados[id] = NULL;
+    pthread_mutex_unlock(&progresso.mutex);
+}
+
+// Avisa todos os coordenadores que este usuário saiu; eles soltam os seus bloqueios.
+// As reservas que seguem o mestre também são avisadas, e contam a saída
+void cliente_sair() {
+    for (int c = 0; c < num_coordenadores; c++) {
+        correio_enfileirar(rank_da_particao(c), QUADRO_SAIR, NULL, 0);
+    }
+    int mestre = rank_da_particao(0);
+    for (int rank = mestre >= reservas.primeira ? mestre + 1 : reservas.primeira; rank < size_global; rank++) {
+        correio_enfileirar(rank, QUADRO_SAIR, NULL, 0);
+    }
+    correio_despachar();
+}
+
+// Conclui a operação a que a resposta se refere. Retorna 1 se ela terminou
+static int concluir_operacao(const int* resposta) {
+    OperacaoPendente* op = &cliente.operacoes[resposta[0] % MAX_OPERACOES];
+    if (!op->ativa || op->concluida || op->conclusao.id_pedido != resposta[0]) {
+        return 0;
+    }
+    if (resposta[1] == BLOQUEIO_NA_FILA && op->conclusao.tipo == OPERACAO_BLOQUEIO) {
+        op->na_fila = 1;  // A concessão virá em outra resposta
+        return 0;
+    }
+    if (resposta[1] && (op->conclusao.tipo == OPERACAO_BLOQUEIO || op->conclusao.tipo == OPERACAO_INTERVALO)) {
+        manter_bloqueio(resposta[2], 1);  // Num intervalo, a primeira linha representa todas
+    }
+    op->conclusao.sucesso = resposta[1];
+    op->conclusao.id_linha = resposta[2];
+    cliente.em_voo--;
+    if (op->retorno) {
+        // Libera a vaga antes do retorno, que pode emitir a próxima operação
+        Conclusao conclusao = op->conclusao;
+        void* contexto = op->contexto;
+        RetornoOperacao retorno = op->retorno;
+        op->ativa = 0;
+        retorno(&conclusao, contexto);
+    } else {
+        op->concluida = 1;
+    }
+    return 1;
+}
+
+// Copia as ocorrências de um QUADRO_RESULTADO_BUSCA para o destino da busca e a conclui
+static int concluir_busca(const int* corpo, int comprimento) {
+    OperacaoPendente* op = &cliente.operacoes[corpo[0] % MAX_OPERACOES];
+    if (op->ativa && !op->concluida && op->conclusao.id_pedido == corpo[0] && op->resultado) {
+        ResultadoBusca* resultado = op->resultado;
+        int cabem = (comprimento / (int)sizeof(int) - 4) / 2;  // Pares presentes no quadro
+        int quantidade = corpo[2] < cabem ? corpo[2] : cabem;
+        if (quantidade > MAX_RESULTADOS_BUSCA) quantidade = MAX_RESULTADOS_BUSCA;
+        resultado->total = corpo[1];
+        resultado->quantidade = quantidade;
+        resultado->microssegundos = corpo[3];
+        for (int i = 0; i < quantidade; i++) {
+            resultado->linhas[i] = corpo[4 + 2 * i];
+            resultado->deslocamentos[i] = corpo[5 + 2 * i];
+        }
+    }
+    int resposta[3] = {corpo[0], 1, -1};
+    return concluir_operacao(resposta);
+}
+
+// Copia a página de um QUADRO_PAGINA_HISTORICO para o destino do pedido e o conclui. Um
+// estado 0 indica canal inexistente ou que o usuário não é membro
+static int concluir_historico(const char* corpo, int comprimento) {
+    const int* campos = (const int*)corpo;
+    OperacaoPendente* op = &cliente.operacoes[campos[0] % MAX_OPERACOES];
+    if (op->ativa && !op->concluida && op->conclusao.id_pedido == campos[0] && op->resultado) {
+        PaginaHistorico* pagina = op->resultado;
+        pagina->total = campos[2];
+        pagina->primeira_guardada = campos[3];
+        pagina->quantidade = 0;
+        int posicao = 6 * sizeof(int);
+        for (int i = 0; i < campos[4] && pagina->quantidade < MENSAGENS_POR_PAGINA; i++) {
+            const MensagemChat* mensagem = (const MensagemChat*)(corpo + posicao);
+            if (posicao + (int)sizeof(MensagemChat) > comprimento || posicao + TAMANHO_MENSAGEM_CHAT(mensagem) > comprimento) break;
+            converter_mensagem_chat(&pagina->mensagens[pagina->quantidade++], mensagem);
+            posicao += TAMANHO_MENSAGEM_CHAT(mensagem);
+        }
+    }
+    int resposta[3] = {campos[0], campos[1], -1};
+    return concluir_operacao(resposta);
+}
+
+// Copia as revisões e o texto de um QUADRO_VERSOES para o destino da consulta e a conclui.
+// Um estado 0 indica linha inexistente ou histórico desligado
+static int concluir_versoes(const char* corpo, int comprimento) {
+    const int* campos = (const int*)corpo;
+    OperacaoPendente* op = &cliente.operacoes[campos[0] % MAX_OPERACOES];
+    if (op->ativa && !op->concluida && op->conclusao.id_pedido == campos[0] && op->resultado) {
+        VersoesLinha* versoes = op->resultado;
+        int quantidade = campos[4] < MAX_REVISOES_LISTADAS ? campos[4] : MAX_REVISOES_LISTADAS;
+        int posicao = 6 * sizeof(int);
+        if (quantidade < 0 || posicao + quantidade * (int)sizeof(RevisaoLinha) > comprimento) quantidade = 0;
+        versoes->revisao_atual = campos[2];
+        versoes->revisao_texto = campos[3];
+        versoes->quantidade = quantidade;
+        memcpy(versoes->revisoes, corpo + posicao, quantidade * sizeof(RevisaoLinha));
+        posicao += campos[4] * sizeof(RevisaoLinha);
+        int tamanho_texto = campos[5] >= 0 && posicao + campos[5] <= comprimento ? campos[5] : 0;
+        versoes->texto = malloc(tamanho_texto + 1);
+        memcpy(versoes->texto, corpo + posicao, tamanho_texto);
+        versoes->texto[tamanho_texto] = '\0';
+        versoes->comprimento = tamanho_texto;
+    }
+    int resposta[3] = {campos[0], campos[1], -1};
+    return concluir_operacao(resposta);
+}
+
+// Um rank morreu: as operações que esperavam a resposta dele falham, e quem editava um
+// documento hospedado (que morreu com o mestre) volta ao principal. Retorna quantas falharam
+static int cliente_esquecer_perdidos() {
+    int falhas = 0;
+    for (int i = 0; i < MAX_OPERACOES; i++) {
+        OperacaoPendente* op = &cliente.operacoes[i];
+        if (op->ativa && !op->concluida && reservas.perdido[op->destino]) {
+            int resposta[3] = {op->conclusao.id_pedido, 0, -1};
+            falhas += concluir_operacao(resposta);
+        }
+    }
+    if (documento_ativo != DOCUMENTO_PRINCIPAL) {
+        pthread_mutex_lock(&progresso.mutex);
+        documento_carregar(DOCUMENTO_PRINCIPAL);
+        documento_ativo = DOCUMENTO_PRINCIPAL;
+        progresso.pendentes.documento_mudou = 1;
+        pthread_mutex_unlock(&progresso.mutex);
+    }
+    return falhas;
+}
+
+// Recebe os pacotes de respostas já disponíveis, conclui as operações correspondentes e
+// envia os pedidos acumulados (inclusive os emitidos pelos retornos) em um pacote por
+// coordenador. Retorna quantas foram concluídas
+int cliente_progredir() {
+    int concluidas = 0;
+    int flag;
+    MPI_Status status;
+    cliente_renovar_bloqueios();
+    int perdidos = __atomic_load_n(&reservas.num_perdidos, __ATOMIC_SEQ_CST);
+    if (perdidos != cliente.perdidos_vistos) {
+        cliente.perdidos_vistos = perdidos;
+        concluidas += cliente_esquecer_perdidos();
+    }
+    MPI_Iprobe(MPI_ANY_SOURCE, TAG_QUADROS, MPI_COMM_WORLD, &flag, &status);
+    while (flag) {
+        int tamanho;
+        MPI_Get_count(&status, MPI_BYTE, &tamanho);
+        char* pacote = malloc(tamanho);
+        MPI_Recv(pacote, tamanho, MPI_BYTE, status.MPI_SOURCE, TAG_QUADROS, MPI_COMM_WORLD, &status);
+        metrica_mensagem(METRICA_RECEBIDA, TAG_QUADROS, tamanho);
+        int posicao = 0;
+        const Quadro* quadro;
+        while ((quadro = proximo_quadro(pacote, tamanho, &posicao)) != NULL) {
+            if (quadro->sequencia != correio.recebidos[status.MPI_SOURCE] + 1) {
+                fprintf(stderr, "Erro: quadro %u de %d fora de sequência (esperado %u).\n", quadro->sequencia,
+                        status.MPI_SOURCE, correio.recebidos[status.MPI_SOURCE] + 1);
+            }
+            correio.recebidos[status.MPI_SOURCE] = quadro->sequencia;
+            if (quadro->tipo == QUADRO_RESPOSTA && quadro->comprimento >= 3 * sizeof(int)) {
+                concluidas += concluir_operacao((const int*)CORPO_QUADRO(quadro));
+            } else if (quadro->tipo == QUADRO_RESULTADO_BUSCA && quadro->comprimento >= 4 * sizeof(int)) {
+                concluidas += concluir_busca((const int*)CORPO_QUADRO(quadro), quadro->comprimento);
+            } else if (quadro->tipo == QUADRO_PAGINA_HISTORICO && quadro->comprimento >= 6 * sizeof(int)) {
+                concluidas += concluir_historico(CORPO_QUADRO(quadro), quadro->comprimento);
+            } else if (quadro->tipo == QUADRO_VERSOES && quadro->comprimento >= 6 * sizeof(int)) {
+                concluidas += concluir_versoes(CORPO_QUADRO(quadro), quadro->comprimento);
+            }
+        }
+        free(pacote);
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_QUADROS, MPI_COMM_WORLD, &flag, &status);
+    }
+    correio_despachar();
+    return concluidas;
+}
 
-            case TAG_SAIR:
-                // Usuário notifica que está saindo do editor
-                printf("[MESTRE] Usuario_%d saiu. %d restantes.\n", remetente, trabalhadores_ativos - 1);
-                trabalhadores_ativos--;
-                break;
+// Espera uma operação registrada sem retorno terminar. Retorna 1 se foi aprovada
+int cliente_aguardar(int id_pedido, Conclusao* conclusao) {
+    OperacaoPendente* op = &cliente.operacoes[id_pedido % MAX_OPERACOES];
+    while (!op->concluida || op->conclusao.id_pedido != id_pedido) {
+        if (cliente_progredir() == 0 && op->na_fila) {
+            usleep(1000);  // Na fila a espera pode ser longa: não gira a CPU
         }
     }
-    
-    // Quando todos saem, envia sinal de finalização
-    printf("[MESTRE] Todos os trabalhadores saíram. Enviando sinal para finalizar.\n");
-    req_count = 0;
-    int dummy = 0;
-    for (int i = 1; i < size_global; i++) {
-        MPI_Isend(&dummy, 1, MPI_INT, i, TAG_FINALIZAR, MPI_COMM_WORLD, &requests[req_count++]);
+    *conclusao = op->conclusao;
+    op->ativa = 0;
+    op->concluida = 0;
+    return conclusao->sucesso;
+}
+
+// ---------------------------------------------------------------------------
+// Métricas de operação: contadores por thread, arquivo no formato do Prometheus
+// e consulta por TAG_METRICAS
+// ---------------------------------------------------------------------------
+
+static const int64_t limites_metricas_ns[NUM_LIMITES_METRICAS] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 10000000, 100000000
+};
+static const char* nomes_tags[NUM_TAGS] = {
+    [TAG_QUADROS] = "quadros", [TAG_ATUALIZACAO] = "atualizacao", [TAG_CHAT] = "chat",
+    [TAG_FINALIZAR] = "finalizar", [TAG_METRICAS] = "metricas", [TAG_RESERVA] = "reserva"
+};
+static const char* nomes_quadros[NUM_TIPOS_QUADRO] = {
+    [QUADRO_PEDIDO_BLOQUEIO] = "pedido_bloqueio", [QUADRO_TEXTO] = "texto", [QUADRO_EDICAO_DIRETA] = "edicao_direta",
+    [QUADRO_TRECHO] = "trecho", [QUADRO_PEDIDO_INTERVALO] = "pedido_intervalo", [QUADRO_LOTE] = "lote",
+    [QUADRO_OPERACAO_LINHA] = "operacao_linha", [QUADRO_RENOVAR_BLOQUEIO] = "renovar_bloqueio",
+    [QUADRO_RESSINCRONIZACAO] = "ressincronizacao", [QUADRO_SAIR] = "sair", [QUADRO_BUSCA] = "busca",
+    [QUADRO_CHAT] = "chat", [QUADRO_CANAL] = "canal", [QUADRO_HISTORICO] = "historico",
+    [QUADRO_ABRIR_DOCUMENTO] = "abrir_documento", [QUADRO_FECHAR_DOCUMENTO] = "fechar_documento",
+    [QUADRO_DOCUMENTO] = "documento", [QUADRO_DESFAZER] = "desfazer", [QUADRO_VERSOES_LINHA] = "versoes_linha"
+};
+static const char* nomes_resultados[NUM_RESULTADOS_BLOQUEIO] = {
+    "concedido", "negado", "na_fila", "concedido_da_fila", "expirado"
+};
+
+static __thread BlocoMetricas* metricas_thread;
+
+static BlocoMetricas* metricas_locais() {
+    if (!metricas_thread) {
+        BlocoMetricas* bloco = calloc(1, sizeof(BlocoMetricas));
+        bloco->proximo = __atomic_load_n(&metricas.blocos, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&metricas.blocos, &bloco->proximo, bloco, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+        metricas_thread = bloco;
     }
-    MPI_Waitall(req_count, requests, MPI_STATUSES_IGNORE);
+    return metricas_thread;
 }
 
-// Loop principal dos processos trabalhadores - interface de usuário
-void loop_trabalhador() {
-    char nome_usuario[50];
-    sprintf(nome_usuario, "Usuario_%d", rank_global);
-    MPI_Status status; 
-    int usuario_ativo = 1;
+// Só a thread dona escreve no contador: leitura e escrita relaxadas bastam, e quem soma os
+// blocos nunca vê um valor rasgado
+static void metrica_somar(uint64_t* contador, uint64_t valor) {
+    __atomic_store_n(contador, __atomic_load_n(contador, __ATOMIC_RELAXED) + valor, __ATOMIC_RELAXED);
+}
 
-    while (1) {
-        // Verifica mensagens recebidas (atualizações, mensagens privadas, finalização)
-        if (verificar_mensagens_e_atualizacoes()) {
-            break;  // Recebeu sinal de finalização
+static uint64_t metrica_ler(const uint64_t* contador) {
+    return __atomic_load_n(contador, __ATOMIC_RELAXED);
+}
+
+static void metrica_mensagem(int sentido, int tag, int bytes) {
+    if (tag < 0 || tag >= NUM_TAGS) return;
+    BlocoMetricas* bloco = metricas_locais();
+    metrica_somar(&bloco->mensagens[sentido][tag], 1);
+    metrica_somar(&bloco->bytes[sentido][tag], bytes);
+}
+
+static void metrica_tempo(HistogramaMetricas* histograma, int64_t ns) {
+    int balde = 0;
+    while (balde < NUM_LIMITES_METRICAS && ns > limites_metricas_ns[balde]) balde++;
+    metrica_somar(&histograma->baldes[balde], 1);
+    metrica_somar(&histograma->soma_ns, ns > 0 ? ns : 0);
+}
+
+static void metrica_bloqueio(int resultado) {
+    metrica_somar(&metricas_locais()->bloqueios[resultado], 1);
+}
+
+// Soma um histograma de todas as threads (deslocamento do campo dentro do bloco)
+static void metricas_somar_histograma(size_t deslocamento, HistogramaMetricas* total) {
+    memset(total, 0, sizeof(HistogramaMetricas));
+    for (BlocoMetricas* b = __atomic_load_n(&metricas.blocos, __ATOMIC_ACQUIRE); b; b = b->proximo) {
+        const HistogramaMetricas* h = (const HistogramaMetricas*)((const char*)b + deslocamento);
+        for (int i = 0; i <= NUM_LIMITES_METRICAS; i++) total->baldes[i] += metrica_ler(&h->baldes[i]);
+        total->soma_ns += metrica_ler(&h->soma_ns);
+    }
+}
+
+static void escrever_histograma(FILE* saida, const char* nome, const char* rotulos, const HistogramaMetricas* h) {
+    uint64_t acumulado = 0;
+    for (int i = 0; i < NUM_LIMITES_METRICAS; i++) {
+        acumulado += h->baldes[i];
+        fprintf(saida, "%s_bucket{%s,le=\"%g\"} %llu\n", nome, rotulos, limites_metricas_ns[i] / 1e9, (unsigned long long)acumulado);
+    }
+    acumulado += h->baldes[NUM_LIMITES_METRICAS];
+    fprintf(saida, "%s_bucket{%s,le=\"+Inf\"} %llu\n", nome, rotulos, (unsigned long long)acumulado);
+    fprintf(saida, "%s_sum{%s} %.9f\n", nome, rotulos, h->soma_ns / 1e9);
+    fprintf(saida, "%s_count{%s} %llu\n", nome, rotulos, (unsigned long long)acumulado);
+}
+
+// Escreve as métricas deste rank no formato de texto do Prometheus. As medidas da fila de
+// bloqueios só são lidas pela thread do coordenador, que é quem chama nos coordenadores
+void metricas_escrever(FILE* saida) {
+    char rotulos[96];
+    BlocoMetricas* primeiro = __atomic_load_n(&metricas.blocos, __ATOMIC_ACQUIRE);
+
+    fprintf(saida, "# HELP nano_mensagens_total Mensagens MPI por tag e sentido (um pacote a cada destino conta uma)\n");
+    fprintf(saida, "# TYPE nano_mensagens_total counter\n");
+    for (int sentido = 0; sentido < 2; sentido++) {
+        for (int tag = 0; tag < NUM_TAGS; tag++) {
+            if (!nomes_tags[tag]) continue;
+            uint64_t total = 0;
+            for (BlocoMetricas* b = primeiro; b; b = b->proximo) total += metrica_ler(&b->mensagens[sentido][tag]);
+            fprintf(saida, "nano_mensagens_total{rank=\"%d\",tag=\"%s\",sentido=\"%s\"} %llu\n", rank_global, nomes_tags[tag],
+                    sentido == METRICA_ENVIADA ? "enviada" : "recebida", (unsigned long long)total);
         }
+    }
+    fprintf(saida, "# HELP nano_bytes_total Bytes das mensagens MPI por tag e sentido\n");
+    fprintf(saida, "# TYPE nano_bytes_total counter\n");
+    for (int sentido = 0; sentido < 2; sentido++) {
+        for (int tag = 0; tag < NUM_TAGS; tag++) {
+            if (!nomes_tags[tag]) continue;
+            uint64_t total = 0;
+            for (BlocoMetricas* b = primeiro; b; b = b->proximo) total += metrica_ler(&b->bytes[sentido][tag]);
+            fprintf(saida, "nano_bytes_total{rank=\"%d\",tag=\"%s\",sentido=\"%s\"} %llu\n", rank_global, nomes_tags[tag],
+                    sentido == METRICA_ENVIADA ? "enviada" : "recebida", (unsigned long long)total);
+        }
+    }
 
-        if (!usuario_ativo) {
-            sleep(1);  // Usuário saiu, aguarda finalização
-            continue;
+    HistogramaMetricas h;
+    snprintf(rotulos, sizeof(rotulos), "rank=\"%d\"", rank_global);
+    fprintf(saida, "# HELP nano_difusao_segundos Tempo para postar um pacote de deltas a todos os filhos na árvore\n");
+    fprintf(saida, "# TYPE nano_difusao_segundos histogram\n");
+    metricas_somar_histograma(offsetof(BlocoMetricas, difusao), &h);
+    escrever_histograma(saida, "nano_difusao_segundos", rotulos, &h);
+    fprintf(saida, "# HELP nano_aplicacao_segundos Tempo para aplicar um pacote de deltas recebido\n");
+    fprintf(saida, "# TYPE nano_aplicacao_segundos histogram\n");
+    metricas_somar_histograma(offsetof(BlocoMetricas, aplicacao), &h);
+    escrever_histograma(saida, "nano_aplicacao_segundos", rotulos, &h);
+
+    if (!eh_coordenador(rank_global) && !eh_reserva(rank_global)) return;
+
+    fprintf(saida, "# HELP nano_quadros_total Quadros de pedido tratados pelo coordenador, por tipo\n");
+    fprintf(saida, "# TYPE nano_quadros_total counter\n");
+    for (int tipo = 0; tipo < NUM_TIPOS_QUADRO; tipo++) {
+        if (!nomes_quadros[tipo]) continue;
+        uint64_t total = 0;
+        for (BlocoMetricas* b = primeiro; b; b = b->proximo) total += metrica_ler(&b->quadros[tipo]);
+        fprintf(saida, "nano_quadros_total{rank=\"%d\",tipo=\"%s\"} %llu\n", rank_global, nomes_quadros[tipo], (unsigned long long)total);
+    }
+    fprintf(saida, "# HELP nano_bloqueios_total Pedidos de bloqueio por resultado, concessões da fila e prazos expirados\n");
+    fprintf(saida, "# TYPE nano_bloqueios_total counter\n");
+    for (int r = 0; r < NUM_RESULTADOS_BLOQUEIO; r++) {
+        uint64_t total = 0;
+        for (BlocoMetricas* b = primeiro; b; b = b->proximo) total += metrica_ler(&b->bloqueios[r]);
+        fprintf(saida, "nano_bloqueios_total{rank=\"%d\",resultado=\"%s\"} %llu\n", rank_global, nomes_resultados[r], (unsigned long long)total);
+    }
+
+    // Somados em todos os documentos hospedados (o carregado está nas variáveis globais)
+    int bloqueadas = 0, em_espera = 0;
+    for (int id = 0; id < documentos.num_documentos; id++) {
+        const TabelaBloqueios* tabela = id == documentos.carregado ? &tabela_bloqueios : &documentos.estados[id]->bloqueios;
+        bloqueadas += bloqueios_total(tabela);
+        for (int f = 0; f < FAIXAS_BLOQUEIO; f++) {
+            for (int i = 0; i < tabela->faixas[f].total; i++) {
+                for (PedidoEmEspera* p = tabela->faixas[f].entradas[i].primeiro; p; p = p->proximo) em_espera++;
+            }
         }
+    }
+    fprintf(saida, "# HELP nano_documentos_hospedados Documentos no registro deste coordenador\n");
+    fprintf(saida, "# TYPE nano_documentos_hospedados gauge\n");
+    fprintf(saida, "nano_documentos_hospedados{rank=\"%d\"} %d\n", rank_global, documentos.num_documentos);
+    pthread_mutex_lock(&anel_versoes.mutex);
+    fprintf(saida, "# HELP nano_historico_bytes Bytes ocupados no anel do histórico de versões\n");
+    fprintf(saida, "# TYPE nano_historico_bytes gauge\n");
+    fprintf(saida, "nano_historico_bytes{rank=\"%d\"} %lld\n", rank_global, (long long)(anel_versoes.fim - anel_versoes.inicio));
+    fprintf(saida, "# HELP nano_historico_descartados_total Revisões descartadas do histórico para caber no orçamento\n");
+    fprintf(saida, "# TYPE nano_historico_descartados_total counter\n");
+    fprintf(saida, "nano_historico_descartados_total{rank=\"%d\"} %ld\n", rank_global, anel_versoes.descartados);
+    pthread_mutex_unlock(&anel_versoes.mutex);
+    pthread_mutex_lock(&envios_mutex);
+    int envios_pendentes = 0;
+    for (int i = 0; i < num_vagas_envio; i++) envios_pendentes += envios[i].buffer != NULL;
+    int vagas = num_vagas_envio;
+    pthread_mutex_unlock(&envios_mutex);
+    fprintf(saida, "# HELP nano_linhas_bloqueadas Linhas bloqueadas neste coordenador\n");
+    fprintf(saida, "# TYPE nano_linhas_bloqueadas gauge\n");
+    fprintf(saida, "nano_linhas_bloqueadas{rank=\"%d\"} %d\n", rank_global, bloqueadas);
+    fprintf(saida, "# HELP nano_fila_bloqueio Pedidos esperando nas filas de bloqueio\n");
+    fprintf(saida, "# TYPE nano_fila_bloqueio gauge\n");
+    fprintf(saida, "nano_fila_bloqueio{rank=\"%d\"} %d\n", rank_global, em_espera);
+    fprintf(saida, "# HELP nano_envios_pendentes Envios não bloqueantes ainda não concluídos (de %d vagas)\n", vagas);
+    fprintf(saida, "# TYPE nano_envios_pendentes gauge\n");
+    fprintf(saida, "nano_envios_pendentes{rank=\"%d\"} %d\n", rank_global, envios_pendentes);
 
-        // Interface do menu principal
-        printf("\n[%s] Menu:\n", nome_usuario);
-        printf("1. Visualizar documento em tempo real\n");
-        printf("2. Editar linha\n");
-        printf("3. Enviar mensagem privada\n");
-        printf("4. Visualizar mensagens recebidas\n");
-        printf("5. Sair\n> ");
+    fprintf(saida, "# HELP nano_tratador_segundos Tempo dentro do tratador de cada tipo de quadro\n");
+    fprintf(saida, "# TYPE nano_tratador_segundos histogram\n");
+    for (int tipo = 0; tipo < NUM_TIPOS_QUADRO; tipo++) {
+        if (!nomes_quadros[tipo]) continue;
+        metricas_somar_histograma(offsetof(BlocoMetricas, tratador) + tipo * sizeof(HistogramaMetricas), &h);
+        snprintf(rotulos, sizeof(rotulos), "rank=\"%d\",tipo=\"%s\"", rank_global, nomes_quadros[tipo]);
+        escrever_histograma(saida, "nano_tratador_segundos", rotulos, &h);
+    }
+}
 
-        int opcao;
-        if (scanf(" %d", &opcao) != 1) { 
-            while (getchar() != '\n');
-            printf("Opção inválida. Por favor, digite um número.\n");
-            continue;
+// Grava metricas_<rank>.prom (num temporário renomeado, para quem coleta nunca ler um arquivo
+// pela metade) se passou o intervalo. Chamada a cada volta dos loops; o custo fora do
+// intervalo é uma leitura do relógio
+void metricas_talvez_gravar() {
+    if (metricas.a_cada_s <= 0) return;
+    int64_t agora = instante_ns(CLOCK_MONOTONIC);
+    if (agora - __atomic_load_n(&metricas.ultima_gravacao, __ATOMIC_RELAXED) < (int64_t)metricas.a_cada_s * 1000000000LL) return;
+    if (pthread_mutex_trylock(&metricas.gravacao_mutex) != 0) return;  // A outra thread já está gravando
+    __atomic_store_n(&metricas.ultima_gravacao, agora, __ATOMIC_RELAXED);
+    char arquivo[64], temporario[72];
+    snprintf(arquivo, sizeof(arquivo), "metricas_%d.prom", rank_global);
+    snprintf(temporario, sizeof(temporario), "%s.tmp", arquivo);
+    FILE* saida = fopen(temporario, "w");
+    if (saida) {
+        metricas_escrever(saida);
+        fclose(saida);
+        rename(temporario, arquivo);
+    }
+    pthread_mutex_unlock(&metricas.gravacao_mutex);
+}
+
+// Última gravação (com os totais da sessão) e liberação dos blocos das threads
+void metricas_finalizar() {
+    metricas.ultima_gravacao = 0;
+    metricas_talvez_gravar();
+    BlocoMetricas* bloco = metricas.blocos;
+    while (bloco) {
+        BlocoMetricas* proximo = bloco->proximo;
+        free(bloco);
+        bloco = proximo;
+    }
+    metricas.blocos = NULL;
+    metricas_thread = NULL;
+}
+
+// Coordenador: responde a um pedido em TAG_METRICAS com o texto das suas métricas
+static void responder_metricas(int destino) {
+    char* texto = NULL;
+    size_t tamanho = 0;
+    FILE* saida = open_memstream(&texto, &tamanho);
+    metricas_escrever(saida);
+    fclose(saida);
+    enviar_sem_bloquear(texto, (int)tamanho + 1, &destino, 1, TAG_METRICAS);
+}
+
+// Menu: pede as métricas a um coordenador e mostra o texto recebido
+void consultar_metricas() {
+    int coordenador = rank_da_particao(0);
+    if (num_coordenadores > 1) {
+        int particao;
+        printf("Rank do coordenador (0 a %d): ", num_coordenadores - 1);
+        scanf(" %d", &particao);
+        if (!eh_coordenador(particao) || particao < 0) {
+            printf(ANSI_COLOR_RED "Rank de coordenador inválido.\n" ANSI_COLOR_RESET);
+            return;
         }
+        coordenador = rank_da_particao(particao);  // O 0 segue o mestre, mesmo depois de uma promoção
+    }
+    int vazio = 0;
+    MPI_Send(&vazio, 0, MPI_INT, coordenador, TAG_METRICAS, MPI_COMM_WORLD);
+    metrica_mensagem(METRICA_ENVIADA, TAG_METRICAS, 0);
+    MPI_Status status;
+    int tamanho;
+    MPI_Probe(coordenador, TAG_METRICAS, MPI_COMM_WORLD, &status);
+    MPI_Get_count(&status, MPI_CHAR, &tamanho);
+    char* texto = malloc(tamanho + 1);
+    MPI_Recv(texto, tamanho, MPI_CHAR, coordenador, TAG_METRICAS, MPI_COMM_WORLD, &status);
+    texto[tamanho] = '\0';
+    metrica_mensagem(METRICA_RECEBIDA, TAG_METRICAS, tamanho);
+    printf(ANSI_COLOR_CYAN "=== MÉTRICAS DO RANK %d ===\n" ANSI_COLOR_RESET "%s", coordenador, texto);
+    free(texto);
+}
 
-        if (opcao == 1) {
-            // Opção 1: Visualização em tempo real do documento
-            visualizacao_tempo_real();
-            
-        } else if (opcao == 2) {
-            // Opção 2: Editar uma linha específica
-            printf("Digite o numero da linha para editar (0 a %d): ", MAX_LINHAS - 1);
-            int linha_para_editar;
-            scanf(" %d", &linha_para_editar);
+// ---------------------------------------------------------------------------
+// Motor de progresso dos trabalhadores
+// ---------------------------------------------------------------------------
+
+// Acorda a interface; com o pipe cheio ela já tem um aviso pendente
+static void avisar_interface() {
+    char sinal = 1;
+    ssize_t escrito = write(progresso.aviso[1], &sinal, 1);
+    (void)escrito;
+}
 
-            // Solicita bloqueio da linha ao mestre
-            int pedido[2] = {linha_para_editar, 0};
-            MPI_Send(pedido, 2, MPI_INT, MASTER, TAG_PEDIDO_BLOQUEIO, MPI_COMM_WORLD);
+// Lote de mensagens de chat entregue pelo mestre: cada uma vai para o anel do chat e para
+// a lista de pendentes (com o mutex travado, se houver a thread de progresso)
+static void receber_entrega_chat(EventosPendentes* ev, const char* pacote, int tamanho) {
+    int posicao = 0;
+    const Quadro* quadro;
+    while ((quadro = proximo_quadro(pacote, tamanho, &posicao)) != NULL) {
+        if (quadro->tipo != QUADRO_MENSAGEM_CHAT || quadro->comprimento < (int)sizeof(MensagemChat)) continue;
+        const MensagemChat* mensagem = (const MensagemChat*)CORPO_QUADRO(quadro);
+        adicionar_mensagem_chat(mensagem);
+        estatisticas.contadores[CONTADOR_ENTREGUES]++;
+        if (ev->num_mensagens < MAX_PENDENTES) {
+            Mensagem convertida;
+            converter_mensagem_chat(&convertida, mensagem);
+            ev->remetentes[ev->num_mensagens] = convertida.remetente;
+            strcpy(ev->canais[ev->num_mensagens], convertida.canal);
+            strcpy(ev->mensagens[ev->num_mensagens], convertida.conteudo);
+            ev->num_mensagens++;
+        }
+    }
+}
 
-            // Aguarda resposta do mestre
-            int resposta;
-            MPI_Recv(&resposta, 1, MPI_INT, MASTER, TAG_RESPOSTA_BLOQUEIO, MPI_COMM_WORLD, &status);
+static void* thread_progresso(void* arg) {
+    (void)arg;
+    int espera_us = ESPERA_MINIMA_PROGRESSO_US;
+    int finalizando = 0;
 
-            if (resposta == 1) {
-                // Bloqueio concedido - permite edição
-                printf(ANSI_COLOR_GREEN "Permissão concedida! Digite o novo texto:\n> " ANSI_COLOR_RESET);
-                char novo_texto[MAX_TEXTO];
-                getchar(); 
-                fgets(novo_texto, MAX_TEXTO, stdin);
-                novo_texto[strcspn(novo_texto, "\n")] = 0;  // Remove quebra de linha
+    while (1) {
+        int houve_evento = 0;
+        int flag;
+        MPI_Status status;
+        MPI_Message mensagem;
 
-                // Envia o novo texto para o mestre
-                int dados_texto[2] = {linha_para_editar, 0};
-                MPI_Send(dados_texto, 2, MPI_INT, MASTER, TAG_ENVIAR_NOVO_TEXTO, MPI_COMM_WORLD);
-                MPI_Send(novo_texto, strlen(novo_texto) + 1, MPI_CHAR, MASTER, TAG_ENVIAR_NOVO_TEXTO, MPI_COMM_WORLD);
-                
-                printf(ANSI_COLOR_GREEN "Alteração enviada. O documento será atualizado em breve.\n" ANSI_COLOR_RESET);
+        // Mantém vivos os bloqueios enquanto o usuário digita o novo texto
+        cliente_renovar_bloqueios();
+        metricas_talvez_gravar();
 
-            } else {
-                // Bloqueio negado - linha ocupada por outro usuário
-                printf(ANSI_COLOR_RED "Acesso negado! A linha pode estar em uso.\n" ANSI_COLOR_RESET);
+        // Pacotes de atualizações têm tamanho variável: a sonda casada entrega ao MPI_Mrecv
+        // exatamente a mensagem sondada, e o tamanho vem dela
+        MPI_Improbe(MPI_ANY_SOURCE, TAG_ATUALIZACAO, MPI_COMM_WORLD, &flag, &mensagem, &status);
+        while (flag) {
+            int tamanho;
+            MPI_Get_count(&status, MPI_BYTE, &tamanho);
+            char* pacote = malloc(tamanho);
+            MPI_Mrecv(pacote, tamanho, MPI_BYTE, &mensagem, &status);
+            metrica_mensagem(METRICA_RECEBIDA, TAG_ATUALIZACAO, tamanho);
+            pthread_mutex_lock(&progresso.mutex);
+            int64_t inicio = instante_ns(CLOCK_MONOTONIC);
+            if (processar_pacote(pacote, tamanho)) {
+                progresso.pendentes.documento_mudou = 1;
             }
-            
-        } else if (opcao == 3) {
-            // Opção 3: Enviar mensagem privada para outro usuário
-            listar_usuarios_disponiveis(); // Lista usuários disponíveis
-            printf("\nDigite o rank do destinatário: ");
-            int destino;
-            scanf(" %d", &destino);
-            
-            if (destino > 0 && destino < size_global && destino != rank_global) {
-                char msg[MAX_TEXTO];
-                printf("Digite sua mensagem para Usuario_%d:\n> ", destino);
-                getchar(); 
-                fgets(msg, sizeof(msg), stdin);
-                
-                // Remove quebra de linha
-                msg[strcspn(msg, "\n")] = 0;
-                
-                // Envia mensagem diretamente para o usuário destinatário
-                MPI_Send(msg, strlen(msg) + 1, MPI_CHAR, destino, TAG_MENSAGEM_PRIVADA, MPI_COMM_WORLD);
-                printf(ANSI_COLOR_GREEN "Mensagem enviada para Usuario_%d!\n" ANSI_COLOR_RESET, destino);
-            } else {
-                printf(ANSI_COLOR_RED "Rank de destino inválido.\n" ANSI_COLOR_RESET);
+            metrica_tempo(&metricas_locais()->aplicacao, instante_ns(CLOCK_MONOTONIC) - inicio);
+            pthread_mutex_unlock(&progresso.mutex);
+            // Repassa só depois de aplicar: entregue aos envios pendentes, o buffer pode ser
+            // liberado a qualquer momento pela interface, que também envia
+            if (!retransmitir_pacote(pacote, tamanho)) {
+                free(pacote);
+            }
+            houve_evento = 1;
+            MPI_Improbe(MPI_ANY_SOURCE, TAG_ATUALIZACAO, MPI_COMM_WORLD, &flag, &mensagem, &status);
+        }
+
+        // Leitor da janela do nó: o escritor já aplicou os deltas, só falta avisar a interface
+        if (replica_mudou()) {
+            pthread_mutex_lock(&progresso.mutex);
+            progresso.pendentes.documento_mudou = 1;
+            pthread_mutex_unlock(&progresso.mutex);
+            houve_evento = 1;
+        }
+
+        // Lotes de chat, também de tamanho variável, vêm só do mestre (que pode mudar)
+        MPI_Improbe(MPI_ANY_SOURCE, TAG_CHAT, MPI_COMM_WORLD, &flag, &mensagem, &status);
+        while (flag) {
+            int tamanho;
+            MPI_Get_count(&status, MPI_BYTE, &tamanho);
+            char* pacote = malloc(tamanho);
+            MPI_Mrecv(pacote, tamanho, MPI_BYTE, &mensagem, &status);
+            metrica_mensagem(METRICA_RECEBIDA, TAG_CHAT, tamanho);
+            pthread_mutex_lock(&progresso.mutex);
+            receber_entrega_chat(&progresso.pendentes, pacote, tamanho);
+            pthread_mutex_unlock(&progresso.mutex);
+            free(pacote);
+            houve_evento = 1;
+            MPI_Improbe(MPI_ANY_SOURCE, TAG_CHAT, MPI_COMM_WORLD, &flag, &mensagem, &status);
+        }
+
+        // Promoção de uma reserva: o mestre morreu e os pedidos passam a ir à nova
+        MPI_Improbe(MPI_ANY_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &flag, &mensagem, &status);
+        while (flag) {
+            int sinal[3];
+            MPI_Mrecv(sinal, sizeof(sinal), MPI_BYTE, &mensagem, &status);
+            metrica_mensagem(METRICA_RECEBIDA, TAG_RESERVA, sizeof(sinal));
+            pthread_mutex_lock(&progresso.mutex);
+            reserva_receber(sinal, status.MPI_SOURCE);
+            progresso.pendentes.documento_mudou = 1;
+            pthread_mutex_unlock(&progresso.mutex);
+            houve_evento = 1;
+            MPI_Improbe(MPI_ANY_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &flag, &mensagem, &status);
+        }
+
+        // Finalização: o mestre despacha o último lote de chat antes dela; um lote que ainda
+        // não tenha chegado é descartado em encerrar_difusao. Recebida, a thread segue
+        // aplicando e repassando à subárvore os deltas até as versões finais que ela traz
+        if (finalizando) {
+            pthread_mutex_lock(&progresso.mutex);
+            int alcancado = fluxo_alcancado();
+            progresso.pendentes.finalizado = alcancado;
+            pthread_mutex_unlock(&progresso.mutex);
+            if (alcancado) {
+                avisar_interface();
+                return NULL;
+            }
+        } else {
+            MPI_Test(&progresso.recepcao_finalizar, &finalizando, MPI_STATUS_IGNORE);
+            if (finalizando) {
+                fim_fluxo.ultimo_aviso = instante_ns(CLOCK_MONOTONIC);
+                continue;
             }
-            
-        } else if (opcao == 4) {
-            // Opção 4: Visualizar mensagens recebidas (chat)
-            visualizar_mensagens_chat();
-            
-        } else if (opcao == 5) {
-            // Opção 5: Sair do editor
-            int msg_sair[2] = {0, 0};
-            MPI_Send(msg_sair, 2, MPI_INT, MASTER, TAG_SAIR, MPI_COMM_WORLD);
-            usuario_ativo = 0; 
-            printf("Você saiu. Aguardando o encerramento seguro do programa...\n");
+        }
+
+        if (houve_evento) {
+            avisar_interface();
+            espera_us = ESPERA_MINIMA_PROGRESSO_US;
+        } else {
+            // Ocioso: recua exponencialmente (uma espera bloqueante do MPI giraria a CPU)
+            usleep(espera_us);
+            espera_us = espera_us * 2 < ESPERA_MAXIMA_PROGRESSO_US ? espera_us * 2 : ESPERA_MAXIMA_PROGRESSO_US;
         }
     }
-    printf("[%s] Saindo...\n", nome_usuario);
 }
 
-// Função para verificar mensagens assíncronas (atualizações e mensagens privadas)
-int verificar_mensagens_e_atualizacoes() {
+// Inicia a thread de progresso do trabalhador. Retorna 0 (e a interface segue sondando)
+// se o MPI não oferece MPI_THREAD_MULTIPLE
+int progresso_iniciar(int nivel_thread) {
+    if (nivel_thread < MPI_THREAD_MULTIPLE || pipe(progresso.aviso) != 0) {
+        return 0;
+    }
+    fcntl(progresso.aviso[0], F_SETFL, O_NONBLOCK);
+    fcntl(progresso.aviso[1], F_SETFL, O_NONBLOCK);
+
+    MPI_Irecv(fim_fluxo.finais, num_coordenadores, MPI_INT, MPI_ANY_SOURCE, TAG_FINALIZAR, MPI_COMM_WORLD, &progresso.recepcao_finalizar);
+    if (pthread_create(&progresso.thread, NULL, thread_progresso, NULL) != 0) {
+        fprintf(stderr, "Erro: não foi possível criar a thread de progresso; usando sondagem.\n");
+        MPI_Cancel(&progresso.recepcao_finalizar);
+        MPI_Wait(&progresso.recepcao_finalizar, MPI_STATUS_IGNORE);
+        close(progresso.aviso[0]);
+        close(progresso.aviso[1]);
+        return 0;
+    }
+    progresso.ativo = 1;
+    setvbuf(stdin, NULL, _IONBF, 0);  // select em stdin só é confiável sem dados retidos pelo stdio
+    return 1;
+}
+
+// Aguarda a thread de progresso, que termina sozinha ao receber TAG_FINALIZAR
+void progresso_finalizar() {
+    if (!progresso.ativo) return;
+    pthread_join(progresso.thread, NULL);
+    close(progresso.aviso[0]);
+    close(progresso.aviso[1]);
+    progresso.ativo = 0;
+}
+
+// Recolhe os eventos recebidos desde a última chamada. Com a thread de progresso só
+// copia o que ela já aplicou; sem ela, sonda e recebe aqui mesmo
+static void coletar_eventos(EventosPendentes* ev) {
+    ev->finalizado = 0;
+    ev->documento_mudou = 0;
+    ev->num_mensagens = 0;
+
+    if (progresso.ativo) {
+        char descarte[64];
+        while (read(progresso.aviso[0], descarte, sizeof(descarte)) > 0);  // Esvazia os avisos antes de ler
+        pthread_mutex_lock(&progresso.mutex);
+        *ev = progresso.pendentes;
+        progresso.pendentes.documento_mudou = 0;
+        progresso.pendentes.num_mensagens = 0;
+        pthread_mutex_unlock(&progresso.mutex);
+        return;
+    }
+
     int flag;
     MPI_Status status;
-    int houve_atualizacao_doc = 0;
-    
-    // Buffers para armazenar mensagens privadas recebidas
-    char buffer_msgs_privadas[10][MAX_TEXTO];
-    int remetentes_msgs[10];
-    int contador_msgs = 0;
-
-    while(1) {
-        // Verifica se recebeu sinal de finalização do mestre
-        MPI_Iprobe(MASTER, TAG_FINALIZAR, MPI_COMM_WORLD, &flag, &status);
+    metricas_talvez_gravar();
+    while (1) {
+        // Verifica se recebeu sinal de finalização do mestre; ainda recebe os deltas até as
+        // versões finais que ele traz
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_FINALIZAR, MPI_COMM_WORLD, &flag, &status);
         if (flag) {
-            int dummy;
-            MPI_Recv(&dummy, 1, MPI_INT, MASTER, TAG_FINALIZAR, MPI_COMM_WORLD, &status);
-            return 1;  // Retorna 1 para sinalizar finalização
+            MPI_Recv(fim_fluxo.finais, num_coordenadores, MPI_INT, status.MPI_SOURCE, TAG_FINALIZAR, MPI_COMM_WORLD, &status);
+            fim_fluxo.finalizando = 1;
+            fim_fluxo.ultimo_aviso = instante_ns(CLOCK_MONOTONIC);
+            continue;
         }
-        
+
         // Verifica se há atualizações do documento
-        MPI_Iprobe(MASTER, TAG_ATUALIZACAO, MPI_COMM_WORLD, &flag, &status);
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_ATUALIZACAO, MPI_COMM_WORLD, &flag, &status);
         if (flag) {
-            // Recebe documento e status de bloqueios atualizados
-            MPI_Recv(documento, MAX_LINHAS * MAX_TEXTO, MPI_CHAR, MASTER, TAG_ATUALIZACAO, MPI_COMM_WORLD, &status);
-            MPI_Recv(linhas_em_uso, MAX_LINHAS, MPI_INT, MASTER, TAG_ATUALIZACAO, MPI_COMM_WORLD, &status);
-            houve_atualizacao_doc = 1;
-            continue; 
-        }
-
-        // Verifica se há mensagens privadas de outros usuários
-        MPI_Iprobe(MPI_ANY_SOURCE, TAG_MENSAGEM_PRIVADA, MPI_COMM_WORLD, &flag, &status);
-        if (flag && status.MPI_SOURCE != MASTER) {
-            char buffer_msg_temp[MAX_TEXTO];
-            MPI_Recv(buffer_msg_temp, MAX_TEXTO, MPI_CHAR, status.MPI_SOURCE, TAG_MENSAGEM_PRIVADA, MPI_COMM_WORLD, &status);
-            
-            // Adiciona mensagem ao chat
-            adicionar_mensagem_chat(status.MPI_SOURCE, buffer_msg_temp);
-            
-            // Também mantém para exibição imediata (compatibilidade)
-            if (contador_msgs < 10) {
-                strcpy(buffer_msgs_privadas[contador_msgs], buffer_msg_temp);
-                remetentes_msgs[contador_msgs] = status.MPI_SOURCE;
-                contador_msgs++;
+            // Aplica o delta (ou o estado completo) sobre a cópia local
+            if (receber_atualizacao()) {
+                ev->documento_mudou = 1;
             }
-            continue; 
+            continue;
         }
-        
+
+        // Verifica se o mestre entregou mensagens de chat
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_CHAT, MPI_COMM_WORLD, &flag, &status);
+        if (flag) {
+            int tamanho;
+            MPI_Get_count(&status, MPI_BYTE, &tamanho);
+            char* pacote = malloc(tamanho);
+            MPI_Recv(pacote, tamanho, MPI_BYTE, status.MPI_SOURCE, TAG_CHAT, MPI_COMM_WORLD, &status);
+            metrica_mensagem(METRICA_RECEBIDA, TAG_CHAT, tamanho);
+            receber_entrega_chat(ev, pacote, tamanho);
+            free(pacote);
+            continue;
+        }
+
+        // Verifica se uma reserva assumiu como mestre
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &flag, &status);
+        if (flag) {
+            int sinal[3];
+            MPI_Recv(sinal, sizeof(sinal), MPI_BYTE, status.MPI_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &status);
+            metrica_mensagem(METRICA_RECEBIDA, TAG_RESERVA, sizeof(sinal));
+            reserva_receber(sinal, status.MPI_SOURCE);
+            ev->documento_mudou = 1;
+            continue;
+        }
+
         break; // Não há mais mensagens pendentes
     }
+    ev->finalizado = fim_fluxo.finalizando && fluxo_alcancado();
+}
 
-    // Exibe notificação se houve atualização do documento
-    if (houve_atualizacao_doc) {
-        printf(ANSI_COLOR_YELLOW "\n>>> O estado do sistema foi atualizado. <<<\n" ANSI_COLOR_RESET);
-        mostrar_documento();
+// Espera entrada do usuário exibindo, enquanto isso, os eventos que chegarem.
+// Com com_entrada = 0 espera só pelo próximo evento. Retorna 1 se o programa foi finalizado.
+// Sem a thread de progresso não há o que multiplexar e retorna na hora.
+static int aguardar_eventos(int com_entrada, const char* prompt) {
+    if (!progresso.ativo) return 0;
+    while (1) {
+        fd_set leitura;
+        FD_ZERO(&leitura);
+        FD_SET(progresso.aviso[0], &leitura);
+        if (com_entrada) {
+            FD_SET(STDIN_FILENO, &leitura);
+        }
+        fflush(stdout);
+        if (select(progresso.aviso[0] + 1, &leitura, NULL, NULL, NULL) < 0) {
+            continue;  // Interrompido por sinal
+        }
+        if (FD_ISSET(progresso.aviso[0], &leitura)) {
+            if (!com_entrada) return 0;  // Quem chamou exibe os eventos
+            if (verificar_mensagens_e_atualizacoes()) return 1;
+            if (prompt && !FD_ISSET(STDIN_FILENO, &leitura)) {
+                printf("%s", prompt);
+            }
+        }
+        if (com_entrada && FD_ISSET(STDIN_FILENO, &leitura)) {
+            return 0;
+        }
     }
+}
 
-    // Exibe mensagens privadas recebidas com interface formatada
-    if (contador_msgs > 0) {
-        for (int i = 0; i < contador_msgs; i++) {
-            printf("\n\n" ANSI_COLOR_MAGENTA "  +--------------------------------------------------------------------------+\n");
-            printf("  | >>> MENSAGEM PRIVADA RECEBIDA de Usuario_%d                               |\n", remetentes_msgs[i]);
-            printf("  +--------------------------------------------------------------------------+\n" ANSI_COLOR_RESET);
-            
-            // Formata a mensagem dentro da caixa com quebra de linha automática
-            char* texto_completo = buffer_msgs_privadas[i];
-            char* linha_atual = strtok(texto_completo, "\n");
+// ---------------------------------------------------------------------------
+// Modo headless: usuário automático guiado por uma carga de trabalho, usado para
+// medir latência de bloqueio, latência de propagação e taxa de negação sob carga
+// ---------------------------------------------------------------------------
 
-            while (linha_atual != NULL) {
-                const int LARGURA_CAIXA = 72;
-                const char* ponteiro_linha = linha_atual;
-                while (strlen(ponteiro_linha) > 0) {
-                    int tamanho_a_imprimir = strlen(ponteiro_linha);
-                    if (tamanho_a_imprimir > LARGURA_CAIXA) {
-                        tamanho_a_imprimir = LARGURA_CAIXA;
-                        // Tenta quebrar em espaço para não cortar palavras
-                        while (tamanho_a_imprimir > 0 && ponteiro_linha[tamanho_a_imprimir] != ' ') {
-                            tamanho_a_imprimir--;
-                        }
-                        if (tamanho_a_imprimir == 0) {
-                            tamanho_a_imprimir = LARGURA_CAIXA;
-                        }
-                    }
-                    
-                    printf(ANSI_COLOR_MAGENTA "  | " ANSI_COLOR_RESET "%.*s", tamanho_a_imprimir, ponteiro_linha);
-                    for (int k = tamanho_a_imprimir; k < LARGURA_CAIXA; k++) {
-                        printf(" ");
-                    }
-                    printf(ANSI_COLOR_MAGENTA " |\n" ANSI_COLOR_RESET);
+int64_t instante_ns(clockid_t relogio) {
+    struct timespec t;
+    clock_gettime(relogio, &t);
+    return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
 
-                    ponteiro_linha += tamanho_a_imprimir;
-                    if (*ponteiro_linha == ' ') {
-                        ponteiro_linha++;
-                    }
-                }
-                linha_atual = strtok(NULL, "\n");
-            }
+// Baldes log-lineares: 1 µs de resolução até 32 µs, depois 16 subdivisões por potência de 2
+static int balde_latencia(int64_t ns) {
+    int64_t us = ns / 1000;
+    if (us < 32) return us < 0 ? 0 : (int)us;
+    int expoente = 63 - __builtin_clzll(us);
+    int sub = (int)((us >> (expoente - 4)) & 15);
+    int balde = 32 + (expoente - 5) * 16 + sub;
+    return balde < BALDES_HISTOGRAMA ? balde : BALDES_HISTOGRAMA - 1;
+}
+
+// Limite inferior (em µs) do balde
+static double valor_balde(int balde) {
+    if (balde < 32) return balde;
+    int expoente = (balde - 32) / 16 + 5;
+    int sub = (balde - 32) % 16;
+    return (double)((16LL + sub) << (expoente - 4));
+}
+
+void registrar_latencia(long* histograma, int64_t ns) {
+    histograma[balde_latencia(ns)]++;
+}
+
+static double percentil(const long* histograma, double fracao) {
+    long total = 0;
+    for (int i = 0; i < BALDES_HISTOGRAMA; i++) total += histograma[i];
+    if (total == 0) return 0;
+    long alvo = (long)(fracao * total);
+    long acumulado = 0;
+    for (int i = 0; i < BALDES_HISTOGRAMA; i++) {
+        acumulado += histograma[i];
+        if (acumulado > alvo) return valor_balde(i);
+    }
+    return valor_balde(BALDES_HISTOGRAMA - 1);
+}
+
+static unsigned int semente_carga;
+
+static double aleatorio_unitario() {
+    return rand_r(&semente_carga) / ((double)RAND_MAX + 1);
+}
+
+// Escolhe a linha segundo a distribuição configurada
+static int escolher_linha(int total) {
+    if (carga.distribuicao == DISTRIBUICAO_QUENTE && aleatorio_unitario() < FRACAO_ACESSOS_QUENTES) {
+        int quentes = carga.linhas_quentes < total ? carga.linhas_quentes : total;
+        return (int)(aleatorio_unitario() * quentes);
+    }
+    return (int)(aleatorio_unitario() * total);
+}
+
+static int texto_automatico(char* texto, int tamanho, intptr_t sequencia) {
+    return snprintf(texto, tamanho, "Usuario_%d edicao automatica %ld", rank_global, (long)sequencia);
+}
+
+static void texto_concluido(const Conclusao* c, void* contexto) {
+    (void)contexto;
+    if (c->sucesso) {
+        estatisticas.contadores[CONTADOR_EDICOES] += c->tipo == OPERACAO_LOTE ? carga.lote : 1;
+    }
+}
+
+static void pedido_concluido(const Conclusao* c, void* contexto);
+
+// Reescreve carga.lote linhas consecutivas a partir da linha indicada em um único lote
+static void enviar_lote_automatico(int id_primeira, int direta, intptr_t sequencia) {
+    int ids[carga.lote];
+    char* textos[carga.lote];
+    int comprimentos[carga.lote];
+    char buffer[carga.lote][64];
+    LinhaLida linhas[carga.lote];
+    int quantidade = replica_ler_id(id_primeira, carga.lote, linhas, 0);
+    for (int i = 0; i < quantidade; i++) {
+        ids[i] = linhas[i].id;
+        textos[i] = buffer[i];
+        comprimentos[i] = texto_automatico(buffer[i], 64, sequencia);
+    }
+    if (quantidade == 0) return;
+    cliente_editar_lote(ids, textos, comprimentos, quantidade, direta, direta ? pedido_concluido : texto_concluido,
+                        (void*)sequencia);
+}
+
+// Resposta do coordenador a um bloqueio ou a uma edição direta: mede a ida e volta e,
+// se for um bloqueio concedido, envia o texto carimbado com o instante
+static void pedido_concluido(const Conclusao* c, void* contexto) {
+    registrar_latencia(estatisticas.latencia_bloqueio, instante_ns(CLOCK_MONOTONIC) - c->inicio);
+    estatisticas.contadores[CONTADOR_PEDIDOS]++;
+    if (!c->sucesso) {
+        estatisticas.contadores[CONTADOR_NEGADOS]++;
+    } else if (c->tipo == OPERACAO_EDICAO_DIRETA || c->tipo == OPERACAO_TRECHO) {
+        estatisticas.contadores[CONTADOR_EDICOES]++;
+    } else if (c->tipo == OPERACAO_LOTE) {
+        estatisticas.contadores[CONTADOR_EDICOES] += carga.lote;
+    } else if (c->tipo == OPERACAO_INTERVALO) {
+        enviar_lote_automatico(c->id_linha, 0, (intptr_t)contexto);
+    } else {
+        char texto[64];
+        int comprimento = texto_automatico(texto, sizeof(texto), (intptr_t)contexto);
+        cliente_enviar_texto(c->id_linha, texto, comprimento, 0, texto_concluido, contexto);
+    }
+}
+
+// Inicia uma edição sem esperar a resposta: bloqueio seguido de texto, ou a edição direta
+static void edicao_automatica(int sequencia) {
+    int total = replica_total_linhas();
+    int sorteada = escolher_linha(total);
+    if (carga.lote > 1 && sorteada > total - carga.lote) {
+        sorteada = total - carga.lote;  // O lote inteiro cabe no documento
+        if (sorteada < 0) sorteada = 0;
+    }
+    LinhaLida escolhida;
+    if (!replica_ler(sorteada, 1, &escolhida, 0)) return;
+    int indice = escolhida.posicao;
+    int id_linha = escolhida.id;
+    int revisao = escolhida.revisao;
+    int comprimento = escolhida.comprimento;
+
+    void* contexto = (void*)(intptr_t)sequencia;
+    if (edicao_por_trecho) {
+        // Insere uma palavra em posição aleatória; linhas longas perdem um trecho
+        int posicao = (int)(aleatorio_unitario() * (comprimento + 1));
+        if (comprimento > 80) {
+            cliente_editar_trecho(id_linha, revisao, posicao, 8, "", 0, pedido_concluido, contexto);
+        } else {
+            char palavra[24];
+            int tamanho = snprintf(palavra, sizeof(palavra), "u%d.%d ", rank_global, sequencia);
+            cliente_editar_trecho(id_linha, revisao, posicao, 0, palavra, tamanho, pedido_concluido, contexto);
+        }
+    } else if (carga.lote > 1 && carga.edicao_direta) {
+        enviar_lote_automatico(id_linha, 1, sequencia);
+    } else if (carga.lote > 1) {
+        int ids[carga.lote];
+        LinhaLida linhas[carga.lote];
+        int quantidade = replica_ler_id(id_linha, carga.lote, linhas, 0);
+        for (int i = 0; i < quantidade; i++) {
+            ids[i] = linhas[i].id;
+        }
+        cliente_bloquear_intervalo(ids, quantidade, pedido_concluido, contexto);
+    } else if (carga.edicao_direta) {
+        char texto[64];
+        int comprimento = texto_automatico(texto, sizeof(texto), sequencia);
+        cliente_enviar_texto(id_linha, texto, comprimento, 1, pedido_concluido, contexto);
+    } else {
+        cliente_pedir_bloqueio(indice, id_linha, pedido_concluido, contexto);
+    }
+}
+
+// Resultado de uma busca automática: mede a ida e volta e o tempo gasto no mestre
+// Retorno da mensagem automática: conta as aceitas pelo mestre
+static void mensagem_concluida(const Conclusao* c, void* contexto) {
+    (void)contexto;
+    if (c->sucesso) {
+        estatisticas.contadores[CONTADOR_MENSAGENS]++;
+    }
+}
+
+static void busca_concluida(const Conclusao* c, void* contexto) {
+    ResultadoBusca* resultado = contexto;
+    registrar_latencia(estatisticas.latencia_busca, instante_ns(CLOCK_MONOTONIC) - c->inicio);
+    registrar_latencia(estatisticas.duracao_busca, (int64_t)resultado->microssegundos * 1000);
+    estatisticas.contadores[CONTADOR_BUSCAS]++;
+    estatisticas.contadores[CONTADOR_OCORRENCIAS] += resultado->total;
+    free(resultado);
+}
+
+// Busca um trecho de até 12 bytes de uma linha sorteada da réplica local
+static void busca_automatica() {
+    LinhaLida linha;
+    if (!replica_ler(escolher_linha(replica_total_linhas()), 1, &linha, TEXTO_INTEIRO)) return;
+    int comprimento = linha.comprimento < 12 ? linha.comprimento : 12;
+    int inicio = (int)(aleatorio_unitario() * (linha.comprimento - comprimento + 1));
+    if (comprimento > 0) {
+        ResultadoBusca* resultado = malloc(sizeof(ResultadoBusca));
+        cliente_buscar(linha.texto + inicio, comprimento, resultado, busca_concluida, resultado);
+    }
+    replica_liberar(&linha, 1);
+}
 
-            printf(ANSI_COLOR_MAGENTA "  +--------------------------------------------------------------------------+\n\n" ANSI_COLOR_RESET);
+// Loop do usuário automático: executa a carga pelo tempo configurado e depois sai normalmente
+void loop_headless() {
+    semente_carga = carga.semente * 7919u + rank_global;
+    int num_trabalhadores = reservas.primeira - num_coordenadores;
+    int64_t inicio = instante_ns(CLOCK_MONOTONIC);
+    int64_t fim = inicio + (int64_t)(carga.duracao * 1e9);
+    int64_t proxima_edicao = inicio, proxima_mensagem = inicio;
+    int64_t intervalo_edicao = carga.taxa_edicao > 0 ? (int64_t)(1e9 / carga.taxa_edicao) : 0;
+    int64_t intervalo_mensagem = carga.taxa_mensagens > 0 ? (int64_t)(1e9 / carga.taxa_mensagens) : -1;
+    int64_t proxima_busca = inicio;
+    int64_t intervalo_busca = carga.taxa_buscas > 0 ? (int64_t)(1e9 / carga.taxa_buscas) : -1;
+    int sequencia = 0;
+
+    while (1) {
+        if (verificar_mensagens_e_atualizacoes()) return;
+        int64_t agora = instante_ns(CLOCK_MONOTONIC);
+        if (agora >= fim) break;
+
+        cliente_progredir();
+        if (agora >= proxima_edicao && cliente.em_voo < carga.em_voo) {
+            edicao_automatica(sequencia++);
+            proxima_edicao += intervalo_edicao;
+            if (proxima_edicao < agora) proxima_edicao = agora;  // Não acumula atraso
         }
+        if (intervalo_mensagem >= 0 && agora >= proxima_mensagem && num_trabalhadores > 1) {
+            int destino;
+            do {
+                destino = num_coordenadores + (int)(aleatorio_unitario() * num_trabalhadores);
+            } while (destino == rank_global);
+            char msg[64], canal[TAMANHO_NOME_CANAL];
+            int comprimento = snprintf(msg, sizeof(msg), "mensagem automatica de Usuario_%d", rank_global);
+            snprintf(canal, sizeof(canal), "@%d", destino);
+            cliente_enviar_chat(canal, msg, comprimento, mensagem_concluida, NULL);
+            proxima_mensagem += intervalo_mensagem;
+            if (proxima_mensagem < agora) proxima_mensagem = agora;
+        }
+        if (intervalo_busca >= 0 && agora >= proxima_busca && cliente.em_voo < carga.em_voo) {
+            busca_automatica();
+            proxima_busca += intervalo_busca;
+            if (proxima_busca < agora) proxima_busca = agora;
+        }
+
+        // Com respostas pendentes continua progredindo sem dormir; senão dorme até o
+        // próximo evento, no máximo 1 ms para continuar drenando atualizações
+        if (cliente.em_voo > 0) continue;
+        int64_t proximo = proxima_edicao;
+        if (intervalo_mensagem >= 0 && proxima_mensagem < proximo) proximo = proxima_mensagem;
+        if (intervalo_busca >= 0 && proxima_busca < proximo) proximo = proxima_busca;
+        int64_t espera = proximo - instante_ns(CLOCK_MONOTONIC);
+        if (espera > 1000000) espera = 1000000;
+        if (espera > 0) usleep(espera / 1000);
     }
 
-    return 0;  // Continua execução normal
+    // Conclui as operações em voo (um bloqueio sem texto deixaria a linha presa),
+    // sai como um usuário normal e continua medindo até o sinal de finalização
+    while (cliente.em_voo > 0) {
+        cliente_progredir();
+    }
+    cliente_sair();
+    while (!verificar_mensagens_e_atualizacoes()) {
+        usleep(1000);
+    }
 }
 
-// Nova função para visualização em tempo real do documento
-void visualizacao_tempo_real() {
-    char nome_usuario[50];
-    sprintf(nome_usuario, "Usuario_%d", rank_global);
-    char input;
-    int primeira_exibicao = 1;
-    
-    printf(ANSI_COLOR_GREEN "\n=== MODO VISUALIZAÇÃO EM TEMPO REAL ===\n" ANSI_COLOR_RESET);
-    printf("Pressione 'Q' seguido de ENTER para sair da visualização\n\n");
-    
-    // Configura entrada não-bloqueante para o terminal
-    system("stty cbreak");
-    
-    while (1) {
-        // Verifica se há atualizações do documento ou mensagens
-        int houve_atualizacao = 0;
-        int flag;
-        MPI_Status status;
-        
-        // Verifica atualizações do documento
-        MPI_Iprobe(MASTER, TAG_ATUALIZACAO, MPI_COMM_WORLD, &flag, &status);
-        if (flag) {
-            // Recebe documento e status de bloqueios atualizados
-            MPI_Recv(documento, MAX_LINHAS * MAX_TEXTO, MPI_CHAR, MASTER, TAG_ATUALIZACAO, MPI_COMM_WORLD, &status);
-            MPI_Recv(linhas_em_uso, MAX_LINHAS, MPI_INT, MASTER, TAG_ATUALIZACAO, MPI_COMM_WORLD, &status);
-            houve_atualizacao = 1;
-        }
-        
-        // Verifica mensagens privadas
-        MPI_Iprobe(MPI_ANY_SOURCE, TAG_MENSAGEM_PRIVADA, MPI_COMM_WORLD, &flag, &status);
-        if (flag && status.MPI_SOURCE != MASTER) {
-            char buffer_msg[MAX_TEXTO];
-            MPI_Recv(buffer_msg, MAX_TEXTO, MPI_CHAR, status.MPI_SOURCE, TAG_MENSAGEM_PRIVADA, MPI_COMM_WORLD, &status);
-            
-            // Adiciona mensagem ao chat
-            adicionar_mensagem_chat(status.MPI_SOURCE, buffer_msg);
-            
-            printf(ANSI_COLOR_YELLOW "\n>>> Nova mensagem de Usuario_%d: %s\n" ANSI_COLOR_RESET, status.MPI_SOURCE, buffer_msg);
-            printf("Pressione 'Q' seguido de ENTER para sair da visualização\n\n");
+// Soma as estatísticas de todos os ranks no mestre e imprime o relatório (coletiva; com
+// reservas, ponto a ponto ao mestre atual, que não espera os ranks que morreram). Com
+// --verificar-convergencia cada rank manda também o hash da sua réplica do principal, e o
+// mestre confere se todos terminaram com o mesmo documento. Retorna 1 se algum divergiu
+int relatorio_benchmark() {
+    Estatisticas total;
+    int num_valores = sizeof(Estatisticas) / sizeof(long);
+    long hashes[size_global];  // O de cada rank, como recebido; ranks mortos ficam fora
+    long hash = 0;
+    if (carga.verificar_convergencia) {
+        documento_carregar(DOCUMENTO_PRINCIPAL);
+        hash = (long)hash_documento();
+    }
+    if (reservas.num == 0) {
+        MPI_Reduce(&estatisticas, &total, num_valores, MPI_LONG, MPI_SUM, MASTER, MPI_COMM_WORLD);
+        if (carga.verificar_convergencia) {
+            MPI_Allgather(&hash, 1, MPI_LONG, hashes, 1, MPI_LONG, MPI_COMM_WORLD);
         }
-        
-        // Verifica sinal de finalização
-        MPI_Iprobe(MASTER, TAG_FINALIZAR, MPI_COMM_WORLD, &flag, &status);
-        if (flag) {
-            int dummy;
-            MPI_Recv(&dummy, 1, MPI_INT, MASTER, TAG_FINALIZAR, MPI_COMM_WORLD, &status);
-            break;
+    } else if (eh_usuario(rank_global)) {
+        // Depois da finalização o mestre já saiu do loop e espera as estatísticas
+        MPI_Send(&estatisticas, num_valores, MPI_LONG, rank_mestre, TAG_RESERVA, MPI_COMM_WORLD);
+        if (carga.verificar_convergencia) {
+            MPI_Send(&hash, 1, MPI_LONG, rank_mestre, TAG_RESERVA, MPI_COMM_WORLD);
         }
-        
-        // Exibe ou re-exibe o documento se houve atualização ou é primeira vez
-        if (houve_atualizacao || primeira_exibicao) {
-            // Limpa a tela para re-exibir o documento atualizado
-            if (!primeira_exibicao) {
-                printf("\033[2J\033[H"); // Clear screen and move cursor to top
-                printf(ANSI_COLOR_GREEN "=== DOCUMENTO ATUALIZADO ===\n" ANSI_COLOR_RESET);
+    } else if (rank_global != rank_mestre) {
+        // Só envia quando o mestre pede: antes disso ele pode estar no loop, que espera
+        // apenas sinais em TAG_RESERVA. Se o mestre morrer aqui, sai sem o relatório
+        int64_t prazo = instante_ns(CLOCK_MONOTONIC) + 10LL * reservas.prazo_ms * 1000000LL;
+        while (instante_ns(CLOCK_MONOTONIC) < prazo) {
+            int flag;
+            MPI_Status status;
+            MPI_Iprobe(MPI_ANY_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &flag, &status);
+            if (!flag) {
+                usleep(1000);
+                continue;
             }
-            
-            mostrar_documento();
-            printf(ANSI_COLOR_YELLOW "\n[%s] Visualização em tempo real - Digite 'Q' + ENTER para sair\n" ANSI_COLOR_RESET, nome_usuario);
-            printf("> ");
-            fflush(stdout);
-            primeira_exibicao = 0;
-        }
-        
-        // Verifica entrada do usuário (não-bloqueante)
-        fd_set readfds;
-        struct timeval timeout;
-        FD_ZERO(&readfds);
-        FD_SET(STDIN_FILENO, &readfds);
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 100000; // 100ms
-        
-        if (select(STDIN_FILENO + 1, &readfds, NULL, NULL, &timeout) > 0) {
-            if (FD_ISSET(STDIN_FILENO, &readfds)) {
-                if (scanf(" %c", &input) == 1) {
-                    if (input == 'Q' || input == 'q') {
-                        break;
-                    }
-                    // Limpa o buffer se não foi 'Q'
-                    while (getchar() != '\n');
+            int sinal[3];
+            MPI_Recv(sinal, sizeof(sinal), MPI_BYTE, status.MPI_SOURCE, TAG_RESERVA, MPI_COMM_WORLD, &status);
+            if (sinal[0] == RESERVA_RELATORIO && status.MPI_SOURCE == rank_mestre) {
+                MPI_Send(&estatisticas, num_valores, MPI_LONG, rank_mestre, TAG_RESERVA, MPI_COMM_WORLD);
+                if (carga.verificar_convergencia) {
+                    MPI_Send(&hash, 1, MPI_LONG, rank_mestre, TAG_RESERVA, MPI_COMM_WORLD);
                 }
+                break;
+            }
+            reserva_receber(sinal, status.MPI_SOURCE);
+        }
+    } else {
+        int destinos[size_global];
+        int num_destinos = 0;
+        for (int rank = 0; rank < size_global; rank++) {
+            if (rank != rank_global && !reservas.perdido[rank] && !eh_usuario(rank)) destinos[num_destinos++] = rank;
+        }
+        reserva_sinalizar(destinos, num_destinos, RESERVA_RELATORIO, 0, rank_global);
+        total = estatisticas;
+        hashes[rank_global] = hash;
+        for (int rank = 0; rank < size_global; rank++) {
+            if (rank == rank_global || reservas.perdido[rank]) continue;
+            Estatisticas parcial;
+            MPI_Recv(&parcial, num_valores, MPI_LONG, rank, TAG_RESERVA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            for (int i = 0; i < num_valores; i++) {
+                ((long*)&total)[i] += ((long*)&parcial)[i];
+            }
+            if (carga.verificar_convergencia) {
+                MPI_Recv(&hashes[rank], 1, MPI_LONG, rank, TAG_RESERVA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
             }
         }
-        
-        // Pequena pausa para não sobrecarregar a CPU
-        usleep(50000); // 50ms
     }
-    
-    // Restaura configuração normal do terminal
-    system("stty cooked");
-    printf(ANSI_COLOR_GREEN "\nSaindo da visualização em tempo real...\n" ANSI_COLOR_RESET);
+    if (rank_global != rank_mestre) return 0;
+
+    long pedidos = total.contadores[CONTADOR_PEDIDOS];
+    char lote[32] = "";
+    if (carga.lote > 1 && !edicao_por_trecho) {
+        snprintf(lote, sizeof(lote), ", lotes de %d linhas", carga.lote);
+    }
+    printf("\n=== RELATÓRIO DO BENCHMARK (%d usuários, %d coordenador(es), %.1f s, %d em voo%s%s%s) ===\n",
+           reservas.primeira - num_coordenadores, num_coordenadores, carga.duracao, carga.em_voo,
+           edicao_por_trecho ? ", edição por trecho" : carga.edicao_direta ? ", edição direta" : "", lote,
+           TRANSPORTE_RELATORIO);
+    printf("%s %ld  negados: %ld (%.2f%%)\n", edicao_por_trecho ? "Pedidos de edição:  " : "Pedidos de bloqueio:", pedidos, total.contadores[CONTADOR_NEGADOS],
+           pedidos ? 100.0 * total.contadores[CONTADOR_NEGADOS] / pedidos : 0.0);
+    printf("Edições aplicadas:   %ld  (%.1f edições/s)\n", total.contadores[CONTADOR_EDICOES],
+           total.contadores[CONTADOR_EDICOES] / carga.duracao);
+    printf("Mensagens privadas:  %ld  entregues: %ld\n", total.contadores[CONTADOR_MENSAGENS], total.contadores[CONTADOR_ENTREGUES]);
+    printf("Atualizações vistas: %ld\n", total.contadores[CONTADOR_ATUALIZACOES]);
+    printf("Mensagens MPI:       %ld  (%.1f por edição)\n", total.contadores[CONTADOR_ENVIOS_MPI],
+           total.contadores[CONTADOR_EDICOES] ? (double)total.contadores[CONTADOR_ENVIOS_MPI] / total.contadores[CONTADOR_EDICOES] : 0.0);
+    printf("%-28s %10s %10s %10s\n", "Latência (µs)", "p50", "p99", "p999");
+    printf("%-28s %10.0f %10.0f %10.0f\n", edicao_por_trecho ? "Edição por trecho" : carga.edicao_direta ? "Edição direta" : "Concessão de bloqueio", percentil(total.latencia_bloqueio, 0.50),
+           percentil(total.latencia_bloqueio, 0.99), percentil(total.latencia_bloqueio, 0.999));
+    printf("%-28s %10.0f %10.0f %10.0f\n", "Edição visível em outro rank", percentil(total.latencia_propagacao, 0.50),
+           percentil(total.latencia_propagacao, 0.99), percentil(total.latencia_propagacao, 0.999));
+    if (total.contadores[CONTADOR_BUSCAS] > 0) {
+        printf("%-28s %10.0f %10.0f %10.0f\n", "Busca (ida e volta)", percentil(total.latencia_busca, 0.50),
+               percentil(total.latencia_busca, 0.99), percentil(total.latencia_busca, 0.999));
+        printf("%-28s %10.0f %10.0f %10.0f\n", "Busca no mestre", percentil(total.duracao_busca, 0.50),
+               percentil(total.duracao_busca, 0.99), percentil(total.duracao_busca, 0.999));
+        printf("Buscas:              %ld  (%.1f ocorrências por busca)\n", total.contadores[CONTADOR_BUSCAS],
+               (double)total.contadores[CONTADOR_OCORRENCIAS] / total.contadores[CONTADOR_BUSCAS]);
+    }
+    if (!carga.verificar_convergencia) return 0;
+
+    int replicas = 0;
+    int divergentes = 0;
+    for (int rank = 0; rank < size_global; rank++) {
+        if (reservas.perdido[rank]) continue;
+        replicas++;
+        if (hashes[rank] != hashes[rank_global]) {
+            fprintf(stderr, "Erro: a réplica do rank %d terminou com o hash %016lx; a do mestre, %016lx.\n", rank,
+                    (unsigned long)hashes[rank], (unsigned long)hashes[rank_global]);
+            divergentes++;
+        }
+    }
+    printf("Convergência:        %d de %d réplicas com o hash %016lx\n", replicas - divergentes, replicas,
+           (unsigned long)hashes[rank_global]);
+    return divergentes > 0;
+}
+
+// Converte a mensagem do mestre para exibição, com a hora local em que ele a aceitou
+static void converter_mensagem_chat(Mensagem* destino, const MensagemChat* origem) {
+    int comprimento = origem->comprimento < MAX_TEXTO - 1 ? origem->comprimento : MAX_TEXTO - 1;
+    destino->remetente = origem->remetente;
+    destino->sequencia = origem->sequencia;
+    memcpy(destino->conteudo, origem->texto, comprimento);
+    destino->conteudo[comprimento] = '\0';
+    memcpy(destino->canal, origem->canal, TAMANHO_NOME_CANAL);
+    destino->canal[TAMANHO_NOME_CANAL - 1] = '\0';
+
+    time_t segundos = (time_t)(origem->instante / 1000000000LL);
+    struct tm *t = localtime(&segundos);
+    strftime(destino->timestamp, sizeof(destino->timestamp), "%H:%M:%S", t);
 }
 
 // Adiciona mensagem ao chat com timestamp
-void adicionar_mensagem_chat(int remetente, const char* conteudo) {
+void adicionar_mensagem_chat(const MensagemChat* mensagem) {
     int indice;
     
     // Se o buffer está cheio, usa estrutura circular
@@ -528,16 +8801,7 @@ void adicionar_mensagem_chat(int remetente, const char* conteudo) {
         indice = chat_inicio;
         chat_inicio = (chat_inicio + 1) % MAX_MENSAGENS;
     }
-    
-    // Adiciona a mensagem
-    chat_mensagens[indice].remetente = remetente;
-    strncpy(chat_mensagens[indice].conteudo, conteudo, MAX_TEXTO - 1);
-    chat_mensagens[indice].conteudo[MAX_TEXTO - 1] = '\0';
-    
-    // Gera timestamp
-    time_t agora = time(NULL);
-    struct tm *t = localtime(&agora);
-    strftime(chat_mensagens[indice].timestamp, sizeof(chat_mensagens[indice].timestamp), "%H:%M:%S", t);
+    converter_mensagem_chat(&chat_mensagens[indice], mensagem);
 }
 
 // Exibe histórico de mensagens do chat
@@ -572,13 +8836,20 @@ void visualizar_mensagens_chat() {
         int indice = (inicio_exibicao + i) % MAX_MENSAGENS;
         Mensagem* msg = &chat_mensagens[indice];
         
-        // Formato: [HH:MM:SS] Usuario_X: mensagem
-        printf(ANSI_COLOR_MAGENTA "  | " ANSI_COLOR_YELLOW "[%s]" ANSI_COLOR_GREEN " Usuario_%d: " ANSI_COLOR_RESET, 
-               msg->timestamp, msg->remetente);
+        // Formato: [HH:MM:SS] #canal Usuario_X: mensagem (conversas privadas sem o canal)
+        char origem[TAMANHO_NOME_CANAL + 24];
+        if (msg->canal[0] == '@') {
+            snprintf(origem, sizeof(origem), "Usuario_%d", msg->remetente);
+        } else {
+            snprintf(origem, sizeof(origem), "#%s Usuario_%d", msg->canal, msg->remetente);
+        }
+        printf(ANSI_COLOR_MAGENTA "  | " ANSI_COLOR_YELLOW "[%s]" ANSI_COLOR_GREEN " %s: " ANSI_COLOR_RESET, 
+               msg->timestamp, origem);
         
         // Quebra linha longa se necessário
         const char* conteudo = msg->conteudo;
-        int chars_restantes = 70 - 20; // 70 largura total - 20 chars do timestamp/usuario
+        int chars_restantes = 68 - 13 - (int)strlen(origem); // Largura total menos o timestamp e a origem
+        if (chars_restantes < 10) chars_restantes = 10;
         
         if (strlen(conteudo) <= chars_restantes) {
             printf("%-*s", chars_restantes, conteudo);
@@ -617,11 +8888,772 @@ void listar_usuarios_disponiveis() {
     printf(ANSI_COLOR_CYAN "\n=== USUÁRIOS DISPONÍVEIS PARA ENVIO ===\n" ANSI_COLOR_RESET);
     printf("Usuários conectados no sistema:\n");
     
-    for (int i = 1; i < size_global; i++) {
+    for (int i = num_coordenadores; i < reservas.primeira; i++) {
         if (i != rank_global) {
             printf(ANSI_COLOR_GREEN "  [%d] Usuario_%d\n" ANSI_COLOR_RESET, i, i);
         }
     }
     
     printf(ANSI_COLOR_YELLOW "\nSeu rank atual: %d (Usuario_%d)\n" ANSI_COLOR_RESET, rank_global, rank_global);
- }
\ No newline at end of file
+ }
+#ifdef NANO_SIMULACAO
+// ---------------------------------------------------------------------------
+// Transporte simulado: cada rank é um processo criado por fork do mesmo binário,
+// com o estado global e as threads próprias de um rank MPI. Cada par ordenado
+// (origem, destino) tem um canal circular em memória compartilhada, com um só
+// produtor e um só consumidor e sem travas. O destino remonta as mensagens em
+// uma fila local, onde as sondas casam origem e tag na ordem de chegada
+// ---------------------------------------------------------------------------
+
+#define CONTEXTO_PONTO_A_PONTO   0
+#define CONTEXTO_COLETIVO        1            // Bcast, Reduce e Allgather: invisíveis às sondas do editor
+#define ORCAMENTO_CANAIS         (256L << 20) // Bytes somados de todos os canais (só as páginas tocadas ocupam memória)
+#define CAPACIDADE_MINIMA_CANAL  4096L
+#define CAPACIDADE_MAXIMA_CANAL  (64L << 10)
+#define ESPERA_MAXIMA_SIMULADA_US 1000
+
+typedef struct {
+    uint64_t escrito;          // Bytes já escritos: só o produtor avança
+    char separador_escrito[56];
+    uint64_t lido;             // Bytes já consumidos: só o consumidor avança
+    char separador_lido[56];
+} CanalSimulado;               // Seguido de 'capacidade' bytes de dados
+
+typedef struct {
+    int32_t tag;
+    int32_t contexto;
+    int32_t tamanho;
+} CabecalhoSimulado;
+
+struct MensagemSimulada {
+    int origem;
+    CabecalhoSimulado cabecalho;
+    char* dados;
+    struct MensagemSimulada* proxima;
+};
+
+// Mensagem de uma origem ainda chegando aos pedaços
+typedef struct {
+    CabecalhoSimulado cabecalho;
+    long lidos;                // Bytes do cabeçalho e dos dados já consumidos
+    struct MensagemSimulada* mensagem;
+} MontagemSimulada;
+
+#define REQUISICAO_ENVIO     0
+#define REQUISICAO_RECEPCAO  1
+#define REQUISICAO_BARREIRA  2
+
+struct RequisicaoSimulada {
+    int tipo;
+    int concluida;
+    int liberada;              // MPI_Request_free antes de concluir: o envio some ao terminar
+    // Envio: cabeçalho e dados seguem aos poucos, conforme o canal do destino esvazia
+    int destino;
+    CabecalhoSimulado cabecalho;
+    const char* dados;
+    long escritos;
+    // Recepção pré-postada
+    int origem;
+    int tag;
+    char* buffer;
+    int capacidade;
+    MPI_Status status;
+    // Barreira: concluída quando o contador compartilhado alcança o alvo
+    uint64_t alvo;
+    struct RequisicaoSimulada* proxima;
+};
+
+// Início da região compartilhada; os canais vêm depois, alinhados
+typedef struct {
+    uint64_t chegadas_barreira; // Entradas somadas de todas as barreiras
+    long capacidade;            // Bytes de dados de cada canal
+    pid_t pids[];               // Zerado quando o processo termina
+} RegiaoSimulada;
+
+static struct {
+    RegiaoSimulada* regiao;
+    char* canais;              // Canal (origem, destino) em (origem * num_ranks + destino) * tamanho_canal
+    long tamanho_canal;
+    int rank;
+    int num_ranks;
+    pthread_mutex_t mutex;     // O editor chama o MPI de várias threads
+    MontagemSimulada* montagens;              // Por origem
+    struct MensagemSimulada* fila;            // Mensagens completas ainda não recebidas
+    struct MensagemSimulada* fim_fila;
+    struct RequisicaoSimulada** envios;       // Por destino, em ordem de envio
+    struct RequisicaoSimulada** fim_envios;
+    struct RequisicaoSimulada* recepcoes;     // Pré-postadas, ainda sem mensagem
+    uint64_t barreiras;                       // Barreiras iniciadas por este rank
+} simulado = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static CanalSimulado* canal_simulado(int origem, int destino) {
+    return (CanalSimulado*)(simulado.canais + ((long)origem * simulado.num_ranks + destino) * simulado.tamanho_canal);
+}
+
+// Copia até 'tamanho' bytes para o canal; devolve quantos couberam
+static long canal_escrever(CanalSimulado* canal, const char* dados, long tamanho) {
+    long capacidade = simulado.regiao->capacidade;
+    uint64_t escrito = canal->escrito;
+    long livre = capacidade - (long)(escrito - __atomic_load_n(&canal->lido, __ATOMIC_ACQUIRE));
+    if (tamanho > livre) tamanho = livre;
+    if (tamanho <= 0) return 0;
+    char* base = (char*)(canal + 1);
+    long inicio = escrito % capacidade;
+    long primeiro = tamanho < capacidade - inicio ? tamanho : capacidade - inicio;
+    memcpy(base + inicio, dados, primeiro);
+    memcpy(base, dados + primeiro, tamanho - primeiro);
+    __atomic_store_n(&canal->escrito, escrito + tamanho, __ATOMIC_RELEASE);  // Publica os dados já copiados
+    return tamanho;
+}
+
+// Retira até 'tamanho' bytes do canal; devolve quantos havia
+static long canal_ler(CanalSimulado* canal, char* destino, long tamanho) {
+    long capacidade = simulado.regiao->capacidade;
+    uint64_t lido = canal->lido;
+    long disponivel = (long)(__atomic_load_n(&canal->escrito, __ATOMIC_ACQUIRE) - lido);
+    if (tamanho > disponivel) tamanho = disponivel;
+    if (tamanho <= 0) return 0;
+    char* base = (char*)(canal + 1);
+    long inicio = lido % capacidade;
+    long primeiro = tamanho < capacidade - inicio ? tamanho : capacidade - inicio;
+    memcpy(destino, base + inicio, primeiro);
+    memcpy(destino + primeiro, base, tamanho - primeiro);
+    __atomic_store_n(&canal->lido, lido + tamanho, __ATOMIC_RELEASE);  // O produtor já pode sobrescrever
+    return tamanho;
+}
+
+// Escreve o que couber do envio; 1 quando ele foi inteiro para o canal
+static int envio_simulado_progredir(struct RequisicaoSimulada* envio) {
+    CanalSimulado* canal = canal_simulado(simulado.rank, envio->destino);
+    long total = (long)sizeof(CabecalhoSimulado) + envio->cabecalho.tamanho;
+    while (envio->escritos < total) {
+        long escritos;
+        if (envio->escritos < (long)sizeof(CabecalhoSimulado)) {
+            escritos = canal_escrever(canal, (const char*)&envio->cabecalho + envio->escritos,
+                                      sizeof(CabecalhoSimulado) - envio->escritos);
+        } else {
+            escritos = canal_escrever(canal, envio->dados + envio->escritos - sizeof(CabecalhoSimulado),
+                                      total - envio->escritos);
+        }
+        if (escritos == 0) return 0;
+        envio->escritos += escritos;
+    }
+    return 1;
+}
+
+static void envios_simulados_progredir(int destino) {
+    while (simulado.envios[destino] && envio_simulado_progredir(simulado.envios[destino])) {
+        struct RequisicaoSimulada* envio = simulado.envios[destino];
+        simulado.envios[destino] = envio->proxima;
+        if (!envio->proxima) simulado.fim_envios[destino] = NULL;
+        envio->concluida = 1;
+        if (envio->liberada) free(envio);
+    }
+}
+
+// Consome o que a origem já escreveu, completando mensagens na fila local
+static void recepcoes_simuladas_progredir(int origem) {
+    MontagemSimulada* montagem = &simulado.montagens[origem];
+    CanalSimulado* canal = canal_simulado(origem, simulado.rank);
+    while (1) {
+        if (montagem->lidos < (long)sizeof(CabecalhoSimulado)) {
+            montagem->lidos += canal_ler(canal, (char*)&montagem->cabecalho + montagem->lidos,
+                                         sizeof(CabecalhoSimulado) - montagem->lidos);
+            if (montagem->lidos < (long)sizeof(CabecalhoSimulado)) return;
+            struct MensagemSimulada* mensagem = malloc(sizeof(struct MensagemSimulada));
+            mensagem->origem = origem;
+            mensagem->cabecalho = montagem->cabecalho;
+            mensagem->dados = malloc(montagem->cabecalho.tamanho > 0 ? montagem->cabecalho.tamanho : 1);
+            mensagem->proxima = NULL;
+            montagem->mensagem = mensagem;
+        }
+        long faltam = (long)sizeof(CabecalhoSimulado) + montagem->cabecalho.tamanho - montagem->lidos;
+        long lidos = canal_ler(canal, montagem->mensagem->dados + montagem->lidos - sizeof(CabecalhoSimulado), faltam);
+        montagem->lidos += lidos;
+        if (lidos < faltam) return;
+        if (simulado.fim_fila) {
+            simulado.fim_fila->proxima = montagem->mensagem;
+        } else {
+            simulado.fila = montagem->mensagem;
+        }
+        simulado.fim_fila = montagem->mensagem;
+        montagem->mensagem = NULL;
+        montagem->lidos = 0;
+    }
+}
+
+// Primeira mensagem da fila que casa com origem, tag e contexto; com 'retirar', sai da fila
+static struct MensagemSimulada* fila_simulada_casar(int origem, int tag, int contexto, int retirar) {
+    struct MensagemSimulada* anterior = NULL;
+    for (struct MensagemSimulada* mensagem = simulado.fila; mensagem; anterior = mensagem, mensagem = mensagem->proxima) {
+        if (mensagem->cabecalho.contexto != contexto) continue;
+        if (origem != MPI_ANY_SOURCE && mensagem->origem != origem) continue;
+        if (tag != MPI_ANY_TAG && mensagem->cabecalho.tag != tag) continue;
+        if (retirar) {
+            if (anterior) {
+                anterior->proxima = mensagem->proxima;
+            } else {
+                simulado.fila = mensagem->proxima;
+            }
+            if (simulado.fim_fila == mensagem) simulado.fim_fila = anterior;
+        }
+        return mensagem;
+    }
+    return NULL;
+}
+
+static void status_simulado(MPI_Status* status, const struct MensagemSimulada* mensagem) {
+    if (!status) return;
+    status->MPI_SOURCE = mensagem->origem;
+    status->MPI_TAG = mensagem->cabecalho.tag;
+    status->MPI_ERROR = MPI_SUCCESS;
+    status->bytes = mensagem->cabecalho.tamanho;
+}
+
+// Copia a mensagem (truncada à capacidade) e a libera
+static void mensagem_simulada_entregar(struct MensagemSimulada* mensagem, void* buffer, long capacidade, MPI_Status* status) {
+    long tamanho = mensagem->cabecalho.tamanho < capacidade ? mensagem->cabecalho.tamanho : capacidade;
+    if (tamanho > 0) memcpy(buffer, mensagem->dados, tamanho);
+    status_simulado(status, mensagem);
+    free(mensagem->dados);
+    free(mensagem);
+}
+
+// Um passo de progresso de todo o rank (chamado com o mutex travado)
+static void simulado_progredir() {
+    for (int rank = 0; rank < simulado.num_ranks; rank++) {
+        if (simulado.envios[rank]) envios_simulados_progredir(rank);
+        recepcoes_simuladas_progredir(rank);
+    }
+    // Recepções pré-postadas têm prioridade sobre as sondas seguintes
+    struct RequisicaoSimulada** elo = &simulado.recepcoes;
+    while (*elo) {
+        struct RequisicaoSimulada* recepcao = *elo;
+        struct MensagemSimulada* mensagem = fila_simulada_casar(recepcao->origem, recepcao->tag, CONTEXTO_PONTO_A_PONTO, 1);
+        if (!mensagem) {
+            elo = &recepcao->proxima;
+            continue;
+        }
+        *elo = recepcao->proxima;
+        mensagem_simulada_entregar(mensagem, recepcao->buffer, recepcao->capacidade, &recepcao->status);
+        recepcao->concluida = 1;
+    }
+}
+
+// Sem progresso possível: cede o processador, recuando até ESPERA_MAXIMA_SIMULADA_US
+static void simulado_esperar(int* espera_us) {
+    pthread_mutex_unlock(&simulado.mutex);
+    usleep(*espera_us);
+    *espera_us = *espera_us * 2 < ESPERA_MAXIMA_SIMULADA_US ? *espera_us * 2 : ESPERA_MAXIMA_SIMULADA_US;
+    pthread_mutex_lock(&simulado.mutex);
+}
+
+static void simulado_nao_suportado(const char* funcao) {
+    fprintf(stderr, "Erro: %s não existe no transporte simulado.\n", funcao);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+static void simulado_conferir_comm(MPI_Comm comm, const char* funcao) {
+    if (comm != MPI_COMM_WORLD) simulado_nao_suportado(funcao);
+}
+
+static int requisicao_simulada_concluida(struct RequisicaoSimulada* requisicao) {
+    if (requisicao->tipo == REQUISICAO_BARREIRA) {
+        return __atomic_load_n(&simulado.regiao->chegadas_barreira, __ATOMIC_ACQUIRE) >= requisicao->alvo;
+    }
+    return requisicao->concluida;
+}
+
+static void requisicao_simulada_encerrar(MPI_Request* requisicao, MPI_Status* status) {
+    if (status) {
+        if ((*requisicao)->tipo == REQUISICAO_RECEPCAO) {
+            *status = (*requisicao)->status;
+        } else {
+            status->MPI_SOURCE = MPI_ANY_SOURCE;
+            status->MPI_TAG = MPI_ANY_TAG;
+            status->MPI_ERROR = MPI_SUCCESS;
+            status->bytes = 0;
+        }
+    }
+    free(*requisicao);
+    *requisicao = MPI_REQUEST_NULL;
+}
+
+// Enfileira o envio ao destino e já escreve o que couber (chamado com o mutex travado)
+static struct RequisicaoSimulada* simulado_enviar(const void* buffer, long tamanho, int destino, int tag, int contexto) {
+    struct RequisicaoSimulada* envio = calloc(1, sizeof(struct RequisicaoSimulada));
+    envio->tipo = REQUISICAO_ENVIO;
+    envio->destino = destino;
+    envio->cabecalho.tag = tag;
+    envio->cabecalho.contexto = contexto;
+    envio->cabecalho.tamanho = tamanho;
+    envio->dados = buffer;
+    if (simulado.fim_envios[destino]) {
+        simulado.fim_envios[destino]->proxima = envio;
+    } else {
+        simulado.envios[destino] = envio;
+    }
+    simulado.fim_envios[destino] = envio;
+    envios_simulados_progredir(destino);
+    return envio;
+}
+
+// Recepção bloqueante em um contexto (chamado com o mutex travado)
+static void simulado_receber(void* buffer, long capacidade, int origem, int tag, int contexto, MPI_Status* status) {
+    int espera_us = 1;
+    struct MensagemSimulada* mensagem;
+    while (1) {
+        simulado_progredir();
+        if ((mensagem = fila_simulada_casar(origem, tag, contexto, 1))) break;
+        simulado_esperar(&espera_us);
+    }
+    mensagem_simulada_entregar(mensagem, buffer, capacidade, status);
+}
+
+static void simulado_aguardar(struct RequisicaoSimulada* requisicao) {
+    int espera_us = 1;
+    while (1) {
+        simulado_progredir();
+        if (requisicao_simulada_concluida(requisicao)) return;
+        simulado_esperar(&espera_us);
+    }
+}
+
+// O processo inicial vira o lançador: cria os N ranks, espera todos e sai com o
+// primeiro código de erro. Cada rank volta daqui como um processo MPI comum
+int MPI_Init_thread(int* argc, char*** argv, int requerido, int* fornecido) {
+    (void)requerido;
+    int num_ranks = 0;
+    for (int i = 1; i < *argc; i++) {
+        if (strncmp((*argv)[i], "--simular=", 10) == 0) {
+            num_ranks = atoi((*argv)[i] + 10);
+            for (int j = i; j < *argc; j++) (*argv)[j] = (*argv)[j + 1];  // Como o MPI, remove a sua opção
+            (*argc)--;
+            break;
+        }
+    }
+    if (num_ranks < 1) {
+        fprintf(stderr, "Erro: informe o número de ranks simulados com --simular=N.\n");
+        exit(1);
+    }
+
+    long capacidade = ORCAMENTO_CANAIS / ((long)num_ranks * num_ranks) / CAPACIDADE_MINIMA_CANAL * CAPACIDADE_MINIMA_CANAL;
+    if (capacidade < CAPACIDADE_MINIMA_CANAL) capacidade = CAPACIDADE_MINIMA_CANAL;
+    if (capacidade > CAPACIDADE_MAXIMA_CANAL) capacidade = CAPACIDADE_MAXIMA_CANAL;
+    long inicio_canais = (sizeof(RegiaoSimulada) + num_ranks * sizeof(pid_t) + 63) / 64 * 64;
+    simulado.tamanho_canal = sizeof(CanalSimulado) + capacidade;
+    size_t tamanho = inicio_canais + (size_t)num_ranks * num_ranks * simulado.tamanho_canal;
+    char* base = mmap(NULL, tamanho, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Erro: não foi possível reservar %zu bytes para %d ranks simulados.\n", tamanho, num_ranks);
+        exit(1);
+    }
+    simulado.regiao = (RegiaoSimulada*)base;
+    simulado.regiao->capacidade = capacidade;
+    simulado.canais = base + inicio_canais;
+    simulado.num_ranks = num_ranks;
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int rank = 0; rank < num_ranks; rank++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("Erro: fork");
+            for (int i = 0; i < rank; i++) kill(simulado.regiao->pids[i], SIGKILL);
+            exit(1);
+        }
+        if (pid == 0) {
+            simulado.rank = rank;
+            simulado.montagens = calloc(num_ranks, sizeof(MontagemSimulada));
+            simulado.envios = calloc(num_ranks, sizeof(struct RequisicaoSimulada*));
+            simulado.fim_envios = calloc(num_ranks, sizeof(struct RequisicaoSimulada*));
+            *fornecido = MPI_THREAD_MULTIPLE;
+            return MPI_SUCCESS;
+        }
+        simulado.regiao->pids[rank] = pid;
+    }
+
+    // Como o mpirun: um rank que morre ou sai com erro derruba os demais
+    int codigo = 0;
+    for (int restantes = num_ranks; restantes > 0;) {
+        int estado;
+        pid_t pid = wait(&estado);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        restantes--;
+        for (int rank = 0; rank < num_ranks; rank++) {
+            if (simulado.regiao->pids[rank] == pid) simulado.regiao->pids[rank] = 0;
+        }
+        int erro = WIFSIGNALED(estado) ? 128 + WTERMSIG(estado) : WEXITSTATUS(estado);
+        if (erro && !codigo) {
+            codigo = erro;
+            for (int rank = 0; rank < num_ranks; rank++) {
+                if (simulado.regiao->pids[rank]) kill(simulado.regiao->pids[rank], SIGTERM);
+            }
+        }
+    }
+    exit(codigo);
+}
+
+int MPI_Finalize(void) {
+    MPI_Barrier(MPI_COMM_WORLD);  // Ninguém lê mais os canais: envios pendentes se perdem, como no MPI
+    return MPI_SUCCESS;
+}
+
+int MPI_Abort(MPI_Comm comm, int codigo) {
+    (void)comm;
+    for (int rank = 0; rank < simulado.num_ranks; rank++) {
+        pid_t pid = simulado.regiao->pids[rank];
+        if (rank != simulado.rank && pid) kill(pid, SIGKILL);
+    }
+    _exit(codigo ? codigo : 1);
+}
+
+int MPI_Comm_rank(MPI_Comm comm, int* rank) {
+    simulado_conferir_comm(comm, "MPI_Comm_rank");
+    *rank = simulado.rank;
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_size(MPI_Comm comm, int* tamanho) {
+    simulado_conferir_comm(comm, "MPI_Comm_size");
+    *tamanho = simulado.num_ranks;
+    return MPI_SUCCESS;
+}
+
+// Um rank simulado só morre derrubando os demais: não há erro a devolver
+int MPI_Comm_set_errhandler(MPI_Comm comm, MPI_Errhandler tratador) {
+    (void)comm;
+    (void)tratador;
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_split(MPI_Comm comm, int cor, int chave, MPI_Comm* novo) {
+    (void)comm; (void)cor; (void)chave; (void)novo;
+    simulado_nao_suportado("MPI_Comm_split");
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_split_type(MPI_Comm comm, int tipo, int chave, MPI_Info info, MPI_Comm* novo) {
+    (void)comm; (void)tipo; (void)chave; (void)info; (void)novo;
+    simulado_nao_suportado("MPI_Comm_split_type");
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_free(MPI_Comm* comm) {
+    *comm = MPI_COMM_NULL;
+    return MPI_SUCCESS;
+}
+
+double MPI_Wtime(void) {
+    struct timespec agora;
+    clock_gettime(CLOCK_MONOTONIC, &agora);
+    return agora.tv_sec + agora.tv_nsec / 1e9;
+}
+
+int MPI_Isend(const void* buffer, int quantidade, MPI_Datatype tipo, int destino, int tag, MPI_Comm comm, MPI_Request* requisicao) {
+    simulado_conferir_comm(comm, "MPI_Isend");
+    pthread_mutex_lock(&simulado.mutex);
+    *requisicao = simulado_enviar(buffer, (long)quantidade * tipo, destino, tag, CONTEXTO_PONTO_A_PONTO);
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Send(const void* buffer, int quantidade, MPI_Datatype tipo, int destino, int tag, MPI_Comm comm) {
+    MPI_Request requisicao;
+    MPI_Isend(buffer, quantidade, tipo, destino, tag, comm, &requisicao);
+    return MPI_Wait(&requisicao, MPI_STATUS_IGNORE);
+}
+
+int MPI_Irecv(void* buffer, int quantidade, MPI_Datatype tipo, int origem, int tag, MPI_Comm comm, MPI_Request* requisicao) {
+    simulado_conferir_comm(comm, "MPI_Irecv");
+    struct RequisicaoSimulada* recepcao = calloc(1, sizeof(struct RequisicaoSimulada));
+    recepcao->tipo = REQUISICAO_RECEPCAO;
+    recepcao->origem = origem;
+    recepcao->tag = tag;
+    recepcao->buffer = buffer;
+    recepcao->capacidade = quantidade * tipo;
+    pthread_mutex_lock(&simulado.mutex);
+    recepcao->proxima = simulado.recepcoes;
+    simulado.recepcoes = recepcao;
+    simulado_progredir();
+    pthread_mutex_unlock(&simulado.mutex);
+    *requisicao = recepcao;
+    return MPI_SUCCESS;
+}
+
+int MPI_Recv(void* buffer, int quantidade, MPI_Datatype tipo, int origem, int tag, MPI_Comm comm, MPI_Status* status) {
+    simulado_conferir_comm(comm, "MPI_Recv");
+    pthread_mutex_lock(&simulado.mutex);
+    simulado_receber(buffer, (long)quantidade * tipo, origem, tag, CONTEXTO_PONTO_A_PONTO, status);
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Iprobe(int origem, int tag, MPI_Comm comm, int* flag, MPI_Status* status) {
+    simulado_conferir_comm(comm, "MPI_Iprobe");
+    pthread_mutex_lock(&simulado.mutex);
+    simulado_progredir();
+    struct MensagemSimulada* mensagem = fila_simulada_casar(origem, tag, CONTEXTO_PONTO_A_PONTO, 0);
+    *flag = mensagem != NULL;
+    if (mensagem) status_simulado(status, mensagem);
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Probe(int origem, int tag, MPI_Comm comm, MPI_Status* status) {
+    int espera_us = 1;
+    int flag;
+    while (MPI_Iprobe(origem, tag, comm, &flag, status) == MPI_SUCCESS && !flag) {
+        usleep(espera_us);
+        espera_us = espera_us * 2 < ESPERA_MAXIMA_SIMULADA_US ? espera_us * 2 : ESPERA_MAXIMA_SIMULADA_US;
+    }
+    return MPI_SUCCESS;
+}
+
+// A sonda casada já retira a mensagem da fila: nenhuma outra thread a recebe
+int MPI_Improbe(int origem, int tag, MPI_Comm comm, int* flag, MPI_Message* mensagem, MPI_Status* status) {
+    simulado_conferir_comm(comm, "MPI_Improbe");
+    pthread_mutex_lock(&simulado.mutex);
+    simulado_progredir();
+    *mensagem = fila_simulada_casar(origem, tag, CONTEXTO_PONTO_A_PONTO, 1);
+    *flag = *mensagem != NULL;
+    if (*mensagem) status_simulado(status, *mensagem);
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Mrecv(void* buffer, int quantidade, MPI_Datatype tipo, MPI_Message* mensagem, MPI_Status* status) {
+    mensagem_simulada_entregar(*mensagem, buffer, (long)quantidade * tipo, status);
+    *mensagem = NULL;
+    return MPI_SUCCESS;
+}
+
+int MPI_Get_count(const MPI_Status* status, MPI_Datatype tipo, int* quantidade) {
+    *quantidade = status->bytes / tipo;
+    return MPI_SUCCESS;
+}
+
+int MPI_Test(MPI_Request* requisicao, int* flag, MPI_Status* status) {
+    *flag = 1;
+    if (*requisicao == MPI_REQUEST_NULL) return MPI_SUCCESS;
+    pthread_mutex_lock(&simulado.mutex);
+    simulado_progredir();
+    *flag = requisicao_simulada_concluida(*requisicao);
+    if (*flag) requisicao_simulada_encerrar(requisicao, status);
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+// Como no MPI, só encerra as requisições quando todas concluíram
+int MPI_Testall(int num, MPI_Request* requisicoes, int* flag, MPI_Status* status) {
+    pthread_mutex_lock(&simulado.mutex);
+    simulado_progredir();
+    *flag = 1;
+    for (int i = 0; i < num && *flag; i++) {
+        if (requisicoes[i] != MPI_REQUEST_NULL && !requisicao_simulada_concluida(requisicoes[i])) *flag = 0;
+    }
+    if (*flag) {
+        for (int i = 0; i < num; i++) {
+            if (requisicoes[i] != MPI_REQUEST_NULL) requisicao_simulada_encerrar(&requisicoes[i], status ? &status[i] : NULL);
+        }
+    }
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Wait(MPI_Request* requisicao, MPI_Status* status) {
+    if (*requisicao == MPI_REQUEST_NULL) return MPI_SUCCESS;
+    pthread_mutex_lock(&simulado.mutex);
+    simulado_aguardar(*requisicao);
+    requisicao_simulada_encerrar(requisicao, status);
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Waitall(int num, MPI_Request* requisicoes, MPI_Status* status) {
+    for (int i = 0; i < num; i++) {
+        MPI_Wait(&requisicoes[i], status ? &status[i] : NULL);
+    }
+    return MPI_SUCCESS;
+}
+
+// Só recepções pré-postadas são canceladas; um envio segue até o fim
+int MPI_Cancel(MPI_Request* requisicao) {
+    pthread_mutex_lock(&simulado.mutex);
+    struct RequisicaoSimulada* alvo = *requisicao;
+    if (alvo->tipo == REQUISICAO_RECEPCAO && !alvo->concluida) {
+        for (struct RequisicaoSimulada** elo = &simulado.recepcoes; *elo; elo = &(*elo)->proxima) {
+            if (*elo == alvo) {
+                *elo = alvo->proxima;
+                break;
+            }
+        }
+        alvo->concluida = 1;
+        alvo->status.MPI_SOURCE = MPI_ANY_SOURCE;
+        alvo->status.MPI_TAG = MPI_ANY_TAG;
+    }
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Request_free(MPI_Request* requisicao) {
+    pthread_mutex_lock(&simulado.mutex);
+    struct RequisicaoSimulada* alvo = *requisicao;
+    if (alvo->tipo == REQUISICAO_ENVIO && !alvo->concluida) {
+        alvo->liberada = 1;  // Ainda na fila do destino: libera-se ao ir inteiro para o canal
+    } else {
+        if (alvo->tipo == REQUISICAO_RECEPCAO && !alvo->concluida) {
+            for (struct RequisicaoSimulada** elo = &simulado.recepcoes; *elo; elo = &(*elo)->proxima) {
+                if (*elo == alvo) {
+                    *elo = alvo->proxima;
+                    break;
+                }
+            }
+        }
+        free(alvo);
+    }
+    *requisicao = MPI_REQUEST_NULL;
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+// As barreiras de todos os ranks somam em um contador compartilhado: a k-ésima
+// termina quando ele chega a k vezes o número de ranks
+int MPI_Ibarrier(MPI_Comm comm, MPI_Request* requisicao) {
+    simulado_conferir_comm(comm, "MPI_Ibarrier");
+    struct RequisicaoSimulada* barreira = calloc(1, sizeof(struct RequisicaoSimulada));
+    barreira->tipo = REQUISICAO_BARREIRA;
+    pthread_mutex_lock(&simulado.mutex);
+    barreira->alvo = ++simulado.barreiras * simulado.num_ranks;
+    pthread_mutex_unlock(&simulado.mutex);
+    __atomic_add_fetch(&simulado.regiao->chegadas_barreira, 1, __ATOMIC_ACQ_REL);
+    *requisicao = barreira;
+    return MPI_SUCCESS;
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+    MPI_Request barreira;
+    MPI_Ibarrier(comm, &barreira);
+    return MPI_Wait(&barreira, MPI_STATUS_IGNORE);
+}
+
+// Coletivas sobre ponto a ponto, em um contexto que as sondas do editor não veem
+int MPI_Bcast(void* buffer, int quantidade, MPI_Datatype tipo, int raiz, MPI_Comm comm) {
+    simulado_conferir_comm(comm, "MPI_Bcast");
+    long tamanho = (long)quantidade * tipo;
+    pthread_mutex_lock(&simulado.mutex);
+    if (simulado.rank == raiz) {
+        // Todos os envios na fila antes de esperar: cada canal esvazia no ritmo do seu destino
+        struct RequisicaoSimulada** envios = malloc(simulado.num_ranks * sizeof(struct RequisicaoSimulada*));
+        for (int rank = 0; rank < simulado.num_ranks; rank++) {
+            if (rank != raiz) envios[rank] = simulado_enviar(buffer, tamanho, rank, 0, CONTEXTO_COLETIVO);
+        }
+        for (int rank = 0; rank < simulado.num_ranks; rank++) {
+            if (rank == raiz) continue;
+            simulado_aguardar(envios[rank]);
+            free(envios[rank]);
+        }
+        free(envios);
+    } else {
+        simulado_receber(buffer, tamanho, raiz, 0, CONTEXTO_COLETIVO, MPI_STATUS_IGNORE);
+    }
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Reduce(const void* envio, void* recepcao, int quantidade, MPI_Datatype tipo, MPI_Op op, int raiz, MPI_Comm comm) {
+    simulado_conferir_comm(comm, "MPI_Reduce");
+    if (op != MPI_SUM || (tipo != MPI_INT && tipo != MPI_LONG)) simulado_nao_suportado("MPI_Reduce com este tipo");
+    long tamanho = (long)quantidade * tipo;
+    pthread_mutex_lock(&simulado.mutex);
+    if (simulado.rank != raiz) {
+        struct RequisicaoSimulada* requisicao = simulado_enviar(envio, tamanho, raiz, 0, CONTEXTO_COLETIVO);
+        simulado_aguardar(requisicao);
+        free(requisicao);
+    } else {
+        char* parcial = malloc(tamanho > 0 ? tamanho : 1);
+        memcpy(recepcao, envio, tamanho);
+        for (int rank = 0; rank < simulado.num_ranks; rank++) {
+            if (rank == raiz) continue;
+            simulado_receber(parcial, tamanho, rank, 0, CONTEXTO_COLETIVO, MPI_STATUS_IGNORE);
+            for (int i = 0; i < quantidade; i++) {
+                if (tipo == MPI_LONG) {
+                    ((long*)recepcao)[i] += ((long*)parcial)[i];
+                } else {
+                    ((int*)recepcao)[i] += ((int*)parcial)[i];
+                }
+            }
+        }
+        free(parcial);
+    }
+    pthread_mutex_unlock(&simulado.mutex);
+    return MPI_SUCCESS;
+}
+
+int MPI_Allgather(const void* envio, int quantidade_envio, MPI_Datatype tipo_envio, void* recepcao,
+                  int quantidade_recepcao, MPI_Datatype tipo_recepcao, MPI_Comm comm) {
+    simulado_conferir_comm(comm, "MPI_Allgather");
+    long tamanho = (long)quantidade_recepcao * tipo_recepcao;
+    struct RequisicaoSimulada** envios = malloc(simulado.num_ranks * sizeof(struct RequisicaoSimulada*));
+    pthread_mutex_lock(&simulado.mutex);
+    for (int rank = 0; rank < simulado.num_ranks; rank++) {
+        if (rank == simulado.rank) continue;
+        envios[rank] = simulado_enviar(envio, (long)quantidade_envio * tipo_envio, rank, 0, CONTEXTO_COLETIVO);
+    }
+    for (int rank = 0; rank < simulado.num_ranks; rank++) {
+        char* bloco = (char*)recepcao + rank * tamanho;
+        if (rank == simulado.rank) {
+            memcpy(bloco, envio, tamanho);
+        } else {
+            simulado_receber(bloco, tamanho, rank, 0, CONTEXTO_COLETIVO, MPI_STATUS_IGNORE);
+        }
+    }
+    for (int rank = 0; rank < simulado.num_ranks; rank++) {
+        if (rank == simulado.rank) continue;
+        simulado_aguardar(envios[rank]);
+        free(envios[rank]);
+    }
+    pthread_mutex_unlock(&simulado.mutex);
+    free(envios);
+    return MPI_SUCCESS;
+}
+
+// A réplica compartilhada é desativada na simulação: as janelas nunca são criadas
+int MPI_Win_allocate_shared(MPI_Aint tamanho, int unidade, MPI_Info info, MPI_Comm comm, void* base, MPI_Win* janela) {
+    (void)tamanho; (void)unidade; (void)info; (void)comm; (void)base; (void)janela;
+    simulado_nao_suportado("MPI_Win_allocate_shared");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_shared_query(MPI_Win janela, int rank, MPI_Aint* tamanho, int* unidade, void* base) {
+    (void)janela; (void)rank; (void)tamanho; (void)unidade; (void)base;
+    simulado_nao_suportado("MPI_Win_shared_query");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_lock_all(int modo, MPI_Win janela) {
+    (void)modo; (void)janela;
+    simulado_nao_suportado("MPI_Win_lock_all");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_unlock_all(MPI_Win janela) {
+    (void)janela;
+    simulado_nao_suportado("MPI_Win_unlock_all");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_sync(MPI_Win janela) {
+    (void)janela;
+    simulado_nao_suportado("MPI_Win_sync");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_free(MPI_Win* janela) {
+    *janela = MPI_WIN_NULL;
+    return MPI_SUCCESS;
+}
+#endif